@@ -794,3 +794,37 @@ drm_public int amdgpu_cs_fence_to_handle(amdgpu_device_handle dev,
 		*out_handle = fth.out.handle;
 	return r;
 }
+
+/* An array of pointers to chunks, each pointing to its data */
+static void amdgpu_cs_trace_chunks(drmTraceChunksPtr chunks, const void *arg)
+{
+	const struct drm_amdgpu_cs_in *cs = arg;
+	const struct drm_amdgpu_cs_chunk *chunk;
+	unsigned int i;
+	int parent, index;
+
+	parent = drmIoctlTraceAddChunk(chunks, -1,
+				       offsetof(struct drm_amdgpu_cs_in, chunks),
+				       cs->num_chunks * sizeof(uint64_t));
+	if (parent < 0)
+		return;
+
+	for (i = 0; i < cs->num_chunks; i++) {
+		index = drmIoctlTraceAddChunk(chunks, parent,
+					      i * sizeof(uint64_t),
+					      sizeof(*chunk));
+		if (index < 0)
+			continue;
+
+		chunk = drmIoctlTraceChunkData(chunks, index);
+		drmIoctlTraceAddChunk(chunks, index,
+				      offsetof(struct drm_amdgpu_cs_chunk,
+					       chunk_data),
+				      chunk->length_dw * sizeof(uint32_t));
+	}
+}
+
+drm_private void amdgpu_cs_trace_register(void)
+{
+	drmIoctlTraceRegister(DRM_IOCTL_AMDGPU_CS, amdgpu_cs_trace_chunks);
+}
@@ -155,6 +155,8 @@ drm_public int amdgpu_device_initialize(int fd,
 
 	*device_handle = NULL;
 
+	amdgpu_cs_trace_register();
+
 	pthread_mutex_lock(&fd_mutex);
 	r = amdgpu_get_auth(fd, &flag_auth);
 	if (r) {
@@ -147,6 +147,8 @@ drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev);
 
 drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout);
 
+drm_private void amdgpu_cs_trace_register(void);
+
 /**
  * Inline functions.
  */
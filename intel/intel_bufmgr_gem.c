@@ -2352,6 +2352,29 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 	return ret;
 }
 
+/* The validation list and relocations of an execbuffer, for ioctl traces */
+static void
+drm_intel_gem_trace_execbuf2(drmTraceChunksPtr chunks, const void *arg)
+{
+	const struct drm_i915_gem_execbuffer2 *execbuf = arg;
+	const struct drm_i915_gem_exec_object2 *objects;
+	unsigned int i;
+	int parent;
+
+	parent = drmIoctlTraceAddChunk(chunks, -1,
+			offsetof(struct drm_i915_gem_execbuffer2, buffers_ptr),
+			execbuf->buffer_count * sizeof(*objects));
+	if (parent < 0)
+		return;
+
+	objects = drmIoctlTraceChunkData(chunks, parent);
+	for (i = 0; i < execbuf->buffer_count; i++)
+		drmIoctlTraceAddChunk(chunks, parent, i * sizeof(*objects) +
+			offsetof(struct drm_i915_gem_exec_object2, relocs_ptr),
+			objects[i].relocation_count *
+			sizeof(struct drm_i915_gem_relocation_entry));
+}
+
 static int
 do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	 drm_clip_rect_t *cliprects, int num_cliprects, int DR4,
@@ -3603,6 +3626,11 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	int ret, tmp;
 	bool exec2 = false;
 
+	drmIoctlTraceRegister(DRM_IOCTL_I915_GEM_EXECBUFFER2,
+			      drm_intel_gem_trace_execbuf2);
+	drmIoctlTraceRegister(DRM_IOCTL_I915_GEM_EXECBUFFER2_WR,
+			      drm_intel_gem_trace_execbuf2);
+
 	pthread_mutex_lock(&bufmgr_list_mutex);
 
 	bufmgr_gem = drm_intel_bufmgr_gem_find(fd);
@@ -31,7 +31,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
 #include <unistd.h>
@@ -57,6 +60,26 @@ struct sync_merge_data {
 #define SYNC_IOC_MERGE		_IOWR(SYNC_IOC_MAGIC, 3, struct sync_merge_data)
 #endif
 
+#ifndef SYNC_IOC_FILE_INFO
+struct sync_fence_info {
+	char	obj_name[32];
+	char	driver_name[32];
+	int32_t	status;
+	uint32_t	flags;
+	uint64_t	timestamp_ns;
+};
+
+struct sync_file_info {
+	char	name[32];
+	int32_t	status;
+	uint32_t	flags;
+	uint32_t	num_fences;
+	uint32_t	pad;
+	uint64_t	sync_fence_info;
+};
+#define SYNC_IOC_FILE_INFO	_IOWR('>', 4, struct sync_file_info)
+#endif
+
 
 static inline int sync_wait(int fd, int timeout)
 {
@@ -141,6 +164,433 @@ static inline int sync_accumulate(const char *name, int *fd1, int fd2)
 	return 0;
 }
 
+/*
+ * Fence set: tracks many sync_file fds in a single epoll instance, so that
+ * waiting on them does not need a poll() setup per fence.  Fences may carry
+ * a deadline, kept in a timer wheel with one millisecond slots; fences
+ * further out than one turn of the wheel stay in their slot until their
+ * turn comes.  A single fd covering all fences is only merged when
+ * sync_fence_set_export() asks for one.  The status of each fence that
+ * signals is read with SYNC_IOC_FILE_INFO, to report its error if any.
+ *
+ *    set = sync_fence_set_create(SYNC_FENCE_SET_LATENCY);
+ *
+ *    // takes ownership of fd
+ *    sync_fence_set_add(set, fd, sync_fence_set_now() + 16, frame);
+ *
+ *    // reports signaled and expired fences, and removes them
+ *    sync_fence_set_poll(set, -1, frame_done);
+ *
+ * The callbacks may add fences to the set and export it, but must not poll
+ * or destroy it.
+ */
+#define SYNC_FENCE_SET_WHEEL_SIZE	256	/* must be a power of two */
+
+/* read back when each fence signaled, costs more ioctls per signaled fence */
+#define SYNC_FENCE_SET_LATENCY		(1 << 0)
+
+struct sync_fence_set_entry {
+	struct sync_fence_set_entry *prev, *next;		/* all fences */
+	struct sync_fence_set_entry *slot_prev, *slot_next;	/* wheel slot */
+	int fd;
+	int64_t deadline;	/* ms, CLOCK_MONOTONIC, -1 for none */
+	unsigned int slot;
+	void *data;
+};
+
+struct sync_fence_set_stats {
+	uint64_t added;
+	uint64_t signaled;
+	uint64_t expired;
+	uint64_t merges;
+	uint64_t total_latency_ns;	/* from signaling to being noticed */
+	uint64_t max_latency_ns;
+};
+
+struct sync_fence_set {
+	int epfd;
+	uint32_t flags;
+	unsigned int count;
+	struct sync_fence_set_entry *entries;
+	struct sync_fence_set_entry *wheel[SYNC_FENCE_SET_WHEEL_SIZE];
+	int64_t wheel_time;	/* deadlines up to this ms have been expired */
+	int merged;		/* cached export, -1 when the set changed */
+	int polling;		/* callbacks are running */
+	struct sync_fence_set_stats stats;
+};
+
+/* status is 0 if the fence signaled, -ETIME if its deadline passed first,
+ * or the negative error the fence signaled with.
+ */
+typedef void (*sync_fence_set_cb)(void *data, int status);
+
+static inline int64_t sync_fence_set_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline struct sync_fence_set *sync_fence_set_create(uint32_t flags)
+{
+	struct sync_fence_set *set;
+
+	set = (struct sync_fence_set *)calloc(1, sizeof(*set));
+	if (!set)
+		return NULL;
+
+	set->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (set->epfd < 0) {
+		free(set);
+		return NULL;
+	}
+
+	set->flags = flags;
+	set->merged = -1;
+	set->wheel_time = sync_fence_set_now();
+
+	return set;
+}
+
+static inline void sync_fence_set_unlink(struct sync_fence_set *set,
+					 struct sync_fence_set_entry *entry)
+{
+	struct sync_fence_set_entry **slot;
+
+	if (entry->deadline >= 0) {
+		slot = &set->wheel[entry->slot];
+		if (entry->slot_prev)
+			entry->slot_prev->slot_next = entry->slot_next;
+		else
+			*slot = entry->slot_next;
+		if (entry->slot_next)
+			entry->slot_next->slot_prev = entry->slot_prev;
+	}
+
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		set->entries = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+
+	epoll_ctl(set->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+	close(entry->fd);
+	free(entry);
+
+	set->count--;
+
+	if (set->merged >= 0) {
+		close(set->merged);
+		set->merged = -1;
+	}
+}
+
+static inline void sync_fence_set_destroy(struct sync_fence_set *set)
+{
+	if (!set)
+		return;
+
+	assert(!set->polling);
+
+	while (set->entries)
+		sync_fence_set_unlink(set, set->entries);
+
+	close(set->epfd);
+	free(set);
+}
+
+/* Takes ownership of fd.  deadline is in ms on CLOCK_MONOTONIC, see
+ * sync_fence_set_now(), or -1 for none.
+ */
+static inline int sync_fence_set_add(struct sync_fence_set *set, int fd,
+				     int64_t deadline, void *data)
+{
+	struct sync_fence_set_entry *entry, **slot;
+	struct epoll_event event = {0};
+
+	entry = (struct sync_fence_set_entry *)calloc(1, sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	entry->fd = fd;
+	entry->deadline = deadline;
+	entry->data = data;
+
+	event.events = EPOLLIN;
+	event.data.ptr = entry;
+
+	if (epoll_ctl(set->epfd, EPOLL_CTL_ADD, fd, &event)) {
+		free(entry);
+		return -errno;
+	}
+
+	entry->next = set->entries;
+	if (entry->next)
+		entry->next->prev = entry;
+	set->entries = entry;
+
+	if (deadline >= 0) {
+		/* deadlines already passed go into the next slot to expire */
+		if (deadline > set->wheel_time)
+			entry->slot = deadline & (SYNC_FENCE_SET_WHEEL_SIZE - 1);
+		else
+			entry->slot = (set->wheel_time + 1) &
+				      (SYNC_FENCE_SET_WHEEL_SIZE - 1);
+
+		slot = &set->wheel[entry->slot];
+		entry->slot_next = *slot;
+		if (entry->slot_next)
+			entry->slot_next->slot_prev = entry;
+		*slot = entry;
+	}
+
+	set->count++;
+	set->stats.added++;
+
+	if (set->merged >= 0) {
+		close(set->merged);
+		set->merged = -1;
+	}
+
+	return 0;
+}
+
+/* Returns how long ago the fence signaled, 0 if unknown */
+static inline uint64_t sync_fence_set_latency(int fd)
+{
+	struct sync_fence_info stack[4], *fences = stack;
+	struct sync_file_info info = {0};
+	uint64_t signaled = 0, now;
+	struct timespec ts;
+	unsigned int i;
+	int ret;
+
+	/* with no room for them, the ioctl returns the number of fences */
+	if (ioctl(fd, SYNC_IOC_FILE_INFO, &info) < 0 || !info.num_fences)
+		return 0;
+
+	if (info.num_fences > sizeof(stack) / sizeof(stack[0])) {
+		fences = (struct sync_fence_info *)
+			calloc(info.num_fences, sizeof(*fences));
+		if (!fences)
+			return 0;
+	}
+
+	info.sync_fence_info = (uintptr_t)fences;
+	ret = ioctl(fd, SYNC_IOC_FILE_INFO, &info);
+
+	for (i = 0; ret == 0 && i < info.num_fences; i++)
+		if (fences[i].timestamp_ns > signaled)
+			signaled = fences[i].timestamp_ns;
+
+	if (fences != stack)
+		free(fences);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	return signaled && now > signaled ? now - signaled : 0;
+}
+
+/*
+ * Returns the error a signaled fence carries, 0 if it has none.  Errors are
+ * only reported through the fence status, never through poll().
+ */
+static inline int sync_fence_set_error(int fd)
+{
+	struct sync_file_info info = {0};
+
+	if (ioctl(fd, SYNC_IOC_FILE_INFO, &info) < 0)
+		return 0;
+
+	return info.status < 0 ? info.status : 0;
+}
+
+/* Expires the deadlines up to now, returns the number of fences reported */
+static inline int sync_fence_set_expire(struct sync_fence_set *set,
+					int64_t now, sync_fence_set_cb cb)
+{
+	struct sync_fence_set_entry *entry, *next;
+	int64_t t, end;
+	void *data;
+	int n = 0;
+
+	/*
+	 * Deadlines that had already passed when they were added wait in the
+	 * next slot, visit it even within the current ms.  A full turn visits
+	 * every slot once.
+	 */
+	end = now > set->wheel_time ? now : set->wheel_time + 1;
+	if (end - set->wheel_time > SYNC_FENCE_SET_WHEEL_SIZE)
+		end = set->wheel_time + SYNC_FENCE_SET_WHEEL_SIZE;
+
+	for (t = set->wheel_time + 1; t <= end; t++) {
+		entry = set->wheel[t & (SYNC_FENCE_SET_WHEEL_SIZE - 1)];
+		for (; entry; entry = next) {
+			next = entry->slot_next;
+			if (entry->deadline > now)
+				continue;
+
+			data = entry->data;
+			sync_fence_set_unlink(set, entry);
+			set->stats.expired++;
+			cb(data, -ETIME);
+			n++;
+		}
+	}
+
+	if (now > set->wheel_time)
+		set->wheel_time = now;
+
+	return n;
+}
+
+/* Returns the ms until the next deadline in the wheel, or -1 */
+static inline int sync_fence_set_next_deadline(struct sync_fence_set *set,
+					       int64_t now)
+{
+	struct sync_fence_set_entry *entry;
+	int64_t next = -1;
+	unsigned int i;
+
+	for (i = 1; i <= SYNC_FENCE_SET_WHEEL_SIZE; i++) {
+		entry = set->wheel[(now + i) & (SYNC_FENCE_SET_WHEEL_SIZE - 1)];
+		for (; entry; entry = entry->slot_next)
+			if (next < 0 || entry->deadline < next)
+				next = entry->deadline;
+
+		/* later slots can only hold later deadlines */
+		if (next >= 0 && next <= now + i)
+			break;
+	}
+
+	if (next < 0)
+		return -1;
+
+	return next > now ? next - now : 0;
+}
+
+static inline int sync_fence_set_do_poll(struct sync_fence_set *set,
+					 int timeout, sync_fence_set_cb cb)
+{
+	struct epoll_event events[32];
+	struct sync_fence_set_entry *entry;
+	int64_t now, end = 0, left;
+	int i, ret, wait, reported, error;
+	uint64_t latency;
+	void *data;
+
+	if (timeout >= 0)
+		end = sync_fence_set_now() + timeout;
+
+	for (;;) {
+		now = sync_fence_set_now();
+		reported = sync_fence_set_expire(set, now, cb);
+		if (reported)
+			return reported;
+
+		wait = sync_fence_set_next_deadline(set, now);
+		if (timeout >= 0) {
+			left = end > now ? end - now : 0;
+			if (wait < 0 || left < wait)
+				wait = left;
+		}
+
+		ret = epoll_wait(set->epfd, events, 32, wait);
+		if (ret < 0 && errno != EINTR)
+			return -errno;
+
+		for (i = 0; i < ret; i++) {
+			entry = (struct sync_fence_set_entry *)
+				events[i].data.ptr;
+			data = entry->data;
+
+			error = sync_fence_set_error(entry->fd);
+			if (error) {
+				sync_fence_set_unlink(set, entry);
+				cb(data, error);
+				reported++;
+				continue;
+			}
+
+			if (set->flags & SYNC_FENCE_SET_LATENCY) {
+				latency = sync_fence_set_latency(entry->fd);
+				set->stats.total_latency_ns += latency;
+				if (latency > set->stats.max_latency_ns)
+					set->stats.max_latency_ns = latency;
+			}
+
+			sync_fence_set_unlink(set, entry);
+			set->stats.signaled++;
+			cb(data, 0);
+			reported++;
+		}
+
+		if (reported)
+			return reported;
+
+		if (timeout >= 0 && sync_fence_set_now() >= end)
+			return sync_fence_set_expire(set, sync_fence_set_now(),
+						     cb);
+	}
+}
+
+/*
+ * Waits up to timeout ms (-1 for no limit) for fences to signal or their
+ * deadlines to pass, and reports each of them to cb before removing it from
+ * the set.  Returns the number of fences reported, 0 on timeout, -EBUSY if
+ * called from a callback.
+ */
+static inline int sync_fence_set_poll(struct sync_fence_set *set, int timeout,
+				      sync_fence_set_cb cb)
+{
+	int ret;
+
+	if (set->polling)
+		return -EBUSY;
+
+	set->polling = 1;
+	ret = sync_fence_set_do_poll(set, timeout, cb);
+	set->polling = 0;
+
+	return ret;
+}
+
+/*
+ * Returns a new sync_file fd that signals once all fences in the set have,
+ * or -1 with errno set.  The merged fence is kept until the set changes, so
+ * exporting an unchanged set does not merge again.
+ */
+static inline int sync_fence_set_export(struct sync_fence_set *set,
+					const char *name)
+{
+	struct sync_fence_set_entry *entry;
+	int merged = -1, ret;
+
+	if (set->merged < 0) {
+		if (!set->entries) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		for (entry = set->entries; entry; entry = entry->next) {
+			ret = sync_accumulate(name, &merged, entry->fd);
+			if (ret < 0 || merged < 0) {
+				if (merged >= 0)
+					close(merged);
+				return -1;
+			}
+		}
+
+		set->merged = merged;
+		set->stats.merges++;
+	}
+
+	return dup(set->merged);
+}
+
 #if defined(__cplusplus)
 }
 #endif
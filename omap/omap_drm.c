@@ -47,7 +47,8 @@
 #define PAGE_SIZE 4096
 
 static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-static void * dev_table;
+static pthread_once_t dev_registry_once = PTHREAD_ONCE_INIT;
+static drmRegistryPtr dev_registry;
 
 struct omap_device {
 	int fd;
@@ -77,38 +78,42 @@ struct omap_bo {
 	atomic_t	refcnt;
 };
 
-static struct omap_device * omap_device_new_impl(int fd)
+static void * omap_device_new_impl(unsigned long key, void *data)
 {
 	struct omap_device *dev = calloc(sizeof(*dev), 1);
 	if (!dev)
 		return NULL;
-	dev->fd = fd;
+	dev->fd = key;
 	atomic_set(&dev->refcnt, 1);
 	dev->handle_table = drmHashCreate();
 	return dev;
 }
 
-drm_public struct omap_device * omap_device_new(int fd)
+/* called with the registry shard locked */
+static void * omap_device_get(void *value, void *data)
 {
-	struct omap_device *dev = NULL;
+	struct omap_device *dev = value;
 
-	pthread_mutex_lock(&table_lock);
+	/* a device losing its last reference is replaced by a new one */
+	if (atomic_add_unless(&dev->refcnt, 1, 0))
+		return NULL;
 
-	if (!dev_table)
-		dev_table = drmHashCreate();
+	return dev;
+}
 
-	if (drmHashLookup(dev_table, fd, (void **)&dev)) {
-		/* not found, create new device */
-		dev = omap_device_new_impl(fd);
-		drmHashInsert(dev_table, fd, dev);
-	} else {
-		/* found, just incr refcnt */
-		dev = omap_device_ref(dev);
-	}
+static void omap_device_registry_init(void)
+{
+	dev_registry = drmRegistryCreate();
+}
 
-	pthread_mutex_unlock(&table_lock);
+drm_public struct omap_device * omap_device_new(int fd)
+{
+	pthread_once(&dev_registry_once, omap_device_registry_init);
+	if (!dev_registry)
+		return NULL;
 
-	return dev;
+	return drmRegistryGet(dev_registry, fd, omap_device_get,
+			      omap_device_new_impl, NULL);
 }
 
 drm_public struct omap_device * omap_device_ref(struct omap_device *dev)
@@ -121,9 +126,9 @@ drm_public void omap_device_del(struct omap_device *dev)
 {
 	if (!atomic_dec_and_test(&dev->refcnt))
 		return;
+	drmRegistryRemove(dev_registry, dev->fd, dev);
 	pthread_mutex_lock(&table_lock);
 	drmHashDestroy(dev->handle_table);
-	drmHashDelete(dev_table, dev->fd);
 	pthread_mutex_unlock(&table_lock);
 	free(dev);
 }
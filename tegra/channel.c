@@ -27,6 +27,7 @@
 #endif
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <xf86drm.h>
@@ -49,6 +50,7 @@ static int drm_tegra_channel_setup(struct drm_tegra_channel *channel)
 		return err;
 
 	channel->syncpt = args.id;
+	drm_tegra_syncpt_forget(drm, channel->syncpt);
 
 	return 0;
 }
@@ -84,6 +86,11 @@ int drm_tegra_channel_open(struct drm_tegra_channel **channelp,
 		return -ENOMEM;
 
 	channel->drm = drm;
+	atomic_inc(&drm->ref);
+	atomic_set(&channel->ref, 1);
+	pthread_mutex_init(&channel->lock, NULL);
+	drm_tegra_pushbuf_pool_init(&channel->pushbuf_pool);
+	DRMINITLISTHEAD(&channel->jobs);
 
 	memset(&args, 0, sizeof(args));
 	args.client = class;
@@ -91,7 +98,7 @@ int drm_tegra_channel_open(struct drm_tegra_channel **channelp,
 	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_OPEN_CHANNEL, &args,
 				  sizeof(args));
 	if (err < 0) {
-		free(channel);
+		drm_tegra_channel_unref(channel);
 		return err;
 	}
 
@@ -100,7 +107,7 @@ int drm_tegra_channel_open(struct drm_tegra_channel **channelp,
 
 	err = drm_tegra_channel_setup(channel);
 	if (err < 0) {
-		free(channel);
+		drm_tegra_channel_unref(channel);
 		return err;
 	}
 
@@ -129,7 +136,27 @@ int drm_tegra_channel_close(struct drm_tegra_channel *channel)
 	if (err < 0)
 		return err;
 
-	free(channel);
+	drm_tegra_syncpt_forget(drm, channel->syncpt);
+
+	/* jobs that are still around and their pushbufs free directly */
+	pthread_mutex_lock(&channel->lock);
+	drm_tegra_job_cache_fini(channel);
+	drm_tegra_pushbuf_pool_fini(&channel->pushbuf_pool);
+	channel->closed = true;
+	pthread_mutex_unlock(&channel->lock);
+
+	drm_tegra_channel_unref(channel);
 
 	return 0;
 }
+
+drm_private
+void drm_tegra_channel_unref(struct drm_tegra_channel *channel)
+{
+	if (!atomic_dec_and_test(&channel->ref))
+		return;
+
+	drm_tegra_unref(channel->drm);
+	pthread_mutex_destroy(&channel->lock);
+	free(channel);
+}
@@ -27,32 +27,348 @@
 #endif
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <xf86drm.h>
 
 #include "private.h"
 
+/* fences kept around for reuse per device */
+#define FENCE_CACHE_MAX 64
+
+drm_private
+struct drm_tegra_fence *drm_tegra_fence_alloc(struct drm_tegra *drm)
+{
+	struct drm_tegra_fence *fence;
+
+	pthread_mutex_lock(&drm->fence_lock);
+
+	fence = drm->fences;
+	if (fence) {
+		drm->fences = fence->next;
+		drm->num_fences--;
+	}
+
+	pthread_mutex_unlock(&drm->fence_lock);
+
+	if (!fence) {
+		fence = calloc(1, sizeof(*fence));
+		if (!fence)
+			return NULL;
+	}
+
+	atomic_inc(&drm->ref);
+	fence->drm = drm;
+
+	return fence;
+}
+
+drm_private
+void drm_tegra_fence_cache_fini(struct drm_tegra *drm)
+{
+	struct drm_tegra_fence *fence;
+
+	while (drm->fences) {
+		fence = drm->fences;
+		drm->fences = fence->next;
+		free(fence);
+	}
+
+	drm->num_fences = 0;
+}
+
+/* remember an observed syncpoint value, which only ever moves forward */
+static void drm_tegra_syncpt_update(struct drm_tegra *drm, uint32_t id,
+				    uint32_t value)
+{
+	struct drm_tegra_syncpt_value *entry;
+
+	entry = &drm->syncpts[id % DRM_TEGRA_SYNCPT_CACHE_SIZE];
+
+	pthread_mutex_lock(&drm->syncpt_lock);
+
+	if (!entry->valid || entry->id != id ||
+	    drm_tegra_syncpt_passed(value, entry->value)) {
+		entry->id = id;
+		entry->value = value;
+		entry->valid = true;
+	}
+
+	pthread_mutex_unlock(&drm->syncpt_lock);
+}
+
+/*
+ * Drop the cached value of a syncpoint, whose value is not meaningful any
+ * more once it is handed to another channel.
+ */
+drm_private
+void drm_tegra_syncpt_forget(struct drm_tegra *drm, uint32_t id)
+{
+	struct drm_tegra_syncpt_value *entry;
+
+	entry = &drm->syncpts[id % DRM_TEGRA_SYNCPT_CACHE_SIZE];
+
+	pthread_mutex_lock(&drm->syncpt_lock);
+
+	if (entry->id == id)
+		entry->valid = false;
+
+	pthread_mutex_unlock(&drm->syncpt_lock);
+}
+
+/* check a threshold against the cached value, without asking the kernel */
+drm_private
+bool drm_tegra_syncpt_signaled(struct drm_tegra *drm, uint32_t id,
+			       uint32_t thresh)
+{
+	struct drm_tegra_syncpt_value *entry;
+	bool signaled;
+
+	entry = &drm->syncpts[id % DRM_TEGRA_SYNCPT_CACHE_SIZE];
+
+	pthread_mutex_lock(&drm->syncpt_lock);
+	signaled = entry->valid && entry->id == id &&
+		   drm_tegra_syncpt_passed(entry->value, thresh);
+	pthread_mutex_unlock(&drm->syncpt_lock);
+
+	return signaled;
+}
+
+drm_private
+int drm_tegra_syncpt_read(struct drm_tegra *drm, uint32_t id,
+			  uint32_t *value)
+{
+	struct drm_tegra_syncpt_read args;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.id = id;
+
+	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_SYNCPT_READ, &args,
+				  sizeof(args));
+	if (err < 0)
+		return err;
+
+	drm_tegra_syncpt_update(drm, id, args.value);
+	*value = args.value;
+
+	return 0;
+}
+
+drm_private
+int drm_tegra_syncpt_wait(struct drm_tegra *drm, uint32_t id,
+			  uint32_t thresh, unsigned long timeout)
+{
+	struct drm_tegra_syncpt_wait args;
+	int err;
+
+	if (drm_tegra_syncpt_signaled(drm, id, thresh))
+		return 0;
+
+	memset(&args, 0, sizeof(args));
+	args.id = id;
+	args.thresh = thresh;
+	args.timeout = timeout;
+
+	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_SYNCPT_WAIT, &args,
+				  sizeof(args));
+	if (err < 0)
+		return err;
+
+	if (!drm_tegra_syncpt_passed(args.value, thresh))
+		args.value = thresh;
+
+	drm_tegra_syncpt_update(drm, id, args.value);
+
+	return 0;
+}
+
 drm_public
 int drm_tegra_fence_wait_timeout(struct drm_tegra_fence *fence,
 				 unsigned long timeout)
 {
-	struct drm_tegra_syncpt_wait args;
-
 	if (!fence)
 		return -EINVAL;
 
-	memset(&args, 0, sizeof(args));
-	args.id = fence->syncpt;
-	args.thresh = fence->value;
-	args.timeout = timeout;
+	return drm_tegra_syncpt_wait(fence->drm, fence->syncpt, fence->value,
+				     timeout);
+}
+
+static bool drm_tegra_fence_signaled(struct drm_tegra_fence *fence)
+{
+	return drm_tegra_syncpt_signaled(fence->drm, fence->syncpt,
+					 fence->value);
+}
+
+static unsigned long drm_tegra_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+static int drm_tegra_fence_wait_all(struct drm_tegra_fence **fences,
+				    unsigned int count,
+				    unsigned long timeout)
+{
+	unsigned long start = drm_tegra_time_ms(), elapsed;
+	struct drm_tegra_fence *fence;
+	unsigned int i, j;
+	int err;
+
+	for (i = 0; i < count; i++) {
+		fence = fences[i];
+
+		if (drm_tegra_fence_signaled(fence))
+			continue;
+
+		/* the furthest fence on a syncpoint covers the others */
+		for (j = i + 1; j < count; j++)
+			if (fences[j]->drm == fence->drm &&
+			    fences[j]->syncpt == fence->syncpt &&
+			    drm_tegra_syncpt_passed(fences[j]->value,
+						    fence->value))
+				fence = fences[j];
+
+		if (timeout != (unsigned long)-1) {
+			elapsed = drm_tegra_time_ms() - start;
+			err = drm_tegra_fence_wait_timeout(fence,
+				elapsed < timeout ? timeout - elapsed : 0);
+		} else {
+			err = drm_tegra_fence_wait_timeout(fence, timeout);
+		}
+
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Host1x can only wait for one syncpoint threshold at a time, so block on
+ * each fence in turn for a slice that doubles up to 16 ms, reading all of
+ * the syncpoints in between.
+ */
+static int drm_tegra_fence_wait_any(struct drm_tegra_fence **fences,
+				    unsigned int count, unsigned long timeout,
+				    unsigned int *first)
+{
+	unsigned long start = drm_tegra_time_ms(), elapsed, slice = 1;
+	struct drm_tegra_fence *fence;
+	unsigned int i, next = 0;
+	uint32_t value;
+	int err;
+
+	for (i = 0; i < count; i++)
+		if (drm_tegra_fence_signaled(fences[i]))
+			goto signaled;
+
+	for (;;) {
+		for (i = 0; i < count; i++) {
+			fence = fences[i];
 
-	return drmCommandWriteRead(fence->drm->fd, DRM_TEGRA_SYNCPT_WAIT,
-				   &args, sizeof(args));
+			if (drm_tegra_fence_signaled(fence))
+				goto signaled;
+
+			err = drm_tegra_syncpt_read(fence->drm, fence->syncpt,
+						    &value);
+			if (err < 0)
+				return err;
+
+			if (drm_tegra_syncpt_passed(value, fence->value))
+				goto signaled;
+		}
+
+		if (timeout != (unsigned long)-1) {
+			elapsed = drm_tegra_time_ms() - start;
+			if (elapsed >= timeout)
+				slice = 0;
+			else if (slice > timeout - elapsed)
+				slice = timeout - elapsed;
+		}
+
+		i = next++ % count;
+
+		err = drm_tegra_fence_wait_timeout(fences[i], slice);
+		if (err == 0)
+			goto signaled;
+
+		if (err != -EAGAIN && err != -EBUSY && err != -ETIMEDOUT)
+			return err;
+
+		if (slice == 0)
+			return err;
+
+		if (slice < 16)
+			slice *= 2;
+	}
+
+signaled:
+	if (first)
+		*first = i;
+
+	return 0;
+}
+
+/**
+ * drm_tegra_fence_wait_many() - wait for several fences
+ * @fences: array of fences
+ * @count: number of fences
+ * @flags: DRM_TEGRA_FENCE_WAIT_ALL to wait for all of the fences rather
+ *	than any of them
+ * @timeout: timeout in milliseconds, -1 to wait forever
+ * @first: if not NULL, receives the index of a signaled fence when waiting
+ *	for any of them
+ *
+ * Fences that are known to have signaled are checked without any ioctl.
+ * Returns 0 on success or the error of the last wait on timeout.
+ */
+drm_public
+int drm_tegra_fence_wait_many(struct drm_tegra_fence **fences,
+			      unsigned int count, uint32_t flags,
+			      unsigned long timeout, unsigned int *first)
+{
+	unsigned int i;
+
+	if (!fences || !count || (flags & ~DRM_TEGRA_FENCE_WAIT_ALL))
+		return -EINVAL;
+
+	for (i = 0; i < count; i++)
+		if (!fences[i])
+			return -EINVAL;
+
+	if (flags & DRM_TEGRA_FENCE_WAIT_ALL)
+		return drm_tegra_fence_wait_all(fences, count, timeout);
+
+	return drm_tegra_fence_wait_any(fences, count, timeout, first);
 }
 
 drm_public
 void drm_tegra_fence_free(struct drm_tegra_fence *fence)
 {
+	struct drm_tegra *drm;
+
+	if (!fence)
+		return;
+
+	drm = fence->drm;
+
+	pthread_mutex_lock(&drm->fence_lock);
+
+	if (!drm->closed && drm->num_fences < FENCE_CACHE_MAX) {
+		fence->next = drm->fences;
+		drm->fences = fence;
+		drm->num_fences++;
+		fence = NULL;
+	}
+
+	pthread_mutex_unlock(&drm->fence_lock);
+
 	free(fence);
+	drm_tegra_unref(drm);
 }
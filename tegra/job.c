@@ -34,20 +34,26 @@
 
 #include "private.h"
 
+/* jobs kept around for reuse per channel */
+#define JOB_CACHE_MAX 8
+
 drm_private
 int drm_tegra_job_add_reloc(struct drm_tegra_job *job,
 			    const struct drm_tegra_reloc *reloc)
 {
 	struct drm_tegra_reloc *relocs;
-	size_t size;
+	unsigned int max_relocs;
 
-	size = (job->num_relocs + 1) * sizeof(*reloc);
+	if (job->num_relocs == job->max_relocs) {
+		max_relocs = job->max_relocs ? job->max_relocs * 2 : 32;
 
-	relocs = realloc(job->relocs, size);
-	if (!relocs)
-		return -ENOMEM;
+		relocs = realloc(job->relocs, max_relocs * sizeof(*reloc));
+		if (!relocs)
+			return -ENOMEM;
 
-	job->relocs = relocs;
+		job->relocs = relocs;
+		job->max_relocs = max_relocs;
+	}
 
 	job->relocs[job->num_relocs++] = *reloc;
 
@@ -59,20 +65,90 @@ int drm_tegra_job_add_cmdbuf(struct drm_tegra_job *job,
 			     const struct drm_tegra_cmdbuf *cmdbuf)
 {
 	struct drm_tegra_cmdbuf *cmdbufs;
-	size_t size;
+	unsigned int max_cmdbufs;
 
-	size = (job->num_cmdbufs + 1) * sizeof(*cmdbuf);
+	if (job->num_cmdbufs == job->max_cmdbufs) {
+		max_cmdbufs = job->max_cmdbufs ? job->max_cmdbufs * 2 : 4;
 
-	cmdbufs = realloc(job->cmdbufs, size);
-	if (!cmdbufs)
-		return -ENOMEM;
+		cmdbufs = realloc(job->cmdbufs, max_cmdbufs * sizeof(*cmdbuf));
+		if (!cmdbufs)
+			return -ENOMEM;
 
-	cmdbufs[job->num_cmdbufs++] = *cmdbuf;
-	job->cmdbufs = cmdbufs;
+		job->cmdbufs = cmdbufs;
+		job->max_cmdbufs = max_cmdbufs;
+	}
+
+	job->cmdbufs[job->num_cmdbufs++] = *cmdbuf;
 
 	return 0;
 }
 
+drm_private
+int drm_tegra_job_add_bo(struct drm_tegra_job *job, struct drm_tegra_bo *bo)
+{
+	struct drm_tegra_bo **bos;
+	unsigned int max_bos;
+
+	/* relocations against the same target tend to come in runs */
+	if (job->num_bos && job->bos[job->num_bos - 1] == bo)
+		return 0;
+
+	if (job->num_bos == job->max_bos) {
+		max_bos = job->max_bos ? job->max_bos * 2 : 16;
+
+		bos = realloc(job->bos, max_bos * sizeof(*bos));
+		if (!bos)
+			return -ENOMEM;
+
+		job->bos = bos;
+		job->max_bos = max_bos;
+	}
+
+	job->bos[job->num_bos++] = drm_tegra_bo_ref(bo);
+
+	return 0;
+}
+
+/*
+ * Concurrent submissions may get here out of order, keep the later fence.
+ * Call with the fence_lock mutex locked.
+ */
+static void drm_tegra_bo_fence(struct drm_tegra_bo *bo, uint32_t syncpt,
+			       uint32_t value)
+{
+	if (bo->busy && bo->fence_syncpt == syncpt &&
+	    drm_tegra_syncpt_passed(bo->fence_value, value))
+		return;
+
+	bo->fence_syncpt = syncpt;
+	bo->fence_value = value;
+	bo->busy = true;
+}
+
+/*
+ * Attach the fence of a submitted job to every BO it references, so that
+ * the BO cache and drm_tegra_bo_cpu_prep() know when the BO is idle.
+ */
+static void drm_tegra_job_fence_bos(struct drm_tegra_job *job, uint32_t value)
+{
+	struct drm_tegra *drm = job->channel->drm;
+	struct drm_tegra_pushbuf_private *pushbuf;
+	struct drm_tegra_bo *bo;
+	unsigned int i;
+
+	pthread_mutex_lock(&drm->fence_lock);
+
+	for (i = 0; i < job->num_bos; i++)
+		drm_tegra_bo_fence(job->bos[i], job->syncpt, value);
+
+	DRMLISTFOREACHENTRY(pushbuf, &job->pushbufs, list) {
+		DRMLISTFOREACHENTRY(bo, &pushbuf->bos, push_list)
+			drm_tegra_bo_fence(bo, job->syncpt, value);
+	}
+
+	pthread_mutex_unlock(&drm->fence_lock);
+}
+
 drm_public
 int drm_tegra_job_new(struct drm_tegra_job **jobp,
 		      struct drm_tegra_channel *channel)
@@ -82,24 +158,67 @@ int drm_tegra_job_new(struct drm_tegra_job **jobp,
 	if (!jobp || !channel)
 		return -EINVAL;
 
+	pthread_mutex_lock(&channel->lock);
+
+	if (!DRMLISTEMPTY(&channel->jobs)) {
+		job = DRMLISTENTRY(struct drm_tegra_job, channel->jobs.next,
+				   list);
+		DRMLISTDEL(&job->list);
+		channel->num_jobs--;
+
+		pthread_mutex_unlock(&channel->lock);
+
+		atomic_inc(&channel->ref);
+		*jobp = job;
+
+		return 0;
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+
 	job = calloc(1, sizeof(*job));
 	if (!job)
 		return -ENOMEM;
 
 	DRMINITLISTHEAD(&job->pushbufs);
+	DRMINITLISTHEAD(&job->spare_pushbufs);
 	job->channel = channel;
 	job->syncpt = channel->syncpt;
 
+	atomic_inc(&channel->ref);
 	*jobp = job;
 
 	return 0;
 }
 
+static void drm_tegra_job_destroy(struct drm_tegra_job *job)
+{
+	struct drm_tegra_pushbuf_private *pushbuf;
+	struct drm_tegra_pushbuf_private *temp;
+
+	DRMLISTFOREACHENTRYSAFE(pushbuf, temp, &job->spare_pushbufs, list)
+		free(pushbuf);
+
+	free(job->bos);
+	free(job->cmdbufs);
+	free(job->relocs);
+	free(job);
+}
+
+/**
+ * drm_tegra_job_reset() - prepare a job for building another submission
+ * @job: job
+ *
+ * Frees the pushbufs of the job and drops its references to relocation
+ * targets, but keeps its arrays and pushbuf objects around, so that
+ * rebuilding a job of a similar size does not allocate.
+ */
 drm_public
-int drm_tegra_job_free(struct drm_tegra_job *job)
+int drm_tegra_job_reset(struct drm_tegra_job *job)
 {
 	struct drm_tegra_pushbuf_private *pushbuf;
 	struct drm_tegra_pushbuf_private *temp;
+	unsigned int i;
 
 	if (!job)
 		return -EINVAL;
@@ -107,20 +226,100 @@ int drm_tegra_job_free(struct drm_tegra_job *job)
 	DRMLISTFOREACHENTRYSAFE(pushbuf, temp, &job->pushbufs, list)
 		drm_tegra_pushbuf_free(&pushbuf->base);
 
-	free(job->cmdbufs);
-	free(job->relocs);
-	free(job);
+	for (i = 0; i < job->num_bos; i++)
+		drm_tegra_bo_unref(job->bos[i]);
+
+	job->num_bos = 0;
+	job->num_relocs = 0;
+	job->num_cmdbufs = 0;
+	job->increments = 0;
+	job->pushbuf = NULL;
 
 	return 0;
 }
 
+drm_public
+int drm_tegra_job_free(struct drm_tegra_job *job)
+{
+	struct drm_tegra_channel *channel;
+
+	if (!job)
+		return -EINVAL;
+
+	drm_tegra_job_reset(job);
+
+	channel = job->channel;
+
+	/* a closed channel has no job cache any more */
+	pthread_mutex_lock(&channel->lock);
+
+	if (!channel->closed && channel->num_jobs < JOB_CACHE_MAX) {
+		DRMLISTADD(&job->list, &channel->jobs);
+		channel->num_jobs++;
+		job = NULL;
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+
+	if (job)
+		drm_tegra_job_destroy(job);
+
+	drm_tegra_channel_unref(channel);
+
+	return 0;
+}
+
+/* call with the channel lock held */
+drm_private
+void drm_tegra_job_cache_fini(struct drm_tegra_channel *channel)
+{
+	struct drm_tegra_job *job, *temp;
+
+	DRMLISTFOREACHENTRYSAFE(job, temp, &channel->jobs, list)
+		drm_tegra_job_destroy(job);
+
+	DRMINITLISTHEAD(&channel->jobs);
+	channel->num_jobs = 0;
+}
+
+/* The arrays of a submission, for ioctl traces */
+static void drm_tegra_job_trace_submit(drmTraceChunksPtr chunks,
+				       const void *arg)
+{
+	const struct drm_tegra_submit *submit = arg;
+
+	drmIoctlTraceAddChunk(chunks, -1,
+			      offsetof(struct drm_tegra_submit, syncpts),
+			      submit->num_syncpts *
+			      sizeof(struct drm_tegra_syncpt));
+	drmIoctlTraceAddChunk(chunks, -1,
+			      offsetof(struct drm_tegra_submit, cmdbufs),
+			      submit->num_cmdbufs *
+			      sizeof(struct drm_tegra_cmdbuf));
+	drmIoctlTraceAddChunk(chunks, -1,
+			      offsetof(struct drm_tegra_submit, relocs),
+			      submit->num_relocs *
+			      sizeof(struct drm_tegra_reloc));
+	drmIoctlTraceAddChunk(chunks, -1,
+			      offsetof(struct drm_tegra_submit, waitchks),
+			      submit->num_waitchks *
+			      sizeof(struct drm_tegra_waitchk));
+}
+
+drm_private
+void drm_tegra_job_trace_register(void)
+{
+	drmIoctlTraceRegister(DRM_IOCTL_TEGRA_SUBMIT,
+			      drm_tegra_job_trace_submit);
+}
+
 drm_public
 int drm_tegra_job_submit(struct drm_tegra_job *job,
 			 struct drm_tegra_fence **fencep)
 {
 	struct drm_tegra *drm;
 	struct drm_tegra_fence *fence = NULL;
-	struct drm_tegra_syncpt *syncpts;
+	struct drm_tegra_syncpt syncpt;
 	struct drm_tegra_submit args;
 	int err;
 
@@ -138,19 +337,14 @@ int drm_tegra_job_submit(struct drm_tegra_job *job,
 	job->pushbuf = NULL;
 
 	if (fencep) {
-		fence = calloc(1, sizeof(*fence));
+		fence = drm_tegra_fence_alloc(job->channel->drm);
 		if (!fence)
 			return -ENOMEM;
 	}
 
-	syncpts = calloc(1, sizeof(*syncpts));
-	if (!syncpts) {
-		free(fence);
-		return -ENOMEM;
-	}
-
-	syncpts[0].id = job->syncpt;
-	syncpts[0].incrs = job->increments;
+	memset(&syncpt, 0, sizeof(syncpt));
+	syncpt.id = job->syncpt;
+	syncpt.incrs = job->increments;
 
 	memset(&args, 0, sizeof(args));
 	args.context = job->channel->context;
@@ -161,7 +355,7 @@ int drm_tegra_job_submit(struct drm_tegra_job *job,
 	args.waitchk_mask = 0;
 	args.timeout = 1000;
 
-	args.syncpts = (uintptr_t)syncpts;
+	args.syncpts = (uintptr_t)&syncpt;
 	args.cmdbufs = (uintptr_t)job->cmdbufs;
 	args.relocs = (uintptr_t)job->relocs;
 	args.waitchks = 0;
@@ -170,19 +364,17 @@ int drm_tegra_job_submit(struct drm_tegra_job *job,
 	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_SUBMIT, &args,
 				  sizeof(args));
 	if (err < 0) {
-		free(syncpts);
-		free(fence);
+		drm_tegra_fence_free(fence);
 		return err;
 	}
 
+	drm_tegra_job_fence_bos(job, args.fence);
+
 	if (fence) {
 		fence->syncpt = job->syncpt;
 		fence->value = args.fence;
-		fence->drm = drm;
 		*fencep = fence;
 	}
 
-	free(syncpts);
-
 	return 0;
 }
@@ -26,6 +26,7 @@
 #define __DRM_TEGRA_PRIVATE_H__ 1
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -35,6 +36,7 @@
 #include <libdrm_lists.h>
 #include <libdrm_macros.h>
 #include <xf86atomic.h>
+#include <xf86drm.h>
 
 #include "tegra.h"
 
@@ -108,17 +110,55 @@ struct drm_tegra_bo_bucket {
 	uint32_t num_mmap_entries;
 };
 
+/* syncpoints read at most when looking for an idle BO in a bucket */
+#define DRM_TEGRA_BUCKET_SYNCPTS	8
+
 struct drm_tegra_bo_cache {
 	struct drm_tegra_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
+	bool coarse;
 	time_t time;
 };
 
+/*
+ * Per-thread magazines of freed BOs for the small size classes, which
+ * allocation and freeing use without taking the table lock.  They are
+ * refilled from and flushed to the shared buckets in batches, and BOs
+ * that sit in a magazine for more than a second are flushed on the next
+ * free, so that drm_tegra_bo_cache_cleanup() gets to age them.
+ */
+#define DRM_TEGRA_MAGAZINE_MAX_SIZE	65536
+#define DRM_TEGRA_MAGAZINE_CLASSES	12	/* buckets of up to 64 KiB */
+#define DRM_TEGRA_MAGAZINE_SIZE		8
+
+struct drm_tegra_magazine {
+	struct drm_tegra_bo *bos[DRM_TEGRA_MAGAZINE_SIZE];
+	unsigned int count;
+};
+
+struct drm_tegra_thread_cache {
+	struct drm_tegra *drm;
+	drmMMListHead list;
+	struct drm_tegra_magazine magazines[DRM_TEGRA_MAGAZINE_CLASSES];
+	time_t time;	/* of the last aging pass */
+	uint64_t allocs;
+	uint64_t frees;
+};
+
 struct drm_tegra_bo_mmap_cache {
 	drmMMListHead list;
 	time_t time;
 };
 
+/* last observed value of a syncpoint */
+struct drm_tegra_syncpt_value {
+	uint32_t id;
+	uint32_t value;
+	bool valid;
+};
+
+#define DRM_TEGRA_SYNCPT_CACHE_SIZE 32
+
 struct drm_tegra {
 	/* tables to keep track of bo's, to avoid "evil-twin" buffer objects:
 	 *
@@ -131,11 +171,44 @@ struct drm_tegra {
 	 */
 	void *handle_table, *name_table;
 
+	/* dma-buf inode -> handle, saves the ioctl and lseek on re-import */
+	drmPrimeCachePtr prime_cache;
+
+	/* protects the tables, the BO cache and the mmap cache */
+	pthread_mutex_t table_lock;
+	uint64_t lock_acquisitions;
+	uint64_t lock_contended;
+	uint64_t lock_wait_ns;
+
 	struct drm_tegra_bo_cache bo_cache;
 	struct drm_tegra_bo_mmap_cache mmap_cache;
 	bool close;
 	int fd;
 
+	/* per-thread magazines, all of them are on the list */
+	pthread_key_t thread_key;
+	drmMMListHead thread_caches;
+	uint64_t magazine_allocs;	/* of exited threads */
+	uint64_t magazine_frees;	/* of exited threads */
+	uint64_t magazine_refills;
+	uint64_t magazine_flushes;
+
+	/* syncpoint values, indexed by id modulo the cache size */
+	pthread_mutex_t syncpt_lock;
+	struct drm_tegra_syncpt_value syncpts[DRM_TEGRA_SYNCPT_CACHE_SIZE];
+
+	/*
+	 * Freed fences, reused by drm_tegra_job_submit().  Channels and
+	 * fences hold a reference to the device, so that they can be freed
+	 * after drm_tegra_close(), which sets closed and drops the caller's.
+	 * fence_lock also protects the fence of BOs that jobs are attached to.
+	 */
+	pthread_mutex_t fence_lock;
+	struct drm_tegra_fence *fences;
+	unsigned int num_fences;
+	atomic_t ref;
+	bool closed;
+
 #ifndef NDEBUG
 	bool debug_bo;
 	bool debug_bo_back_guard;
@@ -167,6 +240,7 @@ struct drm_tegra_bo {
 #endif
 
 	bool reuse;
+	bool shared;	/* handle was handed out, never recycle */
 	/*
 	 * Cache-accessible fields must be at the end of structure
 	 * due to protection of the rest of the fields by valgrind.
@@ -178,6 +252,11 @@ struct drm_tegra_bo {
 	time_t unmap_time;		/* time when added to cache-list */
 	void *map_cached;		/* holds cached mmap pointer */
 
+	/* syncpoint threshold of the last job that referenced this BO */
+	uint32_t fence_syncpt;
+	uint32_t fence_value;
+	bool busy;
+
 	bool custom_tiling;
 
 #ifndef NDEBUG
@@ -188,19 +267,58 @@ struct drm_tegra_bo {
 #endif
 };
 
+/*
+ * Command stream BOs of a channel.  They are mapped once and recycled
+ * when the job that executed them has completed.
+ */
+struct drm_tegra_pushbuf_pool {
+	drmMMListHead idle;	/* ready for reuse */
+	drmMMListHead busy;	/* returned by pushbufs, maybe still in use */
+	uint32_t bo_size;
+	unsigned int num_bos;
+	unsigned int in_use;
+	unsigned int high_water;
+	uint64_t allocs;
+	uint64_t gets;
+};
+
+/*
+ * Jobs hold a reference to their channel, so that the channel outlives
+ * drm_tegra_channel_close() until the last of its jobs is freed.  The
+ * channel in turn holds a reference to the device.
+ */
 struct drm_tegra_channel {
 	struct drm_tegra *drm;
 	enum host1x_class class;
 	uint64_t context;
 	uint32_t syncpt;
+	atomic_t ref;
+
+	/* protects the pushbuf pool, the job cache and the closed flag */
+	pthread_mutex_t lock;
+	bool closed;
+
+	struct drm_tegra_pushbuf_pool pushbuf_pool;
+
+	/* freed jobs, reused by drm_tegra_job_new() */
+	drmMMListHead jobs;
+	unsigned int num_jobs;
 };
 
+void drm_tegra_channel_unref(struct drm_tegra_channel *channel);
+
 struct drm_tegra_fence {
 	struct drm_tegra *drm;
 	uint32_t syncpt;
 	uint32_t value;
+
+	struct drm_tegra_fence *next;	/* fence cache entry */
 };
 
+struct drm_tegra_fence *drm_tegra_fence_alloc(struct drm_tegra *drm);
+void drm_tegra_fence_cache_fini(struct drm_tegra *drm);
+void drm_tegra_unref(struct drm_tegra *drm);
+
 struct drm_tegra_pushbuf_private {
 	struct drm_tegra_pushbuf base;
 	struct drm_tegra_job *job;
@@ -219,36 +337,71 @@ drm_tegra_pushbuf(struct drm_tegra_pushbuf *pb)
 }
 
 int drm_tegra_pushbuf_queue(struct drm_tegra_pushbuf_private *pushbuf);
+void drm_tegra_pushbuf_pool_init(struct drm_tegra_pushbuf_pool *pool);
+void drm_tegra_pushbuf_pool_fini(struct drm_tegra_pushbuf_pool *pool);
 
 struct drm_tegra_job {
 	struct drm_tegra_channel *channel;
+	drmMMListHead list;	/* job cache entry */
 
 	unsigned int increments;
 	uint32_t syncpt;
 
 	struct drm_tegra_reloc *relocs;
 	unsigned int num_relocs;
+	unsigned int max_relocs;
 
 	struct drm_tegra_cmdbuf *cmdbufs;
 	unsigned int num_cmdbufs;
+	unsigned int max_cmdbufs;
+
+	/* relocation targets, referenced until the job is freed */
+	struct drm_tegra_bo **bos;
+	unsigned int num_bos;
+	unsigned int max_bos;
 
 	struct drm_tegra_pushbuf_private *pushbuf;
 	drmMMListHead pushbufs;
+	drmMMListHead spare_pushbufs;	/* freed, kept for reuse */
 };
 
+void drm_tegra_job_cache_fini(struct drm_tegra_channel *channel);
+void drm_tegra_job_trace_register(void);
+
 int drm_tegra_job_add_reloc(struct drm_tegra_job *job,
 			    const struct drm_tegra_reloc *reloc);
 int drm_tegra_job_add_cmdbuf(struct drm_tegra_job *job,
 			     const struct drm_tegra_cmdbuf *cmdbuf);
+int drm_tegra_job_add_bo(struct drm_tegra_job *job, struct drm_tegra_bo *bo);
+
+/* syncpoint values wrap around, compare them as a signed distance */
+static inline bool drm_tegra_syncpt_passed(uint32_t value, uint32_t thresh)
+{
+	return (int32_t)(value - thresh) >= 0;
+}
+
+void drm_tegra_syncpt_forget(struct drm_tegra *drm, uint32_t id);
+bool drm_tegra_syncpt_signaled(struct drm_tegra *drm, uint32_t id,
+			       uint32_t thresh);
+int drm_tegra_syncpt_read(struct drm_tegra *drm, uint32_t id,
+			  uint32_t *value);
+int drm_tegra_syncpt_wait(struct drm_tegra *drm, uint32_t id,
+			  uint32_t thresh, unsigned long timeout);
 
 int drm_tegra_bo_free(struct drm_tegra_bo *bo);
 int __drm_tegra_bo_map(struct drm_tegra_bo *bo, void **ptr);
 
+void drm_tegra_table_lock(struct drm_tegra *drm);
+void drm_tegra_table_unlock(struct drm_tegra *drm);
+
 void drm_tegra_bo_cache_init(struct drm_tegra_bo_cache *cache, bool coarse);
 void drm_tegra_bo_cache_cleanup(struct drm_tegra *drm, time_t time);
 struct drm_tegra_bo * drm_tegra_bo_cache_alloc(struct drm_tegra *drm,
 					       uint32_t *size, uint32_t flags);
 int drm_tegra_bo_cache_free(struct drm_tegra_bo *bo);
+int drm_tegra_bo_magazine_free(struct drm_tegra_bo *bo);
+void drm_tegra_thread_cache_destroy(void *data);
+void drm_tegra_thread_caches_fini(struct drm_tegra *drm);
 void drm_tegra_bo_cache_unmap(struct drm_tegra_bo *bo);
 void *drm_tegra_bo_cache_map(struct drm_tegra_bo *bo);
 
@@ -35,6 +35,195 @@
 #define HOST1X_OPCODE_NONINCR(offset, count) \
 	((0x2 << 28) | (((offset) & 0xfff) << 16) | ((count) & 0xffff))
 
+/* initial size of the pool's BOs and cap on how many to add at once */
+#define PUSHBUF_POOL_BO_SIZE	16384
+#define PUSHBUF_POOL_GROW_MAX	16
+
+drm_private
+void drm_tegra_pushbuf_pool_init(struct drm_tegra_pushbuf_pool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	DRMINITLISTHEAD(&pool->idle);
+	DRMINITLISTHEAD(&pool->busy);
+	pool->bo_size = PUSHBUF_POOL_BO_SIZE;
+}
+
+static void drm_tegra_pushbuf_pool_release(struct drm_tegra_pushbuf_pool *pool,
+					   struct drm_tegra_bo *bo)
+{
+	DRMLISTDEL(&bo->push_list);
+	drm_tegra_bo_unmap(bo);
+	drm_tegra_bo_unref(bo);
+	pool->num_bos--;
+}
+
+drm_private
+void drm_tegra_pushbuf_pool_fini(struct drm_tegra_pushbuf_pool *pool)
+{
+	struct drm_tegra_bo *bo, *tmp;
+
+	/* the BO cache takes care of BOs that are still in use by the GPU */
+	DRMLISTFOREACHENTRYSAFE(bo, tmp, &pool->busy, push_list)
+		drm_tegra_pushbuf_pool_release(pool, bo);
+
+	DRMLISTFOREACHENTRYSAFE(bo, tmp, &pool->idle, push_list)
+		drm_tegra_pushbuf_pool_release(pool, bo);
+}
+
+/* move BOs whose job has completed back to the idle list */
+static void drm_tegra_pushbuf_pool_reclaim(struct drm_tegra_channel *channel)
+{
+	struct drm_tegra_pushbuf_pool *pool = &channel->pushbuf_pool;
+	struct drm_tegra_bo *bo, *tmp;
+	uint32_t syncpt = 0, value = 0;
+	bool read = false;
+
+	DRMLISTFOREACHENTRYSAFE(bo, tmp, &pool->busy, push_list) {
+		if (bo->busy && drm_tegra_syncpt_signaled(channel->drm,
+							  bo->fence_syncpt,
+							  bo->fence_value))
+			bo->busy = false;
+
+		if (bo->busy) {
+			if (!read || bo->fence_syncpt != syncpt) {
+				if (drm_tegra_syncpt_read(channel->drm,
+							  bo->fence_syncpt,
+							  &value) < 0)
+					continue;
+
+				syncpt = bo->fence_syncpt;
+				read = true;
+			}
+
+			if (!drm_tegra_syncpt_passed(value, bo->fence_value))
+				continue;
+
+			bo->busy = false;
+		}
+
+		pool->in_use--;
+
+		/* BOs from before the pool grew its BO size are dropped */
+		if (bo->size < pool->bo_size) {
+			drm_tegra_pushbuf_pool_release(pool, bo);
+			continue;
+		}
+
+		DRMLISTDEL(&bo->push_list);
+		DRMLISTADDTAIL(&bo->push_list, &pool->idle);
+	}
+}
+
+/*
+ * Add as many BOs as the pool already has, so that a client that keeps
+ * several jobs in flight reaches its steady state in a few steps.
+ */
+static int drm_tegra_pushbuf_pool_grow(struct drm_tegra_channel *channel)
+{
+	struct drm_tegra_pushbuf_pool *pool = &channel->pushbuf_pool;
+	unsigned int i, count;
+	struct drm_tegra_bo *bo;
+	int err;
+
+	count = pool->num_bos ? pool->num_bos : 1;
+	if (count > PUSHBUF_POOL_GROW_MAX)
+		count = PUSHBUF_POOL_GROW_MAX;
+
+	for (i = 0; i < count; i++) {
+		err = drm_tegra_bo_new(&bo, channel->drm, 0, pool->bo_size);
+		if (err < 0)
+			break;
+
+		err = drm_tegra_bo_map(bo, NULL);
+		if (err < 0) {
+			drm_tegra_bo_unref(bo);
+			break;
+		}
+
+		DRMLISTADDTAIL(&bo->push_list, &pool->idle);
+		pool->num_bos++;
+		pool->allocs++;
+	}
+
+	/* a partial success still leaves the caller with a BO */
+	return i ? 0 : err;
+}
+
+/* call with the channel lock held */
+static int __drm_tegra_pushbuf_pool_get(struct drm_tegra_channel *channel,
+					uint32_t size, struct drm_tegra_bo **bop)
+{
+	struct drm_tegra_pushbuf_pool *pool = &channel->pushbuf_pool;
+	struct drm_tegra_bo *bo, *tmp;
+	int err;
+
+	if (channel->closed)
+		return -ENODEV;
+
+	if (size > pool->bo_size) {
+		while (pool->bo_size < size)
+			pool->bo_size *= 2;
+
+		DRMLISTFOREACHENTRYSAFE(bo, tmp, &pool->idle, push_list)
+			if (bo->size < pool->bo_size)
+				drm_tegra_pushbuf_pool_release(pool, bo);
+	}
+
+	if (DRMLISTEMPTY(&pool->idle))
+		drm_tegra_pushbuf_pool_reclaim(channel);
+
+	if (DRMLISTEMPTY(&pool->idle)) {
+		err = drm_tegra_pushbuf_pool_grow(channel);
+		if (err < 0)
+			return err;
+	}
+
+	bo = DRMLISTENTRY(struct drm_tegra_bo, pool->idle.next, push_list);
+	DRMLISTDELINIT(&bo->push_list);
+
+	if (++pool->in_use > pool->high_water)
+		pool->high_water = pool->in_use;
+
+	pool->gets++;
+	*bop = bo;
+
+	return 0;
+}
+
+static int drm_tegra_pushbuf_pool_get(struct drm_tegra_channel *channel,
+				      uint32_t size, struct drm_tegra_bo **bop)
+{
+	int err;
+
+	pthread_mutex_lock(&channel->lock);
+	err = __drm_tegra_pushbuf_pool_get(channel, size, bop);
+	pthread_mutex_unlock(&channel->lock);
+
+	return err;
+}
+
+/*
+ * Hand a BO back, it is reused once its job has completed.  Once the
+ * channel is closed there is no pool any more and the BO is dropped.
+ */
+static void drm_tegra_pushbuf_pool_put(struct drm_tegra_channel *channel,
+				       struct drm_tegra_bo *bo)
+{
+	pthread_mutex_lock(&channel->lock);
+
+	if (!channel->closed) {
+		DRMLISTADDTAIL(&bo->push_list, &channel->pushbuf_pool.busy);
+		bo = NULL;
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+
+	if (bo) {
+		drm_tegra_bo_unmap(bo);
+		drm_tegra_bo_unref(bo);
+	}
+}
+
 static inline unsigned long
 drm_tegra_pushbuf_get_offset(struct drm_tegra_pushbuf *pushbuf)
 {
@@ -52,16 +241,12 @@ int drm_tegra_pushbuf_queue(struct drm_tegra_pushbuf_private *pushbuf)
 	if (!pushbuf || !pushbuf->bo)
 		return 0;
 
-	/* unmap buffer object since it won't be accessed anymore */
-	drm_tegra_bo_unmap(pushbuf->bo);
-
 	/* add buffer object as command buffers for this job */
 	memset(&cmdbuf, 0, sizeof(cmdbuf));
 	cmdbuf.words = pushbuf->base.ptr - pushbuf->start;
 	cmdbuf.handle = pushbuf->bo->handle;
 	cmdbuf.offset = 0;
 
-	/* maintain mmap refcount balance upon pushbuf free'ing */
 	pushbuf->bo = NULL;
 
 	err = drm_tegra_job_add_cmdbuf(pushbuf->job, &cmdbuf);
@@ -80,9 +265,16 @@ int drm_tegra_pushbuf_new(struct drm_tegra_pushbuf **pushbufp,
 	if (!pushbufp || !job)
 		return -EINVAL;
 
-	pushbuf = calloc(1, sizeof(*pushbuf));
-	if (!pushbuf)
-		return -ENOMEM;
+	if (!DRMLISTEMPTY(&job->spare_pushbufs)) {
+		pushbuf = DRMLISTENTRY(struct drm_tegra_pushbuf_private,
+				       job->spare_pushbufs.next, list);
+		DRMLISTDEL(&pushbuf->list);
+		memset(pushbuf, 0, sizeof(*pushbuf));
+	} else {
+		pushbuf = calloc(1, sizeof(*pushbuf));
+		if (!pushbuf)
+			return -ENOMEM;
+	}
 
 	DRMINITLISTHEAD(&pushbuf->list);
 	DRMINITLISTHEAD(&pushbuf->bos);
@@ -106,15 +298,18 @@ int drm_tegra_pushbuf_free(struct drm_tegra_pushbuf *pushbuf)
 		return -EINVAL;
 
 	priv = drm_tegra_pushbuf(pushbuf);
-	drm_tegra_bo_unmap(priv->bo);
 
 	DRMLISTFOREACHENTRYSAFE(bo, tmp, &priv->bos, push_list) {
 		DRMLISTDEL(&bo->push_list);
-		drm_tegra_bo_unref(bo);
+		drm_tegra_pushbuf_pool_put(priv->job->channel, bo);
 	}
 
+	/* keep the object for the next pushbuf of the job */
 	DRMLISTDEL(&priv->list);
-	free(priv);
+	DRMLISTADD(&priv->list, &priv->job->spare_pushbufs);
+
+	if (priv->job->pushbuf == priv)
+		priv->job->pushbuf = NULL;
 
 	return 0;
 }
@@ -131,7 +326,6 @@ int drm_tegra_pushbuf_prepare(struct drm_tegra_pushbuf *pushbuf,
 	struct drm_tegra_pushbuf_private *priv;
 	struct drm_tegra_channel *channel;
 	struct drm_tegra_bo *bo;
-	void *ptr;
 	int err;
 
 	if (!pushbuf || !words)
@@ -149,33 +343,52 @@ int drm_tegra_pushbuf_prepare(struct drm_tegra_pushbuf *pushbuf,
 	 */
 	words = align(words, 1024);
 
-	err = drm_tegra_bo_new(&bo, channel->drm, 0, words * sizeof(uint32_t));
+	err = drm_tegra_pushbuf_pool_get(channel, words * sizeof(uint32_t),
+					 &bo);
 	if (err < 0)
 		return err;
 
-	err = drm_tegra_bo_map(bo, &ptr);
-	if (err < 0) {
-		drm_tegra_bo_unref(bo);
-		return err;
-	}
-
 	/* queue current command stream buffer for submission */
 	err = drm_tegra_pushbuf_queue(priv);
 	if (err < 0) {
-		drm_tegra_bo_unmap(bo);
-		drm_tegra_bo_unref(bo);
+		drm_tegra_pushbuf_pool_put(channel, bo);
 		return err;
 	}
 
 	DRMLISTADD(&bo->push_list, &priv->bos);
 
-	priv->start = priv->base.ptr = ptr;
+	priv->start = priv->base.ptr = bo->map;
 	priv->end = priv->start + bo->size / sizeof(uint32_t);
 	priv->bo = bo;
 
 	return 0;
 }
 
+drm_public
+int drm_tegra_channel_get_pushbuf_stats(struct drm_tegra_channel *channel,
+					struct drm_tegra_pushbuf_stats *stats)
+{
+	struct drm_tegra_pushbuf_pool *pool;
+
+	if (!channel || !stats)
+		return -EINVAL;
+
+	pool = &channel->pushbuf_pool;
+
+	pthread_mutex_lock(&channel->lock);
+
+	stats->bo_size = pool->bo_size;
+	stats->num_bos = pool->num_bos;
+	stats->in_use = pool->in_use;
+	stats->high_water = pool->high_water;
+	stats->allocs = pool->allocs;
+	stats->gets = pool->gets;
+
+	pthread_mutex_unlock(&channel->lock);
+
+	return 0;
+}
+
 drm_public
 int drm_tegra_pushbuf_relocate(struct drm_tegra_pushbuf *pushbuf,
 			       struct drm_tegra_bo *target,
@@ -205,6 +418,12 @@ int drm_tegra_pushbuf_relocate(struct drm_tegra_pushbuf *pushbuf,
 	if (err < 0)
 		return err;
 
+	err = drm_tegra_job_add_bo(priv->job, target);
+	if (err < 0) {
+		priv->job->num_relocs--;
+		return err;
+	}
+
 	*pushbuf->ptr++ = 0xdeadbeef;
 
 	return 0;
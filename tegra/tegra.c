@@ -34,7 +34,31 @@
 
 #include "private.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Takes the table lock of a device, counting how often and for how long
+ * other threads held it already.  The counters are protected by the lock.
+ */
+drm_private void drm_tegra_table_lock(struct drm_tegra *drm)
+{
+	struct timespec start, end;
+
+	if (pthread_mutex_trylock(&drm->table_lock)) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pthread_mutex_lock(&drm->table_lock);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		drm->lock_wait_ns += (end.tv_sec - start.tv_sec) * 1000000000ull +
+				     end.tv_nsec - start.tv_nsec;
+		drm->lock_contended++;
+	}
+
+	drm->lock_acquisitions++;
+}
+
+drm_private void drm_tegra_table_unlock(struct drm_tegra *drm)
+{
+	pthread_mutex_unlock(&drm->table_lock);
+}
 
 /* lookup a buffer, call with table_lock mutex locked */
 static struct drm_tegra_bo * lookup_bo(void *table, uint32_t key)
@@ -245,6 +269,7 @@ vg_free:
 		drmHashDelete(drm->name_table, bo->name);
 
 	drmHashDelete(drm->handle_table, bo->handle);
+	drmPrimeCacheForget(drm->prime_cache, bo->handle);
 
 	memset(&args, 0, sizeof(args));
 	args.handle = bo->handle;
@@ -289,13 +314,26 @@ static int drm_tegra_wrap(struct drm_tegra **drmp, int fd, bool close)
 
 	drm->close = close;
 	drm->fd = fd;
+	atomic_set(&drm->ref, 1);
+	pthread_mutex_init(&drm->table_lock, NULL);
+	pthread_mutex_init(&drm->syncpt_lock, NULL);
+	pthread_mutex_init(&drm->fence_lock, NULL);
+	DRMINITLISTHEAD(&drm->thread_caches);
+
+	if (pthread_key_create(&drm->thread_key,
+			       drm_tegra_thread_cache_destroy)) {
+		free(drm);
+		return -ENOMEM;
+	}
 
+	drm_tegra_job_trace_register();
 	drm_tegra_bo_cache_init(&drm->bo_cache, false);
 	drm->handle_table = drmHashCreate();
 	drm->name_table = drmHashCreate();
+	drm->prime_cache = drmPrimeCacheCreate(fd);
 	DRMINITLISTHEAD(&drm->mmap_cache.list);
 
-	if (!drm->handle_table || !drm->name_table)
+	if (!drm->handle_table || !drm->name_table || !drm->prime_cache)
 		return -ENOMEM;
 
 	drm_tegra_setup_debug(drm);
@@ -330,13 +368,38 @@ drm_public void drm_tegra_close(struct drm_tegra *drm)
 	if (!drm)
 		return;
 
+	/* fences freed from now on are not cached */
+	pthread_mutex_lock(&drm->fence_lock);
+	drm_tegra_fence_cache_fini(drm);
+	drm->closed = true;
+	pthread_mutex_unlock(&drm->fence_lock);
+
+	drm_tegra_unref(drm);
+}
+
+/*
+ * Channels and fences hold a reference to the device, so the BOs of jobs
+ * and pushbufs that are freed after drm_tegra_close() still find the
+ * tables and caches they go back to.  The last reference tears them down.
+ */
+drm_private void drm_tegra_unref(struct drm_tegra *drm)
+{
+	if (!atomic_dec_and_test(&drm->ref))
+		return;
+
+	drm_tegra_thread_caches_fini(drm);
 	drm_tegra_bo_cache_cleanup(drm, 0);
 	drmHashDestroy(drm->handle_table);
 	drmHashDestroy(drm->name_table);
+	drmPrimeCacheDestroy(drm->prime_cache);
+	pthread_mutex_destroy(&drm->syncpt_lock);
+	pthread_mutex_destroy(&drm->table_lock);
 
 	if (drm->close)
 		close(drm->fd);
 
+	drm_tegra_fence_cache_fini(drm);
+	pthread_mutex_destroy(&drm->fence_lock);
 	free(drm);
 }
 
@@ -350,9 +413,7 @@ drm_public int drm_tegra_bo_new(struct drm_tegra_bo **bop, struct drm_tegra *drm
 	if (!drm || size == 0 || !bop)
 		return -EINVAL;
 
-	pthread_mutex_lock(&table_lock);
 	bo = drm_tegra_bo_cache_alloc(drm, &size, flags);
-	pthread_mutex_unlock(&table_lock);
 
 	if (bo) {
 		DBG_BO(bo, "success from cache\n");
@@ -408,10 +469,10 @@ drm_public int drm_tegra_bo_new(struct drm_tegra_bo **bop, struct drm_tegra *drm
 	drm_tegra_bo_setup_guards(bo);
 	DBG_BO_STATS(drm);
 
-	pthread_mutex_lock(&table_lock);
+	drm_tegra_table_lock(drm);
 	/* add ourselves into the handle table */
 	drmHashInsert(drm->handle_table, args.handle, bo);
-	pthread_mutex_unlock(&table_lock);
+	drm_tegra_table_unlock(drm);
 out:
 	*bop = bo;
 
@@ -427,7 +488,7 @@ drm_public int drm_tegra_bo_wrap(struct drm_tegra_bo **bop, struct drm_tegra *dr
 	if (!drm || !bop)
 		return -EINVAL;
 
-	pthread_mutex_lock(&table_lock);
+	drm_tegra_table_lock(drm);
 
 	/* check handle table to see if BO is already open */
 	bo = lookup_bo(drm->handle_table, handle);
@@ -447,6 +508,7 @@ drm_public int drm_tegra_bo_wrap(struct drm_tegra_bo **bop, struct drm_tegra *dr
 	bo->flags = flags;
 	bo->size = size;
 	bo->drm = drm;
+	bo->shared = true;
 
 	VG_BO_ALLOC(bo);
 
@@ -455,7 +517,7 @@ drm_public int drm_tegra_bo_wrap(struct drm_tegra_bo **bop, struct drm_tegra *dr
 
 	DBG_BO(bo, "success\n");
 unlock:
-	pthread_mutex_unlock(&table_lock);
+	drm_tegra_table_unlock(drm);
 
 	*bop = bo;
 
@@ -475,6 +537,7 @@ drm_public struct drm_tegra_bo *drm_tegra_bo_ref(struct drm_tegra_bo *bo)
 
 drm_public int drm_tegra_bo_unref(struct drm_tegra_bo *bo)
 {
+	struct drm_tegra *drm;
 	int err = 0;
 
 	if (!bo)
@@ -482,17 +545,47 @@ drm_public int drm_tegra_bo_unref(struct drm_tegra_bo *bo)
 
 	DBG_BO(bo, "\n");
 
-	if (!atomic_dec_and_test(&bo->ref))
-		return 0;
+	drm = bo->drm;
+
+	/*
+	 * Imports look up shared BOs in the handle table and take their
+	 * reference with the table lock held.  Drop the last reference of a
+	 * shared BO under the lock as well, or an import could pick up a BO
+	 * that is about to be freed.
+	 */
+	if (bo->shared) {
+		if (!atomic_add_unless(&bo->ref, -1, 1))
+			return 0;
+
+		drm_tegra_table_lock(drm);
 
-	drm_tegra_bo_check_guards(bo);
+		if (!atomic_dec_and_test(&bo->ref)) {
+			drm_tegra_table_unlock(drm);
+			return 0;
+		}
+
+		drm_tegra_bo_check_guards(bo);
+	} else {
+		if (!atomic_dec_and_test(&bo->ref))
+			return 0;
 
-	pthread_mutex_lock(&table_lock);
+		drm_tegra_bo_check_guards(bo);
 
-	if (!bo->reuse || drm_tegra_bo_cache_free(bo))
+		if (bo->reuse && !drm_tegra_bo_magazine_free(bo))
+			return 0;
+
+		drm_tegra_table_lock(drm);
+	}
+
+	/*
+	 * A shared BO stays in the handle table while cached, where an import
+	 * could find it, and another process may still be using it.  Don't
+	 * recycle it, so that cached BOs are never shared.
+	 */
+	if (!bo->reuse || bo->shared || drm_tegra_bo_cache_free(bo))
 		err = drm_tegra_bo_free(bo);
 
-	pthread_mutex_unlock(&table_lock);
+	drm_tegra_table_unlock(drm);
 
 	return err;
 }
@@ -502,6 +595,7 @@ drm_public int drm_tegra_bo_get_handle(struct drm_tegra_bo *bo, uint32_t *handle
 	if (!bo || !handle)
 		return -EINVAL;
 
+	bo->shared = true;
 	*handle = bo->handle;
 
 	return 0;
@@ -574,7 +668,7 @@ drm_public int drm_tegra_bo_map(struct drm_tegra_bo *bo, void **ptr)
 	if (!bo)
 		return -EINVAL;
 
-	pthread_mutex_lock(&table_lock);
+	drm_tegra_table_lock(bo->drm);
 
 	if (!bo->map) {
 		err = __drm_tegra_bo_map(bo, &bo->map);
@@ -592,7 +686,7 @@ out:
 	if (ptr)
 		*ptr = bo->map;
 
-	pthread_mutex_unlock(&table_lock);
+	drm_tegra_table_unlock(bo->drm);
 
 	return err;
 }
@@ -604,7 +698,7 @@ drm_public int drm_tegra_bo_unmap(struct drm_tegra_bo *bo)
 
 	DBG_BO(bo, "\n");
 
-	pthread_mutex_lock(&table_lock);
+	drm_tegra_table_lock(bo->drm);
 
 	if (bo->mmap_ref == 0)
 		goto unlock;
@@ -617,7 +711,7 @@ drm_public int drm_tegra_bo_unmap(struct drm_tegra_bo *bo)
 	drm_tegra_bo_cache_unmap(bo);
 	bo->map = NULL;
 unlock:
-	pthread_mutex_unlock(&table_lock);
+	drm_tegra_table_unlock(bo->drm);
 
 	return 0;
 }
@@ -739,6 +833,8 @@ int drm_tegra_bo_get_name(struct drm_tegra_bo *bo, uint32_t *name)
 	if (!bo || !name)
 		return -EINVAL;
 
+	bo->shared = true;
+
 	if (!bo->name) {
 		struct drm_gem_flink args;
 		int err;
@@ -753,12 +849,12 @@ int drm_tegra_bo_get_name(struct drm_tegra_bo *bo, uint32_t *name)
 			return -errno;
 		}
 
-		pthread_mutex_lock(&table_lock);
+		drm_tegra_table_lock(bo->drm);
 
 		drmHashInsert(bo->drm->name_table, args.name, bo);
 		bo->name = args.name;
 
-		pthread_mutex_unlock(&table_lock);
+		drm_tegra_table_unlock(bo->drm);
 	}
 
 	*name = bo->name;
@@ -780,7 +876,7 @@ int drm_tegra_bo_from_name(struct drm_tegra_bo **bop, struct drm_tegra *drm,
 	if (!drm || !name || !bop)
 		return -EINVAL;
 
-	pthread_mutex_lock(&table_lock);
+	drm_tegra_table_lock(drm);
 
 	/* check name table first, to see if BO is already open */
 	bo = lookup_bo(drm->name_table, name);
@@ -828,7 +924,7 @@ int drm_tegra_bo_from_name(struct drm_tegra_bo **bop, struct drm_tegra *drm,
 	VG_BO_ALLOC(bo);
 
 unlock:
-	pthread_mutex_unlock(&table_lock);
+	drm_tegra_table_unlock(drm);
 
 	*bop = bo;
 
@@ -844,8 +940,10 @@ int drm_tegra_bo_to_dmabuf(struct drm_tegra_bo *bo, uint32_t *handle)
 	if (!bo || !handle)
 		return -EINVAL;
 
-	err = drmPrimeHandleToFD(bo->drm->fd, bo->handle, DRM_CLOEXEC,
-				 &prime_fd);
+	bo->shared = true;
+
+	err = drmPrimeCacheExport(bo->drm->prime_cache, &bo->handle,
+				  DRM_CLOEXEC, &prime_fd, 1);
 	if (err) {
 		VDBG_BO(bo, "faile err %d strerror(%s)\n",
 			err, strerror(-err));
@@ -859,74 +957,147 @@ int drm_tegra_bo_to_dmabuf(struct drm_tegra_bo *bo, uint32_t *handle)
 	return 0;
 }
 
-drm_public
-int drm_tegra_bo_from_dmabuf(struct drm_tegra_bo **bop, struct drm_tegra *drm,
-			     int fd, uint32_t flags)
+/* wrap an imported handle, call with table_lock mutex locked */
+static struct drm_tegra_bo *
+drm_tegra_bo_import(struct drm_tegra *drm, uint32_t handle, uint64_t size,
+		    uint32_t flags)
 {
-	struct drm_tegra_bo *dup;
+	struct drm_gem_close args;
 	struct drm_tegra_bo *bo;
-	uint32_t handle;
-	uint32_t size;
-	int err;
 
-	if (!drm || !bop)
-		return -EINVAL;
-
-	pthread_mutex_lock(&table_lock);
+	/* check handle table to see if BO is already open */
+	bo = lookup_bo(drm->handle_table, handle);
+	if (bo) {
+		DBG_BO(bo, "success reused\n");
+		return bo;
+	}
 
 	bo = calloc(1, sizeof(*bo));
 	if (!bo) {
-		err = -ENOMEM;
-		goto unlock;
-	}
+		drmPrimeCacheForget(drm->prime_cache, handle);
 
-	err = drmPrimeFDToHandle(drm->fd, fd, &handle);
-	if (err) {
-		free(bo);
-		bo = NULL;
-		goto unlock;
-	}
+		memset(&args, 0, sizeof(args));
+		args.handle = handle;
+		drmIoctl(drm->fd, DRM_IOCTL_GEM_CLOSE, &args);
 
-	/* check handle table to see if BO is already open */
-	dup = lookup_bo(drm->handle_table, handle);
-	if (dup) {
-		DBG_BO(dup, "success reused\n");
-		free(bo);
-		bo = dup;
-		goto unlock;
+		return NULL;
 	}
 
-	errno = 0;
-	/* lseek() to get bo size */
-	size = lseek(fd, 0, SEEK_END);
-	lseek(fd, 0, SEEK_CUR);
-	/* store lseek() error number */
-	err = -errno;
-
+	DRMINITLISTHEAD(&bo->push_list);
+	DRMINITLISTHEAD(&bo->bo_list);
 	atomic_set(&bo->ref, 1);
 	bo->handle = handle;
 	bo->flags = flags;
 	bo->size = size;
 	bo->drm = drm;
+	bo->shared = true;
 
 	VG_BO_ALLOC(bo);
 
 	/* add ourself into the handle table: */
 	drmHashInsert(drm->handle_table, handle, bo);
 
-	/* handle lseek() error */
-	if (err) {
-		VDBG_BO(bo, "lseek failed %d (%s)\n", err, strerror(-err));
-		drm_tegra_bo_free(bo);
-		bo = NULL;
-	} else {
-		DBG_BO(bo, "success\n");
+	DBG_BO(bo, "success\n");
+
+	return bo;
+}
+
+/*
+ * close imported handles that were not wrapped, skipping those that a BO
+ * owns and duplicates, call with table_lock mutex locked
+ */
+static void drm_tegra_close_handles(struct drm_tegra *drm,
+				    const uint32_t *handles, unsigned int count)
+{
+	struct drm_gem_close args;
+	unsigned int i, j;
+	void *value;
+
+	for (i = 0; i < count && handles[i]; i++) {
+		if (!drmHashLookup(drm->handle_table, handles[i], &value))
+			continue;
+
+		for (j = 0; j < i; j++)
+			if (handles[j] == handles[i])
+				break;
+		if (j < i)
+			continue;
+
+		drmPrimeCacheForget(drm->prime_cache, handles[i]);
+
+		memset(&args, 0, sizeof(args));
+		args.handle = handles[i];
+		drmIoctl(drm->fd, DRM_IOCTL_GEM_CLOSE, &args);
 	}
+}
 
-unlock:
-	pthread_mutex_unlock(&table_lock);
+drm_public
+int drm_tegra_bo_from_dmabuf(struct drm_tegra_bo **bop, struct drm_tegra *drm,
+			     int fd, uint32_t flags)
+{
+	return drm_tegra_bo_from_dmabufs(bop, drm, &fd, 1, flags);
+}
 
-	*bop = bo;
+/*
+ * Imports all planes of a frame at once: the dma-bufs go through the PRIME
+ * cache in one batch and the handle table is locked only once.  The lock is
+ * held across the import, so that freeing a BO cannot close a handle that
+ * was just returned for it before it is wrapped.  On failure no BO is
+ * returned.
+ */
+drm_public
+int drm_tegra_bo_from_dmabufs(struct drm_tegra_bo **bos, struct drm_tegra *drm,
+			      const int *fds, unsigned int count,
+			      uint32_t flags)
+{
+	uint32_t handles[16];
+	uint64_t sizes[16];
+	unsigned int i, n, chunk;
+	int err;
+
+	if (!drm || !bos || (count && !fds))
+		return -EINVAL;
+
+	for (n = 0; n < count; n += chunk) {
+		chunk = count - n;
+		if (chunk > ARRAY_SIZE(handles))
+			chunk = ARRAY_SIZE(handles);
+
+		/* handle 0 is never valid, it marks entries not imported */
+		memset(handles, 0, sizeof(handles));
+
+		drm_tegra_table_lock(drm);
+
+		err = drmPrimeCacheImport(drm->prime_cache, fds + n, handles,
+					  sizes, chunk);
+
+		for (i = 0; i < chunk && handles[i]; i++) {
+			bos[n + i] = drm_tegra_bo_import(drm, handles[i],
+							 sizes[i], flags);
+			if (!bos[n + i]) {
+				err = -ENOMEM;
+				drm_tegra_close_handles(drm, handles + i + 1,
+							chunk - i - 1);
+				break;
+			}
+		}
+
+		drm_tegra_table_unlock(drm);
+
+		if (err) {
+			n += i;
+			goto unref;
+		}
+	}
+
+	return 0;
+
+unref:
+	while (n--)
+		drm_tegra_bo_unref(bos[n]);
+
+	for (i = 0; i < count; i++)
+		bos[i] = NULL;
 
 	return err;
 }
@@ -954,3 +1125,109 @@ int drm_tegra_bo_forbid_caching(struct drm_tegra_bo *bo)
 
 	return 0;
 }
+
+/**
+ * drm_tegra_get_bo_stats() - report BO allocator statistics
+ * @drm: device
+ * @stats: filled in with the counters
+ *
+ * The magazine counters of running threads are read without stopping
+ * them, so they are only a snapshot.
+ */
+drm_public
+int drm_tegra_get_bo_stats(struct drm_tegra *drm,
+			   struct drm_tegra_bo_stats *stats)
+{
+	struct drm_tegra_thread_cache *tc;
+
+	if (!drm || !stats)
+		return -EINVAL;
+
+	drm_tegra_table_lock(drm);
+
+	stats->lock_acquisitions = drm->lock_acquisitions;
+	stats->lock_contended = drm->lock_contended;
+	stats->lock_wait_ns = drm->lock_wait_ns;
+	stats->magazine_allocs = drm->magazine_allocs;
+	stats->magazine_frees = drm->magazine_frees;
+	stats->magazine_refills = drm->magazine_refills;
+	stats->magazine_flushes = drm->magazine_flushes;
+
+	DRMLISTFOREACHENTRY(tc, &drm->thread_caches, list) {
+		stats->magazine_allocs += tc->allocs;
+		stats->magazine_frees += tc->frees;
+	}
+
+	drm_tegra_table_unlock(drm);
+
+	return 0;
+}
+
+/**
+ * drm_tegra_bo_cpu_prep() - prepare BO for CPU access
+ * @bo: buffer object
+ * @op: DRM_TEGRA_CPU_PREP_* flags
+ * @timeout: wait timeout in milliseconds
+ *
+ * Waits for the last job submitted through this library that referenced
+ * the BO.  With DRM_TEGRA_CPU_PREP_NOSYNC -EBUSY is returned instead of
+ * waiting.  Jobs of other processes sharing the BO are not tracked.
+ */
+drm_public
+int drm_tegra_bo_cpu_prep(struct drm_tegra_bo *bo, uint32_t op,
+			  unsigned long timeout)
+{
+	struct drm_tegra *drm;
+	uint32_t syncpt, thresh, value;
+	bool busy;
+	int err;
+
+	if (!bo || (op & ~DRM_TEGRA_CPU_PREP_FLAGS))
+		return -EINVAL;
+
+	drm = bo->drm;
+
+	/* jobs may be submitted concurrently, work on a snapshot */
+	pthread_mutex_lock(&drm->fence_lock);
+	busy = bo->busy;
+	syncpt = bo->fence_syncpt;
+	thresh = bo->fence_value;
+	pthread_mutex_unlock(&drm->fence_lock);
+
+	if (!busy)
+		return 0;
+
+	if (!drm_tegra_syncpt_signaled(drm, syncpt, thresh)) {
+		if (op & DRM_TEGRA_CPU_PREP_NOSYNC) {
+			err = drm_tegra_syncpt_read(drm, syncpt, &value);
+			if (err < 0)
+				return err;
+
+			if (!drm_tegra_syncpt_passed(value, thresh))
+				return -EBUSY;
+		} else {
+			err = drm_tegra_syncpt_wait(drm, syncpt, thresh,
+						    timeout);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	/* unless a later job was attached meanwhile, the BO is idle now */
+	pthread_mutex_lock(&drm->fence_lock);
+	if (bo->fence_syncpt == syncpt && bo->fence_value == thresh)
+		bo->busy = false;
+	pthread_mutex_unlock(&drm->fence_lock);
+
+	return 0;
+}
+
+drm_public
+int drm_tegra_bo_cpu_fini(struct drm_tegra_bo *bo)
+{
+	if (!bo)
+		return -EINVAL;
+
+	/* BOs are mapped coherently, there is nothing to flush */
+	return 0;
+}
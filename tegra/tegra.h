@@ -71,10 +71,37 @@ int drm_tegra_bo_from_name(struct drm_tegra_bo **bop, struct drm_tegra *drm,
 int drm_tegra_bo_to_dmabuf(struct drm_tegra_bo *bo, uint32_t *handle);
 int drm_tegra_bo_from_dmabuf(struct drm_tegra_bo **bop, struct drm_tegra *drm,
 			     int fd, uint32_t flags);
+int drm_tegra_bo_from_dmabufs(struct drm_tegra_bo **bos, struct drm_tegra *drm,
+			      const int *fds, unsigned int count,
+			      uint32_t flags);
 
 int drm_tegra_bo_get_size(struct drm_tegra_bo *bo, uint32_t *size);
 int drm_tegra_bo_forbid_caching(struct drm_tegra_bo *bo);
 
+struct drm_tegra_bo_stats {
+	uint64_t lock_acquisitions;	/* of the device's table lock */
+	uint64_t lock_contended;	/* acquisitions that had to wait */
+	uint64_t lock_wait_ns;		/* total time spent waiting */
+	uint64_t magazine_allocs;	/* BOs taken from a thread magazine */
+	uint64_t magazine_frees;	/* BOs put into a thread magazine */
+	uint64_t magazine_refills;
+	uint64_t magazine_flushes;
+};
+
+int drm_tegra_get_bo_stats(struct drm_tegra *drm,
+			   struct drm_tegra_bo_stats *stats);
+
+#define DRM_TEGRA_CPU_PREP_READ		(1 << 0)
+#define DRM_TEGRA_CPU_PREP_WRITE	(1 << 1)
+#define DRM_TEGRA_CPU_PREP_NOSYNC	(1 << 2)
+#define DRM_TEGRA_CPU_PREP_FLAGS	(DRM_TEGRA_CPU_PREP_READ |	\
+					 DRM_TEGRA_CPU_PREP_WRITE |	\
+					 DRM_TEGRA_CPU_PREP_NOSYNC)
+
+int drm_tegra_bo_cpu_prep(struct drm_tegra_bo *bo, uint32_t op,
+			  unsigned long timeout);
+int drm_tegra_bo_cpu_fini(struct drm_tegra_bo *bo);
+
 struct drm_tegra_channel;
 struct drm_tegra_job;
 
@@ -97,9 +124,22 @@ int drm_tegra_channel_open(struct drm_tegra_channel **channelp,
 			   enum drm_tegra_class client);
 int drm_tegra_channel_close(struct drm_tegra_channel *channel);
 
+struct drm_tegra_pushbuf_stats {
+	uint32_t bo_size;	/* size of the command stream BOs */
+	uint32_t num_bos;	/* BOs owned by the channel */
+	uint32_t in_use;	/* held by pushbufs or their pending jobs */
+	uint32_t high_water;	/* largest in_use so far */
+	uint64_t allocs;	/* BOs allocated */
+	uint64_t gets;		/* BOs handed out to pushbufs */
+};
+
+int drm_tegra_channel_get_pushbuf_stats(struct drm_tegra_channel *channel,
+					struct drm_tegra_pushbuf_stats *stats);
+
 int drm_tegra_job_new(struct drm_tegra_job **jobp,
 		      struct drm_tegra_channel *channel);
 int drm_tegra_job_free(struct drm_tegra_job *job);
+int drm_tegra_job_reset(struct drm_tegra_job *job);
 int drm_tegra_job_submit(struct drm_tegra_job *job,
 			 struct drm_tegra_fence **fencep);
 
@@ -119,6 +159,12 @@ int drm_tegra_fence_wait_timeout(struct drm_tegra_fence *fence,
 				 unsigned long timeout);
 void drm_tegra_fence_free(struct drm_tegra_fence *fence);
 
+#define DRM_TEGRA_FENCE_WAIT_ALL	(1 << 0)
+
+int drm_tegra_fence_wait_many(struct drm_tegra_fence **fences,
+			      unsigned int count, uint32_t flags,
+			      unsigned long timeout, unsigned int *first);
+
 static inline int drm_tegra_fence_wait(struct drm_tegra_fence *fence)
 {
 	return drm_tegra_fence_wait_timeout(fence, -1);
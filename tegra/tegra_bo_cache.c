@@ -30,6 +30,7 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "private.h"
@@ -84,6 +85,8 @@ drm_tegra_bo_cache_init(struct drm_tegra_bo_cache *cache, bool course)
 {
 	unsigned long size, cache_max_size = 64 * 1024 * 1024;
 
+	cache->coarse = course;
+
 	/* OK, so power of two buckets was too wasteful of memory.
 	 * Give 3 other sizes between each power of two, to hopefully
 	 * cover things accurately enough.  (The alternative is
@@ -155,20 +158,44 @@ drm_tegra_bo_cache_cleanup(struct drm_tegra *drm,
 	cache->time = time;
 }
 
+/* index of the highest set bit, v must not be 0 */
+static inline unsigned int fls32(uint32_t v)
+{
+	return 31 - __builtin_clz(v);
+}
+
+/*
+ * The bucket sizes follow from drm_tegra_bo_cache_init(), so the index
+ * can be computed rather than searched for: 1, 2 and 3 pages, then each
+ * power of two from 16 KiB up, followed by its 1.25, 1.5 and 1.75
+ * multiples unless the cache is coarse.  Sizes are page aligned here.
+ */
 drm_private struct drm_tegra_bo_bucket *
 drm_tegra_get_bucket(struct drm_tegra *drm, uint32_t size)
 {
 	struct drm_tegra_bo_cache *cache = &drm->bo_cache;
-	int i;
+	unsigned int i, p;
+
+	if (size <= 4096) {
+		i = 0;
+	} else if (size <= 8192) {
+		i = 1;
+	} else if (cache->coarse) {
+		/* 4 KiB, 8 KiB and then powers of two from 16 KiB */
+		i = fls32(size - 1) - 11;
+	} else if (size <= 12288) {
+		i = 2;
+	} else if (size <= 16384) {
+		i = 3;
+	} else {
+		/* the quarter of [2^p, 2^(p+1)) that size - 1 falls into */
+		p = fls32(size - 1);
+		i = 3 + (p - 14) * 4 + ((size - 1) >> (p - 2) & 3) + 1;
+	}
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
-	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct drm_tegra_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
+	if (i < (unsigned int)cache->num_buckets) {
+		assert(cache->cache_bucket[i].size >= size);
+		return &cache->cache_bucket[i];
 	}
 
 	VDBG_DRM(drm, "failed size %u bytes\n",  size);
@@ -181,16 +208,12 @@ static struct drm_tegra_bo_bucket * bo_bucket(struct drm_tegra_bo *bo)
 	return drm_tegra_get_bucket(bo->drm, bo->size);
 }
 
-static int is_idle(struct drm_tegra_bo *bo)
-{
-	/* TODO implement drm_tegra_bo_cpu_prep() */
-	return 1;
-}
-
-static struct drm_tegra_bo *find_in_bucket(struct drm_tegra_bo_bucket *bucket,
+/* Called under table_lock */
+static struct drm_tegra_bo *find_in_bucket(struct drm_tegra *drm,
+					   struct drm_tegra_bo_bucket *bucket,
 					   uint32_t flags)
 {
-	struct drm_tegra_bo *bo = NULL;
+	struct drm_tegra_bo *bo;
 
 	/* TODO .. if we had an ALLOC_FOR_RENDER flag like intel, we could
 	 * skip the busy check.. if it is only going to be a render target
@@ -198,24 +221,95 @@ static struct drm_tegra_bo *find_in_bucket(struct drm_tegra_bo_bucket *bucket,
 	 *
 	 * NOTE that intel takes ALLOC_FOR_RENDER bo's from the list tail
 	 * (MRU, since likely to be in GPU cache), rather than head (LRU)..
+	 *
+	 * Take the least recently used BO that is known to be idle from the
+	 * cached syncpoint values, which costs no ioctl.  Reading syncpoints
+	 * is left to the callers, which must not do it under table_lock.
 	 */
-	if (!DRMLISTEMPTY(&bucket->list)) {
-		bo = DRMLISTENTRY(struct drm_tegra_bo, bucket->list.next,
-				  bo_list);
+	DRMLISTFOREACHENTRY(bo, &bucket->list, bo_list) {
 		/* TODO check for compatible flags? */
-		if (is_idle(bo)) {
-			DRMLISTDELINIT(&bo->bo_list);
-			bucket->num_entries--;
-		} else {
-			bo = NULL;
+		if (!bo->busy)
+			goto found;
+
+		if (drm_tegra_syncpt_signaled(drm, bo->fence_syncpt,
+					      bo->fence_value)) {
+			bo->busy = false;
+			goto found;
 		}
 	}
 
+	return NULL;
+
+found:
+	DRMLISTDELINIT(&bo->bo_list);
+	bucket->num_entries--;
+
 	return bo;
 }
 
-drm_private void drm_tegra_reset_bo(struct drm_tegra_bo *bo, uint32_t flags,
-				    bool set_flags)
+/*
+ * Collects the distinct syncpoints that the busy BOs of a bucket wait on,
+ * up to max of them.  Called under table_lock
+ */
+static unsigned int bucket_busy_syncpts(struct drm_tegra_bo_bucket *bucket,
+					uint32_t *ids, unsigned int max)
+{
+	struct drm_tegra_bo *bo;
+	unsigned int i, n = 0;
+
+	DRMLISTFOREACHENTRY(bo, &bucket->list, bo_list) {
+		if (!bo->busy)
+			continue;
+
+		for (i = 0; i < n; i++)
+			if (ids[i] == bo->fence_syncpt)
+				break;
+
+		if (i < n)
+			continue;
+
+		ids[n++] = bo->fence_syncpt;
+		if (n == max)
+			break;
+	}
+
+	return n;
+}
+
+/*
+ * Like find_in_bucket(), but if no BO is known to be idle, reads the
+ * syncpoints of the busy ones and looks again.  table_lock is dropped
+ * around the reads, so that other threads don't wait on the kernel.
+ * Called under table_lock
+ */
+static struct drm_tegra_bo *
+find_in_bucket_sync(struct drm_tegra *drm, struct drm_tegra_bo_bucket *bucket,
+		    uint32_t flags)
+{
+	uint32_t ids[DRM_TEGRA_BUCKET_SYNCPTS], value;
+	struct drm_tegra_bo *bo;
+	unsigned int i, n;
+
+	bo = find_in_bucket(drm, bucket, flags);
+	if (bo)
+		return bo;
+
+	n = bucket_busy_syncpts(bucket, ids, ARRAY_SIZE(ids));
+	if (!n)
+		return NULL;
+
+	drm_tegra_table_unlock(drm);
+
+	for (i = 0; i < n; i++)
+		drm_tegra_syncpt_read(drm, ids[i], &value);
+
+	drm_tegra_table_lock(drm);
+
+	return find_in_bucket(drm, bucket, flags);
+}
+
+static void reset_bo_state(struct drm_tegra_bo *bo, uint32_t flags,
+			   bool set_flags)
 {
 	struct drm_tegra_bo_tiling tiling;
 
@@ -237,6 +331,12 @@ drm_private void drm_tegra_reset_bo(struct drm_tegra_bo *bo, uint32_t flags,
 	/* reset reference counters */
 	atomic_set(&bo->ref, 1);
 	bo->mmap_ref = 0;
+}
+
+drm_private void drm_tegra_reset_bo(struct drm_tegra_bo *bo, uint32_t flags,
+				    bool set_flags)
+{
+	reset_bo_state(bo, flags, set_flags);
 
 	/*
 	 * Put mapping into the cache to dispose of it if new BO owner
@@ -249,33 +349,220 @@ drm_private void drm_tegra_reset_bo(struct drm_tegra_bo *bo, uint32_t flags,
 	}
 }
 
+/* Adds a released BO to its bucket.  Called under table_lock */
+static void bucket_add(struct drm_tegra *drm,
+		       struct drm_tegra_bo_bucket *bucket,
+		       struct drm_tegra_bo *bo)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	bo->free_time = time.tv_sec;
+	drm_tegra_bo_cache_cleanup(drm, time.tv_sec);
+	DRMLISTADDTAIL(&bo->bo_list, &bucket->list);
+#ifndef NDEBUG
+	if (drm->debug_bo) {
+		drm->debug_bos_cached++;
+		DBG_BO_STATS(drm);
+	}
+#endif
+	bucket->num_entries++;
+}
+
+static struct drm_tegra_thread_cache *thread_cache(struct drm_tegra *drm)
+{
+	struct drm_tegra_thread_cache *tc;
+
+	tc = pthread_getspecific(drm->thread_key);
+	if (tc)
+		return tc;
+
+	tc = calloc(1, sizeof(*tc));
+	if (!tc)
+		return NULL;
+
+	tc->drm = drm;
+
+	if (pthread_setspecific(drm->thread_key, tc)) {
+		free(tc);
+		return NULL;
+	}
+
+	drm_tegra_table_lock(drm);
+	DRMLISTADD(&tc->list, &drm->thread_caches);
+	drm_tegra_table_unlock(drm);
+
+	return tc;
+}
+
+/*
+ * Takes the oldest BO of a magazine that is known to be idle, without
+ * asking the kernel.  BOs stay mapped while they sit in a magazine.
+ */
+static struct drm_tegra_bo *magazine_pop(struct drm_tegra *drm,
+					 struct drm_tegra_magazine *mag)
+{
+	struct drm_tegra_bo *bo;
+	unsigned int i;
+
+	for (i = 0; i < mag->count; i++) {
+		bo = mag->bos[i];
+
+		if (bo->busy) {
+			if (!drm_tegra_syncpt_signaled(drm, bo->fence_syncpt,
+						       bo->fence_value))
+				continue;
+
+			bo->busy = false;
+		}
+
+		mag->count--;
+		memmove(&mag->bos[i], &mag->bos[i + 1],
+			(mag->count - i) * sizeof(bo));
+
+		return bo;
+	}
+
+	return NULL;
+}
+
+/*
+ * Tops the magazine up to half full with idle BOs of the shared bucket.
+ * If it holds busy BOs, their syncpoint is read first so that they are
+ * seen to be idle once their job has completed.
+ */
+static void magazine_refill(struct drm_tegra *drm,
+			    struct drm_tegra_magazine *mag,
+			    struct drm_tegra_bo_bucket *bucket)
+{
+	struct drm_tegra_bo *bo;
+	bool synced = false;
+	uint32_t value;
+
+	if (mag->count)
+		drm_tegra_syncpt_read(drm, mag->bos[0]->fence_syncpt, &value);
+
+	drm_tegra_table_lock(drm);
+
+	while (mag->count < DRM_TEGRA_MAGAZINE_SIZE / 2) {
+		/* syncpoints only need to be read once per refill */
+		bo = find_in_bucket(drm, bucket, 0);
+		if (!bo && !synced) {
+			bo = find_in_bucket_sync(drm, bucket, 0);
+			synced = true;
+		}
+		if (!bo)
+			break;
+
+		mag->bos[mag->count++] = bo;
+#ifndef NDEBUG
+		if (drm->debug_bo)
+			drm->debug_bos_cached--;
+#endif
+	}
+
+	drm->magazine_refills++;
+
+	drm_tegra_table_unlock(drm);
+}
+
+/* Moves the older half of a full magazine to the shared bucket */
+static void magazine_flush(struct drm_tegra *drm,
+			   struct drm_tegra_magazine *mag,
+			   struct drm_tegra_bo_bucket *bucket,
+			   unsigned int count)
+{
+	unsigned int i;
+
+	drm_tegra_table_lock(drm);
+
+	for (i = 0; i < count; i++)
+		bucket_add(drm, bucket, mag->bos[i]);
+
+	drm->magazine_flushes++;
+
+	drm_tegra_table_unlock(drm);
+
+	mag->count -= count;
+	memmove(&mag->bos[0], &mag->bos[count],
+		mag->count * sizeof(mag->bos[0]));
+}
+
+static struct drm_tegra_magazine *
+bucket_magazine(struct drm_tegra *drm, struct drm_tegra_bo_bucket *bucket,
+		struct drm_tegra_thread_cache **tcp)
+{
+	unsigned int i = bucket - drm->bo_cache.cache_bucket;
+	struct drm_tegra_thread_cache *tc;
+
+	/* the bucket index depends on whether the cache is coarse */
+	if (bucket->size > DRM_TEGRA_MAGAZINE_MAX_SIZE)
+		return NULL;
+
+	assert(i < DRM_TEGRA_MAGAZINE_CLASSES);
+
+	tc = thread_cache(drm);
+	if (!tc)
+		return NULL;
+
+	*tcp = tc;
+
+	return &tc->magazines[i];
+}
+
 /* NOTE: size is potentially rounded up to bucket size: */
 drm_private struct drm_tegra_bo *
 drm_tegra_bo_cache_alloc(struct drm_tegra *drm,
 			 uint32_t *size, uint32_t flags)
 {
+	struct drm_tegra_thread_cache *tc;
 	struct drm_tegra_bo *bo = NULL;
 	struct drm_tegra_bo_bucket *bucket;
+	struct drm_tegra_magazine *mag;
 
 	*size = align(*size, 4096);
 	bucket = drm_tegra_get_bucket(drm, *size);
+	if (!bucket)
+		return NULL;
+
+	*size = bucket->size;
+
+	/* small BOs come from this thread's magazine */
+	mag = bucket_magazine(drm, bucket, &tc);
+	if (mag) {
+		bo = magazine_pop(drm, mag);
+		if (!bo) {
+			magazine_refill(drm, mag, bucket);
+			bo = magazine_pop(drm, mag);
+		}
 
-	/* see if we can be green and recycle: */
-	if (bucket) {
-		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
 		if (bo) {
-			drm_tegra_reset_bo(bo, flags, true);
+			reset_bo_state(bo, flags, true);
+			tc->allocs++;
+		}
+
+		return bo;
+	}
+
+	/* see if we can be green and recycle: */
+	drm_tegra_table_lock(drm);
+
+	bo = find_in_bucket_sync(drm, bucket, flags);
+	if (bo) {
+		drm_tegra_reset_bo(bo, flags, true);
 #ifndef NDEBUG
-			if (drm->debug_bo)
-				drm->debug_bos_cached--;
+		if (drm->debug_bo)
+			drm->debug_bos_cached--;
 #endif
-		}
 	}
 
+	drm_tegra_table_unlock(drm);
+
 	return bo;
 }
 
+/* Called under table_lock */
 drm_private int
 drm_tegra_bo_cache_free(struct drm_tegra_bo *bo)
 {
@@ -285,23 +572,10 @@ drm_tegra_bo_cache_free(struct drm_tegra_bo *bo)
 	/* see if we can be green and recycle: */
 	bucket = drm_tegra_get_bucket(drm, bo->size);
 	if (bucket) {
-		struct timespec time;
-
 		DBG_BO(bo, "BO added to cache\n");
 
-		clock_gettime(CLOCK_MONOTONIC, &time);
-
-		bo->free_time = time.tv_sec;
 		VG_BO_RELEASE(bo);
-		drm_tegra_bo_cache_cleanup(drm, time.tv_sec);
-		DRMLISTADDTAIL(&bo->bo_list, &bucket->list);
-#ifndef NDEBUG
-		if (drm->debug_bo) {
-			drm->debug_bos_cached++;
-			DBG_BO_STATS(drm);
-		}
-#endif
-		bucket->num_entries++;
+		bucket_add(drm, bucket, bo);
 
 		return 0;
 	}
@@ -309,6 +583,121 @@ drm_tegra_bo_cache_free(struct drm_tegra_bo *bo)
 	return -1;
 }
 
+/* Flushes the BOs that have sat in this thread's magazines for too long */
+static void thread_cache_age(struct drm_tegra *drm,
+			     struct drm_tegra_thread_cache *tc, time_t time)
+{
+	struct drm_tegra_magazine *mag;
+	unsigned int i, count;
+
+	if (tc->time == time)
+		return;
+
+	for (i = 0; i < DRM_TEGRA_MAGAZINE_CLASSES; i++) {
+		mag = &tc->magazines[i];
+
+		/* magazines are ordered from the oldest BO to the newest */
+		for (count = 0; count < mag->count; count++)
+			if (time - mag->bos[count]->free_time <= 1)
+				break;
+
+		if (count)
+			magazine_flush(drm, mag, &drm->bo_cache.cache_bucket[i],
+				       count);
+	}
+
+	tc->time = time;
+}
+
+/*
+ * Puts a small BO into this thread's magazine, without taking the table
+ * lock unless the magazine is full or holds BOs older than a second.
+ * Shared BOs are not recycled at all, see drm_tegra_bo_unref().
+ */
+drm_private int
+drm_tegra_bo_magazine_free(struct drm_tegra_bo *bo)
+{
+	struct drm_tegra *drm = bo->drm;
+	struct drm_tegra_thread_cache *tc;
+	struct drm_tegra_bo_bucket *bucket;
+	struct drm_tegra_magazine *mag;
+	struct timespec time;
+
+	if (bo->shared)
+		return -1;
+
+	bucket = drm_tegra_get_bucket(drm, bo->size);
+	if (!bucket)
+		return -1;
+
+	mag = bucket_magazine(drm, bucket, &tc);
+	if (!mag)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	thread_cache_age(drm, tc, time.tv_sec);
+
+	if (mag->count == DRM_TEGRA_MAGAZINE_SIZE)
+		magazine_flush(drm, mag, bucket, DRM_TEGRA_MAGAZINE_SIZE / 2);
+
+	DBG_BO(bo, "BO added to magazine\n");
+
+	VG_BO_RELEASE(bo);
+	bo->free_time = time.tv_sec;
+	mag->bos[mag->count++] = bo;
+	tc->frees++;
+
+	return 0;
+}
+
+/* pthread key destructor, hands the magazines of an exiting thread back */
+drm_private void drm_tegra_thread_cache_destroy(void *data)
+{
+	struct drm_tegra_thread_cache *tc = data;
+	struct drm_tegra *drm = tc->drm;
+	unsigned int i;
+
+	for (i = 0; i < DRM_TEGRA_MAGAZINE_CLASSES; i++)
+		if (tc->magazines[i].count)
+			magazine_flush(drm, &tc->magazines[i],
+				       &drm->bo_cache.cache_bucket[i],
+				       tc->magazines[i].count);
+
+	drm_tegra_table_lock(drm);
+
+	drm->magazine_allocs += tc->allocs;
+	drm->magazine_frees += tc->frees;
+	DRMLISTDEL(&tc->list);
+
+	drm_tegra_table_unlock(drm);
+
+	free(tc);
+}
+
+/* frees the magazines of all threads, on device close */
+drm_private void drm_tegra_thread_caches_fini(struct drm_tegra *drm)
+{
+	struct drm_tegra_thread_cache *tc, *tmp;
+	struct drm_tegra_magazine *mag;
+	unsigned int i, j;
+
+	pthread_key_delete(drm->thread_key);
+
+	DRMLISTFOREACHENTRYSAFE(tc, tmp, &drm->thread_caches, list) {
+		for (i = 0; i < DRM_TEGRA_MAGAZINE_CLASSES; i++) {
+			mag = &tc->magazines[i];
+
+			for (j = 0; j < mag->count; j++) {
+				VG_BO_OBTAIN(mag->bos[j]);
+				drm_tegra_bo_free(mag->bos[j]);
+			}
+		}
+
+		DRMLISTDEL(&tc->list);
+		free(tc);
+	}
+}
+
 static void
 drm_tegra_bo_mmap_cache_cleanup(struct drm_tegra *drm,
 				struct drm_tegra_bo_mmap_cache *cache,
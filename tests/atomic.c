@@ -0,0 +1,178 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the sorted atomic request mode against the kernel's expectations.
+ * DRM_IOCTL_MODE_ATOMIC is intercepted, so no device is needed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#include "fake_ioctl.h"
+
+static struct drm_mode_atomic last_atomic;
+
+static int fake_atomic_ioctl(int fd, unsigned long request, void *arg)
+{
+	if (request != DRM_IOCTL_MODE_ATOMIC) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	memcpy(&last_atomic, arg, sizeof(last_atomic));
+	return 0;
+}
+
+#define U642PTR(x) ((void *)(unsigned long)(x))
+
+/* Check that the last commit matches the expected (object, property) set */
+static int check_commit(const uint32_t *objs, const uint32_t *count_props,
+			unsigned int count_objs, const uint32_t *props,
+			const uint64_t *values)
+{
+	const uint32_t *got_objs = U642PTR(last_atomic.objs_ptr);
+	const uint32_t *got_count_props = U642PTR(last_atomic.count_props_ptr);
+	const uint32_t *got_props = U642PTR(last_atomic.props_ptr);
+	const uint64_t *got_values = U642PTR(last_atomic.prop_values_ptr);
+	unsigned int i, count = 0;
+
+	if (last_atomic.count_objs != count_objs) {
+		printf("expected %u objects, got %u\n", count_objs,
+		       last_atomic.count_objs);
+		return -1;
+	}
+
+	for (i = 0; i < count_objs; i++) {
+		if (got_objs[i] != objs[i] ||
+		    got_count_props[i] != count_props[i]) {
+			printf("object %u: expected %u/%u, got %u/%u\n", i,
+			       objs[i], count_props[i], got_objs[i],
+			       got_count_props[i]);
+			return -1;
+		}
+		count += count_props[i];
+	}
+
+	for (i = 0; i < count; i++) {
+		if (got_props[i] != props[i] || got_values[i] != values[i]) {
+			printf("property %u: expected %u=%llu, got %u=%llu\n", i,
+			       props[i], (unsigned long long)values[i],
+			       got_props[i], (unsigned long long)got_values[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int test_sorted(void)
+{
+	static const uint32_t objs[] = { 10, 20 };
+	static const uint32_t count_props[] = { 2, 3 };
+	static const uint32_t props[] = { 1, 3, 1, 2, 5 };
+	static const uint64_t values[] = { 100, 300, 101, 202, 500 };
+	static const uint32_t rb_objs[] = { 10, 20 };
+	static const uint32_t rb_count_props[] = { 2, 2 };
+	static const uint32_t rb_props[] = { 1, 3, 2, 5 };
+	static const uint64_t rb_values[] = { 100, 300, 200, 500 };
+	static const uint64_t cm_values[] = { 100, 300, 200, 505 };
+	drmModeAtomicReqPtr req, dup;
+	int cursor, committed, i, ret = 0;
+
+	req = drmModeAtomicAllocSorted();
+	if (!req)
+		return -1;
+
+	drmModeAtomicAddProperty(req, 20, 5, 500);
+	drmModeAtomicAddProperty(req, 10, 3, 300);
+	drmModeAtomicAddProperty(req, 20, 2, 200);
+	drmModeAtomicAddProperty(req, 10, 1, 100);
+
+	/* overwrite one property, add another, then roll both back */
+	cursor = drmModeAtomicGetCursor(req);
+	drmModeAtomicAddProperty(req, 20, 2, 202);
+	drmModeAtomicAddProperty(req, 20, 1, 101);
+
+	dup = drmModeAtomicDuplicate(req);
+
+	ret |= drmModeAtomicCommit(-1, req, DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+	ret |= check_commit(objs, count_props, 2, props, values);
+
+	drmModeAtomicSetCursor(req, cursor);
+	ret |= drmModeAtomicCommit(-1, req, 0, NULL);
+	ret |= check_commit(rb_objs, rb_count_props, 2, rb_props, rb_values);
+
+	/* a real commit is as far back as a cursor saved before it goes */
+	for (i = 0; i < 1000; i++)
+		drmModeAtomicAddProperty(req, 20, 5, 505);
+	ret |= drmModeAtomicCommit(-1, req, 0, NULL);
+	committed = drmModeAtomicGetCursor(req);
+	drmModeAtomicSetCursor(req, cursor);
+	ret |= drmModeAtomicCommit(-1, req, 0, NULL);
+	ret |= check_commit(rb_objs, rb_count_props, 2, rb_props, cm_values);
+	if (drmModeAtomicGetCursor(req) != committed) {
+		printf("commit: expected a cursor of %d, got %d\n", committed,
+		       drmModeAtomicGetCursor(req));
+		ret = -1;
+	}
+
+	/* while later changes can still be rolled back */
+	drmModeAtomicAddProperty(req, 20, 2, 222);
+	drmModeAtomicAddProperty(req, 30, 1, 1);
+	drmModeAtomicSetCursor(req, committed);
+	ret |= drmModeAtomicCommit(-1, req, 0, NULL);
+	ret |= check_commit(rb_objs, rb_count_props, 2, rb_props, cm_values);
+
+	ret |= drmModeAtomicCommit(-1, dup, 0, NULL);
+	ret |= check_commit(objs, count_props, 2, props, values);
+
+	/* merging into a plain request flattens the deduplicated items */
+	drmModeAtomicSetCursor(req, 0);
+	drmModeAtomicFree(req);
+	req = drmModeAtomicAlloc();
+	ret |= drmModeAtomicMerge(req, dup);
+	if (drmModeAtomicGetCursor(req) != 5) {
+		printf("merge: expected 5 items, got %d\n",
+		       drmModeAtomicGetCursor(req));
+		ret = -1;
+	}
+
+	drmModeAtomicFree(dup);
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
+int main(void)
+{
+	fake_ioctl_set_handler(fake_atomic_ioctl);
+
+	if (test_sorted()) {
+		printf("sorted atomic request test failed\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Compares the cost of building and committing atomic requests of 10 to
+ * 1000 properties in the plain and sorted modes.  DRM_IOCTL_MODE_ATOMIC is
+ * intercepted, so no device is needed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#include "fake_ioctl.h"
+
+static int fake_atomic_ioctl(int fd, unsigned long request, void *arg)
+{
+	if (request != DRM_IOCTL_MODE_ATOMIC) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Build and commit a request with count properties, 16 per object */
+static double bench(drmModeAtomicReqPtr req, unsigned int count,
+		    unsigned int iterations)
+{
+	unsigned int i, j;
+	double start;
+
+	start = now();
+
+	for (i = 0; i < iterations; i++) {
+		drmModeAtomicSetCursor(req, 0);
+
+		for (j = 0; j < count; j++)
+			drmModeAtomicAddProperty(req, 100 + j / 16,
+						 1 + (j * 7) % 16, i + j);
+
+		drmModeAtomicCommit(-1, req, 0, NULL);
+	}
+
+	return (now() - start) / iterations;
+}
+
+int main(void)
+{
+	static const unsigned int counts[] = { 10, 30, 100, 300, 1000 };
+	drmModeAtomicReqPtr plain, sorted;
+	unsigned int i, iterations;
+
+	fake_ioctl_set_handler(fake_atomic_ioctl);
+
+	plain = drmModeAtomicAlloc();
+	sorted = drmModeAtomicAllocSorted();
+	if (!plain || !sorted)
+		return 1;
+
+	printf("%10s %16s %16s\n", "properties", "plain ns/commit",
+	       "sorted ns/commit");
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		iterations = 100000 / counts[i];
+
+		printf("%10u %16.0f %16.0f\n", counts[i],
+		       bench(plain, counts[i], iterations),
+		       bench(sorted, counts[i], iterations));
+	}
+
+	drmModeAtomicFree(sorted);
+	drmModeAtomicFree(plain);
+
+	return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the property blob cache: that identical contents share a blob
+ * for as long as it is referenced and after, that unreferenced blobs are
+ * destroyed oldest first once too many pile up or on a trim, and that
+ * failures are not cached.  The blob ioctls are intercepted, so no device
+ * is needed.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#include "fake_ioctl.h"
+
+/* unreferenced blobs the cache keeps */
+#define MAX_IDLE 16
+
+#define MAX_BLOBS 128
+
+static struct {
+	uint32_t next_id;
+	unsigned int live;
+	int fail;
+	int bad_destroy;
+	uint32_t destroyed;	/* the last blob destroyed */
+	unsigned char alive[MAX_BLOBS];
+} blobs;
+
+static int fake_blob_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct drm_mode_create_blob *create = arg;
+	struct drm_mode_destroy_blob *destroy = arg;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_CREATEPROPBLOB:
+		if (blobs.fail || blobs.next_id + 1 >= MAX_BLOBS)
+			break;
+		create->blob_id = ++blobs.next_id;
+		blobs.alive[create->blob_id] = 1;
+		blobs.live++;
+		return 0;
+	case DRM_IOCTL_MODE_DESTROYPROPBLOB:
+		if (destroy->blob_id >= MAX_BLOBS ||
+		    !blobs.alive[destroy->blob_id]) {
+			blobs.bad_destroy = 1;
+			break;
+		}
+		blobs.alive[destroy->blob_id] = 0;
+		blobs.destroyed = destroy->blob_id;
+		blobs.live--;
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static int test_sharing(void)
+{
+	static const uint16_t gamma[] = { 0, 0x4000, 0x8000, 0xffff };
+	static const uint16_t other[] = { 0, 0x4000, 0x8000, 0xfffe };
+	drmModeBlobCacheStats stats;
+	drmModeBlobCachePtr cache;
+	uint32_t id, same, diff;
+	int ret = 0;
+
+	cache = drmModeBlobCacheCreate(3);
+	if (!cache)
+		return -1;
+
+	if (drmModeBlobCacheAcquire(cache, gamma, sizeof(gamma), &id) ||
+	    drmModeBlobCacheAcquire(cache, gamma, sizeof(gamma), &same) ||
+	    same != id || blobs.live != 1) {
+		printf("sharing: identical contents not shared\n");
+		ret = -1;
+	}
+
+	/* a prefix or different contents are another blob */
+	if (drmModeBlobCacheAcquire(cache, gamma, sizeof(gamma) - 2, &diff) ||
+	    diff == id) {
+		printf("sharing: prefix shared\n");
+		ret = -1;
+	}
+	drmModeBlobCacheRelease(cache, diff);
+
+	if (drmModeBlobCacheAcquire(cache, other, sizeof(other), &diff) ||
+	    diff == id) {
+		printf("sharing: different contents shared\n");
+		ret = -1;
+	}
+	drmModeBlobCacheRelease(cache, diff);
+
+	/* both references dropped, the blob is kept for later */
+	drmModeBlobCacheRelease(cache, id);
+	drmModeBlobCacheRelease(cache, id);
+	drmModeBlobCacheRelease(cache, id);
+	if (!blobs.alive[id] ||
+	    drmModeBlobCacheAcquire(cache, gamma, sizeof(gamma), &same) ||
+	    same != id) {
+		printf("sharing: released blob not reused\n");
+		ret = -1;
+	}
+
+	drmModeBlobCacheGetStats(cache, &stats);
+	if (stats.hits != 2 || stats.misses != 3 || stats.destroyed) {
+		printf("sharing: %llu hits, %llu misses, %llu destroyed\n",
+		       (unsigned long long)stats.hits,
+		       (unsigned long long)stats.misses,
+		       (unsigned long long)stats.destroyed);
+		ret = -1;
+	}
+
+	/* the cache owns its blobs, referenced or not */
+	drmModeBlobCacheDestroy(cache);
+	if (blobs.live) {
+		printf("sharing: %u blobs left\n", blobs.live);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int test_idle(void)
+{
+	drmModeBlobCacheStats stats;
+	drmModeBlobCachePtr cache;
+	uint32_t ids[MAX_IDLE + 2], held, id;
+	uint32_t data;
+	unsigned int i;
+	int ret = 0;
+
+	cache = drmModeBlobCacheCreate(3);
+	if (!cache)
+		return -1;
+
+	data = ~0u;
+	ret |= drmModeBlobCacheAcquire(cache, &data, sizeof(data), &held);
+
+	for (i = 0; i < MAX_IDLE + 2; i++) {
+		data = i;
+		ret |= drmModeBlobCacheAcquire(cache, &data, sizeof(data),
+					       &ids[i]);
+	}
+
+	for (i = 0; i < MAX_IDLE + 1; i++)
+		drmModeBlobCacheRelease(cache, ids[i]);
+
+	/* one too many idle, the first released goes */
+	if (ret || blobs.alive[ids[0]] || !blobs.alive[ids[1]] ||
+	    blobs.live != MAX_IDLE + 2) {
+		printf("idle: blob %u destroyed instead of %u\n",
+		       blobs.destroyed, ids[0]);
+		ret = -1;
+	}
+
+	/* reusing an idle blob takes it off the idle list */
+	data = 1;
+	if (drmModeBlobCacheAcquire(cache, &data, sizeof(data), &id) ||
+	    id != ids[1]) {
+		printf("idle: idle blob not reused\n");
+		ret = -1;
+	}
+
+	drmModeBlobCacheRelease(cache, ids[MAX_IDLE + 1]);
+	if (!blobs.alive[ids[2]]) {
+		printf("idle: blob destroyed below the limit\n");
+		ret = -1;
+	}
+
+	/* only the referenced blobs survive a trim */
+	drmModeBlobCacheTrim(cache);
+	if (blobs.live != 2 || !blobs.alive[held] || !blobs.alive[id]) {
+		printf("idle: %u blobs left after a trim\n", blobs.live);
+		ret = -1;
+	}
+
+	drmModeBlobCacheGetStats(cache, &stats);
+	if (stats.destroyed != MAX_IDLE + 1) {
+		printf("idle: %llu blobs destroyed\n",
+		       (unsigned long long)stats.destroyed);
+		ret = -1;
+	}
+
+	/* blob IDs the cache does not know are ignored */
+	drmModeBlobCacheRelease(cache, 0);
+	drmModeBlobCacheRelease(cache, ids[0]);
+
+	drmModeBlobCacheRelease(cache, held);
+	drmModeBlobCacheRelease(cache, id);
+	drmModeBlobCacheDestroy(cache);
+
+	return ret;
+}
+
+static int test_errors(void)
+{
+	drmModeBlobCacheStats stats;
+	drmModeBlobCachePtr cache;
+	uint32_t data = 1, id;
+	int ret = 0;
+
+	cache = drmModeBlobCacheCreate(3);
+	if (!cache)
+		return -1;
+
+	if (drmModeBlobCacheAcquire(NULL, &data, sizeof(data), &id) !=
+	    -EINVAL ||
+	    drmModeBlobCacheAcquire(cache, &data, sizeof(data), NULL) !=
+	    -EINVAL) {
+		printf("errors: invalid arguments accepted\n");
+		ret = -1;
+	}
+
+	blobs.fail = 1;
+	if (!drmModeBlobCacheAcquire(cache, &data, sizeof(data), &id)) {
+		printf("errors: CREATEPROPBLOB failure not reported\n");
+		ret = -1;
+	}
+	blobs.fail = 0;
+
+	/* the failure is not remembered */
+	if (drmModeBlobCacheAcquire(cache, &data, sizeof(data), &id) ||
+	    !blobs.alive[id]) {
+		printf("errors: failure cached\n");
+		ret = -1;
+	}
+
+	drmModeBlobCacheGetStats(cache, &stats);
+	if (stats.hits || stats.misses != 2) {
+		printf("errors: %llu hits, %llu misses\n",
+		       (unsigned long long)stats.hits,
+		       (unsigned long long)stats.misses);
+		ret = -1;
+	}
+
+	drmModeBlobCacheRelease(cache, id);
+	drmModeBlobCacheDestroy(cache);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_blob_ioctl);
+
+	ret |= test_sharing();
+	ret |= test_idle();
+	ret |= test_errors();
+
+	if (blobs.live || blobs.bad_destroy) {
+		printf("%u blobs left, bad destroy %d\n", blobs.live,
+		       blobs.bad_destroy);
+		ret = -1;
+	}
+
+	return ret ? 1 : 0;
+}
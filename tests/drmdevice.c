@@ -22,6 +22,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -104,9 +105,18 @@ print_device_info(drmDevicePtr device, int i, bool print_revision)
     printf("\n");
 }
 
+static void
+print_cache_stats(const drmDeviceCacheStats *stats)
+{
+    printf("--- Device cache: %" PRIu64 " hits, %" PRIu64 " misses, "
+           "%" PRIu64 " invalidations ---\n",
+           stats->hits, stats->misses, stats->invalidations);
+}
+
 int
 main(void)
 {
+    drmDeviceCacheStats before, stats;
     drmDevicePtr *devices;
     drmDevicePtr device;
     int fd, ret, max_devices;
@@ -158,7 +168,53 @@ main(void)
         }
     }
 
+    drmFreeDevices(devices, ret);
+
+    printf("--- Retrieving devices information again ---\n");
+    drmGetDeviceCacheStats(&before);
+    ret = drmGetDevices2(0, devices, max_devices);
+    if (ret != max_devices) {
+        printf("drmGetDevices2() returned %d, expected %d\n", ret, max_devices);
+        free(devices);
+        return -1;
+    }
+    drmFreeDevices(devices, ret);
+
+    drmGetDeviceCacheStats(&stats);
+    print_cache_stats(&stats);
+
+    /* no counters move if the cache is unavailable, e.g. without inotify */
+    if (stats.hits + stats.misses == 0) {
+        free(devices);
+        return 0;
+    }
+
+    if (stats.hits != before.hits + 1 || stats.misses != before.misses) {
+        printf("Second drmGetDevices2() was not served from the cache\n");
+        free(devices);
+        return -1;
+    }
+
+    printf("--- Retrieving devices information after invalidation ---\n");
+    drmInvalidateDeviceCache();
+    before = stats;
+    ret = drmGetDevices2(0, devices, max_devices);
+    if (ret != max_devices) {
+        printf("drmGetDevices2() returned %d, expected %d\n", ret, max_devices);
+        free(devices);
+        return -1;
+    }
     drmFreeDevices(devices, ret);
     free(devices);
+
+    drmGetDeviceCacheStats(&stats);
+    print_cache_stats(&stats);
+
+    if (stats.misses != before.misses + 1 ||
+        stats.invalidations <= before.invalidations) {
+        printf("drmInvalidateDeviceCache() did not force a rescan\n");
+        return -1;
+    }
+
     return 0;
 }
@@ -0,0 +1,154 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Replays an ioctl trace written with LIBDRM_IOCTL_TRACE=<file>.
+ *
+ * Each record is rebuilt, with the pointers in the argument fixed up to
+ * point at copies of the captured chunks, and issued through drmIoctl().
+ * By default a stand-in backend answers every ioctl with the recorded
+ * result, so that the trace can be replayed without a GPU; with -D the
+ * ioctls are issued on a real device instead.  The ioctl statistics of the
+ * replay are printed at the end.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+
+#include "fake_ioctl.h"
+#include "replay.h"
+
+static struct replay replay;
+static int device_fd = -1;
+
+static int replay_ioctl(int fd, unsigned long request, void *arg)
+{
+	if (device_fd >= 0)
+		return fake_ioctl_real(device_fd, request, arg);
+
+	if (replay.current_out)
+		memcpy(arg, replay.current_out, replay.current->arg_size);
+
+	if (replay.current->ret == -1)
+		errno = replay.current->error;
+
+	return replay.current->ret;
+}
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "usage: %s [-D device] [-n count] [-pv] trace\n", name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -D DEVICE  issue the ioctls on the given device\n");
+	fprintf(stderr, "  -n COUNT   replay the trace COUNT times\n");
+	fprintf(stderr, "  -p         keep the recorded pacing\n");
+	fprintf(stderr, "  -v         print every ioctl\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i, count = 1;
+	const char *device = NULL;
+	uint64_t start, elapsed;
+	int c, err, pace = 0, verbose = 0;
+
+	while ((c = getopt(argc, argv, "D:n:pv")) != -1) {
+		switch (c) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pace = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (optind + 1 != argc)
+		usage(argv[0]);
+
+	err = replay_open(&replay, argv[optind]);
+	if (err == -EINVAL) {
+		fprintf(stderr, "%s: not an ioctl trace\n", argv[optind]);
+		return 1;
+	} else if (err) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-err));
+		return 1;
+	}
+
+	replay.pace = pace;
+	replay.verbose = verbose;
+
+	if (device) {
+		device_fd = open(device, O_RDWR | O_CLOEXEC);
+		if (device_fd < 0) {
+			perror(device);
+			return 1;
+		}
+	}
+
+	fake_ioctl_set_handler(replay_ioctl);
+	drmIoctlStatsEnable(1);
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		if (replay_trace(&replay))
+			return 1;
+	}
+	elapsed = now() - start;
+
+	printf("%lu ioctls in %.3f ms, %.0f ns per ioctl, %lu results differ\n",
+	       replay.records, elapsed / 1e6,
+	       replay.records ? (double)elapsed / replay.records : 0.0,
+	       replay.mismatches);
+	fflush(stdout);
+	drmDumpIoctlStats(STDOUT_FILENO);
+
+	replay_close(&replay);
+	if (device_fd >= 0)
+		close(device_fd);
+
+	return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "replay.h"
+
+#define ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int replay_open(struct replay *replay, const char *path)
+{
+	const drmTraceHeader *header;
+	struct stat st;
+	void *base;
+	int fd;
+
+	memset(replay, 0, sizeof(*replay));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -errno;
+	}
+
+	if ((size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -errno;
+
+	replay->base = base;
+	replay->size = st.st_size;
+
+	header = (const drmTraceHeader *)replay->base;
+	if (header->magic != DRM_TRACE_MAGIC ||
+	    header->version != DRM_TRACE_VERSION) {
+		replay_close(replay);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+void replay_close(struct replay *replay)
+{
+	free(replay->chunks);
+	free(replay->scratch);
+	if (replay->base)
+		munmap((void *)replay->base, replay->size);
+	memset(replay, 0, sizeof(*replay));
+}
+
+/*
+ * Rebuild the argument of a record in the scratch buffer.  The record is
+ * known to fit into the trace, everything inside it is checked here.
+ */
+void *replay_build_arg(struct replay *replay, const drmTraceRecord *record)
+{
+	const char *in = NULL, *ptr = (const char *)(record + 1);
+	const char *end = (const char *)record + record->size;
+	size_t size = ALIGN(record->arg_size);
+	const drmTraceChunk *chunk;
+	unsigned int i;
+	char *data;
+
+	if (record->flags & DRM_TRACE_ARG_IN) {
+		if (size > (size_t)(end - ptr))
+			return NULL;
+		in = ptr;
+		ptr += size;
+	}
+
+	replay->current_out = NULL;
+	if (record->flags & DRM_TRACE_ARG_OUT) {
+		if (size > (size_t)(end - ptr))
+			return NULL;
+		replay->current_out = ptr;
+		ptr += size;
+	}
+
+	/* the chunks are copied as they follow the arguments */
+	size += end - ptr;
+
+	if (size > replay->scratch_size) {
+		free(replay->scratch);
+		replay->scratch = malloc(size);
+		replay->scratch_size = replay->scratch ? size : 0;
+		if (!replay->scratch)
+			return NULL;
+	}
+
+	if (record->num_chunks > replay->max_chunks) {
+		free(replay->chunks);
+		replay->chunks = calloc(record->num_chunks,
+					sizeof(*replay->chunks));
+		replay->max_chunks = replay->chunks ? record->num_chunks : 0;
+		if (!replay->chunks)
+			return NULL;
+	}
+
+	if (in)
+		memcpy(replay->scratch, in, record->arg_size);
+	else
+		memset(replay->scratch, 0, record->arg_size);
+
+	data = replay->scratch + ALIGN(record->arg_size);
+
+	for (i = 0; i < record->num_chunks; i++) {
+		uint32_t parent_size;
+		uint64_t value;
+		char *parent;
+
+		if (sizeof(*chunk) > (size_t)(end - ptr))
+			return NULL;
+
+		chunk = (const drmTraceChunk *)ptr;
+		ptr += sizeof(*chunk);
+
+		if (ALIGN((size_t)chunk->size) > (size_t)(end - ptr))
+			return NULL;
+
+		if (chunk->parent < 0) {
+			parent = replay->scratch;
+			parent_size = record->arg_size;
+		} else if ((unsigned int)chunk->parent < i) {
+			parent = replay->chunks[chunk->parent].data;
+			parent_size = replay->chunks[chunk->parent].size;
+		} else {
+			return NULL;
+		}
+
+		/* the pointer to the chunk must lie within its parent */
+		if (parent_size < sizeof(value) ||
+		    chunk->offset > parent_size - sizeof(value))
+			return NULL;
+
+		memcpy(data, ptr, chunk->size);
+		replay->chunks[i].data = data;
+		replay->chunks[i].size = chunk->size;
+		ptr += ALIGN(chunk->size);
+		data += ALIGN(chunk->size);
+
+		value = (uintptr_t)replay->chunks[i].data;
+		memcpy(parent + chunk->offset, &value, sizeof(value));
+	}
+
+	return replay->scratch;
+}
+
+int replay_trace(struct replay *replay)
+{
+	const drmTraceHeader *header = (const drmTraceHeader *)replay->base;
+	size_t offset = sizeof(*header);
+	uint64_t start = now();
+
+	while (offset + sizeof(drmTraceRecord) <= replay->size) {
+		const drmTraceRecord *record;
+		void *arg;
+		int ret;
+
+		record = (const drmTraceRecord *)(replay->base + offset);
+		if (record->size < sizeof(*record) ||
+		    record->size > replay->size - offset) {
+			fprintf(stderr, "truncated record at %zu\n", offset);
+			return -1;
+		}
+		offset += record->size;
+
+		arg = replay_build_arg(replay, record);
+		if (!arg) {
+			fprintf(stderr, "bad record at %zu\n", offset);
+			return -1;
+		}
+
+		if (replay->pace) {
+			uint64_t target = start + record->time_ns;
+			uint64_t t = now();
+
+			if (t < target) {
+				struct timespec ts = {
+					.tv_sec = (target - t) / 1000000000,
+					.tv_nsec = (target - t) % 1000000000,
+				};
+
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		replay->current = record;
+		ret = drmIoctl(record->fd, record->request, arg);
+		if (ret != record->ret)
+			replay->mismatches++;
+		replay->records++;
+
+		if (replay->verbose)
+			printf("%10" PRIu64 " ns: thread %u ioctl 0x%08" PRIx64
+			       " on %d: %d (recorded %d), %u chunks\n",
+			       record->time_ns, record->thread, record->request,
+			       record->fd, ret, record->ret,
+			       record->num_chunks);
+	}
+
+	return 0;
+}
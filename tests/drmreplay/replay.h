@@ -0,0 +1,65 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>
+
+#include "xf86drm.h"
+
+/*
+ * Walks an ioctl trace and issues each record through drmIoctl(), with
+ * the argument rebuilt and its pointers fixed up to point at copies of
+ * the captured chunks.  While a record is issued, current is the record
+ * and current_out the argument as it was returned, if it was captured.
+ */
+struct replay {
+	const char *base;
+	size_t size;
+
+	char *scratch;
+	size_t scratch_size;
+	struct {
+		char *data;
+		uint32_t size;
+	} *chunks;
+	unsigned int max_chunks;
+
+	int pace;
+	int verbose;
+
+	const drmTraceRecord *current;
+	const void *current_out;
+
+	unsigned long records;
+	unsigned long mismatches;
+};
+
+/* map a trace and check its header */
+int replay_open(struct replay *replay, const char *path);
+void replay_close(struct replay *replay);
+
+/* rebuild the argument of a record, NULL if the record is malformed */
+void *replay_build_arg(struct replay *replay, const drmTraceRecord *record);
+
+int replay_trace(struct replay *replay);
+
+#endif /* REPLAY_H */
@@ -0,0 +1,285 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Writes an ioctl trace against a fake device and replays it, checking
+ * that every argument comes back with the arrays it pointed to, nested
+ * ones included, and that the recorded results are returned.  Also
+ * checks that a record whose chunk points outside of its argument is
+ * refused.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+
+#include "fake_ioctl.h"
+#include "replay.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* a driver ioctl with an array of items, each pointing to its words */
+struct test_item {
+	uint64_t words_ptr;
+	uint32_t num_words;
+	uint32_t pad;
+};
+
+struct test_submit {
+	uint64_t items_ptr;
+	uint32_t num_items;
+	uint32_t sum;		/* out */
+};
+
+#define DRM_IOCTL_TEST_SUBMIT \
+	DRM_IOWR(DRM_COMMAND_BASE + 0x20, struct test_submit)
+
+static uint32_t objs[] = { 31, 32 };
+static uint32_t count_props[] = { 2, 1 };
+static uint32_t props[] = { 7, 8, 9 };
+static uint64_t prop_values[] = { 1, 0x100000000ull, 3 };
+
+static uint32_t words0[] = { 1, 2, 3 };
+static uint32_t words1[] = { 4, 5 };
+
+static struct test_item items[] = {
+	{ (uintptr_t)words0, ARRAY_SIZE(words0), 0 },
+	{ (uintptr_t)words1, ARRAY_SIZE(words1), 0 },
+};
+
+static struct replay replay;
+static unsigned int failures;
+
+static void test_trace_submit(drmTraceChunksPtr chunks, const void *arg)
+{
+	const struct test_submit *submit = arg;
+	const struct test_item *item;
+	unsigned int i;
+	int parent;
+
+	parent = drmIoctlTraceAddChunk(chunks, -1,
+				       offsetof(struct test_submit, items_ptr),
+				       submit->num_items * sizeof(*item));
+	if (parent < 0)
+		return;
+
+	item = drmIoctlTraceChunkData(chunks, parent);
+	for (i = 0; i < submit->num_items; i++)
+		drmIoctlTraceAddChunk(chunks, parent, i * sizeof(*item) +
+				      offsetof(struct test_item, words_ptr),
+				      item[i].num_words * sizeof(uint32_t));
+}
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s failed\n", __func__,		\
+			__LINE__, #cond);				\
+		failures++;						\
+	}								\
+} while (0)
+
+/* Acts as the device: sums up the words of a submission */
+static int record_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct test_submit *submit = arg;
+	const struct test_item *item;
+	unsigned int i, j;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_ATOMIC:
+		return 0;
+
+	case DRM_IOCTL_TEST_SUBMIT:
+		item = (const struct test_item *)(uintptr_t)submit->items_ptr;
+		submit->sum = 0;
+		for (i = 0; i < submit->num_items; i++)
+			for (j = 0; j < item[i].num_words; j++)
+				submit->sum += ((const uint32_t *)(uintptr_t)
+						item[i].words_ptr)[j];
+		return 0;
+
+	default:
+		errno = ENOENT;
+		return -1;
+	}
+}
+
+#define ARRAY_EQUAL(ptr, array) \
+	(!memcmp((const void *)(uintptr_t)(ptr), array, sizeof(array)))
+
+/* Checks the rebuilt arguments against the ones that were traced */
+static int replay_ioctl(int fd, unsigned long request, void *arg)
+{
+	const struct drm_mode_atomic *atomic = arg;
+	const struct test_submit *submit = arg;
+	const struct test_item *item;
+
+	CHECK(fd == 42);
+
+	switch (request) {
+	case DRM_IOCTL_MODE_ATOMIC:
+		CHECK(atomic->count_objs == ARRAY_SIZE(objs));
+		CHECK(ARRAY_EQUAL(atomic->objs_ptr, objs));
+		CHECK(ARRAY_EQUAL(atomic->count_props_ptr, count_props));
+		CHECK(ARRAY_EQUAL(atomic->props_ptr, props));
+		CHECK(ARRAY_EQUAL(atomic->prop_values_ptr, prop_values));
+		break;
+
+	case DRM_IOCTL_TEST_SUBMIT:
+		item = (const struct test_item *)(uintptr_t)submit->items_ptr;
+		CHECK(submit->num_items == ARRAY_SIZE(items));
+		CHECK(item[0].num_words == ARRAY_SIZE(words0));
+		CHECK(item[1].num_words == ARRAY_SIZE(words1));
+		CHECK(ARRAY_EQUAL(item[0].words_ptr, words0));
+		CHECK(ARRAY_EQUAL(item[1].words_ptr, words1));
+		break;
+
+	default:
+		CHECK(request == DRM_IOCTL_GEM_CLOSE);
+		break;
+	}
+
+	if (replay.current_out)
+		memcpy(arg, replay.current_out, replay.current->arg_size);
+
+	if (replay.current->ret == -1)
+		errno = replay.current->error;
+
+	return replay.current->ret;
+}
+
+static void write_trace(const char *path)
+{
+	struct drm_mode_atomic atomic;
+	struct test_submit submit;
+	struct drm_gem_close gem_close;
+
+	CHECK(!drmIoctlTraceRegister(DRM_IOCTL_TEST_SUBMIT,
+				     test_trace_submit));
+	CHECK(!drmIoctlTraceOpen(path));
+
+	fake_ioctl_set_handler(record_ioctl);
+
+	memset(&atomic, 0, sizeof(atomic));
+	atomic.count_objs = ARRAY_SIZE(objs);
+	atomic.objs_ptr = (uintptr_t)objs;
+	atomic.count_props_ptr = (uintptr_t)count_props;
+	atomic.props_ptr = (uintptr_t)props;
+	atomic.prop_values_ptr = (uintptr_t)prop_values;
+	CHECK(drmIoctl(42, DRM_IOCTL_MODE_ATOMIC, &atomic) == 0);
+
+	memset(&submit, 0, sizeof(submit));
+	submit.items_ptr = (uintptr_t)items;
+	submit.num_items = ARRAY_SIZE(items);
+	CHECK(drmIoctl(42, DRM_IOCTL_TEST_SUBMIT, &submit) == 0);
+	CHECK(submit.sum == 15);
+
+	memset(&gem_close, 0, sizeof(gem_close));
+	gem_close.handle = 1;
+	CHECK(drmIoctl(42, DRM_IOCTL_GEM_CLOSE, &gem_close) == -1);
+
+	fake_ioctl_set_handler(NULL);
+	drmIoctlTraceClose();
+}
+
+/* The submission comes back with the sum the device returned */
+static int check_submit(int fd, unsigned long request, void *arg)
+{
+	struct test_submit *submit = arg;
+	int ret = replay_ioctl(fd, request, arg);
+
+	if (request == DRM_IOCTL_TEST_SUBMIT)
+		CHECK(submit->sum == 15);
+
+	return ret;
+}
+
+static void check_replay(const char *path)
+{
+	CHECK(!replay_open(&replay, path));
+	if (!replay.base)
+		return;
+
+	fake_ioctl_set_handler(check_submit);
+	CHECK(!replay_trace(&replay));
+	fake_ioctl_set_handler(NULL);
+
+	CHECK(replay.records == 3);
+	CHECK(replay.mismatches == 0);
+
+	replay_close(&replay);
+}
+
+/* Moves the pointer of the first chunk past the end of the argument */
+static void check_bad_chunk(const char *path)
+{
+	const drmTraceRecord *record;
+	drmTraceChunk *chunk;
+	char *copy;
+
+	CHECK(!replay_open(&replay, path));
+	if (!replay.base)
+		return;
+
+	copy = malloc(replay.size);
+	memcpy(copy, replay.base, replay.size);
+
+	record = (const drmTraceRecord *)(copy + sizeof(drmTraceHeader));
+	CHECK(record->request == DRM_IOCTL_MODE_ATOMIC);
+	CHECK(record->num_chunks == 4);
+	CHECK(replay_build_arg(&replay, record) != NULL);
+
+	chunk = (drmTraceChunk *)((char *)(record + 1) +
+				  2 * ((record->arg_size + 7) & ~7u));
+	chunk->offset = record->arg_size - 4;
+	CHECK(replay_build_arg(&replay, record) == NULL);
+
+	chunk->offset = 0;
+	chunk->size = record->size;
+	CHECK(replay_build_arg(&replay, record) == NULL);
+
+	free(copy);
+	replay_close(&replay);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/drmreplay-XXXXXX";
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	write_trace(path);
+	check_replay(path);
+	check_bad_chunk(path);
+
+	unlink(path);
+
+	return failures ? 1 : 0;
+}
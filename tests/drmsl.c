@@ -27,14 +27,8 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward skip list implementation.n
- *
- * FUTURE ENHANCEMENTS
- *
- * REFERENCES
- *
- * [Pugh90] William Pugh.  Skip Lists: A Probabilistic Alternative to
- * Balanced Trees. CACM 33(6), June 1990, pp. 668-676.
+ * Checks the ordered map behind drmSL* and measures insert, lookup,
+ * neighbor lookup, iteration and delete times for 100 to 1M keys.
  *
  */
 
@@ -56,25 +50,36 @@ static void print(void* list)
     }
 }
 
+static double elapsed(struct timeval *start, int count)
+{
+    struct timeval stop;
+
+    gettimeofday(&stop, NULL);
+    return (double)(stop.tv_sec * 1000000 + stop.tv_usec
+		    - start->tv_sec * 1000000 - start->tv_usec) / count;
+}
+
 static double do_time(int size, int iter)
 {
     void           *list;
-    int            i, j;
-    unsigned long  keys[1000000];
+    int            i, j, count;
+    static unsigned long keys[1000000];
     unsigned long  previous;
-    unsigned long  key;
-    void           *value;
-    struct timeval start, stop;
-    double         usec;
+    unsigned long  key, prev_key, next_key;
+    void           *value, *prev_value, *next_value;
+    struct timeval start;
+    double         insert, usec, neighbors, next, delete;
     void           *ranstate;
 
     list = drmSLCreate();
     ranstate = drmRandomCreate(12345);
 
+    gettimeofday(&start, NULL);
     for (i = 0; i < size; i++) {
 	keys[i] = drmRandom(ranstate);
 	drmSLInsert(list, keys[i], NULL);
     }
+    insert = elapsed(&start, size);
 
     previous = 0;
     if (drmSLFirst(list, &key, &value)) {
@@ -93,19 +98,84 @@ static double do_time(int size, int iter)
 		printf("Error %lu %d\n", keys[i], i);
 	}
     }
-    gettimeofday(&stop, NULL);
+    usec = elapsed(&start, size * iter);
 
-    usec = (double)(stop.tv_sec * 1000000 + stop.tv_usec
-		    - start.tv_sec * 1000000 - start.tv_usec) / (size * iter);
+    gettimeofday(&start, NULL);
+    for (j = 0; j < iter; j++) {
+	for (i = 0; i < size; i++)
+	    drmSLLookupNeighbors(list, keys[i] + 1, &prev_key, &prev_value,
+				 &next_key, &next_value);
+    }
+    neighbors = elapsed(&start, size * iter);
 
-    printf("%0.2f microseconds for list length %d\n", usec, size);
+    count = 0;
+    gettimeofday(&start, NULL);
+    for (j = 0; j < iter; j++) {
+	if (drmSLFirst(list, &key, &value)) {
+	    do {
+		++count;
+	    } while (drmSLNext(list, &key, &value));
+	}
+    }
+    next = elapsed(&start, count ? count : 1);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < size; i++)
+	drmSLDelete(list, keys[i]);
+    delete = elapsed(&start, size);
+
+    if (drmSLFirst(list, &key, &value))
+	printf("Error: %lu left after deleting all keys\n", key);
+
+    printf("%0.2f microseconds for list length %d"
+	   " (insert %0.3f, neighbors %0.3f, next %0.3f, delete %0.3f)\n",
+	   usec, size, insert, neighbors, next, delete);
 
     drmRandomDouble(ranstate);
+    drmRandomDestroy(ranstate);
     drmSLDestroy(list);
 
     return usec;
 }
 
+/* Delete every other key while iterating and check what is left */
+static int check_delete(int size)
+{
+    void          *list;
+    unsigned long key;
+    void          *value;
+    int           i, count = 0, ret = 0;
+
+    list = drmSLCreate();
+    for (i = 0; i < size; i++)
+	drmSLInsert(list, i, (void *)(unsigned long)(i + 1));
+
+    if (drmSLFirst(list, &key, &value)) {
+	do {
+	    if (!(key & 1))
+		drmSLDelete(list, key);
+	} while (drmSLNext(list, &key, &value));
+    }
+
+    if (drmSLFirst(list, &key, &value)) {
+	do {
+	    if (!(key & 1) || value != (void *)(key + 1)) {
+		printf("Unexpected entry <%lu, %p>\n", key, value);
+		ret = 1;
+	    }
+	    ++count;
+	} while (drmSLNext(list, &key, &value));
+    }
+
+    if (count != size / 2) {
+	printf("%d entries left, expected %d\n", count, size / 2);
+	ret = 1;
+    }
+
+    drmSLDestroy(list);
+    return ret;
+}
+
 static void print_neighbors(void *list, unsigned long key,
                             unsigned long expected_prev,
                             unsigned long expected_next)
@@ -136,7 +206,7 @@ static void print_neighbors(void *list, unsigned long key,
 int main(void)
 {
     void*    list;
-    double   usec, usec2, usec3, usec4;
+    double   usec, usec2, usec3, usec4, usec5;
 
     list = drmSLCreate();
     printf( "list at %p\n", list);
@@ -180,5 +250,9 @@ int main(void)
     printf("Table size increased by %0.2f, search time increased by %0.2f\n",
 	   100000.0/100.0, usec4 / usec);
 
-    return 0;
+    usec5 = do_time(1000000, 1);
+    printf("Table size increased by %0.2f, search time increased by %0.2f\n",
+	   1000000.0/100.0, usec5 / usec);
+
+    return check_delete(100000);
 }
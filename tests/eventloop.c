@@ -0,0 +1,333 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the event loop: that one dispatch drains every event queued, in
+ * order and to the right handlers, reading more only when the buffer was
+ * filled; that the latency histogram is in microseconds; and that read
+ * errors are reported.  A SOCK_SEQPACKET socket stands in for the DRM fd,
+ * as it also returns whole writes from each read().
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "xf86drm.h"
+
+/* the smallest buffer the loop uses */
+#define BUFFER_SIZE 4096
+#define EVENTS_PER_BUFFER (BUFFER_SIZE / sizeof(struct drm_event_vblank))
+
+static struct {
+	unsigned int vblanks;
+	unsigned int flips;
+	unsigned int sequences;
+	unsigned int out_of_order;
+	uint64_t next;		/* expected user data */
+} seen;
+
+static void check_order(uint64_t data)
+{
+	if (data != seen.next)
+		seen.out_of_order++;
+	seen.next = data + 1;
+}
+
+static void vblank_handler(int fd, unsigned int sequence, unsigned int sec,
+			   unsigned int usec, void *data)
+{
+	seen.vblanks++;
+	check_order((uintptr_t)data);
+}
+
+static void flip_handler(int fd, unsigned int sequence, unsigned int sec,
+			 unsigned int usec, unsigned int crtc_id, void *data)
+{
+	seen.flips++;
+	if (crtc_id != 42)
+		seen.out_of_order++;
+	check_order((uintptr_t)data);
+}
+
+static void sequence_handler(int fd, uint64_t sequence, uint64_t ns,
+			     uint64_t data)
+{
+	seen.sequences++;
+	check_order(data);
+}
+
+static drmEventContext evctx = {
+	.version = DRM_EVENT_CONTEXT_VERSION,
+	.vblank_handler = vblank_handler,
+	.page_flip_handler2 = flip_handler,
+	.sequence_handler = sequence_handler,
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void set_vblank(struct drm_event_vblank *e, uint32_t type,
+		       uint64_t data, uint64_t ns)
+{
+	memset(e, 0, sizeof(*e));
+	e->base.type = type;
+	e->base.length = sizeof(*e);
+	e->user_data = data;
+	e->tv_sec = ns / 1000000000;
+	e->tv_usec = ns % 1000000000 / 1000;
+	e->crtc_id = 42;
+}
+
+static void set_sequence(struct drm_event_crtc_sequence *e, uint64_t data,
+			 uint64_t ns)
+{
+	memset(e, 0, sizeof(*e));
+	e->base.type = DRM_EVENT_CRTC_SEQUENCE;
+	e->base.length = sizeof(*e);
+	e->user_data = data;
+	e->time_ns = ns;
+}
+
+static int open_socket(int *writer)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds))
+		return -1;
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	*writer = fds[1];
+
+	return fds[0];
+}
+
+static int test_batch(void)
+{
+	struct drm_event_vblank vblanks[EVENTS_PER_BUFFER];
+	struct drm_event_crtc_sequence seqs[10];
+	drmEventLoopStats stats;
+	drmEventLoopPtr loop;
+	int fd, writer, count, ret = 0;
+	uint64_t data = 0;
+	unsigned int i;
+
+	fd = open_socket(&writer);
+	if (fd < 0)
+		return -1;
+
+	loop = drmEventLoopCreate(fd, &evctx, 1);
+	if (!loop || drmEventLoopGetFd(loop) != fd ||
+	    drmEventLoopCreate(fd, NULL, 0) || drmEventLoopCreate(-1, &evctx, 0))
+		return -1;
+
+	/* two full buffers, then a short one */
+	memset(&seen, 0, sizeof(seen));
+	for (i = 0; i < EVENTS_PER_BUFFER; i++)
+		set_vblank(&vblanks[i], DRM_EVENT_VBLANK, data++, 0);
+	if (write(writer, vblanks, sizeof(vblanks)) != sizeof(vblanks))
+		ret = -1;
+
+	for (i = 0; i < EVENTS_PER_BUFFER; i++)
+		set_vblank(&vblanks[i], DRM_EVENT_FLIP_COMPLETE, data++, 0);
+	if (write(writer, vblanks, sizeof(vblanks)) != sizeof(vblanks))
+		ret = -1;
+
+	for (i = 0; i < 10; i++)
+		set_sequence(&seqs[i], data++, 0);
+	if (write(writer, seqs, sizeof(seqs)) != sizeof(seqs))
+		ret = -1;
+
+	count = drmEventLoopDispatch(loop);
+	if (count != (int)data || seen.vblanks != EVENTS_PER_BUFFER ||
+	    seen.flips != EVENTS_PER_BUFFER || seen.sequences != 10 ||
+	    seen.out_of_order) {
+		printf("batch: %d events dispatched, %u out of order\n", count,
+		       seen.out_of_order);
+		ret = -1;
+	}
+
+	drmEventLoopGetStats(loop, &stats);
+	if (stats.dispatches != 1 || stats.reads != 3 ||
+	    stats.events != data) {
+		printf("batch: %llu reads for %llu events\n",
+		       (unsigned long long)stats.reads,
+		       (unsigned long long)stats.events);
+		ret = -1;
+	}
+
+	/* nothing queued, the loop must not block */
+	if (drmEventLoopDispatch(loop) != 0) {
+		printf("batch: empty queue not handled\n");
+		ret = -1;
+	}
+
+	/* a short buffer is all there was, no further read */
+	set_sequence(&seqs[0], data, 0);
+	seen.next = data;
+	if (write(writer, seqs, sizeof(seqs[0])) != sizeof(seqs[0]) ||
+	    drmEventLoopDispatch(loop) != 1) {
+		printf("batch: single event not dispatched\n");
+		ret = -1;
+	}
+
+	drmEventLoopGetStats(loop, &stats);
+	if (stats.dispatches != 3 || stats.reads != 4) {
+		printf("batch: %llu reads after a single event\n",
+		       (unsigned long long)stats.reads);
+		ret = -1;
+	}
+
+	drmEventLoopDestroy(loop);
+	close(writer);
+	close(fd);
+
+	return ret;
+}
+
+/* 5 ms old events land in bucket 13, for [4096, 8192) us */
+#define LATENCY_NS 5000000ull
+#define LATENCY_BUCKET 13
+
+static int test_latency(void)
+{
+	struct drm_event_vblank events[4];
+	drmEventLoopStats stats;
+	drmEventLoopPtr loop;
+	int fd, writer, ret = 0;
+	uint64_t now;
+	unsigned int i;
+
+	fd = open_socket(&writer);
+	if (fd < 0)
+		return -1;
+
+	loop = drmEventLoopCreate(fd, &evctx, 0);
+	if (!loop)
+		return -1;
+
+	now = now_ns();
+	memset(&seen, 0, sizeof(seen));
+	set_vblank(&events[0], DRM_EVENT_VBLANK, 0, now - LATENCY_NS);
+	set_vblank(&events[1], DRM_EVENT_FLIP_COMPLETE, 1, now - LATENCY_NS);
+	/* from the future, and without a timestamp */
+	set_vblank(&events[2], DRM_EVENT_VBLANK, 2, now + 1000000000);
+	set_vblank(&events[3], 0x1234, 3, now - LATENCY_NS);
+
+	if (write(writer, events, sizeof(events)) != sizeof(events) ||
+	    drmEventLoopDispatch(loop) != 4) {
+		printf("latency: events not dispatched\n");
+		ret = -1;
+	}
+
+	drmEventLoopGetStats(loop, &stats);
+	if (stats.latency[LATENCY_BUCKET] != 2 || stats.latency[0] != 1 ||
+	    stats.max_latency_ns < LATENCY_NS ||
+	    stats.max_latency_ns > 2 * LATENCY_NS) {
+		for (i = 0; i < DRM_EVENT_LATENCY_BUCKETS; i++)
+			if (stats.latency[i])
+				printf("latency: %llu in bucket %u\n",
+				       (unsigned long long)stats.latency[i], i);
+		ret = -1;
+	}
+
+	drmEventLoopDestroy(loop);
+	close(writer);
+	close(fd);
+
+	return ret;
+}
+
+static int test_errors(void)
+{
+	struct drm_event_vblank vblanks[EVENTS_PER_BUFFER];
+	drmEventLoopPtr loop;
+	int fd, writer, fds[2], ret = 0;
+	unsigned int i;
+
+	if (drmEventLoopDispatch(NULL) != -EINVAL)
+		ret = -1;
+
+	fd = open_socket(&writer);
+	if (fd < 0)
+		return -1;
+
+	loop = drmEventLoopCreate(fd, &evctx, BUFFER_SIZE);
+	if (!loop)
+		return -1;
+
+	if (write(writer, "", 1) != 1 || drmEventLoopDispatch(loop) != -EIO) {
+		printf("errors: short read not reported\n");
+		ret = -1;
+	}
+
+	/* events read before the error are still dispatched */
+	memset(&seen, 0, sizeof(seen));
+	for (i = 0; i < EVENTS_PER_BUFFER; i++)
+		set_vblank(&vblanks[i], DRM_EVENT_VBLANK, i, 0);
+	if (write(writer, vblanks, sizeof(vblanks)) != sizeof(vblanks) ||
+	    write(writer, "", 1) != 1 ||
+	    drmEventLoopDispatch(loop) != (int)EVENTS_PER_BUFFER ||
+	    seen.vblanks != EVENTS_PER_BUFFER) {
+		printf("errors: events before a short read lost\n");
+		ret = -1;
+	}
+
+	drmEventLoopDestroy(loop);
+	close(writer);
+	close(fd);
+
+	/* reading from the write end of a pipe fails */
+	if (pipe(fds))
+		return -1;
+
+	loop = drmEventLoopCreate(fds[1], &evctx, 0);
+	if (!loop || drmEventLoopDispatch(loop) != -EBADF) {
+		printf("errors: failed read not reported\n");
+		ret = -1;
+	}
+
+	drmEventLoopDestroy(loop);
+	close(fds[0]);
+	close(fds[1]);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= test_batch();
+	ret |= test_latency();
+	ret |= test_errors();
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
+
+#include "fake_ioctl.h"
+
+static fake_ioctl_handler handler;
+static typeof(ioctl) *real_ioctl;
+
+void fake_ioctl_set_handler(fake_ioctl_handler func)
+{
+	handler = func;
+}
+
+int fake_ioctl_real(int fd, unsigned long request, void *arg)
+{
+	if (!real_ioctl)
+		real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	if (!real_ioctl) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	return real_ioctl(fd, request, arg);
+}
+
+/* must be visible so that it takes precedence over the one libdrm uses */
+__attribute__((visibility("default"))) int ioctl(int fd, unsigned long request, ...)
+{
+	va_list va;
+	void *arg;
+
+	va_start(va, request);
+	arg = va_arg(va, void *);
+	va_end(va);
+
+	if (handler)
+		return handler(fd, request, arg);
+
+	return fake_ioctl_real(fd, request, arg);
+}
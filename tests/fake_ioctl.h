@@ -0,0 +1,38 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FAKE_IOCTL_H
+#define FAKE_IOCTL_H
+
+/*
+ * Interception of the ioctls issued by libdrm, for tests that fake a
+ * device.  Linking this library interposes ioctl(), which hands every call
+ * to the handler set with fake_ioctl_set_handler(), or on to the C library
+ * while there is none.  Handlers return like ioctl() does.
+ */
+
+typedef int (*fake_ioctl_handler)(int fd, unsigned long request, void *arg);
+
+void fake_ioctl_set_handler(fake_ioctl_handler handler);
+
+/* issue an ioctl on a real file descriptor, bypassing the handler */
+int fake_ioctl_real(int fd, unsigned long request, void *arg);
+
+#endif /* FAKE_IOCTL_H */
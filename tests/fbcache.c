@@ -0,0 +1,408 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the framebuffer cache: that identical layouts share one
+ * framebuffer and any difference in the layout creates another, that the
+ * least recently used framebuffers are removed first, that pinned ones are
+ * not, that evicting a GEM handle removes every framebuffer using it, and
+ * that failures are not cached.  ADDFB2 and RMFB are intercepted, so no device is needed.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+#include "drm_fourcc.h"
+
+#include "fake_ioctl.h"
+
+#define MAX_FBS 64
+
+static struct {
+	uint32_t next_id;
+	unsigned int live;
+	unsigned int created;
+	int fail;
+	int bad_rmfb;
+	uint32_t removed;	/* the last framebuffer removed */
+	uint32_t handles[MAX_FBS][4];
+} fbs;
+
+static int fake_fb_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct drm_mode_fb_cmd2 *cmd = arg;
+	uint32_t *id = arg;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_ADDFB2:
+		if (fbs.fail || fbs.next_id + 1 >= MAX_FBS)
+			break;
+		cmd->fb_id = ++fbs.next_id;
+		memcpy(fbs.handles[cmd->fb_id], cmd->handles,
+		       sizeof(cmd->handles));
+		fbs.live++;
+		fbs.created++;
+		return 0;
+	case DRM_IOCTL_MODE_RMFB:
+		if (*id == 0 || *id > fbs.next_id || !fbs.handles[*id][0]) {
+			fbs.bad_rmfb = 1;
+			break;
+		}
+		memset(fbs.handles[*id], 0, sizeof(fbs.handles[*id]));
+		fbs.removed = *id;
+		fbs.live--;
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+struct layout {
+	uint32_t format;
+	uint32_t handles[4];
+	uint32_t pitches[4];
+	uint32_t offsets[4];
+	uint64_t modifiers[4];
+	uint32_t flags;
+};
+
+static int get_fb(drmModeFBCachePtr cache, const struct layout *l,
+		  uint32_t *id)
+{
+	return drmModeFBCacheGetFB(cache, 64, 64, l->format, l->handles,
+				   l->pitches, l->offsets, l->modifiers, id,
+				   l->flags);
+}
+
+static void set_layout(struct layout *l, uint32_t handle)
+{
+	memset(l, 0, sizeof(*l));
+	l->format = DRM_FORMAT_XRGB8888;
+	l->handles[0] = handle;
+	l->pitches[0] = 256;
+}
+
+static int test_layouts(void)
+{
+	drmModeFBCacheStats stats;
+	drmModeFBCachePtr cache;
+	struct layout l, nv12;
+	uint32_t id, other;
+	int ret = 0;
+
+	cache = drmModeFBCacheCreate(3, 0);
+	if (!cache)
+		return -1;
+
+	set_layout(&l, 1);
+	if (get_fb(cache, &l, &id) || get_fb(cache, &l, &other) ||
+	    other != id || fbs.created != 1) {
+		printf("layouts: identical layout not shared\n");
+		ret = -1;
+	}
+
+	/* without the flag the kernel ignores the modifiers, so does the cache */
+	l.modifiers[0] = I915_FORMAT_MOD_X_TILED;
+	if (get_fb(cache, &l, &other) || other != id) {
+		printf("layouts: ignored modifier made a difference\n");
+		ret = -1;
+	}
+
+	l.flags = DRM_MODE_FB_MODIFIERS;
+	if (get_fb(cache, &l, &other) || other == id) {
+		printf("layouts: modifier made no difference\n");
+		ret = -1;
+	}
+
+	set_layout(&l, 1);
+	l.pitches[0] = 512;
+	if (get_fb(cache, &l, &other) || other == id) {
+		printf("layouts: pitch made no difference\n");
+		ret = -1;
+	}
+
+	/* two planes in one BO */
+	set_layout(&nv12, 1);
+	nv12.format = DRM_FORMAT_NV12;
+	nv12.handles[1] = 1;
+	nv12.pitches[1] = 256;
+	nv12.offsets[1] = 256 * 64;
+	if (get_fb(cache, &nv12, &id) || get_fb(cache, &nv12, &other) ||
+	    other != id) {
+		printf("layouts: NV12 layout not shared\n");
+		ret = -1;
+	}
+
+	nv12.offsets[1] += 4096;
+	if (get_fb(cache, &nv12, &other) || other == id) {
+		printf("layouts: offset made no difference\n");
+		ret = -1;
+	}
+
+	drmModeFBCacheGetStats(cache, &stats);
+	if (stats.hits != 3 || stats.misses != 5 || stats.evictions ||
+	    fbs.created != 5) {
+		printf("layouts: %llu hits, %llu misses, %u framebuffers\n",
+		       (unsigned long long)stats.hits,
+		       (unsigned long long)stats.misses, fbs.created);
+		ret = -1;
+	}
+
+	drmModeFBCacheDestroy(cache);
+
+	if (fbs.live) {
+		printf("layouts: %u framebuffers left\n", fbs.live);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int test_lru(void)
+{
+	drmModeFBCacheStats stats;
+	drmModeFBCachePtr cache;
+	uint32_t ids[4], id;
+	struct layout l;
+	unsigned int i;
+	int ret = 0;
+
+	cache = drmModeFBCacheCreate(3, 3);
+	if (!cache)
+		return -1;
+
+	for (i = 0; i < 3; i++) {
+		set_layout(&l, i + 1);
+		if (get_fb(cache, &l, &ids[i]))
+			ret = -1;
+	}
+
+	/* using the first one again makes the second the oldest */
+	set_layout(&l, 1);
+	if (get_fb(cache, &l, &id) || id != ids[0])
+		ret = -1;
+
+	set_layout(&l, 4);
+	if (get_fb(cache, &l, &ids[3]) || fbs.removed != ids[1] ||
+	    fbs.live != 3) {
+		printf("lru: framebuffer %u removed instead of %u\n",
+		       fbs.removed, ids[1]);
+		ret = -1;
+	}
+
+	set_layout(&l, 1);
+	if (get_fb(cache, &l, &id) || id != ids[0]) {
+		printf("lru: recently used framebuffer removed\n");
+		ret = -1;
+	}
+
+	set_layout(&l, 2);
+	if (get_fb(cache, &l, &id) || id == ids[1] || fbs.removed != ids[2]) {
+		printf("lru: removed framebuffer reused\n");
+		ret = -1;
+	}
+
+	drmModeFBCacheGetStats(cache, &stats);
+	if (stats.evictions != 2) {
+		printf("lru: %llu evictions instead of 2\n",
+		       (unsigned long long)stats.evictions);
+		ret = -1;
+	}
+
+	drmModeFBCacheDestroy(cache);
+
+	return ret;
+}
+
+static int test_pin(void)
+{
+	drmModeFBCachePtr cache;
+	uint32_t ids[5];
+	struct layout l;
+	unsigned int i;
+	int ret = 0;
+
+	cache = drmModeFBCacheCreate(3, 2);
+	if (!cache)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		set_layout(&l, i + 1);
+		ret |= get_fb(cache, &l, &ids[i]);
+	}
+
+	if (drmModeFBCachePin(cache, ids[1] + 100) != -ENOENT) {
+		printf("pin: unknown framebuffer pinned\n");
+		ret = -1;
+	}
+
+	/* the oldest one is pinned, so the next oldest makes room */
+	if (drmModeFBCachePin(cache, ids[0]))
+		ret = -1;
+	set_layout(&l, 3);
+	if (get_fb(cache, &l, &ids[2]) || fbs.removed != ids[1] ||
+	    !fbs.handles[ids[0]][0]) {
+		printf("pin: framebuffer %u removed instead of %u\n",
+		       fbs.removed, ids[1]);
+		ret = -1;
+	}
+
+	drmModeFBCacheUnpin(cache, ids[0]);
+	set_layout(&l, 4);
+	if (get_fb(cache, &l, &ids[3]) || fbs.removed != ids[0]) {
+		printf("pin: unpinned framebuffer %u not removed\n", ids[0]);
+		ret = -1;
+	}
+
+	/* with everything pinned, the cache grows past its size */
+	ret |= drmModeFBCachePin(cache, ids[2]);
+	ret |= drmModeFBCachePin(cache, ids[3]);
+	set_layout(&l, 5);
+	if (get_fb(cache, &l, &ids[4]) || fbs.live != 3) {
+		printf("pin: pinned framebuffers removed, %u left\n",
+		       fbs.live);
+		ret = -1;
+	}
+
+	drmModeFBCacheDestroy(cache);
+
+	return ret;
+}
+
+static int test_evict_handle(void)
+{
+	drmModeFBCacheStats stats;
+	drmModeFBCachePtr cache;
+	uint32_t ids[3], id;
+	struct layout l;
+	unsigned int i;
+	int ret = 0;
+
+	cache = drmModeFBCacheCreate(3, 0);
+	if (!cache)
+		return -1;
+
+	/* handle 5 in the first plane, in the second plane, and not at all */
+	set_layout(&l, 5);
+	ret |= get_fb(cache, &l, &ids[0]);
+	l.format = DRM_FORMAT_NV12;
+	l.handles[0] = 6;
+	l.handles[1] = 5;
+	l.pitches[1] = 256;
+	ret |= get_fb(cache, &l, &ids[1]);
+	set_layout(&l, 6);
+	ret |= get_fb(cache, &l, &ids[2]);
+
+	/* 0 stands for the unused planes, it is never a handle */
+	drmModeFBCacheEvictHandle(cache, 0);
+	drmModeFBCacheEvictHandle(cache, 7);
+	if (ret || fbs.live != 3) {
+		printf("evict handle: unused handle evicted framebuffers\n");
+		ret = -1;
+	}
+
+	drmModeFBCacheEvictHandle(cache, 5);
+	for (i = 0; i < 2; i++) {
+		if (fbs.handles[ids[i]][0]) {
+			printf("evict handle: framebuffer %u left\n", ids[i]);
+			ret = -1;
+		}
+	}
+
+	if (fbs.live != 1 || get_fb(cache, &l, &id) || id != ids[2]) {
+		printf("evict handle: other framebuffer evicted\n");
+		ret = -1;
+	}
+
+	drmModeFBCacheGetStats(cache, &stats);
+	if (stats.evictions != 2) {
+		printf("evict handle: %llu evictions instead of 2\n",
+		       (unsigned long long)stats.evictions);
+		ret = -1;
+	}
+
+	drmModeFBCacheDestroy(cache);
+
+	return ret;
+}
+
+static int test_errors(void)
+{
+	drmModeFBCachePtr cache;
+	unsigned int created;
+	struct layout l;
+	uint32_t id;
+	int ret = 0;
+
+	cache = drmModeFBCacheCreate(3, 0);
+	if (!cache)
+		return -1;
+
+	set_layout(&l, 1);
+	if (get_fb(NULL, &l, &id) != -EINVAL || get_fb(cache, &l, NULL) !=
+	    -EINVAL) {
+		printf("errors: invalid arguments accepted\n");
+		ret = -1;
+	}
+
+	created = fbs.created;
+	fbs.fail = 1;
+	if (!get_fb(cache, &l, &id)) {
+		printf("errors: ADDFB2 failure not reported\n");
+		ret = -1;
+	}
+	fbs.fail = 0;
+
+	/* the failure is not remembered */
+	if (get_fb(cache, &l, &id) || fbs.created != created + 1) {
+		printf("errors: failure cached\n");
+		ret = -1;
+	}
+
+	drmModeFBCacheDestroy(cache);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_fb_ioctl);
+
+	ret |= test_layouts();
+	ret |= test_lru();
+	ret |= test_pin();
+	ret |= test_evict_handle();
+	ret |= test_errors();
+
+	if (fbs.live || fbs.bad_rmfb) {
+		printf("%u framebuffers left, bad RMFB %d\n", fbs.live,
+		       fbs.bad_rmfb);
+		ret = -1;
+	}
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the libsync fence set: that the timer wheel expires deadlines in
+ * order, including ones that passed before they were added and ones more
+ * than a turn of the wheel out, that signaled fences are reported, that
+ * callbacks cannot poll the set again, that fences signaling with an error
+ * report it, and that signal timestamps are read back from fences with many
+ * components.  Pipes stand in for sync_files,
+ * and SYNC_IOC_FILE_INFO is intercepted.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libsync.h"
+
+#include "fake_ioctl.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static struct {
+	unsigned long data[16];
+	int status[16];
+	unsigned int count;
+} reports;
+
+static void record(void *data, int status)
+{
+	if (reports.count < ARRAY_SIZE(reports.data)) {
+		reports.data[reports.count] = (unsigned long)data;
+		reports.status[reports.count] = status;
+	}
+	reports.count++;
+}
+
+/* returns the read end of a pipe, the write end is stored in *writer */
+static int fence(int *writer)
+{
+	int fds[2];
+
+	if (pipe(fds))
+		return -1;
+
+	if (writer)
+		*writer = fds[1];
+	else
+		close(fds[1]);
+
+	return fds[0];
+}
+
+static int test_wheel(void)
+{
+	static const int64_t deadlines[] = {
+		3, 1, 2, SYNC_FENCE_SET_WHEEL_SIZE + 5,
+	};
+	static const struct {
+		int64_t time;
+		unsigned int count;
+		unsigned long first;
+	} steps[] = {
+		{ 1, 1, 1 },
+		{ 3, 2, 2 },
+		{ SYNC_FENCE_SET_WHEEL_SIZE, 0, 0 },
+		{ SYNC_FENCE_SET_WHEEL_SIZE + 5, 1, 3 },
+	};
+	struct sync_fence_set *set;
+	unsigned int i, j;
+	int64_t start;
+	int ret = 0;
+
+	set = sync_fence_set_create(0);
+	if (!set)
+		return -1;
+
+	start = set->wheel_time;
+
+	for (i = 0; i < ARRAY_SIZE(deadlines); i++)
+		sync_fence_set_add(set, fence(NULL), start + deadlines[i],
+				   (void *)(unsigned long)i);
+
+	/* a deadline that already passed expires within the current ms */
+	sync_fence_set_add(set, fence(NULL), start - 5, (void *)10ul);
+
+	memset(&reports, 0, sizeof(reports));
+	if (sync_fence_set_expire(set, start, record) != 1 ||
+	    reports.data[0] != 10 || reports.status[0] != -ETIME) {
+		printf("wheel: passed deadline not expired right away\n");
+		ret = -1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(steps); i++) {
+		memset(&reports, 0, sizeof(reports));
+		sync_fence_set_expire(set, start + steps[i].time, record);
+
+		if (reports.count != steps[i].count ||
+		    (reports.count && reports.data[0] != steps[i].first)) {
+			printf("wheel: %u fences expired at %lld ms\n",
+			       reports.count, (long long)steps[i].time);
+			ret = -1;
+		}
+
+		for (j = 0; j < reports.count; j++) {
+			if (reports.status[j] != -ETIME ||
+			    deadlines[reports.data[j]] > steps[i].time) {
+				printf("wheel: fence %lu expired early\n",
+				       reports.data[j]);
+				ret = -1;
+			}
+		}
+	}
+
+	if (set->count || set->stats.expired != ARRAY_SIZE(deadlines) + 1) {
+		printf("wheel: %u fences left\n", set->count);
+		ret = -1;
+	}
+
+	sync_fence_set_destroy(set);
+
+	return ret;
+}
+
+static struct sync_fence_set *reentry_set;
+static int reentry_poll;
+
+static void reenter(void *data, int status)
+{
+	record(data, status);
+
+	reentry_poll = sync_fence_set_poll(reentry_set, 0, record);
+	if (!data)
+		sync_fence_set_add(reentry_set, fence(NULL), 0, (void *)1ul);
+}
+
+static int test_poll(void)
+{
+	struct sync_fence_set *set;
+	int writer = -1, ret = 0;
+	int64_t start;
+
+	set = sync_fence_set_create(0);
+	if (!set)
+		return -1;
+
+	/* a signaled fence is reported right away */
+	sync_fence_set_add(set, fence(&writer), -1, (void *)0ul);
+	if (write(writer, "", 1) != 1)
+		ret = -1;
+
+	reentry_set = set;
+	memset(&reports, 0, sizeof(reports));
+	start = sync_fence_set_now();
+
+	if (sync_fence_set_poll(set, 1000, reenter) != 1 ||
+	    reports.count != 1 || reports.status[0] != 0 ||
+	    sync_fence_set_now() - start > 500) {
+		printf("poll: signaled fence not reported\n");
+		ret = -1;
+	}
+
+	if (reentry_poll != -EBUSY) {
+		printf("poll: callback polled the set, %d\n", reentry_poll);
+		ret = -1;
+	}
+
+	/* the fence added by the callback is long past its deadline */
+	memset(&reports, 0, sizeof(reports));
+	if (sync_fence_set_poll(set, 1000, record) != 1 ||
+	    reports.data[0] != 1 || reports.status[0] != -ETIME ||
+	    sync_fence_set_now() - start > 500) {
+		printf("poll: added fence not expired\n");
+		ret = -1;
+	}
+
+	/* nothing left to report */
+	if (sync_fence_set_poll(set, 10, record) != 0) {
+		printf("poll: empty set reported fences\n");
+		ret = -1;
+	}
+
+	close(writer);
+	sync_fence_set_destroy(set);
+
+	return ret;
+}
+
+/* every fence signaled with -EIO */
+static int fake_error_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct sync_file_info *info = arg;
+
+	if (request != SYNC_IOC_FILE_INFO)
+		return fake_ioctl_real(fd, request, arg);
+
+	info->status = -EIO;
+	return 0;
+}
+
+static int test_error(void)
+{
+	struct sync_fence_set *set;
+	int writer = -1, ret = 0;
+
+	set = sync_fence_set_create(0);
+	if (!set)
+		return -1;
+
+	sync_fence_set_add(set, fence(&writer), -1, (void *)2ul);
+	if (write(writer, "", 1) != 1)
+		ret = -1;
+
+	memset(&reports, 0, sizeof(reports));
+	fake_ioctl_set_handler(fake_error_ioctl);
+
+	if (sync_fence_set_poll(set, 1000, record) != 1 ||
+	    reports.data[0] != 2 || reports.status[0] != -EIO) {
+		printf("error: fence error not reported, %d\n",
+		       reports.status[0]);
+		ret = -1;
+	}
+
+	fake_ioctl_set_handler(NULL);
+	close(writer);
+	sync_fence_set_destroy(set);
+
+	return ret;
+}
+
+#define NUM_COMPONENTS 6
+#define SIGNALED_AGO_NS 5000000ull
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* a fence merged from several, the last one signaled 5 ms ago */
+static int fake_sync_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct sync_file_info *info = arg;
+	struct sync_fence_info *fences;
+	unsigned int i;
+
+	if (request != SYNC_IOC_FILE_INFO)
+		return fake_ioctl_real(fd, request, arg);
+
+	if (!info->num_fences) {
+		info->num_fences = NUM_COMPONENTS;
+		return 0;
+	}
+
+	if (info->num_fences < NUM_COMPONENTS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fences = (struct sync_fence_info *)(uintptr_t)info->sync_fence_info;
+	for (i = 0; i < NUM_COMPONENTS; i++)
+		fences[i].timestamp_ns = now_ns() - SIGNALED_AGO_NS * (10 - i);
+	fences[NUM_COMPONENTS - 1].timestamp_ns = now_ns() - SIGNALED_AGO_NS;
+	info->num_fences = NUM_COMPONENTS;
+
+	return 0;
+}
+
+static int test_latency(void)
+{
+	uint64_t latency;
+
+	fake_ioctl_set_handler(fake_sync_ioctl);
+	latency = sync_fence_set_latency(0);
+	fake_ioctl_set_handler(NULL);
+
+	if (latency < SIGNALED_AGO_NS || latency > 2 * SIGNALED_AGO_NS) {
+		printf("latency: %llu ns instead of 5 ms\n",
+		       (unsigned long long)latency);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= test_wheel();
+	ret |= test_poll();
+	ret |= test_error();
+	ret |= test_latency();
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,287 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that drmModeFormatIndexCreate() parses IN_FORMATS blobs: format
+ * masks at an offset, more than 64 formats and modifiers, and that
+ * malformed blobs are refused or cannot index past the formats.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+#include "drm_fourcc.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define MAX_FORMATS 128
+#define MAX_MODIFIERS 128
+
+static union {
+	struct drm_format_modifier_blob header;
+	uint64_t align;
+	char data[sizeof(struct drm_format_modifier_blob) +
+		  MAX_FORMATS * sizeof(uint32_t) +
+		  MAX_MODIFIERS * sizeof(struct drm_format_modifier)];
+} blob;
+
+static uint32_t *blob_formats(void)
+{
+	return (uint32_t *)(blob.data + blob.header.formats_offset);
+}
+
+static struct drm_format_modifier *blob_modifiers(void)
+{
+	return (struct drm_format_modifier *)
+		(blob.data + blob.header.modifiers_offset);
+}
+
+/* lays out an empty blob, returns its length */
+static size_t blob_init(uint32_t count_formats, uint32_t count_modifiers)
+{
+	memset(&blob, 0, sizeof(blob));
+
+	blob.header.version = FORMAT_BLOB_CURRENT;
+	blob.header.count_formats = count_formats;
+	blob.header.formats_offset = sizeof(blob.header);
+	blob.header.count_modifiers = count_modifiers;
+	blob.header.modifiers_offset = (sizeof(blob.header) +
+					count_formats * sizeof(uint32_t) + 7) &
+				       ~7u;
+
+	return blob.header.modifiers_offset +
+	       count_modifiers * sizeof(struct drm_format_modifier);
+}
+
+static int test_basic(void)
+{
+	static const uint32_t formats[] = {
+		DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_NV12,
+	};
+	struct drm_format_modifier *mods;
+	drmModeFormatIndexPtr index;
+	uint64_t modifiers[4];
+	size_t length;
+	int ret = 0;
+
+	length = blob_init(ARRAY_SIZE(formats), 3);
+	memcpy(blob_formats(), formats, sizeof(formats));
+
+	mods = blob_modifiers();
+	mods[0].modifier = DRM_FORMAT_MOD_LINEAR;
+	mods[0].formats = 0x7;
+	mods[1].modifier = I915_FORMAT_MOD_X_TILED;
+	mods[1].formats = 0x3;
+	/* NV12 only, through the offset */
+	mods[2].modifier = I915_FORMAT_MOD_Y_TILED;
+	mods[2].offset = 1;
+	mods[2].formats = 0x2;
+
+	index = drmModeFormatIndexCreate(blob.data, length);
+	if (!index) {
+		printf("basic: valid blob refused\n");
+		return -1;
+	}
+
+	if (!drmModeFormatIndexHasFormat(index, DRM_FORMAT_NV12) ||
+	    drmModeFormatIndexHasFormat(index, DRM_FORMAT_RGB565)) {
+		printf("basic: wrong formats\n");
+		ret = -1;
+	}
+
+	if (!drmModeFormatIndexSupports(index, DRM_FORMAT_ARGB8888,
+					I915_FORMAT_MOD_X_TILED) ||
+	    drmModeFormatIndexSupports(index, DRM_FORMAT_NV12,
+				       I915_FORMAT_MOD_X_TILED) ||
+	    !drmModeFormatIndexSupports(index, DRM_FORMAT_NV12,
+					I915_FORMAT_MOD_Y_TILED) ||
+	    drmModeFormatIndexSupports(index, DRM_FORMAT_XRGB8888,
+				       I915_FORMAT_MOD_Y_TILED) ||
+	    drmModeFormatIndexSupports(index, DRM_FORMAT_XRGB8888,
+				       DRM_FORMAT_MOD_INVALID)) {
+		printf("basic: wrong pairs\n");
+		ret = -1;
+	}
+
+	if (drmModeFormatIndexGetModifiers(index, DRM_FORMAT_NV12, modifiers,
+					   ARRAY_SIZE(modifiers)) != 2 ||
+	    modifiers[0] != DRM_FORMAT_MOD_LINEAR ||
+	    modifiers[1] != I915_FORMAT_MOD_Y_TILED) {
+		printf("basic: wrong NV12 modifiers\n");
+		ret = -1;
+	}
+
+	/* the count does not depend on the room given */
+	if (drmModeFormatIndexGetModifiers(index, DRM_FORMAT_XRGB8888,
+					   modifiers, 1) != 2 ||
+	    drmModeFormatIndexGetModifiers(index, DRM_FORMAT_RGB565,
+					   modifiers, 1) != 0) {
+		printf("basic: wrong modifier counts\n");
+		ret = -1;
+	}
+
+	drmModeFreeFormatIndex(index);
+
+	return ret;
+}
+
+/* more formats and modifiers than fit in one 64 bit word */
+static int test_large(void)
+{
+	struct drm_format_modifier *mods;
+	drmModeFormatIndexPtr index;
+	uint64_t modifiers[MAX_MODIFIERS];
+	uint32_t *formats;
+	size_t length;
+	int i, ret = 0;
+
+	length = blob_init(100, 70);
+
+	formats = blob_formats();
+	for (i = 0; i < 100; i++)
+		formats[i] = 0x1000 + i;
+
+	/* every modifier but one for format 0, that one for format 99 only */
+	mods = blob_modifiers();
+	for (i = 0; i < 70; i++) {
+		mods[i].modifier = 0x100 + i;
+		mods[i].formats = 1;
+	}
+	mods[68].offset = 64;
+	mods[68].formats = 1ull << 35;
+
+	index = drmModeFormatIndexCreate(blob.data, length);
+	if (!index) {
+		printf("large: valid blob refused\n");
+		return -1;
+	}
+
+	if (drmModeFormatIndexGetModifiers(index, 0x1000, modifiers,
+					   ARRAY_SIZE(modifiers)) != 69 ||
+	    modifiers[68] != 0x100 + 69) {
+		printf("large: wrong modifiers of the first format\n");
+		ret = -1;
+	}
+
+	if (!drmModeFormatIndexSupports(index, 0x1000 + 99, 0x100 + 68) ||
+	    drmModeFormatIndexSupports(index, 0x1000 + 98, 0x100 + 68) ||
+	    drmModeFormatIndexSupports(index, 0x1000, 0x100 + 68) ||
+	    !drmModeFormatIndexSupports(index, 0x1000, 0x100 + 69)) {
+		printf("large: wrong pairs\n");
+		ret = -1;
+	}
+
+	for (i = 1; i < 99; i++) {
+		if (!drmModeFormatIndexHasFormat(index, 0x1000 + i) ||
+		    drmModeFormatIndexGetModifiers(index, 0x1000 + i,
+						   modifiers, 1) != 0) {
+			printf("large: format %d has modifiers\n", i);
+			ret = -1;
+			break;
+		}
+	}
+
+	drmModeFreeFormatIndex(index);
+
+	return ret;
+}
+
+static int test_malformed(void)
+{
+	struct drm_format_modifier *mods;
+	drmModeFormatIndexPtr index;
+	uint64_t modifiers[4];
+	size_t length;
+	int ret = 0;
+
+	length = blob_init(2, 1);
+	blob_formats()[0] = DRM_FORMAT_XRGB8888;
+	blob_formats()[1] = DRM_FORMAT_ARGB8888;
+	mods = blob_modifiers();
+	mods[0].modifier = DRM_FORMAT_MOD_LINEAR;
+	mods[0].formats = 0x3;
+
+	if (drmModeFormatIndexCreate(NULL, length) ||
+	    drmModeFormatIndexCreate(blob.data, sizeof(blob.header) - 1) ||
+	    drmModeFormatIndexCreate(blob.data, length - 1)) {
+		printf("malformed: short blob accepted\n");
+		ret = -1;
+	}
+
+	blob.header.version = FORMAT_BLOB_CURRENT + 1;
+	if (drmModeFormatIndexCreate(blob.data, length)) {
+		printf("malformed: unknown version accepted\n");
+		ret = -1;
+	}
+	blob.header.version = FORMAT_BLOB_CURRENT;
+
+	blob.header.count_formats = 0x40000000;
+	if (drmModeFormatIndexCreate(blob.data, length)) {
+		printf("malformed: too many formats accepted\n");
+		ret = -1;
+	}
+	blob.header.count_formats = 2;
+
+	blob.header.modifiers_offset = 0xfffffff0;
+	if (drmModeFormatIndexCreate(blob.data, length)) {
+		printf("malformed: modifiers out of the blob accepted\n");
+		ret = -1;
+	}
+	blob.header.modifiers_offset = length - sizeof(*mods);
+
+	/* masks must not reach past the formats, even when offsets wrap */
+	mods[0].offset = 0xffffffff;
+	mods[0].formats = 0x6;
+	index = drmModeFormatIndexCreate(blob.data, length);
+	if (!index ||
+	    drmModeFormatIndexGetModifiers(index, DRM_FORMAT_XRGB8888,
+					   modifiers, ARRAY_SIZE(modifiers)) ||
+	    drmModeFormatIndexGetModifiers(index, DRM_FORMAT_ARGB8888,
+					   modifiers, ARRAY_SIZE(modifiers))) {
+		printf("malformed: modifier offset wrapped around\n");
+		ret = -1;
+	}
+	drmModeFreeFormatIndex(index);
+
+	/* an empty blob is valid */
+	length = blob_init(0, 0);
+	index = drmModeFormatIndexCreate(blob.data, length);
+	if (!index || drmModeFormatIndexHasFormat(index, DRM_FORMAT_XRGB8888)) {
+		printf("malformed: empty blob not indexed\n");
+		ret = -1;
+	}
+	drmModeFreeFormatIndex(index);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= test_basic();
+	ret |= test_large();
+	ret |= test_malformed();
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,434 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the frame pacer: the period taken from the mode and tracked from
+ * vblanks, the predicted vblanks and render start times with and without
+ * VRR, sampling the vblank from the kernel when nothing was fed, and the
+ * missed frame statistics.  The CRTC ioctls are intercepted, so no device
+ * is needed.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#include "fake_ioctl.h"
+
+/* 1920x1080@60 */
+#define PERIOD_NS 16666666
+#define VRR_PROP_ID 7
+
+static struct {
+	int mode;
+	int vrr;
+	int seq_fail;
+	uint64_t seq;
+	uint64_t seq_ns;
+	uint64_t seq_step_ns;	/* 0 for a CRTC that is stuck */
+} crtc;
+
+static int fake_crtc_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct drm_mode_crtc *get_crtc = arg;
+	struct drm_mode_obj_get_properties *props = arg;
+	struct drm_mode_get_property *prop = arg;
+	struct drm_crtc_get_sequence *seq = arg;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_GETCRTC:
+		if (!crtc.mode)
+			break;
+		get_crtc->mode_valid = 1;
+		get_crtc->mode.clock = 148500;
+		get_crtc->mode.htotal = 2200;
+		get_crtc->mode.vtotal = 1125;
+		return 0;
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES:
+		if (props->props_ptr) {
+			*(uint32_t *)(uintptr_t)props->props_ptr = VRR_PROP_ID;
+			*(uint64_t *)(uintptr_t)props->prop_values_ptr = crtc.vrr;
+		}
+		props->count_props = 1;
+		return 0;
+	case DRM_IOCTL_MODE_GETPROPERTY:
+		if (prop->prop_id != VRR_PROP_ID)
+			break;
+		strcpy(prop->name, "VRR_ENABLED");
+		prop->flags = DRM_MODE_PROP_RANGE;
+		return 0;
+	case DRM_IOCTL_CRTC_GET_SEQUENCE:
+		if (crtc.seq_fail)
+			break;
+		seq->active = 1;
+		seq->sequence = crtc.seq;
+		seq->sequence_ns = crtc.seq_ns;
+		if (crtc.seq_step_ns) {
+			crtc.seq++;
+			crtc.seq_ns += crtc.seq_step_ns;
+		}
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int near(uint64_t a, uint64_t b, uint64_t tolerance)
+{
+	return (a > b ? a - b : b - a) <= tolerance;
+}
+
+static int test_period(void)
+{
+	drmModeFramePacerStats stats;
+	drmModeFramePacerPtr pacer;
+	uint64_t ns = 1000000000;
+	unsigned int i;
+	int ret = 0;
+
+	memset(&crtc, 0, sizeof(crtc));
+	crtc.mode = 1;
+
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (stats.period_ns != PERIOD_NS || stats.vrr) {
+		printf("period: %llu ns from the mode\n",
+		       (unsigned long long)stats.period_ns);
+		ret = -1;
+	}
+
+	/* vblanks that were not reported count as several periods */
+	drmModeFramePacerAddVblank(pacer, 10, ns);
+	drmModeFramePacerAddVblank(pacer, 13, ns + 3 * PERIOD_NS);
+	/* twice, and out of order */
+	drmModeFramePacerAddVblank(pacer, 13, ns + 3 * PERIOD_NS);
+	drmModeFramePacerAddVblank(pacer, 12, ns + 2 * PERIOD_NS);
+
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (stats.period_ns != PERIOD_NS || stats.jitter_ns ||
+	    stats.vblanks != 2) {
+		printf("period: %llu ns after %llu vblanks\n",
+		       (unsigned long long)stats.period_ns,
+		       (unsigned long long)stats.vblanks);
+		ret = -1;
+	}
+
+	/* the mode changes to 75 Hz */
+	ns += 3 * PERIOD_NS;
+	for (i = 14; i < 100; i++) {
+		ns += 13333333;
+		drmModeFramePacerAddVblank(pacer, i, ns);
+	}
+
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (!near(stats.period_ns, 13333333, 10000) ||
+	    stats.jitter_ns > 10000) {
+		printf("period: %llu ns at 75 Hz, jitter %llu ns\n",
+		       (unsigned long long)stats.period_ns,
+		       (unsigned long long)stats.jitter_ns);
+		ret = -1;
+	}
+
+	/* vblanks 1 ms early and late */
+	for (i = 100; i < 200; i++) {
+		ns += 13333333 + (i & 1 ? 1000000 : -1000000);
+		drmModeFramePacerAddVblank(pacer, i, ns);
+	}
+
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (!near(stats.period_ns, 13333333, 300000) ||
+	    !near(stats.jitter_ns, 1000000, 300000)) {
+		printf("period: %llu ns with jitter %llu ns\n",
+		       (unsigned long long)stats.period_ns,
+		       (unsigned long long)stats.jitter_ns);
+		ret = -1;
+	}
+
+	drmModeFramePacerDestroy(pacer);
+
+	return ret;
+}
+
+static int test_predict(void)
+{
+	uint64_t sequences[3], times[3], start, sequence, last;
+	drmModeFramePacerPtr pacer;
+	unsigned int i;
+	int ret = 0;
+
+	memset(&crtc, 0, sizeof(crtc));
+	crtc.mode = 1;
+
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	/* an eighth of a period ago */
+	last = now_ns() - PERIOD_NS / 8;
+	drmModeFramePacerAddVblank(pacer, 100, last);
+
+	if (drmModeFramePacerPredict(pacer, sequences, times, 3)) {
+		printf("predict: failed\n");
+		ret = -1;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (sequences[i] != 101 + i ||
+		    times[i] != last + (i + 1) * PERIOD_NS) {
+			printf("predict: vblank %llu at %lld ns\n",
+			       (unsigned long long)sequences[i],
+			       (long long)(times[i] - last));
+			ret = -1;
+		}
+	}
+
+	/* enough time to render for the next vblank, or only the one after */
+	if (drmModeFramePacerGetRenderStart(pacer, PERIOD_NS / 2, &start,
+					    &sequence) ||
+	    sequence != 101 || start != last + PERIOD_NS / 2) {
+		printf("render start: vblank %llu\n",
+		       (unsigned long long)sequence);
+		ret = -1;
+	}
+
+	if (drmModeFramePacerGetRenderStart(pacer, PERIOD_NS, &start,
+					    &sequence) ||
+	    sequence != 102 || start != last + PERIOD_NS) {
+		printf("render start: vblank %llu for a long frame\n",
+		       (unsigned long long)sequence);
+		ret = -1;
+	}
+
+	drmModeFramePacerDestroy(pacer);
+
+	/* vblanks that were not fed are skipped */
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	drmModeFramePacerAddVblank(pacer, 200, now_ns() - 5 * PERIOD_NS / 2);
+	if (drmModeFramePacerPredict(pacer, sequences, NULL, 1) ||
+	    sequences[0] != 203) {
+		printf("predict: vblank %llu after missing ones\n",
+		       (unsigned long long)sequences[0]);
+		ret = -1;
+	}
+
+	drmModeFramePacerDestroy(pacer);
+
+	return ret;
+}
+
+static int test_vrr(void)
+{
+	drmModeFramePacerStats stats;
+	drmModeFramePacerPtr pacer;
+	uint64_t sequence, time, start, before, after, last;
+	int ret = 0;
+
+	memset(&crtc, 0, sizeof(crtc));
+	crtc.mode = 1;
+	crtc.vrr = 1;
+
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	/* the shortest interval is the refresh limit */
+	last = now_ns() - 40000000;
+	drmModeFramePacerAddVblank(pacer, 1, last - 29000000);
+	drmModeFramePacerAddVblank(pacer, 2, last - 19000000);
+	drmModeFramePacerAddVblank(pacer, 3, last - 12000000);
+	drmModeFramePacerAddVblank(pacer, 4, last);
+
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (!stats.vrr || stats.period_ns != 7000000) {
+		printf("vrr: %llu ns period, vrr %d\n",
+		       (unsigned long long)stats.period_ns, stats.vrr);
+		ret = -1;
+	}
+
+	/* the next vblank can come right away, rendering starts now */
+	before = now_ns();
+	if (drmModeFramePacerPredict(pacer, &sequence, &time, 1) ||
+	    drmModeFramePacerGetRenderStart(pacer, 5000000, &start, NULL)) {
+		printf("vrr: prediction failed\n");
+		ret = -1;
+	}
+	after = now_ns();
+
+	if (sequence != 5 || time < before || time > after || start < before ||
+	    start > after) {
+		printf("vrr: vblank %llu in %lld ns, start in %lld ns\n",
+		       (unsigned long long)sequence, (long long)(time - before),
+		       (long long)(start - before));
+		ret = -1;
+	}
+
+	/* a recent vblank limits the next one */
+	last = now_ns();
+	drmModeFramePacerAddVblank(pacer, 5, last);
+	if (drmModeFramePacerGetRenderStart(pacer, 1000000, &start, NULL) ||
+	    start != last + 6000000) {
+		printf("vrr: start %lld ns after the vblank\n",
+		       (long long)(start - last));
+		ret = -1;
+	}
+
+	drmModeFramePacerSetVrr(pacer, 0);
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (stats.vrr) {
+		printf("vrr: not disabled\n");
+		ret = -1;
+	}
+
+	drmModeFramePacerDestroy(pacer);
+
+	return ret;
+}
+
+static int test_sample(void)
+{
+	drmModeFramePacerStats stats;
+	drmModeFramePacerPtr pacer;
+	uint64_t sequence;
+	int ret = 0;
+
+	/* no mode, no vblanks: two samples give the period */
+	memset(&crtc, 0, sizeof(crtc));
+	crtc.seq = 1000;
+	crtc.seq_ns = now_ns() - 5 * PERIOD_NS / 2;
+	crtc.seq_step_ns = PERIOD_NS;
+
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	if (drmModeFramePacerPredict(pacer, &sequence, NULL, 1) ||
+	    sequence != 1003) {
+		printf("sample: vblank %llu predicted\n",
+		       (unsigned long long)sequence);
+		ret = -1;
+	}
+
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (stats.period_ns != PERIOD_NS || stats.vblanks != 2) {
+		printf("sample: %llu ns from %llu samples\n",
+		       (unsigned long long)stats.period_ns,
+		       (unsigned long long)stats.vblanks);
+		ret = -1;
+	}
+
+	drmModeFramePacerDestroy(pacer);
+
+	/* a CRTC that does not advance gives no period */
+	crtc.seq_step_ns = 0;
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	if (drmModeFramePacerPredict(pacer, &sequence, NULL, 1) != -EAGAIN) {
+		printf("sample: period made up\n");
+		ret = -1;
+	}
+
+	crtc.seq_fail = 1;
+	drmModeFramePacerDestroy(pacer);
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	if (drmModeFramePacerSample(pacer) != -EINVAL ||
+	    drmModeFramePacerGetRenderStart(pacer, 0, NULL, NULL) != -EINVAL ||
+	    drmModeFramePacerPredict(NULL, NULL, NULL, 0) != -EINVAL) {
+		printf("sample: failure not reported\n");
+		ret = -1;
+	}
+
+	drmModeFramePacerDestroy(pacer);
+
+	return ret;
+}
+
+static int test_presented(void)
+{
+	drmModeFramePacerStats stats;
+	drmModeFramePacerPtr pacer;
+	int ret = 0;
+
+	memset(&crtc, 0, sizeof(crtc));
+
+	pacer = drmModeFramePacerCreate(3, 31);
+	if (!pacer)
+		return -1;
+
+	drmModeFramePacerPresented(pacer, 10, 10);
+	drmModeFramePacerPresented(pacer, 11, 13);
+	drmModeFramePacerPresented(pacer, 14, 15);
+	/* earlier than asked for is not a miss */
+	drmModeFramePacerPresented(pacer, 17, 16);
+
+	drmModeFramePacerGetStats(pacer, &stats);
+	if (stats.frames != 4 || stats.missed != 2 ||
+	    stats.max_missed_vblanks != 2) {
+		printf("presented: %llu of %llu frames missed, by up to %llu\n",
+		       (unsigned long long)stats.missed,
+		       (unsigned long long)stats.frames,
+		       (unsigned long long)stats.max_missed_vblanks);
+		ret = -1;
+	}
+
+	drmModeFramePacerDestroy(pacer);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_crtc_ioctl);
+
+	ret |= test_period();
+	ret |= test_predict();
+	ret |= test_vrr();
+	ret |= test_sample();
+	ret |= test_presented();
+
+	return ret ? 1 : 0;
+}
@@ -27,49 +27,16 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward implementation of a fixed-sized
- * hash table using self-organizing linked lists [Knuth73, pp. 398-399] for
- * collision resolution.  There are two potentially interesting things
- * about this implementation:
- *
- * 1) The table is power-of-two sized.  Prime sized tables are more
- * traditional, but do not have a significant advantage over power-of-two
- * sized table, especially when double hashing is not used for collision
- * resolution.
- *
- * 2) The hash computation uses a table of random integers [Hanson97,
- * pp. 39-41].
- *
- * FUTURE ENHANCEMENTS
- *
- * With a table size of 512, the current implementation is sufficient for a
- * few hundred keys.  Since this is well above the expected size of the
- * tables for which this implementation was designed, the implementation of
- * dynamic hash tables was postponed until the need arises.  A common (and
- * naive) approach to dynamic hash table implementation simply creates a
- * new hash table when necessary, rehashes all the data into the new table,
- * and destroys the old table.  The approach in [Larson88] is superior in
- * two ways: 1) only a portion of the table is expanded when needed,
- * distributing the expansion cost over several insertions, and 2) portions
- * of the table can be locked, enabling a scalable thread-safe
- * implementation.
- *
- * REFERENCES
- *
- * [Hanson97] David R. Hanson.  C Interfaces and Implementations:
- * Techniques for Creating Reusable Software.  Reading, Massachusetts:
- * Addison-Wesley, 1997.
- *
- * [Knuth73] Donald E. Knuth. The Art of Computer Programming.  Volume 3:
- * Sorting and Searching.  Reading, Massachusetts: Addison-Wesley, 1973.
- *
- * [Larson88] Per-Ake Larson. "Dynamic Hash Tables".  CACM 31(4), April
- * 1988, pp. 446-457.
+ * Checks the hash table against a few key patterns and prints how far the
+ * keys ended up from their home slot, then measures insert, lookup and
+ * delete throughput and lookup latency for tables of 1K to 1M keys.
  *
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "xf86drm.h"
 #include "xf86drmHash.h"
@@ -84,15 +51,6 @@ static void clear_dist(void) {
         dist[i] = 0;
 }
 
-static int count_entries(HashBucketPtr bucket)
-{
-    int count = 0;
-
-    for (; bucket; bucket = bucket->next)
-        ++count;
-    return count;
-}
-
 static void update_dist(int count)
 {
     if (count >= DIST_LIMIT)
@@ -101,21 +59,30 @@ static void update_dist(int count)
         ++dist[count];
 }
 
+/* Distance of each key from its home slot, must match xf86drmHash.c */
+static unsigned long probe_length(HashTablePtr table, unsigned long i)
+{
+    uint64_t hash = table->slots[i].key;
+
+    hash ^= hash >> 33;
+    hash *= 0x9e3779b97f4a7c15ull;
+
+    return (i - (unsigned long)(hash >> table->shift)) & table->mask;
+}
+
 static void compute_dist(HashTablePtr table)
 {
-    int           i;
-    HashBucketPtr bucket;
+    unsigned long i;
 
-    printf("Entries = %ld, hits = %ld, partials = %ld, misses = %ld\n",
-          table->entries, table->hits, table->partials, table->misses);
+    printf("Entries = %ld, slots = %ld\n", table->entries, table->mask + 1);
     clear_dist();
-    for (i = 0; i < HASH_SIZE; i++) {
-        bucket = table->buckets[i];
-        update_dist(count_entries(bucket));
+    for (i = 0; i <= table->mask; i++) {
+        if (table->tags[i])
+            update_dist(probe_length(table, i));
     }
     for (i = 0; i < DIST_LIMIT; i++) {
         if (i != DIST_LIMIT-1)
-            printf("%5d %10d\n", i, dist[i]);
+            printf("%5ld %10d\n", i, dist[i]);
         else
             printf("other %10d\n", dist[i]);
     }
@@ -152,6 +119,230 @@ static int check_table(HashTablePtr table,
     return retcode;
 }
 
+/* Distinct, scattered keys: multiplying by an odd constant is a bijection */
+static unsigned long bench_key(unsigned long i)
+{
+    return (i + 1) * 2654435761ul;
+}
+
+/* Delete each entry as the walk visits it, which must see every key once */
+static int check_walk_delete(unsigned long count)
+{
+    void *table = drmHashCreate(), *seen = drmHashCreate(), *value;
+    unsigned long i, key, visited = 0;
+    int ret = 0, more;
+
+    for (i = 0; i < count; i++)
+        drmHashInsert(table, bench_key(i), (void *)i);
+
+    for (more = drmHashFirst(table, &key, &value); more;
+         more = drmHashNext(table, &key, &value)) {
+        if (drmHashInsert(seen, key, value)) {
+            printf("Key visited twice: key = %lu\n", key);
+            ret = -1;
+        }
+        drmHashDelete(table, key);
+        visited++;
+    }
+
+    if (visited != count || ((HashTablePtr)table)->entries) {
+        printf("Walk visited %lu of %lu keys, %lu left\n", visited, count,
+               ((HashTablePtr)table)->entries);
+        ret = -1;
+    }
+
+    drmHashDestroy(seen);
+    drmHashDestroy(table);
+    return ret;
+}
+
+/* Drain by deleting the first entry until none is left, in linear time */
+static int check_drain(unsigned long count)
+{
+    void *table = drmHashCreate(), *value;
+    unsigned long i, key;
+    int ret = 0;
+
+    for (i = 0; i < count; i++)
+        drmHashInsert(table, bench_key(i), (void *)i);
+
+    for (i = 0; drmHashFirst(table, &key, &value); i++)
+        drmHashDelete(table, key);
+
+    if (i != count) {
+        printf("Drained %lu of %lu keys\n", i, count);
+        ret = -1;
+    }
+
+    drmHashDestroy(table);
+    return ret;
+}
+
+static void *registry_get(void *value, void *data)
+{
+    /* odd values stand for objects being torn down */
+    return ((unsigned long)value & 1) ? NULL : value;
+}
+
+static void *registry_create(unsigned long key, void *data)
+{
+    return (void *)(key << 1);
+}
+
+static void *registry_create_stale(unsigned long key, void *data)
+{
+    return (void *)(key << 1 | 1);
+}
+
+static int check_registry(void)
+{
+    drmRegistryPtr reg = drmRegistryCreate();
+    unsigned long i;
+    int ret = 0;
+
+    if (!reg)
+        return -1;
+
+    for (i = 0; i < 1024; i++)
+        if (drmRegistryGet(reg, i, registry_get, registry_create, NULL) !=
+            (void *)(i << 1))
+            ret = -1;
+
+    for (i = 0; i < 1024; i++)
+        if (drmRegistryLookup(reg, i) != (void *)(i << 1))
+            ret = -1;
+
+    /* a value get() rejects is replaced */
+    drmRegistryRemove(reg, 7, (void *)14);
+    drmRegistryGet(reg, 7, NULL, registry_create_stale, NULL);
+    if (drmRegistryGet(reg, 7, registry_get, registry_create, NULL) !=
+        (void *)14)
+        ret = -1;
+
+    /* only the current value is removed */
+    if (drmRegistryRemove(reg, 8, (void *)0) != 1 ||
+        drmRegistryLookup(reg, 8) != (void *)16 ||
+        drmRegistryRemove(reg, 8, (void *)16) != 0 ||
+        drmRegistryLookup(reg, 8) != NULL)
+        ret = -1;
+
+    drmRegistryDestroy(reg);
+
+    if (ret)
+        printf("registry check failed\n");
+
+    return ret;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double first = *(const double *)a, second = *(const double *)b;
+
+    return first < second ? -1 : first > second;
+}
+
+#define LATENCY_SAMPLES 1000
+
+static void bench(unsigned long count)
+{
+    static double latency[LATENCY_SAMPLES];
+    double start, insert, hit, miss, delete;
+    unsigned long i, step;
+    void *table, *value;
+
+    table = drmHashCreate();
+
+    start = now();
+    for (i = 0; i < count; i++)
+        drmHashInsert(table, bench_key(i), (void *)i);
+    insert = now() - start;
+
+    start = now();
+    for (i = 0; i < count; i++)
+        drmHashLookup(table, bench_key(i), &value);
+    hit = now() - start;
+
+    start = now();
+    for (i = count; i < 2 * count; i++)
+        drmHashLookup(table, bench_key(i), &value);
+    miss = now() - start;
+
+    /* time single lookups spread over the table */
+    step = count / LATENCY_SAMPLES ? count / LATENCY_SAMPLES : 1;
+    for (i = 0; i < LATENCY_SAMPLES; i++) {
+        start = now();
+        drmHashLookup(table, bench_key((i * step) % count), &value);
+        latency[i] = now() - start;
+    }
+    qsort(latency, LATENCY_SAMPLES, sizeof(latency[0]), compare_double);
+
+    start = now();
+    for (i = 0; i < count; i++)
+        drmHashDelete(table, bench_key(i));
+    delete = now() - start;
+
+    drmHashDestroy(table);
+
+    printf("%8lu %10.1f %10.1f %10.1f %10.1f %8.0f %8.0f\n", count,
+           insert / count, hit / count, miss / count, delete / count,
+           latency[LATENCY_SAMPLES / 2], latency[LATENCY_SAMPLES * 99 / 100]);
+}
+
+/* Best of a few passes of looking up all count keys, in ns per lookup */
+static double registry_lookup_time(unsigned long count)
+{
+    drmRegistryPtr reg = drmRegistryCreate();
+    double start, best = 0;
+    unsigned long i;
+    int pass;
+
+    if (!reg)
+        return -1;
+
+    for (i = 0; i < count; i++)
+        drmRegistryGet(reg, bench_key(i), NULL, registry_create, NULL);
+
+    for (pass = 0; pass < 5; pass++) {
+        start = now();
+        for (i = 0; i < count; i++)
+            drmRegistryLookup(reg, bench_key(i));
+        if (!pass || now() - start < best)
+            best = now() - start;
+    }
+
+    drmRegistryDestroy(reg);
+
+    return best / count;
+}
+
+/*
+ * Lookups have to stay about as fast with 64 times the keys.  Picking the
+ * shard with bits the shard tables index with made them 20 times slower.
+ */
+static int check_registry_scaling(void)
+{
+    double small = registry_lookup_time(1024);
+    double large = registry_lookup_time(65536);
+
+    printf("registry lookup: %.1f ns with 1K keys, %.1f ns with 64K keys\n",
+           small, large);
+
+    if (small < 0 || large < 0 || large > 5 * small) {
+        printf("registry lookups do not scale\n");
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(void)
 {
     HashTablePtr  table;
@@ -213,5 +404,46 @@ int main(void)
     compute_dist(table);
     drmHashDestroy(table);
 
+    printf("\n***** 5000 random integers, every other one deleted ****\n");
+    table = drmHashCreate();
+    srandom(0xbeefbeef);
+    for (i = 0; i < 5000; i++)
+        drmHashInsert(table, random(), (void *)(i << 16 | i));
+    srandom(0xbeefbeef);
+    for (i = 0; i < 5000; i++) {
+        unsigned long key = random();
+
+        if (i & 1)
+            drmHashDelete(table, key);
+    }
+    srandom(0xbeefbeef);
+    for (i = 0; i < 5000; i++) {
+        unsigned long key = random();
+        void *value;
+
+        if (!(i & 1))
+            ret |= check_table(table, key, (void *)(i << 16 | i));
+        else if (drmHashLookup(table, key, &value) != 1) {
+            printf("Deleted key found: key = %lu\n", key);
+            ret = -1;
+        }
+    }
+    compute_dist(table);
+    drmHashDestroy(table);
+
+    printf("\n***** deleting while walking ****\n");
+    ret |= check_walk_delete(5000);
+    ret |= check_drain(1000000);
+
+    printf("\n***** sharded registry ****\n");
+    ret |= check_registry();
+    ret |= check_registry_scaling();
+
+    printf("\n***** throughput (ns/op) and lookup latency (ns) ****\n");
+    printf("%8s %10s %10s %10s %10s %8s %8s\n", "keys", "insert",
+           "hit", "miss", "delete", "p50", "p99");
+    for (i = 1000; i <= 1000000; i *= 10)
+        bench(i);
+
     return ret;
 }
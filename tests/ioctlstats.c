@@ -0,0 +1,226 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the ioctl statistics: that requests sharing an ioctl number are
+ * counted apart, that errors are counted, and that the latency histogram
+ * is in microseconds.  The ioctls are intercepted, so no device is needed.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "xf86drm.h"
+
+#include "fake_ioctl.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* same ioctl number as DRM_IOCTL_GEM_CLOSE, but another request */
+#define TEST_IOCTL_SHARED DRM_IOWR(0x09, uint64_t)
+
+/* GEM_CLOSE takes at least this long */
+#define SLOW_NS 64000
+
+#define FAIL_FD 1
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int fake_stats_ioctl(int fd, unsigned long request, void *arg)
+{
+	uint64_t start = now_ns();
+
+	if (fd == FAIL_FD) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (request == DRM_IOCTL_GEM_CLOSE)
+		while (now_ns() - start < SLOW_NS)
+			;
+
+	return 0;
+}
+
+static const drmIoctlStats *find_stats(const drmIoctlStats *stats, int count,
+				       unsigned long request)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (stats[i].request == request)
+			return &stats[i];
+
+	return NULL;
+}
+
+static int test_requests(void)
+{
+	drmIoctlStats stats[8];
+	const drmIoctlStats *s;
+	struct drm_gem_close close;
+	uint64_t value = 0;
+	unsigned int i;
+	int count, ret = 0;
+
+	memset(&close, 0, sizeof(close));
+
+	drmResetIoctlStats();
+
+	for (i = 0; i < 10; i++)
+		drmIoctl(3, DRM_IOCTL_GEM_CLOSE, &close);
+
+	for (i = 0; i < 5; i++)
+		drmIoctl(i < 2 ? FAIL_FD : 3, TEST_IOCTL_SHARED, &value);
+
+	count = drmGetIoctlStats(stats, ARRAY_SIZE(stats));
+	if (count != 2) {
+		printf("requests: %d entries instead of 2\n", count);
+		return -1;
+	}
+
+	s = find_stats(stats, count, DRM_IOCTL_GEM_CLOSE);
+	if (!s || s->count != 10 || s->errors != 0) {
+		printf("requests: GEM_CLOSE not counted apart\n");
+		ret = -1;
+	}
+
+	s = find_stats(stats, count, TEST_IOCTL_SHARED);
+	if (!s || s->count != 5 || s->errors != 2) {
+		printf("requests: shared ioctl number not counted apart\n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/* many distinct requests, in pairs that share an ioctl number */
+static int test_many_requests(void)
+{
+	drmIoctlStats stats[128];
+	uint64_t value = 0;
+	unsigned int i, j;
+	int count, ret = 0;
+
+	drmResetIoctlStats();
+
+	for (i = 0; i < 32; i++) {
+		for (j = 0; j <= i % 3; j++) {
+			drmIoctl(3, DRM_IOW(i, uint32_t), &value);
+			drmIoctl(3, DRM_IOR(i, uint64_t), &value);
+		}
+	}
+
+	count = drmGetIoctlStats(stats, ARRAY_SIZE(stats));
+	if (count != 64) {
+		printf("many requests: %d entries instead of 64\n", count);
+		return -1;
+	}
+
+	for (i = 0; i < 32; i++) {
+		const drmIoctlStats *w, *r;
+
+		w = find_stats(stats, count, DRM_IOW(i, uint32_t));
+		r = find_stats(stats, count, DRM_IOR(i, uint64_t));
+		if (!w || !r || w->count != i % 3 + 1 || r->count != i % 3 + 1) {
+			printf("many requests: ioctl 0x%02x miscounted\n", i);
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Every GEM_CLOSE takes at least 64 us, so it must land in bucket 7, for
+ * [64, 128) us, or above.  With 1.024 us units anything up to 65.5 us
+ * would land in bucket 6.
+ */
+static int test_latency(void)
+{
+	drmIoctlStats stats[8];
+	const drmIoctlStats *s;
+	struct drm_gem_close close;
+	uint64_t below = 0, total = 0;
+	unsigned int i;
+	int count;
+
+	memset(&close, 0, sizeof(close));
+
+	drmResetIoctlStats();
+
+	for (i = 0; i < 100; i++)
+		drmIoctl(3, DRM_IOCTL_GEM_CLOSE, &close);
+
+	count = drmGetIoctlStats(stats, ARRAY_SIZE(stats));
+	s = find_stats(stats, count, DRM_IOCTL_GEM_CLOSE);
+	if (!s) {
+		printf("latency: GEM_CLOSE not counted\n");
+		return -1;
+	}
+
+	for (i = 0; i < DRM_IOCTL_LATENCY_BUCKETS; i++) {
+		if (i < 7)
+			below += s->latency[i];
+		total += s->latency[i];
+	}
+
+	if (below || total != 100 || s->max_ns < SLOW_NS ||
+	    s->total_ns < 100 * SLOW_NS) {
+		printf("latency: %llu of %llu below 64 us, max %llu ns\n",
+		       (unsigned long long)below, (unsigned long long)total,
+		       (unsigned long long)s->max_ns);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	drmIoctlStats stats[1];
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_stats_ioctl);
+	drmIoctlStatsEnable(1);
+
+	ret |= test_requests();
+	ret |= test_many_requests();
+	ret |= test_latency();
+
+	drmResetIoctlStats();
+	if (drmGetIoctlStats(stats, ARRAY_SIZE(stats)) != 0) {
+		printf("reset: statistics left behind\n");
+		ret = -1;
+	}
+
+	drmIoctlStatsEnable(0);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the colour LUT helpers: known points of the transfer curves, the
+ * colour temperature tint, interpolation, and that every step of a LUT
+ * transition matches interpolating directly, whichever order the steps
+ * are visited in, with one blob per step.  The blob ioctls are
+ * intercepted, so no device is needed.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#include "fake_ioctl.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* entries at multiples of 1/8 */
+#define LUT_SIZE 1025
+
+static struct {
+	uint32_t next_id;
+	unsigned int live;
+	unsigned int created;
+} blobs;
+
+static int fake_blob_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct drm_mode_create_blob *create = arg;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_CREATEPROPBLOB:
+		if (create->length != LUT_SIZE * sizeof(struct drm_color_lut))
+			break;
+		create->blob_id = ++blobs.next_id;
+		blobs.live++;
+		blobs.created++;
+		return 0;
+	case DRM_IOCTL_MODE_DESTROYPROPBLOB:
+		blobs.live--;
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static int near(int a, int b, int tolerance)
+{
+	return abs(a - b) <= tolerance;
+}
+
+/* entry at x = eighths / 8 */
+static uint16_t at(const uint16_t *channel, unsigned int eighths)
+{
+	return channel[(LUT_SIZE - 1) * eighths / 8];
+}
+
+static int lut_near(const drmModeLut *a, const drmModeLut *b, int tolerance)
+{
+	unsigned int i;
+
+	for (i = 0; i < LUT_SIZE; i++) {
+		if (!near(a->red[i], b->red[i], tolerance) ||
+		    !near(a->green[i], b->green[i], tolerance) ||
+		    !near(a->blue[i], b->blue[i], tolerance))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int test_curves(void)
+{
+	static const struct {
+		drmModeLutCurve curve;
+		double param;
+		uint16_t quarter, half;	/* expected at x = 1/4 and 1/2 */
+	} curves[] = {
+		{ DRM_MODE_LUT_LINEAR, 0, 16384, 32768 },
+		{ DRM_MODE_LUT_POWER, 2.0, 4096, 16384 },
+		{ DRM_MODE_LUT_SRGB_EOTF, 0, 3334, 14027 },
+		{ DRM_MODE_LUT_SRGB_INV_EOTF, 0, 35199, 48192 },
+		{ DRM_MODE_LUT_PQ_EOTF, 0, 34, 605 },
+		{ DRM_MODE_LUT_PQ_INV_EOTF, 0, 55816, 60721 },
+		{ DRM_MODE_LUT_HLG_OETF, 0, 48401, 57123 },
+		{ DRM_MODE_LUT_HLG_INV_OETF, 0, 1365, 5461 },
+	};
+	drmModeLutPtr lut;
+	unsigned int i, j;
+	int ret = 0;
+
+	lut = drmModeLutCreate(LUT_SIZE);
+	if (!lut || drmModeLutCreate(1))
+		return -1;
+
+	for (i = 0; i < ARRAY_SIZE(curves); i++) {
+		if (drmModeLutFillCurve(lut, curves[i].curve,
+					curves[i].param)) {
+			printf("curve %u: refused\n", i);
+			ret = -1;
+			continue;
+		}
+
+		for (j = 1; j < LUT_SIZE; j++)
+			if (lut->red[j] < lut->red[j - 1])
+				break;
+
+		if (j < LUT_SIZE || lut->red[0] != 0 ||
+		    lut->red[LUT_SIZE - 1] != 0xffff ||
+		    !near(at(lut->red, 2), curves[i].quarter, 1) ||
+		    !near(at(lut->red, 4), curves[i].half, 1) ||
+		    memcmp(lut->red, lut->green, LUT_SIZE * 2) ||
+		    memcmp(lut->red, lut->blue, LUT_SIZE * 2)) {
+			printf("curve %u: %u at 1/4, %u at 1/2\n", i,
+			       at(lut->red, 2), at(lut->red, 4));
+			ret = -1;
+		}
+	}
+
+	if (drmModeLutFillCurve(lut, DRM_MODE_LUT_POWER, 0) != -EINVAL ||
+	    drmModeLutFillCurve(lut, DRM_MODE_LUT_HLG_INV_OETF + 1, 0) !=
+	    -EINVAL) {
+		printf("curves: invalid curve accepted\n");
+		ret = -1;
+	}
+
+	drmModeLutFree(lut);
+
+	return ret;
+}
+
+static int test_tint(void)
+{
+	drmModeLutPtr lut;
+	int ret = 0;
+
+	lut = drmModeLutCreate(LUT_SIZE);
+	if (!lut)
+		return -1;
+
+	drmModeLutFillCurve(lut, DRM_MODE_LUT_LINEAR, 0);
+
+	/* at 2000 K, green is at about 54% of red and blue at 5% */
+	if (drmModeLutTint(lut, 2000) ||
+	    lut->red[LUT_SIZE - 1] != 0xffff ||
+	    !near(lut->green[LUT_SIZE - 1], 35175, 200) ||
+	    !near(lut->blue[LUT_SIZE - 1], 3573, 200) ||
+	    lut->green[0] || lut->blue[0]) {
+		printf("tint: %u %u %u at 2000 K\n", lut->red[LUT_SIZE - 1],
+		       lut->green[LUT_SIZE - 1], lut->blue[LUT_SIZE - 1]);
+		ret = -1;
+	}
+
+	/* 6500 K is close to neutral */
+	drmModeLutFillCurve(lut, DRM_MODE_LUT_LINEAR, 0);
+	if (drmModeLutTint(lut, 6500) ||
+	    lut->green[LUT_SIZE - 1] < 0xfc00 ||
+	    lut->blue[LUT_SIZE - 1] < 0xf800) {
+		printf("tint: %u %u %u at 6500 K\n", lut->red[LUT_SIZE - 1],
+		       lut->green[LUT_SIZE - 1], lut->blue[LUT_SIZE - 1]);
+		ret = -1;
+	}
+
+	if (drmModeLutTint(lut, 999) != -EINVAL ||
+	    drmModeLutTint(lut, 40001) != -EINVAL) {
+		printf("tint: invalid temperature accepted\n");
+		ret = -1;
+	}
+
+	drmModeLutFree(lut);
+
+	return ret;
+}
+
+static int test_interpolate(void)
+{
+	drmModeLutPtr from, to, lut, small;
+	unsigned int i;
+	int ret = 0;
+
+	from = drmModeLutCreate(LUT_SIZE);
+	to = drmModeLutCreate(LUT_SIZE);
+	lut = drmModeLutCreate(LUT_SIZE);
+	small = drmModeLutCreate(LUT_SIZE / 2);
+	if (!from || !to || !lut || !small)
+		return -1;
+
+	drmModeLutFillCurve(from, DRM_MODE_LUT_LINEAR, 0);
+	drmModeLutFillCurve(to, DRM_MODE_LUT_SRGB_INV_EOTF, 0);
+	drmModeLutTint(to, 3000);
+
+	if (drmModeLutInterpolate(lut, from, to, 0) ||
+	    !lut_near(lut, from, 0) ||
+	    drmModeLutInterpolate(lut, from, to, 0x10000) ||
+	    !lut_near(lut, to, 0)) {
+		printf("interpolate: ends do not match\n");
+		ret = -1;
+	}
+
+	drmModeLutInterpolate(lut, from, to, 0x8000);
+	for (i = 0; i < LUT_SIZE; i++) {
+		if (lut->red[i] != (from->red[i] + to->red[i] + 1) / 2 ||
+		    lut->blue[i] != (from->blue[i] + to->blue[i] + 1) / 2) {
+			printf("interpolate: entry %u off the midpoint\n", i);
+			ret = -1;
+			break;
+		}
+	}
+
+	if (drmModeLutInterpolate(lut, from, to, 0x10001) != -EINVAL ||
+	    drmModeLutInterpolate(small, from, to, 0) != -EINVAL) {
+		printf("interpolate: invalid arguments accepted\n");
+		ret = -1;
+	}
+
+	drmModeLutFree(from);
+	drmModeLutFree(to);
+	drmModeLutFree(lut);
+	drmModeLutFree(small);
+
+	return ret;
+}
+
+static int check_step(drmModeLutTransitionPtr transition,
+		      const drmModeLut *from, const drmModeLut *to,
+		      uint32_t steps, uint32_t step, drmModeLutPtr lut,
+		      drmModeLutPtr expected)
+{
+	if (drmModeLutTransitionGetLut(transition, step, lut))
+		return -1;
+
+	drmModeLutInterpolate(expected, from, to,
+			      (uint64_t)step * 0x10000 / steps);
+
+	return lut_near(lut, expected, 1) ? 0 : -1;
+}
+
+static int test_transition(void)
+{
+	static const uint32_t order[] = { 0, 1, 2, 3, 7, 6, 30, 59, 60, 5, 6 };
+	drmModeLutTransitionPtr transition;
+	drmModeLutPtr from, to, lut, expected;
+	uint32_t steps = 60, id, ids[61];
+	unsigned int i;
+	int ret = 0;
+
+	from = drmModeLutCreate(LUT_SIZE);
+	to = drmModeLutCreate(LUT_SIZE);
+	lut = drmModeLutCreate(LUT_SIZE);
+	expected = drmModeLutCreate(LUT_SIZE);
+	if (!from || !to || !lut || !expected)
+		return -1;
+
+	/* channels that go up and down */
+	drmModeLutFillCurve(from, DRM_MODE_LUT_SRGB_INV_EOTF, 0);
+	drmModeLutFillCurve(to, DRM_MODE_LUT_LINEAR, 0);
+	drmModeLutTint(to, 1500);
+	drmModeLutTint(from, 9000);
+
+	transition = drmModeLutTransitionCreate(3, from, to, steps);
+	if (!transition || drmModeLutTransitionCreate(3, from, to, 0)) {
+		printf("transition: not created\n");
+		return -1;
+	}
+
+	for (i = 0; i <= steps; i++) {
+		if (check_step(transition, from, to, steps, i, lut, expected)) {
+			printf("transition: step %u off\n", i);
+			ret = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(order); i++) {
+		if (check_step(transition, from, to, steps, order[i], lut,
+			       expected)) {
+			printf("transition: step %u off after seeking\n",
+			       order[i]);
+			ret = -1;
+			break;
+		}
+	}
+
+	if (drmModeLutTransitionGetLut(transition, steps + 1, lut) != -EINVAL)
+		ret = -1;
+
+	/* one blob per step, created on first use and kept */
+	for (i = 0; i <= steps; i++) {
+		if (drmModeLutTransitionGetBlob(transition, i, &ids[i])) {
+			printf("transition: no blob for step %u\n", i);
+			ret = -1;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(order); i++) {
+		if (drmModeLutTransitionGetBlob(transition, order[i], &id) ||
+		    id != ids[order[i]]) {
+			printf("transition: blob of step %u changed\n",
+			       order[i]);
+			ret = -1;
+		}
+	}
+
+	if (blobs.created != steps + 1 || blobs.live != steps + 1) {
+		printf("transition: %u blobs created\n", blobs.created);
+		ret = -1;
+	}
+
+	drmModeLutTransitionFree(transition);
+
+	if (blobs.live) {
+		printf("transition: %u blobs left\n", blobs.live);
+		ret = -1;
+	}
+
+	drmModeLutFree(from);
+	drmModeLutFree(to);
+	drmModeLutFree(lut);
+	drmModeLutFree(expected);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_blob_ioctl);
+
+	ret |= test_curves();
+	ret |= test_tint();
+	ret |= test_interpolate();
+	ret |= test_transition();
+
+	return ret ? 1 : 0;
+}
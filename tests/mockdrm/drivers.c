@@ -0,0 +1,352 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the msm, etnaviv, amdgpu and radeon emulations of the mock DRM
+ * device through their raw ioctls: that BOs can be created and mapped,
+ * that a submitted job keeps its BOs and fence busy for the execution
+ * latency, and that non-blocking waits report that while blocking waits
+ * return once the job is done.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "etnaviv_drm.h"
+#include "msm_drm.h"
+#include "radeon_drm.h"
+
+#include "mockdrm.h"
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: %s failed\n", __func__,	\
+				__LINE__, #cond);			\
+			return 1;					\
+		}							\
+	} while (0)
+
+/* how long each job runs, long enough to catch it busy */
+#define EXEC_NS 20000000ull
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Write to a BO through one mapping and read it back through another */
+static int check_mmap(int fd, uint64_t offset)
+{
+	uint32_t *a, *b;
+	int ret = 0;
+
+	a = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	b = mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, offset);
+	if (a == MAP_FAILED || b == MAP_FAILED)
+		return 1;
+
+	a[0] = 0xdeadbeef;
+	if (b[0] != 0xdeadbeef)
+		ret = 1;
+
+	munmap(a, 4096);
+	munmap(b, 4096);
+
+	return ret;
+}
+
+static int check_msm(void)
+{
+	struct drm_msm_gem_new bo = { .size = 4096 };
+	struct drm_msm_gem_info info = { 0 };
+	struct drm_msm_submitqueue queue = { 0 };
+	struct drm_msm_gem_submit_bo submit_bo = { 0 };
+	struct drm_msm_gem_submit submit = { 0 };
+	struct drm_msm_gem_cpu_prep prep = { 0 };
+	struct drm_msm_wait_fence wait = { 0 };
+	struct drm_msm_param param = { .param = MSM_PARAM_GPU_ID };
+	uint64_t deadline;
+	int fd;
+
+	fd = mock_drm_open(MOCK_DRM_MSM);
+	CHECK(fd >= 0);
+	CHECK(!mock_drm_set_latency(fd, MOCK_DRM_LATENCY_EXEC, EXEC_NS));
+
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_GET_PARAM, &param));
+	CHECK(param.value == 630);
+
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_GEM_NEW, &bo));
+	info.handle = bo.handle;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_GEM_INFO, &info));
+	CHECK(!check_mmap(fd, info.offset));
+
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_SUBMITQUEUE_NEW, &queue));
+	CHECK(queue.id != 0);
+
+	submit_bo.handle = bo.handle;
+	submit.queueid = queue.id;
+	submit.nr_bos = 1;
+	submit.bos = (uintptr_t)&submit_bo;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_GEM_SUBMIT, &submit));
+	CHECK(submit.fence == 1);
+
+	/* the job has not finished, so neither the BO nor the fence is idle */
+	prep.handle = bo.handle;
+	prep.op = MSM_PREP_READ | MSM_PREP_NOSYNC;
+	CHECK(drmIoctl(fd, DRM_IOCTL_MSM_GEM_CPU_PREP, &prep) == -1 &&
+	      errno == EBUSY);
+
+	/* the fence is on the new queue, the default one never gets there */
+	wait.fence = submit.fence;
+	deadline = now_ns() + EXEC_NS / 10;
+	wait.timeout.tv_sec = deadline / 1000000000;
+	wait.timeout.tv_nsec = deadline % 1000000000;
+	CHECK(drmIoctl(fd, DRM_IOCTL_MSM_WAIT_FENCE, &wait) == -1 &&
+	      errno == ETIMEDOUT);
+
+	deadline = now_ns() + 10 * EXEC_NS;
+	wait.timeout.tv_sec = deadline / 1000000000;
+	wait.timeout.tv_nsec = deadline % 1000000000;
+	wait.queueid = queue.id;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_WAIT_FENCE, &wait));
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_GEM_CPU_PREP, &prep));
+
+	CHECK(!drmIoctl(fd, DRM_IOCTL_MSM_SUBMITQUEUE_CLOSE, &queue.id));
+	CHECK(drmIoctl(fd, DRM_IOCTL_MSM_WAIT_FENCE, &wait) == -1 &&
+	      errno == ENOENT);
+
+	mock_drm_close(fd);
+
+	return 0;
+}
+
+static int check_etnaviv(void)
+{
+	struct drm_etnaviv_gem_new bo = { .size = 4096 };
+	struct drm_etnaviv_gem_info info = { 0 };
+	struct drm_etnaviv_gem_submit_bo submit_bo = { 0 };
+	struct drm_etnaviv_gem_submit submit = { 0 };
+	struct drm_etnaviv_wait_fence wait = { 0 };
+	struct drm_etnaviv_gem_wait bo_wait = { 0 };
+	struct mock_drm_stats stats;
+	uint64_t deadline;
+	int fd;
+
+	fd = mock_drm_open(MOCK_DRM_ETNAVIV);
+	CHECK(fd >= 0);
+	CHECK(!mock_drm_set_latency(fd, MOCK_DRM_LATENCY_EXEC, EXEC_NS));
+
+	CHECK(!drmIoctl(fd, DRM_IOCTL_ETNAVIV_GEM_NEW, &bo));
+	info.handle = bo.handle;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_ETNAVIV_GEM_INFO, &info));
+	CHECK(!check_mmap(fd, info.offset));
+
+	submit_bo.handle = bo.handle;
+	submit.nr_bos = 1;
+	submit.bos = (uintptr_t)&submit_bo;
+	submit.nr_relocs = 3;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_ETNAVIV_GEM_SUBMIT, &submit));
+
+	/* a second job queues behind the first */
+	CHECK(!drmIoctl(fd, DRM_IOCTL_ETNAVIV_GEM_SUBMIT, &submit));
+	CHECK(submit.fence == 2);
+
+	wait.fence = 1;
+	wait.flags = ETNA_WAIT_NONBLOCK;
+	CHECK(drmIoctl(fd, DRM_IOCTL_ETNAVIV_WAIT_FENCE, &wait) == -1 &&
+	      errno == EBUSY);
+
+	deadline = now_ns() + 10 * EXEC_NS;
+	wait.flags = 0;
+	wait.timeout.tv_sec = deadline / 1000000000;
+	wait.timeout.tv_nsec = deadline % 1000000000;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_ETNAVIV_WAIT_FENCE, &wait));
+
+	/* the BO is busy until the second job is done */
+	bo_wait.handle = bo.handle;
+	bo_wait.flags = ETNA_WAIT_NONBLOCK;
+	CHECK(drmIoctl(fd, DRM_IOCTL_ETNAVIV_GEM_WAIT, &bo_wait) == -1 &&
+	      errno == EBUSY);
+
+	bo_wait.flags = 0;
+	bo_wait.timeout = wait.timeout;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_ETNAVIV_GEM_WAIT, &bo_wait));
+
+	CHECK(!mock_drm_get_stats(fd, &stats));
+	CHECK(stats.submits == 2 && stats.relocs == 6 && stats.bos == 1);
+
+	mock_drm_close(fd);
+
+	return 0;
+}
+
+static int check_amdgpu(void)
+{
+	union drm_amdgpu_gem_create bo = { .in.bo_size = 4096 };
+	union drm_amdgpu_gem_mmap map = { { 0 } };
+	union drm_amdgpu_ctx ctx = { { 0 } };
+	union drm_amdgpu_bo_list list = { { 0 } };
+	union drm_amdgpu_cs cs = { { 0 } };
+	union drm_amdgpu_wait_cs wait = { { 0 } };
+	union drm_amdgpu_gem_wait_idle idle = { { 0 } };
+	struct drm_amdgpu_bo_list_entry entry = { 0 };
+	uint64_t deadline, seq;
+	uint32_t handle, ctx_id, list_id;
+	int fd;
+
+	fd = mock_drm_open(MOCK_DRM_AMDGPU);
+	CHECK(fd >= 0);
+	CHECK(!mock_drm_set_latency(fd, MOCK_DRM_LATENCY_EXEC, EXEC_NS));
+
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_GEM_CREATE, &bo));
+	handle = bo.out.handle;
+	map.in.handle = handle;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_GEM_MMAP, &map));
+	CHECK(!check_mmap(fd, map.out.addr_ptr));
+
+	ctx.in.op = AMDGPU_CTX_OP_ALLOC_CTX;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_CTX, &ctx));
+	ctx_id = ctx.out.alloc.ctx_id;
+
+	entry.bo_handle = handle;
+	list.in.operation = AMDGPU_BO_LIST_OP_CREATE;
+	list.in.bo_number = 1;
+	list.in.bo_info_size = sizeof(entry);
+	list.in.bo_info_ptr = (uintptr_t)&entry;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_BO_LIST, &list));
+	list_id = list.out.list_handle;
+
+	cs.in.ctx_id = ctx_id;
+	cs.in.bo_list_handle = list_id;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_CS, &cs));
+	seq = cs.out.handle;
+
+	/* a timeout is a status, not an error */
+	wait.in.handle = seq;
+	wait.in.ctx_id = ctx_id;
+	wait.in.timeout = 0;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_WAIT_CS, &wait));
+	CHECK(wait.out.status == 1);
+
+	idle.in.handle = handle;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_GEM_WAIT_IDLE, &idle));
+	CHECK(idle.out.status == 1);
+
+	deadline = now_ns() + 10 * EXEC_NS;
+	memset(&wait, 0, sizeof(wait));
+	wait.in.handle = seq;
+	wait.in.ctx_id = ctx_id;
+	wait.in.timeout = deadline;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_WAIT_CS, &wait));
+	CHECK(wait.out.status == 0);
+
+	memset(&idle, 0, sizeof(idle));
+	idle.in.handle = handle;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_GEM_WAIT_IDLE, &idle));
+	CHECK(idle.out.status == 0);
+
+	memset(&list, 0, sizeof(list));
+	list.in.operation = AMDGPU_BO_LIST_OP_DESTROY;
+	list.in.list_handle = list_id;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_BO_LIST, &list));
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.in.op = AMDGPU_CTX_OP_FREE_CTX;
+	ctx.in.ctx_id = ctx_id;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_AMDGPU_CTX, &ctx));
+
+	mock_drm_close(fd);
+
+	return 0;
+}
+
+static int check_radeon(void)
+{
+	struct drm_radeon_gem_create bo = { .size = 4096 };
+	struct drm_radeon_gem_mmap map = { 0 };
+	struct drm_radeon_gem_busy busy = { 0 };
+	struct drm_radeon_gem_wait_idle idle = { 0 };
+	struct drm_radeon_cs_reloc reloc = { 0 };
+	struct drm_radeon_cs_chunk chunk = { 0 };
+	struct drm_radeon_cs cs = { 0 };
+	struct mock_drm_stats stats;
+	uint64_t chunks[1];
+	uint64_t start;
+	int fd;
+
+	fd = mock_drm_open(MOCK_DRM_RADEON);
+	CHECK(fd >= 0);
+	CHECK(!mock_drm_set_latency(fd, MOCK_DRM_LATENCY_EXEC, EXEC_NS));
+
+	CHECK(!drmIoctl(fd, DRM_IOCTL_RADEON_GEM_CREATE, &bo));
+	map.handle = bo.handle;
+	map.size = 4096;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_RADEON_GEM_MMAP, &map));
+	CHECK(!check_mmap(fd, map.addr_ptr));
+
+	/* the BO is used through the relocation chunk */
+	reloc.handle = bo.handle;
+	chunk.chunk_id = RADEON_CHUNK_ID_RELOCS;
+	chunk.length_dw = sizeof(reloc) / 4;
+	chunk.chunk_data = (uintptr_t)&reloc;
+	chunks[0] = (uintptr_t)&chunk;
+	cs.num_chunks = 1;
+	cs.chunks = (uintptr_t)chunks;
+
+	start = now_ns();
+	CHECK(!drmIoctl(fd, DRM_IOCTL_RADEON_CS, &cs));
+
+	busy.handle = bo.handle;
+	CHECK(drmIoctl(fd, DRM_IOCTL_RADEON_GEM_BUSY, &busy) == -1 &&
+	      errno == EBUSY);
+
+	idle.handle = bo.handle;
+	CHECK(!drmIoctl(fd, DRM_IOCTL_RADEON_GEM_WAIT_IDLE, &idle));
+	CHECK(now_ns() - start >= EXEC_NS);
+	CHECK(!drmIoctl(fd, DRM_IOCTL_RADEON_GEM_BUSY, &busy));
+
+	CHECK(!mock_drm_get_stats(fd, &stats));
+	CHECK(stats.submits == 1 && stats.relocs == 1 && stats.waits == 1);
+
+	mock_drm_close(fd);
+
+	return 0;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= check_msm();
+	ret |= check_etnaviv();
+	ret |= check_amdgpu();
+	ret |= check_radeon();
+
+	return ret;
+}
@@ -0,0 +1,1730 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "etnaviv_drm.h"
+#include "msm_drm.h"
+#include "radeon_drm.h"
+#include "tegra_drm.h"
+
+#include "fake_ioctl.h"
+#include "mockdrm.h"
+
+#define MOCK_MAX_DEVICES 16
+#define MOCK_NEVER UINT64_MAX
+
+/* keeps BOs apart, so that tegra's debug guard pages can be mapped */
+#define MOCK_BO_GAP 4096
+#define MOCK_BO_ALIGN(x) (((x) + 4095) & ~(uint64_t)4095)
+
+#define U642PTR(x) ((void *)(uintptr_t)(x))
+
+struct mock_bo {
+	uint64_t size;
+	uint64_t offset;	/* in the backing memfd */
+	uint64_t busy_until;
+	unsigned int handles;	/* in all devices */
+	uint32_t name;
+	int prime_fd;
+	ino_t prime_ino;
+	uint32_t flags;
+	uint32_t tiling_mode;
+	uint32_t tiling_value;
+};
+
+struct mock_fence {
+	uint64_t value;
+	uint64_t done;
+};
+
+/*
+ * A sequence of fences, standing in for a tegra syncpoint, an msm
+ * submitqueue, an amdgpu context or the single ring of the others.
+ */
+struct mock_timeline {
+	bool used;
+	uint64_t value;		/* of the last job submitted */
+	uint64_t signaled;
+	struct mock_fence *pending;
+	unsigned int first;
+	unsigned int count;
+	unsigned int size;
+};
+
+struct mock_bo_list {
+	bool used;
+	uint32_t *handles;
+	unsigned int count;
+};
+
+struct mock_device {
+	int fd;
+	enum mock_drm_driver driver;
+	uint64_t latency[MOCK_DRM_LATENCY_COUNT];
+	uint64_t engine_idle;	/* when the last job submitted completes */
+
+	struct mock_bo **handles;
+	unsigned int num_handles;
+	unsigned int free_handle;	/* no free handle below this one */
+
+	struct mock_timeline *timelines;
+	unsigned int num_timelines;
+
+	struct mock_bo_list *bo_lists;
+	unsigned int num_bo_lists;
+
+	struct mock_drm_stats stats;
+};
+
+/* what an ioctl does after the lock is dropped */
+struct mock_wait {
+	uint64_t until;
+	uint64_t spin;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	int memfd;
+	uint64_t memfd_size;
+	uint64_t next_offset;
+	struct mock_device *devices[MOCK_MAX_DEVICES];
+	struct mock_bo **names;
+	unsigned int num_names;
+	unsigned int free_name;
+	struct mock_bo **primes;
+	unsigned int num_primes;
+} mock = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.memfd = -1,
+};
+
+static const struct {
+	const char *name;
+	int major, minor, patchlevel;
+} mock_versions[] = {
+	[MOCK_DRM_GENERIC] = { "mock", 1, 0, 0 },
+	[MOCK_DRM_TEGRA] = { "tegra", 1, 0, 0 },
+	[MOCK_DRM_MSM] = { "msm", 1, 3, 0 },
+	[MOCK_DRM_ETNAVIV] = { "etnaviv", 1, 2, 0 },
+	[MOCK_DRM_AMDGPU] = { "amdgpu", 3, 27, 0 },
+	[MOCK_DRM_RADEON] = { "radeon", 2, 50, 0 },
+};
+
+static uint64_t mock_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t mock_timespec(int64_t sec, int64_t nsec)
+{
+	if (sec < 0)
+		return 0;
+
+	return sec * 1000000000ull + nsec;
+}
+
+static void *mock_grow(void *array, unsigned int *size, size_t elem,
+		       unsigned int min)
+{
+	unsigned int new_size = *size ? *size * 2 : 16;
+
+	while (new_size <= min)
+		new_size *= 2;
+
+	array = realloc(array, new_size * elem);
+	if (!array)
+		return NULL;
+
+	memset((char *)array + *size * elem, 0, (new_size - *size) * elem);
+	*size = new_size;
+
+	return array;
+}
+
+static struct mock_device *mock_find(int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < MOCK_MAX_DEVICES; i++)
+		if (mock.devices[i] && mock.devices[i]->fd == fd)
+			return mock.devices[i];
+
+	return NULL;
+}
+
+/*
+ * Timelines
+ */
+
+static int mock_timeline_new(struct mock_device *dev)
+{
+	struct mock_timeline *timelines;
+	unsigned int i;
+
+	for (i = 0; i < dev->num_timelines; i++)
+		if (!dev->timelines[i].used)
+			break;
+
+	if (i == dev->num_timelines) {
+		timelines = mock_grow(dev->timelines, &dev->num_timelines,
+				      sizeof(*timelines), i);
+		if (!timelines)
+			return -ENOMEM;
+		dev->timelines = timelines;
+	}
+
+	dev->timelines[i].used = true;
+	return i;
+}
+
+static struct mock_timeline *mock_timeline_get(struct mock_device *dev,
+					       uint64_t id)
+{
+	if (id >= dev->num_timelines || !dev->timelines[id].used)
+		return NULL;
+
+	return &dev->timelines[id];
+}
+
+static void mock_timeline_free(struct mock_timeline *timeline)
+{
+	free(timeline->pending);
+	memset(timeline, 0, sizeof(*timeline));
+}
+
+static void mock_timeline_retire(struct mock_timeline *timeline, uint64_t now)
+{
+	while (timeline->first < timeline->count &&
+	       timeline->pending[timeline->first].done <= now)
+		timeline->signaled = timeline->pending[timeline->first++].value;
+
+	if (timeline->first == timeline->count)
+		timeline->first = timeline->count = 0;
+}
+
+/* When the timeline reaches value, or MOCK_NEVER if nothing will get it there */
+static uint64_t mock_timeline_done(struct mock_timeline *timeline,
+				   uint64_t value)
+{
+	unsigned int i;
+
+	mock_timeline_retire(timeline, mock_now());
+
+	if (value <= timeline->signaled)
+		return 0;
+
+	for (i = timeline->first; i < timeline->count; i++)
+		if (timeline->pending[i].value >= value)
+			return timeline->pending[i].done;
+
+	return MOCK_NEVER;
+}
+
+/* Queue a job on the engine, advancing the timeline by incrs when it is done */
+static int mock_submit(struct mock_device *dev, struct mock_timeline *timeline,
+		       uint64_t incrs, uint64_t *done)
+{
+	uint64_t now = mock_now();
+	struct mock_fence *pending;
+
+	mock_timeline_retire(timeline, now);
+
+	if (timeline->count == timeline->size) {
+		if (timeline->first) {
+			timeline->count -= timeline->first;
+			memmove(timeline->pending,
+				timeline->pending + timeline->first,
+				timeline->count * sizeof(*pending));
+			timeline->first = 0;
+		} else {
+			pending = mock_grow(timeline->pending, &timeline->size,
+					    sizeof(*pending), 0);
+			if (!pending)
+				return -ENOMEM;
+			timeline->pending = pending;
+		}
+	}
+
+	if (dev->engine_idle < now)
+		dev->engine_idle = now;
+	dev->engine_idle += dev->latency[MOCK_DRM_LATENCY_EXEC];
+
+	timeline->value += incrs;
+	timeline->pending[timeline->count].value = timeline->value;
+	timeline->pending[timeline->count].done = dev->engine_idle;
+	timeline->count++;
+
+	dev->stats.submits++;
+	*done = dev->engine_idle;
+
+	return 0;
+}
+
+/* Set up a wait for done, giving up at deadline */
+static int mock_wait_for(struct mock_device *dev, struct mock_wait *wait,
+			 uint64_t done, uint64_t deadline)
+{
+	uint64_t now = mock_now();
+
+	if (done <= now)
+		return 0;
+
+	if (deadline <= now)
+		return -EBUSY;
+
+	if (done == MOCK_NEVER && deadline == MOCK_NEVER)
+		return -EDEADLK;
+
+	dev->stats.waits++;
+
+	if (done <= deadline) {
+		wait->until = done;
+		return 0;
+	}
+
+	wait->until = deadline;
+	return -ETIMEDOUT;
+}
+
+/*
+ * BOs and handles
+ */
+
+static struct mock_bo *mock_bo_alloc(struct mock_device *dev, uint64_t size,
+				     struct mock_wait *wait)
+{
+	uint64_t end, new_size;
+	struct mock_bo *bo;
+
+	if (!size)
+		return NULL;
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return NULL;
+
+	end = mock.next_offset + MOCK_BO_ALIGN(size) + MOCK_BO_GAP;
+	if (end > mock.memfd_size) {
+		new_size = mock.memfd_size ? mock.memfd_size : 1 << 24;
+		while (new_size < end)
+			new_size *= 2;
+
+		if (ftruncate(mock.memfd, new_size)) {
+			free(bo);
+			return NULL;
+		}
+		mock.memfd_size = new_size;
+	}
+
+	bo->size = size;
+	bo->offset = mock.next_offset;
+	bo->prime_fd = -1;
+	mock.next_offset = end;
+
+	dev->stats.allocs++;
+	dev->stats.bos++;
+	dev->stats.bytes += size;
+	wait->spin += dev->latency[MOCK_DRM_LATENCY_ALLOC];
+
+	return bo;
+}
+
+static void mock_bo_free(struct mock_device *dev, struct mock_bo *bo)
+{
+	unsigned int i;
+
+	fallocate(mock.memfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		  bo->offset, MOCK_BO_ALIGN(bo->size));
+
+	if (bo->name) {
+		mock.names[bo->name] = NULL;
+		if (bo->name < mock.free_name)
+			mock.free_name = bo->name;
+	}
+
+	if (bo->prime_fd >= 0) {
+		for (i = 0; i < mock.num_primes; i++)
+			if (mock.primes[i] == bo)
+				mock.primes[i] = NULL;
+		close(bo->prime_fd);
+	}
+
+	dev->stats.frees++;
+	dev->stats.bos--;
+	dev->stats.bytes -= bo->size;
+
+	free(bo);
+}
+
+/* Find a free slot at or above *hint in a table indexed from 1 */
+static int mock_table_insert(struct mock_bo ***table, unsigned int *size,
+			     unsigned int *hint, struct mock_bo *bo)
+{
+	struct mock_bo **entries;
+	unsigned int i;
+
+	for (i = *hint ? *hint : 1; i < *size; i++)
+		if (!(*table)[i])
+			break;
+
+	if (i >= *size) {
+		entries = mock_grow(*table, size, sizeof(*entries), i);
+		if (!entries)
+			return -ENOMEM;
+		*table = entries;
+	}
+
+	(*table)[i] = bo;
+	*hint = i + 1;
+
+	return i;
+}
+
+static int mock_handle_new(struct mock_device *dev, struct mock_bo *bo,
+			   uint32_t *handle)
+{
+	int ret;
+
+	ret = mock_table_insert(&dev->handles, &dev->num_handles,
+				&dev->free_handle, bo);
+	if (ret < 0)
+		return ret;
+
+	bo->handles++;
+	*handle = ret;
+
+	return 0;
+}
+
+static struct mock_bo *mock_handle_get(struct mock_device *dev,
+				       uint32_t handle)
+{
+	if (handle >= dev->num_handles)
+		return NULL;
+
+	return dev->handles[handle];
+}
+
+static int mock_handle_close(struct mock_device *dev, uint32_t handle)
+{
+	struct mock_bo *bo = mock_handle_get(dev, handle);
+
+	if (!bo)
+		return -EINVAL;
+
+	dev->handles[handle] = NULL;
+	if (handle < dev->free_handle)
+		dev->free_handle = handle;
+
+	if (--bo->handles == 0)
+		mock_bo_free(dev, bo);
+
+	return 0;
+}
+
+/* Create a BO together with its first handle */
+static int mock_bo_create(struct mock_device *dev, uint64_t size,
+			  uint32_t *handle, struct mock_wait *wait)
+{
+	struct mock_bo *bo;
+	int err;
+
+	bo = mock_bo_alloc(dev, size, wait);
+	if (!bo)
+		return size ? -ENOMEM : -EINVAL;
+
+	err = mock_handle_new(dev, bo, handle);
+	if (err < 0) {
+		mock_bo_free(dev, bo);
+		return err;
+	}
+
+	return 0;
+}
+
+static void mock_bo_use(struct mock_device *dev, uint32_t handle,
+			uint64_t done)
+{
+	struct mock_bo *bo = mock_handle_get(dev, handle);
+
+	if (bo && bo->busy_until < done)
+		bo->busy_until = done;
+}
+
+static int mock_bo_wait(struct mock_device *dev, uint32_t handle,
+			uint64_t deadline, struct mock_wait *wait)
+{
+	struct mock_bo *bo = mock_handle_get(dev, handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	return mock_wait_for(dev, wait, bo->busy_until, deadline);
+}
+
+/*
+ * Core ioctls
+ */
+
+static void mock_copy_string(char *dst, __kernel_size_t *len, const char *src)
+{
+	size_t size = strlen(src);
+
+	if (dst && *len)
+		memcpy(dst, src, *len < size ? *len : size);
+	*len = size;
+}
+
+static int mock_version(struct mock_device *dev, struct drm_version *version)
+{
+	version->version_major = mock_versions[dev->driver].major;
+	version->version_minor = mock_versions[dev->driver].minor;
+	version->version_patchlevel = mock_versions[dev->driver].patchlevel;
+
+	mock_copy_string(version->name, &version->name_len,
+			 mock_versions[dev->driver].name);
+	mock_copy_string(version->date, &version->date_len, "20190101");
+	mock_copy_string(version->desc, &version->desc_len, "mock DRM device");
+
+	return 0;
+}
+
+static int mock_gem_flink(struct mock_device *dev, struct drm_gem_flink *args)
+{
+	struct mock_bo *bo = mock_handle_get(dev, args->handle);
+	int ret;
+
+	if (!bo)
+		return -ENOENT;
+
+	if (!bo->name) {
+		ret = mock_table_insert(&mock.names, &mock.num_names,
+					&mock.free_name, bo);
+		if (ret < 0)
+			return ret;
+		bo->name = ret;
+	}
+
+	args->name = bo->name;
+	return 0;
+}
+
+static int mock_gem_open(struct mock_device *dev, struct drm_gem_open *args)
+{
+	struct mock_bo *bo = NULL;
+
+	if (args->name < mock.num_names)
+		bo = mock.names[args->name];
+	if (!bo)
+		return -ENOENT;
+
+	args->size = bo->size;
+	return mock_handle_new(dev, bo, &args->handle);
+}
+
+static int mock_prime_handle_to_fd(struct mock_device *dev,
+				   struct drm_prime_handle *args)
+{
+	struct mock_bo *bo = mock_handle_get(dev, args->handle);
+	struct mock_bo **primes;
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	if (!bo)
+		return -ENOENT;
+
+	if (bo->prime_fd < 0) {
+		for (i = 0; i < mock.num_primes; i++)
+			if (!mock.primes[i])
+				break;
+
+		if (i == mock.num_primes) {
+			primes = mock_grow(mock.primes, &mock.num_primes,
+					   sizeof(*primes), i);
+			if (!primes)
+				return -ENOMEM;
+			mock.primes = primes;
+		}
+
+		fd = memfd_create("mock-drm-prime", MFD_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+
+		/* sparse, only there so that lseek() reports the size */
+		if (ftruncate(fd, bo->size) || fstat(fd, &st)) {
+			close(fd);
+			return -errno;
+		}
+
+		bo->prime_fd = fd;
+		bo->prime_ino = st.st_ino;
+		mock.primes[i] = bo;
+	}
+
+	fd = fcntl(bo->prime_fd, args->flags & DRM_CLOEXEC ?
+		   F_DUPFD_CLOEXEC : F_DUPFD, 0);
+	if (fd < 0)
+		return -errno;
+
+	args->fd = fd;
+	return 0;
+}
+
+static int mock_prime_fd_to_handle(struct mock_device *dev,
+				   struct drm_prime_handle *args)
+{
+	struct mock_bo *bo = NULL;
+	struct stat st;
+	unsigned int i;
+
+	if (fstat(args->fd, &st))
+		return -errno;
+
+	for (i = 0; i < mock.num_primes && !bo; i++)
+		if (mock.primes[i] && mock.primes[i]->prime_ino == st.st_ino)
+			bo = mock.primes[i];
+
+	if (!bo)
+		return -EINVAL;
+
+	for (i = 1; i < dev->num_handles; i++) {
+		if (dev->handles[i] == bo) {
+			args->handle = i;
+			return 0;
+		}
+	}
+
+	return mock_handle_new(dev, bo, &args->handle);
+}
+
+static int mock_core_ioctl(struct mock_device *dev, unsigned long request,
+			   void *arg, struct mock_wait *wait)
+{
+	switch (request) {
+	case DRM_IOCTL_VERSION:
+		return mock_version(dev, arg);
+
+	case DRM_IOCTL_GET_CAP: {
+		struct drm_get_cap *args = arg;
+
+		if (args->capability != DRM_CAP_PRIME)
+			return -EINVAL;
+
+		args->value = DRM_PRIME_CAP_IMPORT | DRM_PRIME_CAP_EXPORT;
+		return 0;
+	}
+
+	case DRM_IOCTL_GEM_CLOSE:
+		return mock_handle_close(dev, ((struct drm_gem_close *)arg)->handle);
+
+	case DRM_IOCTL_GEM_FLINK:
+		return mock_gem_flink(dev, arg);
+
+	case DRM_IOCTL_GEM_OPEN:
+		return mock_gem_open(dev, arg);
+
+	case DRM_IOCTL_PRIME_HANDLE_TO_FD:
+		return mock_prime_handle_to_fd(dev, arg);
+
+	case DRM_IOCTL_PRIME_FD_TO_HANDLE:
+		return mock_prime_fd_to_handle(dev, arg);
+
+	case DRM_IOCTL_MODE_CREATE_DUMB: {
+		struct drm_mode_create_dumb *args = arg;
+
+		args->pitch = (args->width * ((args->bpp + 7) / 8) + 63) & ~63;
+		args->size = (uint64_t)args->pitch * args->height;
+		return mock_bo_create(dev, args->size, &args->handle, wait);
+	}
+
+	case DRM_IOCTL_MODE_MAP_DUMB: {
+		struct drm_mode_map_dumb *args = arg;
+		struct mock_bo *bo = mock_handle_get(dev, args->handle);
+
+		if (!bo)
+			return -ENOENT;
+
+		args->offset = bo->offset;
+		return 0;
+	}
+
+	case DRM_IOCTL_MODE_DESTROY_DUMB:
+		return mock_handle_close(dev,
+				((struct drm_mode_destroy_dumb *)arg)->handle);
+	}
+
+	return -ENOTTY;
+}
+
+/*
+ * tegra
+ */
+
+static int mock_tegra_submit(struct mock_device *dev,
+			     struct drm_tegra_submit *args)
+{
+	const struct drm_tegra_syncpt *syncpts = U642PTR(args->syncpts);
+	const struct drm_tegra_cmdbuf *cmdbufs = U642PTR(args->cmdbufs);
+	const struct drm_tegra_reloc *relocs = U642PTR(args->relocs);
+	struct mock_timeline *timeline;
+	unsigned int i;
+	uint64_t done;
+	int err;
+
+	if (!mock_timeline_get(dev, args->context) || args->num_syncpts != 1)
+		return -EINVAL;
+
+	timeline = mock_timeline_get(dev, syncpts[0].id);
+	if (!timeline)
+		return -EINVAL;
+
+	err = mock_submit(dev, timeline, syncpts[0].incrs, &done);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < args->num_cmdbufs; i++)
+		mock_bo_use(dev, cmdbufs[i].handle, done);
+
+	for (i = 0; i < args->num_relocs; i++)
+		mock_bo_use(dev, relocs[i].target.handle, done);
+
+	dev->stats.relocs += args->num_relocs;
+	args->fence = timeline->value;
+
+	return 0;
+}
+
+static int mock_tegra_ioctl(struct mock_device *dev, unsigned long request,
+			    void *arg, struct mock_wait *wait)
+{
+	struct mock_timeline *timeline;
+	struct mock_bo *bo;
+	int ret;
+
+	switch (request) {
+	case DRM_IOCTL_TEGRA_GEM_CREATE: {
+		struct drm_tegra_gem_create *args = arg;
+
+		return mock_bo_create(dev, args->size, &args->handle, wait);
+	}
+
+	case DRM_IOCTL_TEGRA_GEM_MMAP: {
+		struct drm_tegra_gem_mmap *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -EINVAL;
+
+		args->offset = bo->offset;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_OPEN_CHANNEL: {
+		struct drm_tegra_open_channel *args = arg;
+
+		ret = mock_timeline_new(dev);
+		if (ret < 0)
+			return ret;
+
+		args->context = ret;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_CLOSE_CHANNEL: {
+		struct drm_tegra_close_channel *args = arg;
+
+		timeline = mock_timeline_get(dev, args->context);
+		if (!timeline)
+			return -EINVAL;
+
+		mock_timeline_free(timeline);
+		return 0;
+	}
+
+	/* every channel has a single syncpoint, sharing its index */
+	case DRM_IOCTL_TEGRA_GET_SYNCPT: {
+		struct drm_tegra_get_syncpt *args = arg;
+
+		if (!mock_timeline_get(dev, args->context) || args->index)
+			return -EINVAL;
+
+		args->id = args->context;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_SUBMIT:
+		wait->spin += dev->latency[MOCK_DRM_LATENCY_SUBMIT];
+		return mock_tegra_submit(dev, arg);
+
+	case DRM_IOCTL_TEGRA_SYNCPT_READ: {
+		struct drm_tegra_syncpt_read *args = arg;
+
+		timeline = mock_timeline_get(dev, args->id);
+		if (!timeline)
+			return -EINVAL;
+
+		mock_timeline_retire(timeline, mock_now());
+		args->value = timeline->signaled;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_SYNCPT_INCR: {
+		struct drm_tegra_syncpt_incr *args = arg;
+
+		timeline = mock_timeline_get(dev, args->id);
+		if (!timeline)
+			return -EINVAL;
+
+		/* the CPU increment lands once the queued jobs are done */
+		mock_timeline_retire(timeline, mock_now());
+		timeline->value++;
+		if (timeline->first == timeline->count)
+			timeline->signaled = timeline->value;
+		else
+			timeline->pending[timeline->count - 1].value++;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_SYNCPT_WAIT: {
+		struct drm_tegra_syncpt_wait *args = arg;
+		uint64_t deadline = MOCK_NEVER;
+
+		timeline = mock_timeline_get(dev, args->id);
+		if (!timeline)
+			return -EINVAL;
+
+		if (args->timeout != ~0u)
+			deadline = mock_now() + args->timeout * 1000000ull;
+
+		ret = mock_wait_for(dev, wait,
+				    mock_timeline_done(timeline, args->thresh),
+				    deadline);
+		args->value = ret ? timeline->signaled : args->thresh;
+		return ret;
+	}
+
+	case DRM_IOCTL_TEGRA_GET_SYNCPT_BASE:
+		return -ENXIO;
+
+	case DRM_IOCTL_TEGRA_GEM_SET_TILING: {
+		struct drm_tegra_gem_set_tiling *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -ENOENT;
+
+		bo->tiling_mode = args->mode;
+		bo->tiling_value = args->value;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_GEM_GET_TILING: {
+		struct drm_tegra_gem_get_tiling *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -ENOENT;
+
+		args->mode = bo->tiling_mode;
+		args->value = bo->tiling_value;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_GEM_SET_FLAGS: {
+		struct drm_tegra_gem_set_flags *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -ENOENT;
+
+		bo->flags = args->flags;
+		return 0;
+	}
+
+	case DRM_IOCTL_TEGRA_GEM_GET_FLAGS: {
+		struct drm_tegra_gem_get_flags *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -ENOENT;
+
+		args->flags = bo->flags;
+		return 0;
+	}
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * msm
+ */
+
+static int mock_msm_submit(struct mock_device *dev,
+			   struct drm_msm_gem_submit *args)
+{
+	const struct drm_msm_gem_submit_bo *bos = U642PTR(args->bos);
+	const struct drm_msm_gem_submit_cmd *cmds = U642PTR(args->cmds);
+	struct mock_timeline *timeline;
+	unsigned int i;
+	uint64_t done;
+	int err;
+
+	if (args->flags & (MSM_SUBMIT_FENCE_FD_IN | MSM_SUBMIT_FENCE_FD_OUT))
+		return -EINVAL;
+
+	timeline = mock_timeline_get(dev, args->queueid);
+	if (!timeline)
+		return -ENOENT;
+
+	err = mock_submit(dev, timeline, 1, &done);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < args->nr_bos; i++)
+		mock_bo_use(dev, bos[i].handle, done);
+
+	for (i = 0; i < args->nr_cmds; i++)
+		dev->stats.relocs += cmds[i].nr_relocs;
+
+	args->fence = timeline->value;
+	return 0;
+}
+
+static int mock_msm_ioctl(struct mock_device *dev, unsigned long request,
+			  void *arg, struct mock_wait *wait)
+{
+	struct mock_timeline *timeline;
+	struct mock_bo *bo;
+	int ret;
+
+	switch (request) {
+	case DRM_IOCTL_MSM_GET_PARAM: {
+		struct drm_msm_param *args = arg;
+
+		switch (args->param) {
+		case MSM_PARAM_GPU_ID:
+			args->value = 630;
+			break;
+		case MSM_PARAM_GMEM_SIZE:
+			args->value = 1024 * 1024;
+			break;
+		case MSM_PARAM_CHIP_ID:
+			args->value = 0x06030000;
+			break;
+		case MSM_PARAM_MAX_FREQ:
+			args->value = 710000000;
+			break;
+		case MSM_PARAM_TIMESTAMP:
+			args->value = mock_now();
+			break;
+		case MSM_PARAM_GMEM_BASE:
+			args->value = 0x100000;
+			break;
+		case MSM_PARAM_NR_RINGS:
+			args->value = 1;
+			break;
+		default:
+			return -EINVAL;
+		}
+		return 0;
+	}
+
+	case DRM_IOCTL_MSM_GEM_NEW: {
+		struct drm_msm_gem_new *args = arg;
+
+		return mock_bo_create(dev, args->size, &args->handle, wait);
+	}
+
+	case DRM_IOCTL_MSM_GEM_INFO: {
+		struct drm_msm_gem_info *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -ENOENT;
+
+		/* hand out the memfd offset as iova too, it is unique */
+		args->offset = bo->offset;
+		if (args->flags & MSM_INFO_IOVA)
+			args->offset += 0x1000000;
+		return 0;
+	}
+
+	case DRM_IOCTL_MSM_GEM_CPU_PREP: {
+		struct drm_msm_gem_cpu_prep *args = arg;
+		uint64_t deadline = 0;
+
+		if (!(args->op & MSM_PREP_NOSYNC))
+			deadline = mock_timespec(args->timeout.tv_sec,
+						 args->timeout.tv_nsec);
+
+		return mock_bo_wait(dev, args->handle, deadline, wait);
+	}
+
+	case DRM_IOCTL_MSM_GEM_CPU_FINI: {
+		struct drm_msm_gem_cpu_fini *args = arg;
+
+		return mock_handle_get(dev, args->handle) ? 0 : -ENOENT;
+	}
+
+	case DRM_IOCTL_MSM_GEM_SUBMIT:
+		wait->spin += dev->latency[MOCK_DRM_LATENCY_SUBMIT];
+		return mock_msm_submit(dev, arg);
+
+	case DRM_IOCTL_MSM_WAIT_FENCE: {
+		struct drm_msm_wait_fence *args = arg;
+
+		timeline = mock_timeline_get(dev, args->queueid);
+		if (!timeline)
+			return -ENOENT;
+
+		return mock_wait_for(dev, wait,
+				     mock_timeline_done(timeline, args->fence),
+				     mock_timespec(args->timeout.tv_sec,
+						   args->timeout.tv_nsec));
+	}
+
+	case DRM_IOCTL_MSM_GEM_MADVISE: {
+		struct drm_msm_gem_madvise *args = arg;
+
+		if (!mock_handle_get(dev, args->handle))
+			return -ENOENT;
+
+		args->retained = 1;
+		return 0;
+	}
+
+	case DRM_IOCTL_MSM_SUBMITQUEUE_NEW: {
+		struct drm_msm_submitqueue *args = arg;
+
+		ret = mock_timeline_new(dev);
+		if (ret < 0)
+			return ret;
+
+		args->id = ret;
+		return 0;
+	}
+
+	case DRM_IOCTL_MSM_SUBMITQUEUE_CLOSE: {
+		uint32_t *id = arg;
+
+		/* the default queue stays */
+		timeline = mock_timeline_get(dev, *id);
+		if (!timeline || !*id)
+			return -ENOENT;
+
+		mock_timeline_free(timeline);
+		return 0;
+	}
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * etnaviv
+ */
+
+static int mock_etnaviv_submit(struct mock_device *dev,
+			       struct drm_etnaviv_gem_submit *args)
+{
+	const struct drm_etnaviv_gem_submit_bo *bos = U642PTR(args->bos);
+	unsigned int i;
+	uint64_t done;
+	int err;
+
+	if (args->flags & (ETNA_SUBMIT_FENCE_FD_IN | ETNA_SUBMIT_FENCE_FD_OUT))
+		return -EINVAL;
+
+	err = mock_submit(dev, &dev->timelines[0], 1, &done);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < args->nr_bos; i++)
+		mock_bo_use(dev, bos[i].handle, done);
+
+	dev->stats.relocs += args->nr_relocs;
+	args->fence = dev->timelines[0].value;
+
+	return 0;
+}
+
+static int mock_etnaviv_ioctl(struct mock_device *dev, unsigned long request,
+			      void *arg, struct mock_wait *wait)
+{
+	struct mock_bo *bo;
+
+	switch (request) {
+	case DRM_IOCTL_ETNAVIV_GET_PARAM: {
+		struct drm_etnaviv_param *args = arg;
+
+		switch (args->param) {
+		case ETNAVIV_PARAM_GPU_MODEL:
+			args->value = 0x3000;
+			break;
+		case ETNAVIV_PARAM_GPU_REVISION:
+			args->value = 0x5450;
+			break;
+		default:
+			args->value = 0;
+			break;
+		}
+		return 0;
+	}
+
+	case DRM_IOCTL_ETNAVIV_GEM_NEW: {
+		struct drm_etnaviv_gem_new *args = arg;
+
+		return mock_bo_create(dev, args->size, &args->handle, wait);
+	}
+
+	case DRM_IOCTL_ETNAVIV_GEM_INFO: {
+		struct drm_etnaviv_gem_info *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -ENOENT;
+
+		args->offset = bo->offset;
+		return 0;
+	}
+
+	case DRM_IOCTL_ETNAVIV_GEM_CPU_PREP: {
+		struct drm_etnaviv_gem_cpu_prep *args = arg;
+		uint64_t deadline = 0;
+
+		if (!(args->op & ETNA_PREP_NOSYNC))
+			deadline = mock_timespec(args->timeout.tv_sec,
+						 args->timeout.tv_nsec);
+
+		return mock_bo_wait(dev, args->handle, deadline, wait);
+	}
+
+	case DRM_IOCTL_ETNAVIV_GEM_CPU_FINI: {
+		struct drm_etnaviv_gem_cpu_fini *args = arg;
+
+		return mock_handle_get(dev, args->handle) ? 0 : -ENOENT;
+	}
+
+	case DRM_IOCTL_ETNAVIV_GEM_SUBMIT:
+		wait->spin += dev->latency[MOCK_DRM_LATENCY_SUBMIT];
+		return mock_etnaviv_submit(dev, arg);
+
+	case DRM_IOCTL_ETNAVIV_WAIT_FENCE: {
+		struct drm_etnaviv_wait_fence *args = arg;
+		uint64_t deadline = 0;
+
+		if (!(args->flags & ETNA_WAIT_NONBLOCK))
+			deadline = mock_timespec(args->timeout.tv_sec,
+						 args->timeout.tv_nsec);
+
+		return mock_wait_for(dev, wait,
+				     mock_timeline_done(&dev->timelines[0],
+							args->fence),
+				     deadline);
+	}
+
+	case DRM_IOCTL_ETNAVIV_GEM_WAIT: {
+		struct drm_etnaviv_gem_wait *args = arg;
+		uint64_t deadline = 0;
+
+		if (!(args->flags & ETNA_WAIT_NONBLOCK))
+			deadline = mock_timespec(args->timeout.tv_sec,
+						 args->timeout.tv_nsec);
+
+		return mock_bo_wait(dev, args->handle, deadline, wait);
+	}
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * amdgpu
+ */
+
+static int mock_amdgpu_bo_list(struct mock_device *dev,
+			       union drm_amdgpu_bo_list *args)
+{
+	/* the output overlaps the input, so work from a copy */
+	const struct drm_amdgpu_bo_list_in in = args->in;
+	const char *entries = U642PTR(in.bo_info_ptr);
+	struct mock_bo_list *list, *lists;
+	uint32_t *handles = NULL;
+	unsigned int i, index;
+
+	if (in.operation == AMDGPU_BO_LIST_OP_CREATE) {
+		for (index = 0; index < dev->num_bo_lists; index++)
+			if (!dev->bo_lists[index].used)
+				break;
+
+		if (index == dev->num_bo_lists) {
+			lists = mock_grow(dev->bo_lists, &dev->num_bo_lists,
+					  sizeof(*lists), index);
+			if (!lists)
+				return -ENOMEM;
+			dev->bo_lists = lists;
+		}
+	} else {
+		index = in.list_handle - 1;
+		if (index >= dev->num_bo_lists || !dev->bo_lists[index].used)
+			return -ENOENT;
+	}
+
+	list = &dev->bo_lists[index];
+
+	if (in.operation == AMDGPU_BO_LIST_OP_DESTROY) {
+		free(list->handles);
+		memset(list, 0, sizeof(*list));
+		return 0;
+	}
+
+	if (in.operation != AMDGPU_BO_LIST_OP_CREATE &&
+	    in.operation != AMDGPU_BO_LIST_OP_UPDATE)
+		return -EINVAL;
+
+	if (in.bo_number) {
+		if (in.bo_info_size < sizeof(uint32_t))
+			return -EINVAL;
+
+		handles = calloc(in.bo_number, sizeof(*handles));
+		if (!handles)
+			return -ENOMEM;
+
+		/* bo_handle is the first member of each entry */
+		for (i = 0; i < in.bo_number; i++)
+			memcpy(&handles[i], entries + i * in.bo_info_size,
+			       sizeof(*handles));
+	}
+
+	free(list->handles);
+	list->used = true;
+	list->handles = handles;
+	list->count = in.bo_number;
+
+	memset(args, 0, sizeof(*args));
+	args->out.list_handle = index + 1;
+
+	return 0;
+}
+
+static int mock_amdgpu_cs(struct mock_device *dev, union drm_amdgpu_cs *args)
+{
+	const uint64_t *chunks = U642PTR(args->in.chunks);
+	struct mock_timeline *timeline;
+	struct mock_bo_list *list = NULL;
+	unsigned int i, j;
+	uint64_t done;
+	int err;
+
+	timeline = mock_timeline_get(dev, args->in.ctx_id);
+	if (!timeline)
+		return -EINVAL;
+
+	if (args->in.bo_list_handle) {
+		i = args->in.bo_list_handle - 1;
+		if (i >= dev->num_bo_lists || !dev->bo_lists[i].used)
+			return -ENOENT;
+		list = &dev->bo_lists[i];
+	}
+
+	err = mock_submit(dev, timeline, 1, &done);
+	if (err < 0)
+		return err;
+
+	for (i = 0; list && i < list->count; i++)
+		mock_bo_use(dev, list->handles[i], done);
+
+	for (i = 0; i < args->in.num_chunks; i++) {
+		const struct drm_amdgpu_cs_chunk *chunk = U642PTR(chunks[i]);
+		const struct drm_amdgpu_bo_list_in *in;
+		const char *entries;
+
+		if (chunk->chunk_id != AMDGPU_CHUNK_ID_BO_HANDLES)
+			continue;
+
+		in = U642PTR(chunk->chunk_data);
+		entries = U642PTR(in->bo_info_ptr);
+		for (j = 0; j < in->bo_number; j++) {
+			uint32_t handle;
+
+			memcpy(&handle, entries + j * in->bo_info_size,
+			       sizeof(handle));
+			mock_bo_use(dev, handle, done);
+		}
+	}
+
+	args->out.handle = timeline->value;
+	return 0;
+}
+
+static int mock_amdgpu_info(struct mock_device *dev,
+			    struct drm_amdgpu_info *args)
+{
+	struct drm_amdgpu_info_device info;
+	void *out = U642PTR(args->return_pointer);
+
+	memset(out, 0, args->return_size);
+
+	if (args->query != AMDGPU_INFO_DEV_INFO)
+		return 0;
+
+	memset(&info, 0, sizeof(info));
+	info.virtual_address_offset = 1ull << 20;
+	info.virtual_address_max = 1ull << 40;
+	info.virtual_address_alignment = 4096;
+	info.gart_page_size = 4096;
+	info.pte_fragment_size = 2 * 1024 * 1024;
+
+	memcpy(out, &info, args->return_size < sizeof(info) ?
+	       args->return_size : sizeof(info));
+	return 0;
+}
+
+static int mock_amdgpu_ioctl(struct mock_device *dev, unsigned long request,
+			     void *arg, struct mock_wait *wait)
+{
+	struct mock_timeline *timeline;
+	struct mock_bo *bo;
+	int ret;
+
+	switch (request) {
+	case DRM_IOCTL_AMDGPU_GEM_CREATE: {
+		union drm_amdgpu_gem_create *args = arg;
+		uint64_t size = args->in.bo_size;
+
+		memset(args, 0, sizeof(*args));
+		return mock_bo_create(dev, size, &args->out.handle, wait);
+	}
+
+	case DRM_IOCTL_AMDGPU_GEM_MMAP: {
+		union drm_amdgpu_gem_mmap *args = arg;
+
+		bo = mock_handle_get(dev, args->in.handle);
+		if (!bo)
+			return -ENOENT;
+
+		args->out.addr_ptr = bo->offset;
+		return 0;
+	}
+
+	/* timeouts are absolute, and a timeout is reported in the status */
+	case DRM_IOCTL_AMDGPU_GEM_WAIT_IDLE: {
+		union drm_amdgpu_gem_wait_idle *args = arg;
+
+		ret = mock_bo_wait(dev, args->in.handle, args->in.timeout, wait);
+		if (ret == -ENOENT)
+			return ret;
+
+		memset(args, 0, sizeof(*args));
+		args->out.status = ret != 0;
+		return 0;
+	}
+
+	case DRM_IOCTL_AMDGPU_CTX: {
+		union drm_amdgpu_ctx *args = arg;
+		uint32_t id = args->in.ctx_id;
+
+		switch (args->in.op) {
+		case AMDGPU_CTX_OP_ALLOC_CTX:
+			ret = mock_timeline_new(dev);
+			if (ret < 0)
+				return ret;
+			memset(args, 0, sizeof(*args));
+			args->out.alloc.ctx_id = ret;
+			return 0;
+
+		case AMDGPU_CTX_OP_FREE_CTX:
+			timeline = mock_timeline_get(dev, id);
+			if (!timeline)
+				return -EINVAL;
+			mock_timeline_free(timeline);
+			return 0;
+
+		case AMDGPU_CTX_OP_QUERY_STATE:
+		case AMDGPU_CTX_OP_QUERY_STATE2:
+			if (!mock_timeline_get(dev, id))
+				return -EINVAL;
+			memset(args, 0, sizeof(*args));
+			return 0;
+		}
+		return -EINVAL;
+	}
+
+	case DRM_IOCTL_AMDGPU_BO_LIST:
+		return mock_amdgpu_bo_list(dev, arg);
+
+	case DRM_IOCTL_AMDGPU_CS:
+		wait->spin += dev->latency[MOCK_DRM_LATENCY_SUBMIT];
+		return mock_amdgpu_cs(dev, arg);
+
+	case DRM_IOCTL_AMDGPU_WAIT_CS: {
+		union drm_amdgpu_wait_cs *args = arg;
+
+		timeline = mock_timeline_get(dev, args->in.ctx_id);
+		if (!timeline)
+			return -EINVAL;
+
+		ret = mock_wait_for(dev, wait,
+				    mock_timeline_done(timeline,
+						       args->in.handle),
+				    args->in.timeout);
+		if (ret == -EDEADLK)
+			return ret;
+
+		memset(args, 0, sizeof(*args));
+		args->out.status = ret != 0;
+		return 0;
+	}
+
+	case DRM_IOCTL_AMDGPU_INFO:
+		return mock_amdgpu_info(dev, arg);
+
+	case DRM_IOCTL_AMDGPU_GEM_VA:
+	case DRM_IOCTL_AMDGPU_GEM_OP:
+	case DRM_IOCTL_AMDGPU_GEM_METADATA:
+	case DRM_IOCTL_AMDGPU_VM:
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * radeon
+ */
+
+static int mock_radeon_cs(struct mock_device *dev, struct drm_radeon_cs *args)
+{
+	const uint64_t *chunks = U642PTR(args->chunks);
+	unsigned int i, j;
+	uint64_t done;
+	int err;
+
+	err = mock_submit(dev, &dev->timelines[0], 1, &done);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < args->num_chunks; i++) {
+		const struct drm_radeon_cs_chunk *chunk = U642PTR(chunks[i]);
+		const struct drm_radeon_cs_reloc *relocs;
+		unsigned int count;
+
+		if (chunk->chunk_id != RADEON_CHUNK_ID_RELOCS)
+			continue;
+
+		relocs = U642PTR(chunk->chunk_data);
+		count = chunk->length_dw * 4 / sizeof(*relocs);
+		for (j = 0; j < count; j++)
+			mock_bo_use(dev, relocs[j].handle, done);
+
+		dev->stats.relocs += count;
+	}
+
+	return 0;
+}
+
+static int mock_radeon_ioctl(struct mock_device *dev, unsigned long request,
+			     void *arg, struct mock_wait *wait)
+{
+	struct mock_bo *bo;
+
+	switch (request) {
+	case DRM_IOCTL_RADEON_GEM_INFO: {
+		struct drm_radeon_gem_info *args = arg;
+
+		args->gart_size = 1ull << 30;
+		args->vram_size = 1ull << 30;
+		args->vram_visible = 256 << 20;
+		return 0;
+	}
+
+	case DRM_IOCTL_RADEON_GEM_CREATE: {
+		struct drm_radeon_gem_create *args = arg;
+
+		return mock_bo_create(dev, args->size, &args->handle, wait);
+	}
+
+	case DRM_IOCTL_RADEON_GEM_MMAP: {
+		struct drm_radeon_gem_mmap *args = arg;
+
+		bo = mock_handle_get(dev, args->handle);
+		if (!bo)
+			return -ENOENT;
+
+		args->addr_ptr = bo->offset + args->offset;
+		return 0;
+	}
+
+	case DRM_IOCTL_RADEON_GEM_WAIT_IDLE: {
+		struct drm_radeon_gem_wait_idle *args = arg;
+
+		return mock_bo_wait(dev, args->handle, MOCK_NEVER, wait);
+	}
+
+	case DRM_IOCTL_RADEON_GEM_SET_DOMAIN: {
+		struct drm_radeon_gem_set_domain *args = arg;
+
+		return mock_bo_wait(dev, args->handle, MOCK_NEVER, wait);
+	}
+
+	case DRM_IOCTL_RADEON_GEM_BUSY: {
+		struct drm_radeon_gem_busy *args = arg;
+
+		args->domain = RADEON_GEM_DOMAIN_GTT;
+		return mock_bo_wait(dev, args->handle, 0, wait);
+	}
+
+	case DRM_IOCTL_RADEON_CS:
+		wait->spin += dev->latency[MOCK_DRM_LATENCY_SUBMIT];
+		return mock_radeon_cs(dev, arg);
+
+	/* all queries read as zero */
+	case DRM_IOCTL_RADEON_INFO: {
+		struct drm_radeon_info *args = arg;
+		uint32_t *value = U642PTR(args->value);
+
+		*value = 0;
+		return 0;
+	}
+
+	case DRM_IOCTL_RADEON_GEM_SET_TILING:
+	case DRM_IOCTL_RADEON_GEM_GET_TILING:
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int mock_ioctl(struct mock_device *dev, unsigned long request,
+		      void *arg, struct mock_wait *wait)
+{
+	int err;
+
+	err = mock_core_ioctl(dev, request, arg, wait);
+	if (err != -ENOTTY)
+		return err;
+
+	switch (dev->driver) {
+	case MOCK_DRM_GENERIC:
+		break;
+	case MOCK_DRM_TEGRA:
+		return mock_tegra_ioctl(dev, request, arg, wait);
+	case MOCK_DRM_MSM:
+		return mock_msm_ioctl(dev, request, arg, wait);
+	case MOCK_DRM_ETNAVIV:
+		return mock_etnaviv_ioctl(dev, request, arg, wait);
+	case MOCK_DRM_AMDGPU:
+		return mock_amdgpu_ioctl(dev, request, arg, wait);
+	case MOCK_DRM_RADEON:
+		return mock_radeon_ioctl(dev, request, arg, wait);
+	}
+
+	return -EINVAL;
+}
+
+static int mock_handle_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct mock_wait wait = { 0 };
+	struct mock_device *dev;
+	struct timespec ts;
+	uint64_t start;
+	int err;
+
+	pthread_mutex_lock(&mock.lock);
+
+	dev = mock_find(fd);
+	if (!dev) {
+		pthread_mutex_unlock(&mock.lock);
+		return fake_ioctl_real(fd, request, arg);
+	}
+
+	start = mock_now();
+	dev->stats.ioctls++;
+	err = mock_ioctl(dev, request, arg, &wait);
+	wait.spin += dev->latency[MOCK_DRM_LATENCY_IOCTL];
+
+	pthread_mutex_unlock(&mock.lock);
+
+	if (wait.until) {
+		ts.tv_sec = wait.until / 1000000000;
+		ts.tv_nsec = wait.until % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+	}
+
+	while (wait.spin && mock_now() - start < wait.spin)
+		;
+
+	if (err) {
+		errno = -err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int mock_drm_open(enum mock_drm_driver driver)
+{
+	struct mock_device *dev;
+	unsigned int i;
+	int err = -EMFILE;
+
+	if (driver > MOCK_DRM_RADEON)
+		return -EINVAL;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return -ENOMEM;
+
+	dev->driver = driver;
+
+	/* the default ring, queue or context */
+	if (mock_timeline_new(dev) < 0) {
+		free(dev);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_lock(&mock.lock);
+
+	if (mock.memfd < 0) {
+		mock.memfd = memfd_create("mock-drm", MFD_CLOEXEC);
+		if (mock.memfd < 0) {
+			err = -errno;
+			goto err;
+		}
+	}
+
+	for (i = 0; i < MOCK_MAX_DEVICES; i++)
+		if (!mock.devices[i])
+			break;
+
+	if (i == MOCK_MAX_DEVICES)
+		goto err;
+
+	/* all devices share the memfd, so BOs can be mapped from any of them */
+	dev->fd = fcntl(mock.memfd, F_DUPFD_CLOEXEC, 0);
+	if (dev->fd < 0) {
+		err = -errno;
+		goto err;
+	}
+
+	mock.devices[i] = dev;
+	fake_ioctl_set_handler(mock_handle_ioctl);
+
+	pthread_mutex_unlock(&mock.lock);
+
+	return dev->fd;
+
+err:
+	pthread_mutex_unlock(&mock.lock);
+	free(dev->timelines);
+	free(dev);
+	return err;
+}
+
+void mock_drm_close(int fd)
+{
+	struct mock_device *dev;
+	unsigned int i;
+
+	pthread_mutex_lock(&mock.lock);
+
+	dev = mock_find(fd);
+	if (!dev) {
+		pthread_mutex_unlock(&mock.lock);
+		return;
+	}
+
+	for (i = 0; i < MOCK_MAX_DEVICES; i++)
+		if (mock.devices[i] == dev)
+			mock.devices[i] = NULL;
+
+	for (i = 1; i < dev->num_handles; i++)
+		if (dev->handles[i])
+			mock_handle_close(dev, i);
+
+	for (i = 0; i < dev->num_timelines; i++)
+		free(dev->timelines[i].pending);
+
+	for (i = 0; i < dev->num_bo_lists; i++)
+		free(dev->bo_lists[i].handles);
+
+	pthread_mutex_unlock(&mock.lock);
+
+	close(dev->fd);
+	free(dev->bo_lists);
+	free(dev->timelines);
+	free(dev->handles);
+	free(dev);
+}
+
+int mock_drm_set_latency(int fd, enum mock_drm_latency latency, uint64_t ns)
+{
+	struct mock_device *dev;
+	int err = -EINVAL;
+
+	pthread_mutex_lock(&mock.lock);
+
+	dev = mock_find(fd);
+	if (dev && latency < MOCK_DRM_LATENCY_COUNT) {
+		dev->latency[latency] = ns;
+		err = 0;
+	}
+
+	pthread_mutex_unlock(&mock.lock);
+
+	return err;
+}
+
+int mock_drm_get_stats(int fd, struct mock_drm_stats *stats)
+{
+	struct mock_device *dev;
+	int err = -EINVAL;
+
+	pthread_mutex_lock(&mock.lock);
+
+	dev = mock_find(fd);
+	if (dev) {
+		*stats = dev->stats;
+		err = 0;
+	}
+
+	pthread_mutex_unlock(&mock.lock);
+
+	return err;
+}
@@ -0,0 +1,76 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOCKDRM_H
+#define MOCKDRM_H
+
+#include <stdint.h>
+
+/*
+ * A userspace stand-in for a DRM device, for benchmarking and stress
+ * testing BO managers and submission paths without hardware.
+ *
+ * mock_drm_open() returns a file descriptor that the libdrm driver
+ * libraries can be pointed at.  It installs a fake_ioctl.h handler, which
+ * emulates the GEM ioctls and the BO, submit and wait ioctls of the given
+ * driver on that descriptor and passes everything else on.  BOs are
+ * backed by anonymous shared memory, and the descriptor can be mmap()ed at
+ * the offsets that the driver's mmap ioctl returns.
+ *
+ * Submitted jobs execute one after the other on a single fake engine, each
+ * taking MOCK_DRM_LATENCY_EXEC; fences and BO waits complete when the jobs
+ * they depend on do.  The other latencies are spent spinning in the ioctl.
+ */
+
+enum mock_drm_driver {
+	MOCK_DRM_GENERIC,	/* dumb buffers only */
+	MOCK_DRM_TEGRA,
+	MOCK_DRM_MSM,
+	MOCK_DRM_ETNAVIV,
+	MOCK_DRM_AMDGPU,
+	MOCK_DRM_RADEON,
+};
+
+enum mock_drm_latency {
+	MOCK_DRM_LATENCY_IOCTL,		/* every ioctl */
+	MOCK_DRM_LATENCY_ALLOC,		/* BO allocation, on top of IOCTL */
+	MOCK_DRM_LATENCY_SUBMIT,	/* job submission, on top of IOCTL */
+	MOCK_DRM_LATENCY_EXEC,		/* execution of a job */
+	MOCK_DRM_LATENCY_COUNT,
+};
+
+struct mock_drm_stats {
+	uint64_t ioctls;
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t bos;		/* currently allocated */
+	uint64_t bytes;		/* currently allocated */
+	uint64_t submits;
+	uint64_t relocs;
+	uint64_t waits;		/* that had to block */
+};
+
+int mock_drm_open(enum mock_drm_driver driver);
+void mock_drm_close(int fd);
+
+int mock_drm_set_latency(int fd, enum mock_drm_latency latency, uint64_t ns);
+int mock_drm_get_stats(int fd, struct mock_drm_stats *stats);
+
+#endif /* MOCKDRM_H */
@@ -0,0 +1,236 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that the property cache serves repeated lookups without ioctls,
+ * picks up new properties after invalidation, both explicit and through
+ * lease creation, and keeps returned properties valid across it.  The
+ * property ioctls are intercepted, so no device is needed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#include "fake_ioctl.h"
+
+#define U642PTR(x) ((void *)(unsigned long)(x))
+
+struct fake_prop {
+	uint32_t id;
+	const char *name;
+};
+
+static const struct fake_prop fake_props[] = {
+	{ 1, "ACTIVE" },
+	{ 2, "MODE_ID" },
+	{ 3, "FB_ID" },
+	{ 4, "CRTC_ID" },
+	{ 5, "VRR_ENABLED" },
+};
+
+/* properties of CRTC 10 and plane 20; the CRTC gains VRR_ENABLED later */
+static uint32_t crtc_props[3] = { 1, 2 };
+static uint32_t count_crtc_props = 2;
+static const uint32_t plane_props[] = { 3, 4 };
+
+/* libdrm issues each of these ioctls twice, to size and to fill arrays */
+static unsigned int get_properties_calls, get_property_calls;
+
+static int fake_get_properties(struct drm_mode_obj_get_properties *args)
+{
+	const uint32_t *props;
+	uint32_t count, i;
+
+	get_properties_calls++;
+
+	switch (args->obj_id) {
+	case 10:
+		props = crtc_props;
+		count = count_crtc_props;
+		break;
+	case 20:
+		props = plane_props;
+		count = 2;
+		break;
+	default:
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (args->count_props >= count) {
+		for (i = 0; i < count; i++) {
+			((uint32_t *)U642PTR(args->props_ptr))[i] = props[i];
+			((uint64_t *)U642PTR(args->prop_values_ptr))[i] = 0;
+		}
+	}
+
+	args->count_props = count;
+	return 0;
+}
+
+static int fake_get_property(struct drm_mode_get_property *args)
+{
+	unsigned int i;
+
+	get_property_calls++;
+
+	for (i = 0; i < sizeof(fake_props) / sizeof(fake_props[0]); i++) {
+		if (fake_props[i].id == args->prop_id) {
+			args->flags = DRM_MODE_PROP_RANGE;
+			args->count_values = 0;
+			args->count_enum_blobs = 0;
+			strcpy(args->name, fake_props[i].name);
+			return 0;
+		}
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+static int fake_propcache_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct drm_mode_create_lease *lease;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES:
+		return fake_get_properties(arg);
+	case DRM_IOCTL_MODE_GETPROPERTY:
+		return fake_get_property(arg);
+	case DRM_IOCTL_MODE_CREATE_LEASE:
+		lease = arg;
+		lease->lessee_id = 1;
+		lease->fd = 100;
+		return 0;
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+static int check_calls(const char *step, unsigned int get_properties,
+		       unsigned int get_property)
+{
+	if (get_properties_calls != get_properties ||
+	    get_property_calls != get_property) {
+		printf("%s: expected %u/%u ioctls, got %u/%u\n", step,
+		       get_properties, get_property, get_properties_calls,
+		       get_property_calls);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	const drmModePropertyRes *active, *prop;
+	drmModePropertyCachePtr cache;
+	uint32_t lessee_id, objects[] = { 10 };
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_propcache_ioctl);
+
+	cache = drmModePropertyCacheCreate(0);
+	if (!cache)
+		return 1;
+
+	/* the first lookup of an object queries all of its properties */
+	active = drmModePropertyCacheGet(cache, 10, DRM_MODE_OBJECT_CRTC,
+					 "ACTIVE");
+	if (!active || active->prop_id != 1) {
+		printf("lookup of ACTIVE failed\n");
+		ret = -1;
+	}
+	ret |= check_calls("first lookup", 2, 4);
+
+	/* later ones are served from memory, including misses */
+	if (drmModePropertyCacheGetId(cache, 10, DRM_MODE_OBJECT_CRTC,
+				      "MODE_ID") != 2 ||
+	    drmModePropertyCacheGetId(cache, 10, DRM_MODE_OBJECT_CRTC,
+				      "VRR_ENABLED") != 0) {
+		printf("cached lookups returned the wrong IDs\n");
+		ret = -1;
+	}
+	ret |= check_calls("cached lookup", 2, 4);
+
+	if (drmModePropertyCacheGetId(cache, 20, DRM_MODE_OBJECT_PLANE,
+				      "FB_ID") != 3) {
+		printf("lookup of FB_ID failed\n");
+		ret = -1;
+	}
+	ret |= check_calls("second object", 4, 8);
+
+	/* the kernel's order of the properties does not matter */
+	if (drmModePropertyCacheGetId(cache, 20, DRM_MODE_OBJECT_PLANE,
+				      "CRTC_ID") != 4 ||
+	    drmModePropertyCacheGetId(cache, 20, DRM_MODE_OBJECT_PLANE,
+				      "ZPOS") != 0 ||
+	    drmModePropertyCacheGetId(cache, 20, DRM_MODE_OBJECT_PLANE,
+				      "A") != 0) {
+		printf("lookups in unsorted properties failed\n");
+		ret = -1;
+	}
+	ret |= check_calls("unsorted properties", 4, 8);
+
+	/* new properties only show up after invalidation */
+	crtc_props[count_crtc_props++] = 5;
+	if (drmModePropertyCacheGetId(cache, 10, DRM_MODE_OBJECT_CRTC,
+				      "VRR_ENABLED") != 0) {
+		printf("VRR_ENABLED found before invalidation\n");
+		ret = -1;
+	}
+
+	drmModePropertyCacheInvalidate(cache);
+	prop = drmModePropertyCacheGet(cache, 10, DRM_MODE_OBJECT_CRTC,
+				       "VRR_ENABLED");
+	if (!prop || prop->prop_id != 5) {
+		printf("VRR_ENABLED not found after invalidation\n");
+		ret = -1;
+	}
+
+	/* only the new property is queried, the old ones are kept */
+	ret |= check_calls("invalidation", 6, 10);
+	if (drmModePropertyCacheGet(cache, 10, DRM_MODE_OBJECT_CRTC,
+				    "ACTIVE") != active ||
+	    strcmp(active->name, "ACTIVE")) {
+		printf("ACTIVE changed across invalidation\n");
+		ret = -1;
+	}
+
+	/* creating a lease invalidates every cache of the fd */
+	if (drmModeCreateLease(0, objects, 1, 0, &lessee_id) != 100) {
+		printf("lease creation failed\n");
+		ret = -1;
+	}
+	drmModePropertyCacheGetId(cache, 20, DRM_MODE_OBJECT_PLANE, "FB_ID");
+	ret |= check_calls("lease", 8, 10);
+
+	drmModePropertyCacheDestroy(cache);
+
+	if (ret)
+		printf("property cache test failed\n");
+
+	return ret ? 1 : 0;
+}
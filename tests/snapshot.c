@@ -0,0 +1,350 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks KMS state snapshots against a fake device: the snapshot contents,
+ * that connectors are not probed, that refreshing only costs one ioctl per
+ * unchanged connector, and that connectors which gained modes are fetched
+ * in full.  The mode setting ioctls are intercepted, so no device is
+ * needed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#include "fake_ioctl.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define U642PTR(x) ((void *)(unsigned long)(x))
+
+static const uint32_t crtc_ids[] = { 10, 11 };
+static const uint32_t encoder_ids[] = { 20, 21 };
+static const uint32_t connector_ids[] = { 30, 31 };
+static const uint32_t plane_ids[] = { 40, 41, 42 };
+static const uint32_t formats[] = { 0x34325258, 0x34325241, 0x3231564e };
+
+/* connector 30 is connected with count_modes modes, 31 is disconnected */
+static uint32_t count_modes = 2;
+
+/* CRTCs have count_crtc_props properties, planes always have 3 */
+static uint32_t count_crtc_props = 2;
+
+static unsigned int get_connector_calls, probes, count_queries;
+
+/* Copy count ids to ptr if the caller made room for them, like the kernel */
+static void fake_copy(uint64_t ptr, uint32_t *room, const void *ids,
+		      uint32_t count, size_t size)
+{
+	if (*room >= count && count)
+		memcpy(U642PTR(ptr), ids, count * size);
+	*room = count;
+}
+
+static int fake_get_resources(struct drm_mode_card_res *res)
+{
+	fake_copy(res->crtc_id_ptr, &res->count_crtcs, crtc_ids,
+		  ARRAY_SIZE(crtc_ids), sizeof(uint32_t));
+	fake_copy(res->encoder_id_ptr, &res->count_encoders, encoder_ids,
+		  ARRAY_SIZE(encoder_ids), sizeof(uint32_t));
+	fake_copy(res->connector_id_ptr, &res->count_connectors,
+		  connector_ids, ARRAY_SIZE(connector_ids), sizeof(uint32_t));
+	res->count_fbs = 0;
+	res->min_width = res->min_height = 1;
+	res->max_width = res->max_height = 8192;
+
+	return 0;
+}
+
+static int fake_get_connector(struct drm_mode_get_connector *conn)
+{
+	struct drm_mode_modeinfo modes[3];
+	uint32_t props[] = { 1, 2 };
+	uint64_t values[] = { 100, conn->connector_id };
+	uint32_t encoder = conn->connector_id - 10;
+	uint32_t i, count, room;
+
+	get_connector_calls++;
+	if (conn->count_modes == 0)
+		probes++;
+
+	count = conn->connector_id == 30 ? count_modes : 0;
+	memset(modes, 0, sizeof(modes));
+	for (i = 0; i < count; i++) {
+		modes[i].hdisplay = 1920 - i * 640;
+		modes[i].vdisplay = 1080 - i * 360;
+		sprintf(modes[i].name, "mode%u", i);
+	}
+
+	fake_copy(conn->modes_ptr, &conn->count_modes, modes, count,
+		  sizeof(modes[0]));
+	room = conn->count_props;
+	fake_copy(conn->props_ptr, &room, props, 2, sizeof(props[0]));
+	fake_copy(conn->prop_values_ptr, &conn->count_props, values, 2,
+		  sizeof(values[0]));
+	fake_copy(conn->encoders_ptr, &conn->count_encoders, &encoder, 1,
+		  sizeof(encoder));
+
+	conn->encoder_id = count ? encoder : 0;
+	conn->connector_type = DRM_MODE_CONNECTOR_HDMIA;
+	conn->connector_type_id = conn->connector_id - 29;
+	conn->connection = count ? DRM_MODE_CONNECTED : DRM_MODE_DISCONNECTED;
+	conn->mm_width = count ? 520 : 0;
+	conn->mm_height = count ? 290 : 0;
+	conn->subpixel = 0;
+
+	return 0;
+}
+
+static int fake_snapshot_ioctl(int fd, unsigned long request, void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_MODE_GETRESOURCES:
+		return fake_get_resources(arg);
+
+	case DRM_IOCTL_MODE_GETPLANERESOURCES: {
+		struct drm_mode_get_plane_res *res = arg;
+
+		fake_copy(res->plane_id_ptr, &res->count_planes, plane_ids,
+			  ARRAY_SIZE(plane_ids), sizeof(uint32_t));
+		return 0;
+	}
+
+	case DRM_IOCTL_MODE_GETCRTC: {
+		struct drm_mode_crtc *crtc = arg;
+
+		crtc->mode_valid = crtc->crtc_id == 10;
+		crtc->mode.hdisplay = 1920;
+		crtc->mode.vdisplay = 1080;
+		crtc->fb_id = crtc->crtc_id == 10 ? 50 : 0;
+		crtc->gamma_size = 256;
+		return 0;
+	}
+
+	case DRM_IOCTL_MODE_GETENCODER: {
+		struct drm_mode_get_encoder *enc = arg;
+
+		enc->crtc_id = enc->encoder_id == 20 ? 10 : 0;
+		enc->encoder_type = DRM_MODE_ENCODER_TMDS;
+		enc->possible_crtcs = 3;
+		return 0;
+	}
+
+	case DRM_IOCTL_MODE_GETCONNECTOR:
+		return fake_get_connector(arg);
+
+	case DRM_IOCTL_MODE_GETPLANE: {
+		struct drm_mode_get_plane *plane = arg;
+		uint32_t count = plane->plane_id - 39;
+
+		if (!plane->count_format_types)
+			count_queries++;
+		fake_copy(plane->format_type_ptr, &plane->count_format_types,
+			  formats, count, sizeof(formats[0]));
+		plane->crtc_id = plane->plane_id == 40 ? 10 : 0;
+		plane->possible_crtcs = 3;
+		return 0;
+	}
+
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES: {
+		struct drm_mode_obj_get_properties *props = arg;
+		uint32_t ids[] = { 3, 4, 5 };
+		uint64_t values[] = { props->obj_id, 1, 2 };
+		uint32_t count = props->obj_type == DRM_MODE_OBJECT_CRTC ?
+				 count_crtc_props : 3;
+
+		if (!props->count_props)
+			count_queries++;
+		if (props->count_props >= count) {
+			memcpy(U642PTR(props->props_ptr), ids,
+			       count * sizeof(ids[0]));
+			memcpy(U642PTR(props->prop_values_ptr), values,
+			       count * sizeof(values[0]));
+		}
+		props->count_props = count;
+		return 0;
+	}
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+static int check_snapshot(drmModeStateSnapshotPtr snap)
+{
+	drmModeConnectorPtr conn;
+	int i;
+
+	if (snap->count_crtcs != 2 || snap->count_connectors != 2 ||
+	    snap->count_encoders != 2 || snap->count_planes != 3 ||
+	    snap->max_width != 8192) {
+		printf("wrong object counts %d/%d/%d/%d\n", snap->count_crtcs,
+		       snap->count_connectors, snap->count_encoders,
+		       snap->count_planes);
+		return -1;
+	}
+
+	if (snap->crtcs[0].crtc_id != 10 || !snap->crtcs[0].mode_valid ||
+	    snap->crtcs[0].width != 1920 || snap->crtcs[0].buffer_id != 50 ||
+	    snap->crtcs[1].crtc_id != 11 || snap->crtcs[1].mode_valid ||
+	    snap->crtc_props[1].count_props != count_crtc_props ||
+	    snap->crtc_props[1].props[1] != 4 ||
+	    snap->crtc_props[1].prop_values[0] != 11) {
+		printf("wrong CRTC state\n");
+		return -1;
+	}
+
+	if (snap->encoders[0].encoder_id != 20 ||
+	    snap->encoders[0].crtc_id != 10 ||
+	    snap->encoders[1].possible_crtcs != 3) {
+		printf("wrong encoder state\n");
+		return -1;
+	}
+
+	conn = &snap->connectors[0];
+	if (conn->connector_id != 30 || conn->connection != DRM_MODE_CONNECTED ||
+	    conn->count_modes != (int)count_modes ||
+	    conn->count_encoders != 1 || conn->encoders[0] != 20 ||
+	    conn->count_props != 2 || conn->prop_values[1] != 30 ||
+	    conn->subpixel != DRM_MODE_SUBPIXEL_UNKNOWN) {
+		printf("wrong state of connector 30\n");
+		return -1;
+	}
+
+	for (i = 0; i < conn->count_modes; i++) {
+		if (conn->modes[i].hdisplay != 1920 - i * 640) {
+			printf("wrong mode %d of connector 30\n", i);
+			return -1;
+		}
+	}
+
+	conn = &snap->connectors[1];
+	if (conn->connector_id != 31 ||
+	    conn->connection != DRM_MODE_DISCONNECTED ||
+	    conn->count_modes != 0 || conn->encoders[0] != 21) {
+		printf("wrong state of connector 31\n");
+		return -1;
+	}
+
+	for (i = 0; i < snap->count_planes; i++) {
+		if (snap->planes[i].plane_id != plane_ids[i] ||
+		    snap->planes[i].count_formats != (uint32_t)i + 1 ||
+		    snap->planes[i].formats[i] != formats[i] ||
+		    snap->plane_props[i].count_props != 3 ||
+		    snap->plane_props[i].prop_values[0] != plane_ids[i]) {
+			printf("wrong state of plane %u\n", plane_ids[i]);
+			return -1;
+		}
+	}
+
+	if (snap->planes[0].crtc_id != 10 || snap->planes[1].crtc_id != 0) {
+		printf("wrong plane CRTCs\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	drmModeStateSnapshotPtr snap, refreshed, grown, regrown;
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_snapshot_ioctl);
+
+	snap = drmModeGetStateSnapshot(0, 0);
+	if (!snap) {
+		printf("drmModeGetStateSnapshot() failed\n");
+		return 1;
+	}
+	ret |= check_snapshot(snap);
+
+	if (probes) {
+		printf("connectors were probed without DRM_MODE_SNAPSHOT_PROBE\n");
+		ret = -1;
+	}
+
+	/* 2 CRTC property counts, plus formats and properties of 3 planes */
+	if (count_queries != 8) {
+		printf("snapshot took %u count queries, expected 8\n",
+		       count_queries);
+		ret = -1;
+	}
+
+	/* unchanged objects are complete after a single query */
+	get_connector_calls = 0;
+	count_queries = 0;
+	refreshed = drmModeRefreshStateSnapshot(0, snap, 0);
+	if (!refreshed) {
+		printf("drmModeRefreshStateSnapshot() failed\n");
+		return 1;
+	}
+	ret |= check_snapshot(refreshed);
+
+	if (get_connector_calls != 2) {
+		printf("refresh took %u connector queries, expected 2\n",
+		       get_connector_calls);
+		ret = -1;
+	}
+
+	if (count_queries) {
+		printf("refresh took %u count queries, expected none\n",
+		       count_queries);
+		ret = -1;
+	}
+
+	/* a connector that gained modes has to be queried again */
+	count_modes = 3;
+	get_connector_calls = 0;
+	grown = drmModeRefreshStateSnapshot(0, refreshed, 0);
+	if (!grown) {
+		printf("drmModeRefreshStateSnapshot() failed\n");
+		return 1;
+	}
+	ret |= check_snapshot(grown);
+
+	if (get_connector_calls != 3) {
+		printf("refresh took %u connector queries, expected 3\n",
+		       get_connector_calls);
+		ret = -1;
+	}
+
+	/* CRTCs that gained properties make the refresh start over */
+	count_crtc_props = 3;
+	regrown = drmModeRefreshStateSnapshot(0, grown, 0);
+	if (!regrown) {
+		printf("drmModeRefreshStateSnapshot() failed\n");
+		return 1;
+	}
+	ret |= check_snapshot(regrown);
+
+	drmModeFreeStateSnapshot(regrown);
+	drmModeFreeStateSnapshot(grown);
+	drmModeFreeStateSnapshot(refreshed);
+	drmModeFreeStateSnapshot(snap);
+
+	if (ret)
+		printf("state snapshot test failed\n");
+
+	return ret ? 1 : 0;
+}
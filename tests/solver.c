@@ -0,0 +1,483 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the plane assignment solver against a fake CRTC with a primary
+ * plane and up to eight overlays: that layers land on planes with zpos
+ * values in range, that solutions are remembered, that layers are handed
+ * to composition when the planes run out, and that a search cut short by
+ * the test commit limit still composes everything and is not remembered.
+ * The mode setting ioctls are intercepted, so no device is needed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+#include "drm_fourcc.h"
+
+#include "fake_ioctl.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define U642PTR(x) ((void *)(unsigned long)(x))
+
+#define MAX_PLANES 9
+#define FIRST_PLANE 40
+
+enum {
+	PROP_TYPE = 1,
+	PROP_PRIMARY_ZPOS,
+	PROP_FB_ID,
+	PROP_CRTC_ID,
+	PROP_SRC_X,
+	PROP_SRC_Y,
+	PROP_SRC_W,
+	PROP_SRC_H,
+	PROP_CRTC_X,
+	PROP_CRTC_Y,
+	PROP_CRTC_W,
+	PROP_CRTC_H,
+	PROP_OVERLAY_ZPOS,
+	PROP_COUNT
+};
+
+static const char * const prop_names[PROP_COUNT] = {
+	[PROP_TYPE] = "type",
+	[PROP_PRIMARY_ZPOS] = "zpos",
+	[PROP_FB_ID] = "FB_ID",
+	[PROP_CRTC_ID] = "CRTC_ID",
+	[PROP_SRC_X] = "SRC_X",
+	[PROP_SRC_Y] = "SRC_Y",
+	[PROP_SRC_W] = "SRC_W",
+	[PROP_SRC_H] = "SRC_H",
+	[PROP_CRTC_X] = "CRTC_X",
+	[PROP_CRTC_Y] = "CRTC_Y",
+	[PROP_CRTC_W] = "CRTC_W",
+	[PROP_CRTC_H] = "CRTC_H",
+	[PROP_OVERLAY_ZPOS] = "zpos",
+};
+
+/* overlays can be stacked from 2 to 7, the primary is fixed at 0 */
+#define OVERLAY_ZPOS_MIN 2
+#define OVERLAY_ZPOS_MAX 7
+
+static const uint32_t crtc_id = 10;
+static const uint32_t primary_formats[] = {
+	DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,
+};
+static const uint32_t overlay_formats[] = {
+	DRM_FORMAT_ARGB8888, DRM_FORMAT_NV12,
+};
+
+/* the fake CRTC has count_planes planes, of which max_active can be used */
+static uint32_t count_planes = 3;
+static uint32_t max_active = 3;
+
+/* TEST_ONLY commits, and the state of the planes after real commits */
+static unsigned int tests;
+static uint64_t plane_fb[MAX_PLANES], plane_zpos[MAX_PLANES];
+
+static void fake_copy(uint64_t ptr, uint32_t *room, const void *ids,
+		      uint32_t count, size_t size)
+{
+	if (*room >= count && count)
+		memcpy(U642PTR(ptr), ids, count * size);
+	*room = count;
+}
+
+static int fake_get_property(struct drm_mode_get_property *prop)
+{
+	uint64_t range[2] = { OVERLAY_ZPOS_MIN, OVERLAY_ZPOS_MAX };
+	uint32_t count = 0;
+
+	if (prop->prop_id == 0 || prop->prop_id >= PROP_COUNT) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	strcpy(prop->name, prop_names[prop->prop_id]);
+	prop->flags = DRM_MODE_PROP_RANGE;
+
+	switch (prop->prop_id) {
+	case PROP_TYPE:
+		prop->flags = DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE;
+		break;
+	case PROP_PRIMARY_ZPOS:
+		prop->flags |= DRM_MODE_PROP_IMMUTABLE;
+		range[1] = range[0] = 0;
+		count = 2;
+		break;
+	case PROP_OVERLAY_ZPOS:
+		count = 2;
+		break;
+	}
+
+	fake_copy(prop->values_ptr, &prop->count_values, range, count,
+		  sizeof(range[0]));
+	prop->count_enum_blobs = 0;
+
+	return 0;
+}
+
+static int fake_get_properties(struct drm_mode_obj_get_properties *args)
+{
+	uint32_t index = args->obj_id - FIRST_PLANE;
+	uint32_t props[PROP_COUNT - 2];
+	uint64_t values[PROP_COUNT - 2];
+	uint32_t i, room;
+
+	if (args->obj_type != DRM_MODE_OBJECT_PLANE || index >= count_planes) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	memset(values, 0, sizeof(values));
+	for (i = 0; i < ARRAY_SIZE(props); i++)
+		props[i] = i + 1;
+
+	if (index == 0) {
+		values[PROP_TYPE - 1] = DRM_PLANE_TYPE_PRIMARY;
+	} else {
+		values[PROP_TYPE - 1] = DRM_PLANE_TYPE_OVERLAY;
+		props[PROP_PRIMARY_ZPOS - 1] = PROP_OVERLAY_ZPOS;
+		values[PROP_PRIMARY_ZPOS - 1] = OVERLAY_ZPOS_MIN + index - 1;
+	}
+
+	room = args->count_props;
+	fake_copy(args->props_ptr, &room, props, ARRAY_SIZE(props),
+		  sizeof(props[0]));
+	fake_copy(args->prop_values_ptr, &args->count_props, values,
+		  ARRAY_SIZE(values), sizeof(values[0]));
+
+	return 0;
+}
+
+static int fake_get_plane(struct drm_mode_get_plane *plane)
+{
+	uint32_t index = plane->plane_id - FIRST_PLANE;
+
+	if (index >= count_planes) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (index == 0)
+		fake_copy(plane->format_type_ptr, &plane->count_format_types,
+			  primary_formats, ARRAY_SIZE(primary_formats),
+			  sizeof(uint32_t));
+	else
+		fake_copy(plane->format_type_ptr, &plane->count_format_types,
+			  overlay_formats, ARRAY_SIZE(overlay_formats),
+			  sizeof(uint32_t));
+
+	plane->crtc_id = 0;
+	plane->fb_id = 0;
+	plane->possible_crtcs = 1;
+
+	return 0;
+}
+
+/*
+ * Accept a commit if it uses at most max_active planes, all with zpos
+ * values in range.
+ */
+static int fake_atomic(struct drm_mode_atomic *atomic)
+{
+	const uint32_t *objs = U642PTR(atomic->objs_ptr);
+	const uint32_t *count_props = U642PTR(atomic->count_props_ptr);
+	const uint32_t *props = U642PTR(atomic->props_ptr);
+	const uint64_t *values = U642PTR(atomic->prop_values_ptr);
+	uint64_t fb[MAX_PLANES], zpos[MAX_PLANES];
+	uint32_t i, j, k = 0, index, active = 0;
+
+	if (atomic->flags & DRM_MODE_ATOMIC_TEST_ONLY)
+		tests++;
+
+	memcpy(fb, plane_fb, sizeof(fb));
+	memcpy(zpos, plane_zpos, sizeof(zpos));
+
+	for (i = 0; i < atomic->count_objs; i++) {
+		index = objs[i] - FIRST_PLANE;
+		if (index >= count_planes) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		for (j = 0; j < count_props[i]; j++, k++) {
+			if (props[k] == PROP_FB_ID)
+				fb[index] = values[k];
+			if (props[k] == PROP_OVERLAY_ZPOS && index == 0) {
+				errno = EINVAL;
+				return -1;
+			}
+			if (props[k] == PROP_OVERLAY_ZPOS)
+				zpos[index] = values[k];
+		}
+	}
+
+	for (i = 0; i < count_planes; i++) {
+		if (!fb[i])
+			continue;
+
+		active++;
+		if (i && (zpos[i] < OVERLAY_ZPOS_MIN ||
+			  zpos[i] > OVERLAY_ZPOS_MAX)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (active > max_active) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!(atomic->flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+		memcpy(plane_fb, fb, sizeof(fb));
+		memcpy(plane_zpos, zpos, sizeof(zpos));
+	}
+
+	return 0;
+}
+
+static int fake_solver_ioctl(int fd, unsigned long request, void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_MODE_GETRESOURCES: {
+		struct drm_mode_card_res *res = arg;
+
+		fake_copy(res->crtc_id_ptr, &res->count_crtcs, &crtc_id, 1,
+			  sizeof(crtc_id));
+		res->count_encoders = 0;
+		res->count_connectors = 0;
+		res->count_fbs = 0;
+		return 0;
+	}
+
+	case DRM_IOCTL_MODE_GETPLANERESOURCES: {
+		struct drm_mode_get_plane_res *res = arg;
+		uint32_t ids[MAX_PLANES], i;
+
+		for (i = 0; i < count_planes; i++)
+			ids[i] = FIRST_PLANE + i;
+		fake_copy(res->plane_id_ptr, &res->count_planes, ids,
+			  count_planes, sizeof(ids[0]));
+		return 0;
+	}
+
+	case DRM_IOCTL_MODE_GETPLANE:
+		return fake_get_plane(arg);
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES:
+		return fake_get_properties(arg);
+	case DRM_IOCTL_MODE_GETPROPERTY:
+		return fake_get_property(arg);
+	case DRM_IOCTL_MODE_ATOMIC:
+		return fake_atomic(arg);
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+static void init_layer(drmModePlaneLayerPtr layer, uint32_t fb_id,
+		       uint32_t format, uint32_t zpos, uint32_t size)
+{
+	memset(layer, 0, sizeof(*layer));
+	layer->fb_id = fb_id;
+	layer->format = format;
+	layer->modifier = DRM_FORMAT_MOD_INVALID;
+	layer->src_w = size << 16;
+	layer->src_h = size << 16;
+	layer->crtc_w = size;
+	layer->crtc_h = size;
+	layer->zpos = zpos;
+}
+
+/* Assign the layers and commit the result into plane_fb and plane_zpos */
+static int assign(drmModePlaneSolverPtr solver, drmModePlaneLayerPtr layers,
+		  uint32_t count, drmModePlaneLayerPtr composition)
+{
+	drmModeAtomicReqPtr req;
+	int ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	ret = drmModePlaneSolverAssign(solver, req, layers, count,
+				       composition, 0);
+	if (ret >= 0 && drmModeAtomicCommit(0, req, 0, NULL))
+		ret = -errno;
+
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
+static int test_planes(void)
+{
+	drmModePlaneSolverStats stats;
+	drmModePlaneSolverPtr solver;
+	drmModePlaneLayer layers[3], composition;
+	unsigned int before;
+	int ret = 0;
+
+	solver = drmModePlaneSolverCreate(0, crtc_id);
+	if (!solver) {
+		printf("drmModePlaneSolverCreate() failed\n");
+		return -1;
+	}
+
+	/* given out of order, the NV12 video goes on top of the desktop */
+	init_layer(&layers[0], 101, DRM_FORMAT_NV12, 1, 640);
+	init_layer(&layers[1], 100, DRM_FORMAT_XRGB8888, 0, 1920);
+	init_layer(&composition, 200, DRM_FORMAT_ARGB8888, 0, 1920);
+
+	if (assign(solver, layers, 2, &composition) != 0 ||
+	    layers[1].plane_id != FIRST_PLANE ||
+	    layers[0].plane_id != FIRST_PLANE + 1 ||
+	    composition.plane_id != 0) {
+		printf("two layers: got planes %u, %u\n", layers[1].plane_id,
+		       layers[0].plane_id);
+		ret = -1;
+	}
+
+	/* the overlay gets the lowest zpos its range allows */
+	if (plane_fb[0] != 100 || plane_fb[1] != 101 ||
+	    plane_zpos[1] != OVERLAY_ZPOS_MIN) {
+		printf("two layers: committed fbs %llu, %llu at zpos %llu\n",
+		       (unsigned long long)plane_fb[0],
+		       (unsigned long long)plane_fb[1],
+		       (unsigned long long)plane_zpos[1]);
+		ret = -1;
+	}
+
+	/* flipping to new framebuffers needs no test commit */
+	before = tests;
+	layers[0].fb_id = 103;
+	layers[1].fb_id = 102;
+	if (assign(solver, layers, 2, &composition) != 0 ||
+	    tests != before || plane_fb[0] != 102 || plane_fb[1] != 103) {
+		printf("flip: %u test commits\n", tests - before);
+		ret = -1;
+	}
+
+	/* a third layer stacks above the second overlay */
+	init_layer(&layers[2], 104, DRM_FORMAT_ARGB8888, 2, 64);
+	if (assign(solver, layers, 3, &composition) != 0 ||
+	    layers[2].plane_id != FIRST_PLANE + 2 ||
+	    plane_zpos[2] != OVERLAY_ZPOS_MIN + 1) {
+		printf("three layers: got plane %u at zpos %llu\n",
+		       layers[2].plane_id, (unsigned long long)plane_zpos[2]);
+		ret = -1;
+	}
+
+	/* with only one usable plane, everything is composited */
+	max_active = 1;
+	drmModePlaneSolverInvalidate(solver);
+	if (assign(solver, layers, 3, &composition) != 3 ||
+	    composition.plane_id != FIRST_PLANE ||
+	    layers[0].plane_id || layers[1].plane_id || layers[2].plane_id) {
+		printf("one plane: composition on plane %u\n",
+		       composition.plane_id);
+		ret = -1;
+	}
+
+	/* which fails when the caller cannot composite */
+	if (assign(solver, layers, 3, NULL) != -EINVAL) {
+		printf("one plane: assigned without composition\n");
+		ret = -1;
+	}
+
+	drmModePlaneSolverGetStats(solver, &stats);
+	if (stats.hits != 1) {
+		printf("expected 1 hit, got %llu\n",
+		       (unsigned long long)stats.hits);
+		ret = -1;
+	}
+
+	drmModePlaneSolverDestroy(solver);
+	max_active = 3;
+
+	return ret;
+}
+
+static int test_budget(void)
+{
+	drmModePlaneSolverStats stats;
+	drmModePlaneSolverPtr solver;
+	drmModePlaneLayer layers[8], composition;
+	unsigned int i, pass;
+	int ret = 0;
+
+	count_planes = MAX_PLANES;
+	max_active = 1;
+	memset(plane_fb, 0, sizeof(plane_fb));
+
+	solver = drmModePlaneSolverCreate(0, crtc_id);
+	if (!solver) {
+		printf("drmModePlaneSolverCreate() failed\n");
+		return -1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(layers); i++)
+		init_layer(&layers[i], 100 + i, DRM_FORMAT_ARGB8888, i, 64);
+	init_layer(&composition, 200, DRM_FORMAT_ARGB8888, 0, 1920);
+
+	/*
+	 * Eight layers on one usable plane out of nine take more test
+	 * commits than the solver allows, which must not keep it from
+	 * composing them, now or later.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		if (assign(solver, layers, ARRAY_SIZE(layers),
+			   &composition) != ARRAY_SIZE(layers) ||
+		    !composition.plane_id) {
+			printf("budget, pass %u: layers not composited\n", pass);
+			ret = -1;
+		}
+	}
+
+	drmModePlaneSolverGetStats(solver, &stats);
+	if (stats.hits != 0 || stats.tests <= 64) {
+		printf("budget: %llu hits after %llu tests\n",
+		       (unsigned long long)stats.hits,
+		       (unsigned long long)stats.tests);
+		ret = -1;
+	}
+
+	drmModePlaneSolverDestroy(solver);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	fake_ioctl_set_handler(fake_solver_ioctl);
+
+	ret |= test_planes();
+	ret |= test_budget();
+
+	return ret ? 1 : 0;
+}
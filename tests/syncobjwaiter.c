@@ -0,0 +1,502 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the syncobj waiter service: that each registration completes
+ * exactly once, when its syncobj signals, when its deadline passes, or
+ * with the error of a handle that cannot be waited on, while the others
+ * keep waiting; that new registrations interrupt a wait in progress; that
+ * syncobjs signaling together are all retired by the same wait; and that
+ * registrations are spread over the threads.  The syncobj ioctls are
+ * intercepted by a fake that blocks in WAIT like the kernel does.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "xf86drm.h"
+
+#include "fake_ioctl.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define MAX_SYNCOBJS 256
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool exists[MAX_SYNCOBJS];
+	bool signaled[MAX_SYNCOBJS];
+	uint32_t next;
+	unsigned int waits;
+	uint32_t blocked_handles;	/* handles of the WAIT now blocking */
+} fake = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int fake_wait(struct drm_syncobj_wait *args)
+{
+	const uint32_t *handles = (const uint32_t *)(uintptr_t)args->handles;
+	struct timespec ts;
+	uint32_t i;
+
+	fake.waits++;
+	fake.blocked_handles = 0;
+
+	for (;;) {
+		for (i = 0; i < args->count_handles; i++)
+			if (handles[i] >= MAX_SYNCOBJS || !fake.exists[handles[i]])
+				return -ENOENT;
+
+		for (i = 0; i < args->count_handles; i++) {
+			if (fake.signaled[handles[i]]) {
+				args->first_signaled = i;
+				return 0;
+			}
+		}
+
+		if (args->timeout_nsec <= (int64_t)now_ns())
+			return -ETIME;
+
+		fake.blocked_handles = args->count_handles;
+		if (args->timeout_nsec == INT64_MAX) {
+			pthread_cond_wait(&fake.cond, &fake.lock);
+		} else {
+			ts.tv_sec = args->timeout_nsec / 1000000000;
+			ts.tv_nsec = args->timeout_nsec % 1000000000;
+			pthread_cond_timedwait(&fake.cond, &fake.lock, &ts);
+		}
+	}
+}
+
+static int fake_syncobj_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct drm_syncobj_create *create = arg;
+	struct drm_syncobj_destroy *destroy = arg;
+	struct drm_syncobj_array *array = arg;
+	const uint32_t *handles;
+	int ret = 0;
+	uint32_t i;
+
+	pthread_mutex_lock(&fake.lock);
+
+	switch (request) {
+	case DRM_IOCTL_SYNCOBJ_CREATE:
+		if (fake.next + 1 >= MAX_SYNCOBJS) {
+			ret = -ENOMEM;
+			break;
+		}
+		create->handle = ++fake.next;
+		fake.exists[create->handle] = true;
+		break;
+	case DRM_IOCTL_SYNCOBJ_DESTROY:
+		if (destroy->handle >= MAX_SYNCOBJS ||
+		    !fake.exists[destroy->handle]) {
+			ret = -ENOENT;
+			break;
+		}
+		fake.exists[destroy->handle] = false;
+		fake.signaled[destroy->handle] = false;
+		break;
+	case DRM_IOCTL_SYNCOBJ_SIGNAL:
+	case DRM_IOCTL_SYNCOBJ_RESET:
+		handles = (const uint32_t *)(uintptr_t)array->handles;
+		for (i = 0; i < array->count_handles; i++)
+			if (handles[i] < MAX_SYNCOBJS)
+				fake.signaled[handles[i]] =
+					request == DRM_IOCTL_SYNCOBJ_SIGNAL;
+		pthread_cond_broadcast(&fake.cond);
+		break;
+	case DRM_IOCTL_SYNCOBJ_WAIT:
+		ret = fake_wait(arg);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	pthread_mutex_unlock(&fake.lock);
+
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fake_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&fake.cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static uint32_t syncobj_new(void)
+{
+	uint32_t handle = 0;
+
+	drmSyncobjCreate(3, 0, &handle);
+	return handle;
+}
+
+static void syncobj_signal(uint32_t handle)
+{
+	drmSyncobjSignal(3, &handle, 1);
+}
+
+/* wait for a thread to block in the fake WAIT after count waits so far */
+static void wait_blocked(unsigned int count)
+{
+	struct timespec ts = { 0, 100000 };
+	unsigned int waits;
+
+	do {
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&fake.lock);
+		waits = fake.waits;
+		pthread_mutex_unlock(&fake.lock);
+	} while (waits <= count);
+}
+
+static struct {
+	unsigned int count;
+	unsigned int calls[MAX_SYNCOBJS];
+	int status[MAX_SYNCOBJS];
+} done;
+
+static void callback(uint32_t handle, int status, void *data)
+{
+	done.count++;
+	if ((uintptr_t)data < MAX_SYNCOBJS) {
+		done.calls[(uintptr_t)data]++;
+		done.status[(uintptr_t)data] = status;
+	}
+}
+
+/* dispatch until count callbacks ran in total, for up to a second */
+static int dispatch_until(drmSyncobjWaiterPtr waiter, unsigned int count)
+{
+	struct pollfd pfd = {
+		.fd = drmSyncobjWaiterGetFD(waiter),
+		.events = POLLIN,
+	};
+	uint64_t end = now_ns() + 1000000000;
+
+	while (done.count < count && now_ns() < end) {
+		if (poll(&pfd, 1, 10) > 0 && drmSyncobjWaiterDispatch(waiter) < 0)
+			return -1;
+	}
+
+	return done.count == count ? 0 : -1;
+}
+
+static int test_signal(void)
+{
+	drmSyncobjWaiterStats stats;
+	drmSyncobjWaiterPtr waiter;
+	unsigned int waits;
+	uint32_t a, b;
+	int ret = 0;
+
+	memset(&done, 0, sizeof(done));
+
+	waiter = drmSyncobjWaiterCreate(3, 1);
+	if (!waiter)
+		return -1;
+
+	a = syncobj_new();
+	b = syncobj_new();
+
+	/* the second registration interrupts the wait for the first */
+	pthread_mutex_lock(&fake.lock);
+	waits = fake.waits;
+	pthread_mutex_unlock(&fake.lock);
+
+	if (drmSyncobjWaiterAdd(waiter, a, INT64_MAX, callback, (void *)1))
+		ret = -1;
+	wait_blocked(waits);
+	if (drmSyncobjWaiterAdd(waiter, b, INT64_MAX, callback, (void *)2))
+		ret = -1;
+
+	syncobj_signal(b);
+	if (dispatch_until(waiter, 1) || done.calls[2] != 1 || done.status[2]) {
+		printf("signal: signaled syncobj not reported\n");
+		ret = -1;
+	}
+
+	syncobj_signal(a);
+	if (dispatch_until(waiter, 2) || done.calls[1] != 1 || done.status[1]) {
+		printf("signal: second syncobj not reported\n");
+		ret = -1;
+	}
+
+	/* nothing more to report */
+	if (drmSyncobjWaiterDispatch(waiter) != 0) {
+		printf("signal: callbacks run twice\n");
+		ret = -1;
+	}
+
+	drmSyncobjWaiterGetStats(waiter, &stats);
+	if (stats.registered != 2 || stats.completed != 2 || stats.timed_out ||
+	    !stats.rearms) {
+		printf("signal: %llu of %llu completed, %llu rearms\n",
+		       (unsigned long long)stats.completed,
+		       (unsigned long long)stats.registered,
+		       (unsigned long long)stats.rearms);
+		ret = -1;
+	}
+
+	drmSyncobjWaiterDestroy(waiter);
+
+	return ret;
+}
+
+static int test_deadline(void)
+{
+	drmSyncobjWaiterStats stats;
+	drmSyncobjWaiterPtr waiter;
+	uint64_t start, deadline;
+	uint32_t a, b;
+	int ret = 0;
+
+	memset(&done, 0, sizeof(done));
+
+	waiter = drmSyncobjWaiterCreate(3, 1);
+	if (!waiter)
+		return -1;
+
+	a = syncobj_new();
+	b = syncobj_new();
+
+	start = now_ns();
+	deadline = start + 20000000;
+	drmSyncobjWaiterAdd(waiter, a, 0, callback, (void *)1);
+	drmSyncobjWaiterAdd(waiter, b, deadline, callback, (void *)2);
+
+	/* a passed deadline expires right away, the other one in 20 ms */
+	if (dispatch_until(waiter, 1) || done.status[1] != -ETIME ||
+	    done.calls[2]) {
+		printf("deadline: passed deadline not expired\n");
+		ret = -1;
+	}
+
+	if (dispatch_until(waiter, 2) || done.status[2] != -ETIME ||
+	    now_ns() < deadline) {
+		printf("deadline: expired after %lld ns\n",
+		       (long long)(now_ns() - start));
+		ret = -1;
+	}
+
+	drmSyncobjWaiterGetStats(waiter, &stats);
+	if (stats.timed_out != 2) {
+		printf("deadline: %llu timed out\n",
+		       (unsigned long long)stats.timed_out);
+		ret = -1;
+	}
+
+	drmSyncobjWaiterDestroy(waiter);
+
+	return ret;
+}
+
+static int test_error(void)
+{
+	drmSyncobjWaiterPtr waiter;
+	uint32_t a;
+	int ret = 0;
+
+	memset(&done, 0, sizeof(done));
+
+	waiter = drmSyncobjWaiterCreate(3, 1);
+	if (!waiter)
+		return -1;
+
+	/* the invalid handle fails, the other one keeps waiting */
+	a = syncobj_new();
+	drmSyncobjWaiterAdd(waiter, a, INT64_MAX, callback, (void *)1);
+	drmSyncobjWaiterAdd(waiter, MAX_SYNCOBJS + 1, INT64_MAX, callback,
+			    (void *)2);
+
+	if (dispatch_until(waiter, 1) || done.status[2] != -ENOENT ||
+	    done.calls[1]) {
+		printf("error: invalid handle reported %d\n", done.status[2]);
+		ret = -1;
+	}
+
+	syncobj_signal(a);
+	if (dispatch_until(waiter, 2) || done.status[1]) {
+		printf("error: valid handle not reported after an error\n");
+		ret = -1;
+	}
+
+	drmSyncobjWaiterDestroy(waiter);
+
+	return ret;
+}
+
+static int test_batch(void)
+{
+	drmSyncobjWaiterStats stats;
+	drmSyncobjWaiterPtr waiter;
+	struct timespec ts = { 0, 100000 };
+	uint32_t handles[16], blocked;
+	uint64_t waits;
+	unsigned int i;
+	int ret = 0;
+
+	memset(&done, 0, sizeof(done));
+
+	waiter = drmSyncobjWaiterCreate(3, 1);
+	if (!waiter)
+		return -1;
+
+	for (i = 0; i < ARRAY_SIZE(handles); i++) {
+		handles[i] = syncobj_new();
+		drmSyncobjWaiterAdd(waiter, handles[i], INT64_MAX, callback,
+				    (void *)(uintptr_t)i);
+	}
+
+	/* wait for the thread to block on all of them and the kick */
+	do {
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&fake.lock);
+		blocked = fake.blocked_handles;
+		pthread_mutex_unlock(&fake.lock);
+	} while (blocked != ARRAY_SIZE(handles) + 1);
+
+	drmSyncobjWaiterGetStats(waiter, &stats);
+	waits = stats.waits;
+
+	drmSyncobjSignal(3, handles, ARRAY_SIZE(handles));
+	if (dispatch_until(waiter, ARRAY_SIZE(handles))) {
+		printf("batch: %u of %zu completed\n", done.count,
+		       ARRAY_SIZE(handles));
+		ret = -1;
+	}
+
+	drmSyncobjWaiterGetStats(waiter, &stats);
+	if (stats.waits != waits) {
+		printf("batch: %llu more waits to retire %zu syncobjs\n",
+		       (unsigned long long)(stats.waits - waits),
+		       ARRAY_SIZE(handles));
+		ret = -1;
+	}
+
+	drmSyncobjWaiterDestroy(waiter);
+
+	return ret;
+}
+
+static int test_many(void)
+{
+	drmSyncobjWaiterStats stats;
+	drmSyncobjWaiterPtr waiter;
+	uint32_t handles[100];
+	unsigned int i;
+	int ret = 0;
+
+	memset(&done, 0, sizeof(done));
+
+	/* more than one thread takes */
+	waiter = drmSyncobjWaiterCreate(3, 2);
+	if (!waiter)
+		return -1;
+
+	for (i = 0; i < ARRAY_SIZE(handles); i++) {
+		handles[i] = syncobj_new();
+		if (!handles[i] ||
+		    drmSyncobjWaiterAdd(waiter, handles[i], INT64_MAX, callback,
+					(void *)(uintptr_t)i))
+			ret = -1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(handles); i++)
+		syncobj_signal(handles[i]);
+
+	if (dispatch_until(waiter, ARRAY_SIZE(handles))) {
+		printf("many: %u of %zu completed\n", done.count,
+		       ARRAY_SIZE(handles));
+		ret = -1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(handles); i++) {
+		if (done.calls[i] != 1 || done.status[i]) {
+			printf("many: syncobj %u reported %u times\n", i,
+			       done.calls[i]);
+			ret = -1;
+			break;
+		}
+	}
+
+	drmSyncobjWaiterGetStats(waiter, &stats);
+	if (stats.completed != ARRAY_SIZE(handles)) {
+		printf("many: %llu completed\n",
+		       (unsigned long long)stats.completed);
+		ret = -1;
+	}
+
+	/* pending registrations are dropped without their callbacks */
+	drmSyncobjWaiterAdd(waiter, syncobj_new(), INT64_MAX, callback,
+			    (void *)1);
+	drmSyncobjWaiterDestroy(waiter);
+	if (done.count != ARRAY_SIZE(handles)) {
+		printf("many: callback of a dropped registration run\n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	fake_init();
+	fake_ioctl_set_handler(fake_syncobj_ioctl);
+
+	if (drmSyncobjWaiterAdd(NULL, 1, 0, callback, NULL) != -EINVAL)
+		ret = -1;
+
+	ret |= test_signal();
+	ret |= test_deadline();
+	ret |= test_error();
+	ret |= test_batch();
+	ret |= test_many();
+
+	return ret ? 1 : 0;
+}
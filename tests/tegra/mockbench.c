@@ -0,0 +1,264 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Measures BO allocation, mapping and job submission throughput of
+ * libdrm_tegra against the mock DRM device, so no hardware is needed.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "tegra.h"
+
+#include "mockdrm/mockdrm.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Allocate count BOs of size, then free them, in batches of 64 */
+static double bench_alloc(struct drm_tegra *drm, uint32_t size,
+			  unsigned int count)
+{
+	struct drm_tegra_bo *bos[64];
+	unsigned int i, j;
+	double start;
+
+	start = now();
+
+	for (i = 0; i < count; i += 64) {
+		for (j = 0; j < 64; j++)
+			if (drm_tegra_bo_new(&bos[j], drm, 0, size))
+				return -1;
+
+		for (j = 0; j < 64; j++)
+			drm_tegra_bo_unref(bos[j]);
+	}
+
+	return (now() - start) / count;
+}
+
+struct alloc_thread {
+	struct drm_tegra *drm;
+	unsigned int count;
+	pthread_t thread;
+};
+
+/* Allocate and free small BOs of varying size, 8 at a time */
+static void *alloc_thread(void *data)
+{
+	struct alloc_thread *thread = data;
+	struct drm_tegra_bo *bos[8];
+	unsigned int i, j;
+
+	for (i = 0; i < thread->count; i += 8) {
+		for (j = 0; j < 8; j++)
+			if (drm_tegra_bo_new(&bos[j], thread->drm, 0,
+					     4096 << (j % 4)))
+				return NULL;
+
+		for (j = 0; j < 8; j++)
+			drm_tegra_bo_unref(bos[j]);
+	}
+
+	return NULL;
+}
+
+/* Run alloc_thread() on num threads and report lock contention */
+static double bench_alloc_threads(struct drm_tegra *drm, unsigned int num,
+				  unsigned int count)
+{
+	struct alloc_thread threads[8];
+	struct drm_tegra_bo_stats before, after;
+	unsigned int i;
+	double start;
+
+	drm_tegra_get_bo_stats(drm, &before);
+	start = now();
+
+	for (i = 0; i < num; i++) {
+		threads[i].drm = drm;
+		threads[i].count = count;
+		pthread_create(&threads[i].thread, NULL, alloc_thread,
+			       &threads[i]);
+	}
+
+	for (i = 0; i < num; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	start = (now() - start) / count;
+	drm_tegra_get_bo_stats(drm, &after);
+
+	printf("alloc+free, %u threads: %8.0f ns, %llu of %llu locks "
+	       "contended, %llu us waiting\n", num, start,
+	       (unsigned long long)(after.lock_contended -
+				    before.lock_contended),
+	       (unsigned long long)(after.lock_acquisitions -
+				    before.lock_acquisitions),
+	       (unsigned long long)(after.lock_wait_ns -
+				    before.lock_wait_ns) / 1000);
+
+	return start;
+}
+
+static double bench_map(struct drm_tegra *drm, unsigned int count)
+{
+	struct drm_tegra_bo *bo;
+	unsigned int i;
+	double start;
+	void *ptr;
+
+	if (drm_tegra_bo_new(&bo, drm, 0, 65536))
+		return -1;
+
+	start = now();
+
+	for (i = 0; i < count; i++) {
+		if (drm_tegra_bo_map(bo, &ptr))
+			return -1;
+		memset(ptr, i, 64);
+		drm_tegra_bo_unmap(bo);
+	}
+
+	start = (now() - start) / count;
+	drm_tegra_bo_unref(bo);
+
+	return start;
+}
+
+/*
+ * Submit count jobs with relocs relocations each, waiting for every 8th,
+ * and return the number of submissions per second.  With reset, a single
+ * job is rebuilt with drm_tegra_job_reset() instead of a new one per
+ * submission.
+ */
+static double bench_submit(struct drm_tegra *drm, unsigned int relocs,
+			   unsigned int count, bool reset)
+{
+	struct drm_tegra_channel *channel;
+	struct drm_tegra_pushbuf *pushbuf;
+	struct drm_tegra_fence *fence;
+	struct drm_tegra_job *job;
+	struct drm_tegra_bo *target;
+	unsigned int i, j;
+	double start;
+
+	if (drm_tegra_channel_open(&channel, drm, DRM_TEGRA_GR2D))
+		return -1;
+
+	if (drm_tegra_bo_new(&target, drm, 0, 4096))
+		return -1;
+
+	if (reset && drm_tegra_job_new(&job, channel))
+		return -1;
+
+	start = now();
+
+	for (i = 0; i < count; i++) {
+		if (!reset && drm_tegra_job_new(&job, channel))
+			return -1;
+
+		if (drm_tegra_pushbuf_new(&pushbuf, job) ||
+		    drm_tegra_pushbuf_prepare(pushbuf, 2 * relocs + 4))
+			return -1;
+
+		for (j = 0; j < relocs; j++) {
+			*pushbuf->ptr++ = 0x2b000001;
+			drm_tegra_pushbuf_relocate(pushbuf, target, 0, 0);
+		}
+
+		drm_tegra_pushbuf_sync(pushbuf, DRM_TEGRA_SYNCPT_COND_OP_DONE);
+
+		if (drm_tegra_job_submit(job, &fence))
+			return -1;
+
+		if (i % 8 == 7)
+			drm_tegra_fence_wait(fence);
+
+		drm_tegra_fence_free(fence);
+
+		if (reset)
+			drm_tegra_job_reset(job);
+		else
+			drm_tegra_job_free(job);
+	}
+
+	start = count * 1e9 / (now() - start);
+
+	if (reset)
+		drm_tegra_job_free(job);
+
+	drm_tegra_bo_unref(target);
+	drm_tegra_channel_close(channel);
+
+	return start;
+}
+
+int main(void)
+{
+	static const uint32_t sizes[] = { 4096, 65536, 1048576 };
+	static const uint64_t exec[] = { 0, 20000 };
+	struct mock_drm_stats stats;
+	struct drm_tegra *drm;
+	unsigned int i;
+	int fd;
+
+	fd = mock_drm_open(MOCK_DRM_TEGRA);
+	if (fd < 0 || drm_tegra_new(&drm, fd))
+		return 1;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		printf("alloc+free %8u bytes: %8.0f ns\n", sizes[i],
+		       bench_alloc(drm, sizes[i], 64 * 256));
+
+	for (i = 1; i <= 8; i *= 2)
+		bench_alloc_threads(drm, i, 64 * 1024);
+
+	printf("map+unmap:                %8.0f ns\n", bench_map(drm, 100000));
+
+	for (i = 0; i < sizeof(exec) / sizeof(exec[0]); i++) {
+		mock_drm_set_latency(fd, MOCK_DRM_LATENCY_EXEC, exec[i]);
+		printf("submit, %6llu ns/job, 16 relocs: %8.0f/s new+free "
+		       "%8.0f/s reset\n", (unsigned long long)exec[i],
+		       bench_submit(drm, 16, 20000, false),
+		       bench_submit(drm, 16, 20000, true));
+	}
+
+	mock_drm_get_stats(fd, &stats);
+	printf("%llu ioctls, %llu allocs, %llu submits, %llu waits\n",
+	       (unsigned long long)stats.ioctls,
+	       (unsigned long long)stats.allocs,
+	       (unsigned long long)stats.submits,
+	       (unsigned long long)stats.waits);
+
+	drm_tegra_close(drm);
+	mock_drm_close(fd);
+
+	return 0;
+}
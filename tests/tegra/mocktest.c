@@ -0,0 +1,542 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks libdrm_tegra's BO sharing, job and fence paths against the mock
+ * DRM device.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "tegra.h"
+
+#include "mockdrm/mockdrm.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: %s failed\n", __func__,	\
+				__LINE__, #cond);			\
+			return 1;					\
+		}							\
+	} while (0)
+
+/*
+ * Imports more dma-bufs than fit in one batch, with duplicates, and checks
+ * that every fd resolves to the BO it was exported from.
+ */
+static int check_prime_batch(struct drm_tegra *drm, int fd)
+{
+	struct drm_tegra_bo *bos[20], *imported[ARRAY_SIZE(bos) * 2];
+	struct mock_drm_stats before, after;
+	int fds[ARRAY_SIZE(imported)];
+	unsigned int i;
+	uint32_t fdu;
+
+	mock_drm_get_stats(fd, &before);
+
+	for (i = 0; i < ARRAY_SIZE(bos); i++) {
+		CHECK(!drm_tegra_bo_new(&bos[i], drm, 0, 4096));
+		CHECK(!drm_tegra_bo_forbid_caching(bos[i]));
+		CHECK(!drm_tegra_bo_to_dmabuf(bos[i], &fdu));
+		fds[i] = fdu;
+		fds[ARRAY_SIZE(bos) + i] = fdu;
+	}
+
+	CHECK(!drm_tegra_bo_from_dmabufs(imported, drm, fds,
+					 ARRAY_SIZE(fds), 0));
+
+	for (i = 0; i < ARRAY_SIZE(fds); i++)
+		CHECK(imported[i] == bos[i % ARRAY_SIZE(bos)]);
+
+	for (i = 0; i < ARRAY_SIZE(fds); i++)
+		drm_tegra_bo_unref(imported[i]);
+
+	for (i = 0; i < ARRAY_SIZE(bos); i++) {
+		drm_tegra_bo_unref(bos[i]);
+		close(fds[i]);
+	}
+
+	/* no handle may be left behind */
+	mock_drm_get_stats(fd, &after);
+	CHECK(after.bos == before.bos);
+
+	return 0;
+}
+
+struct import_thread {
+	struct drm_tegra *drm;
+	int fd;
+	int err;
+	pthread_t thread;
+};
+
+/* Import the dma-buf, use the handle and drop it again */
+static void *import_thread(void *data)
+{
+	struct import_thread *thread = data;
+	struct drm_tegra_bo *bo;
+	unsigned int i;
+	void *ptr;
+
+	for (i = 0; i < 20000 && !thread->err; i++) {
+		thread->err = drm_tegra_bo_from_dmabuf(&bo, thread->drm,
+						       thread->fd, 0);
+		if (thread->err)
+			break;
+
+		thread->err = drm_tegra_bo_map(bo, &ptr);
+		if (!thread->err)
+			drm_tegra_bo_unmap(bo);
+
+		drm_tegra_bo_unref(bo);
+	}
+
+	return NULL;
+}
+
+/*
+ * Imports a BO of another device from several threads at once, so that
+ * imports race with the last reference of the same BO going away.  An
+ * import must never hand out a handle that is closed behind its back.
+ */
+static int check_prime_race(struct drm_tegra *drm)
+{
+	struct import_thread threads[4];
+	struct drm_tegra *other;
+	struct drm_tegra_bo *bo;
+	unsigned int i;
+	uint32_t fdu;
+	int fd;
+
+	fd = mock_drm_open(MOCK_DRM_TEGRA);
+	CHECK(fd >= 0 && !drm_tegra_new(&other, fd));
+	CHECK(!drm_tegra_bo_new(&bo, other, 0, 4096));
+	CHECK(!drm_tegra_bo_to_dmabuf(bo, &fdu));
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+		threads[i].drm = drm;
+		threads[i].fd = fdu;
+		threads[i].err = 0;
+		pthread_create(&threads[i].thread, NULL, import_thread,
+			       &threads[i]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++)
+		pthread_join(threads[i].thread, NULL);
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++)
+		CHECK(!threads[i].err);
+
+	close(fdu);
+	drm_tegra_bo_unref(bo);
+	drm_tegra_close(other);
+	mock_drm_close(fd);
+
+	return 0;
+}
+
+struct submit_thread {
+	struct drm_tegra_job *job;
+	struct drm_tegra_bo *target;
+	unsigned int count;
+	int err;
+	pthread_t thread;
+};
+
+/* Build and submit the same job over and over, waiting for every 4th */
+static void *submit_thread(void *data)
+{
+	struct submit_thread *thread = data;
+	struct drm_tegra_pushbuf *pushbuf;
+	struct drm_tegra_fence *fence;
+	unsigned int i;
+
+	for (i = 0; i < thread->count && !thread->err; i++) {
+		thread->err = drm_tegra_pushbuf_new(&pushbuf, thread->job);
+		if (!thread->err)
+			thread->err = drm_tegra_pushbuf_prepare(pushbuf, 8);
+		if (!thread->err)
+			thread->err = drm_tegra_pushbuf_relocate(pushbuf,
+								 thread->target,
+								 0, 0);
+		if (!thread->err)
+			thread->err = drm_tegra_job_submit(thread->job, &fence);
+		if (thread->err)
+			break;
+
+		if (i % 4 == 3)
+			thread->err = drm_tegra_fence_wait(fence);
+
+		drm_tegra_fence_free(fence);
+		drm_tegra_job_reset(thread->job);
+	}
+
+	return NULL;
+}
+
+/*
+ * Submits from several threads on one channel and checks that the
+ * pushbuf pool's bookkeeping adds up afterwards.
+ */
+static int check_pushbuf_pool(struct drm_tegra *drm)
+{
+	struct drm_tegra_pushbuf_stats stats;
+	struct drm_tegra_channel *channel;
+	struct submit_thread threads[4];
+	struct drm_tegra_bo *target;
+	unsigned int i;
+
+	CHECK(!drm_tegra_channel_open(&channel, drm, DRM_TEGRA_GR2D));
+	CHECK(!drm_tegra_bo_new(&target, drm, 0, 4096));
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+		CHECK(!drm_tegra_job_new(&threads[i].job, channel));
+		threads[i].target = target;
+		threads[i].count = 2000;
+		threads[i].err = 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++)
+		pthread_create(&threads[i].thread, NULL, submit_thread,
+			       &threads[i]);
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++)
+		pthread_join(threads[i].thread, NULL);
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+		CHECK(!threads[i].err);
+		drm_tegra_job_free(threads[i].job);
+	}
+
+	CHECK(!drm_tegra_channel_get_pushbuf_stats(channel, &stats));
+	CHECK(stats.gets == ARRAY_SIZE(threads) * 2000);
+	CHECK(stats.in_use <= stats.num_bos);
+	CHECK(stats.num_bos <= stats.allocs);
+
+	drm_tegra_bo_unref(target);
+	drm_tegra_channel_close(channel);
+
+	return 0;
+}
+
+/*
+ * Closes a channel while a job with a pushbuf is still around; the job
+ * keeps the channel alive and frees its pushbuf BOs directly.
+ */
+static int check_close_with_job(struct drm_tegra *drm, int fd)
+{
+	struct drm_tegra_pushbuf *pushbuf;
+	struct drm_tegra_channel *channel;
+	struct mock_drm_stats before, after;
+	struct drm_tegra_job *job;
+
+	CHECK(!drm_tegra_channel_open(&channel, drm, DRM_TEGRA_GR2D));
+	CHECK(!drm_tegra_job_new(&job, channel));
+	CHECK(!drm_tegra_pushbuf_new(&pushbuf, job));
+	CHECK(!drm_tegra_pushbuf_prepare(pushbuf, 8));
+
+	mock_drm_get_stats(fd, &before);
+	CHECK(!drm_tegra_channel_close(channel));
+
+	/* no new pushbuf BOs for a closed channel */
+	CHECK(drm_tegra_pushbuf_prepare(pushbuf, 16384) == -ENODEV);
+	CHECK(!drm_tegra_pushbuf_free(pushbuf));
+	CHECK(!drm_tegra_job_free(job));
+
+	mock_drm_get_stats(fd, &after);
+	CHECK(after.allocs == before.allocs);
+
+	return 0;
+}
+
+struct job_thread {
+	struct drm_tegra_channel *channel;
+	int err;
+	pthread_t thread;
+};
+
+/* Take jobs from the channel's cache and put them back */
+static void *job_thread(void *data)
+{
+	struct job_thread *thread = data;
+	struct drm_tegra_job *jobs[12];
+	unsigned int i, j;
+
+	for (i = 0; i < 2000 && !thread->err; i++) {
+		for (j = 0; j < ARRAY_SIZE(jobs); j++) {
+			thread->err = drm_tegra_job_new(&jobs[j],
+							thread->channel);
+			if (thread->err)
+				break;
+		}
+
+		while (j--)
+			drm_tegra_job_free(jobs[j]);
+	}
+
+	return NULL;
+}
+
+/* Churns the job cache of a channel from several threads */
+static int check_job_cache(struct drm_tegra *drm)
+{
+	struct drm_tegra_channel *channel;
+	struct job_thread threads[4];
+	unsigned int i;
+
+	CHECK(!drm_tegra_channel_open(&channel, drm, DRM_TEGRA_GR3D));
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+		threads[i].channel = channel;
+		threads[i].err = 0;
+		pthread_create(&threads[i].thread, NULL, job_thread,
+			       &threads[i]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++)
+		pthread_join(threads[i].thread, NULL);
+
+	for (i = 0; i < ARRAY_SIZE(threads); i++)
+		CHECK(!threads[i].err);
+
+	drm_tegra_channel_close(channel);
+
+	return 0;
+}
+
+/*
+ * BOs that sit in a thread's magazine for more than a second are handed
+ * to the shared buckets on the next free, where the cache ages them.
+ */
+static int check_magazine_aging(struct drm_tegra *drm)
+{
+	struct drm_tegra_bo_stats before, after;
+	struct drm_tegra_bo *bos[4];
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(bos); i++)
+		CHECK(!drm_tegra_bo_new(&bos[i], drm, 0, 4096));
+
+	for (i = 0; i < ARRAY_SIZE(bos); i++)
+		drm_tegra_bo_unref(bos[i]);
+
+	CHECK(!drm_tegra_get_bo_stats(drm, &before));
+	sleep(2);
+
+	CHECK(!drm_tegra_bo_new(&bos[0], drm, 0, 4096));
+	drm_tegra_bo_unref(bos[0]);
+
+	CHECK(!drm_tegra_get_bo_stats(drm, &after));
+	CHECK(after.magazine_flushes > before.magazine_flushes);
+
+	return 0;
+}
+
+/*
+ * A BO that was exported is not recycled: freeing it closes its handle
+ * rather than putting it into the cache.
+ */
+static int check_shared_not_recycled(struct drm_tegra *drm, int fd)
+{
+	struct mock_drm_stats before, after;
+	struct drm_tegra_bo *bo;
+	uint32_t fdu;
+
+	CHECK(!drm_tegra_bo_new(&bo, drm, 0, 4096));
+	CHECK(!drm_tegra_bo_to_dmabuf(bo, &fdu));
+	close(fdu);
+
+	mock_drm_get_stats(fd, &before);
+	drm_tegra_bo_unref(bo);
+	mock_drm_get_stats(fd, &after);
+	CHECK(after.bos == before.bos - 1);
+
+	return 0;
+}
+
+/* Submits a job that increments its syncpoint once, using target if set */
+static int submit_job(struct drm_tegra_job *job, struct drm_tegra_bo *target,
+		      struct drm_tegra_fence **fence)
+{
+	struct drm_tegra_pushbuf *pushbuf;
+
+	CHECK(!drm_tegra_pushbuf_new(&pushbuf, job));
+	CHECK(!drm_tegra_pushbuf_prepare(pushbuf, 8));
+	if (target)
+		CHECK(!drm_tegra_pushbuf_relocate(pushbuf, target, 0, 0));
+	CHECK(!drm_tegra_pushbuf_sync(pushbuf, DRM_TEGRA_SYNCPT_COND_OP_DONE));
+	CHECK(!drm_tegra_job_submit(job, fence));
+	CHECK(!drm_tegra_job_reset(job));
+
+	return 0;
+}
+
+/*
+ * Waits for fences on two syncpoints and for a BO, with jobs that take
+ * 20 ms each on the mock engine.  Once the waits have seen the syncpoints
+ * pass, waiting again must not take an ioctl, and freed fences are
+ * reused.
+ */
+static int check_fences(struct drm_tegra *drm, int fd)
+{
+	struct drm_tegra_channel *channels[2];
+	struct drm_tegra_fence *fences[3], *fence;
+	struct mock_drm_stats before, after;
+	struct drm_tegra_job *jobs[2];
+	struct drm_tegra_bo *target;
+	unsigned int i, first;
+
+	CHECK(!mock_drm_set_latency(fd, MOCK_DRM_LATENCY_EXEC, 20000000));
+	CHECK(!drm_tegra_bo_new(&target, drm, 0, 4096));
+
+	for (i = 0; i < ARRAY_SIZE(channels); i++) {
+		CHECK(!drm_tegra_channel_open(&channels[i], drm,
+					      i ? DRM_TEGRA_GR3D :
+						  DRM_TEGRA_GR2D));
+		CHECK(!drm_tegra_job_new(&jobs[i], channels[i]));
+	}
+
+	/* a BO that was never submitted is idle */
+	CHECK(!drm_tegra_bo_cpu_prep(target, DRM_TEGRA_CPU_PREP_NOSYNC, 0));
+	CHECK(drm_tegra_bo_cpu_prep(target, ~0u, 0) == -EINVAL);
+
+	/* done after 20, 40 and 60 ms, the last one uses the BO */
+	CHECK(!submit_job(jobs[0], NULL, &fences[0]));
+	CHECK(!submit_job(jobs[1], NULL, &fences[1]));
+	CHECK(!submit_job(jobs[0], target, &fences[2]));
+
+	CHECK(drm_tegra_bo_cpu_prep(target, DRM_TEGRA_CPU_PREP_NOSYNC, 0) ==
+	      -EBUSY);
+	CHECK(drm_tegra_fence_wait_many(fences, 3, 0, 0, &first) < 0);
+	CHECK(drm_tegra_fence_wait_many(fences, 3, DRM_TEGRA_FENCE_WAIT_ALL,
+					5, NULL) < 0);
+
+	/* the first fence to signal is reported, whichever syncpoint */
+	CHECK(!drm_tegra_fence_wait_many(fences, 3, 0, 1000, &first));
+	CHECK(first == 0);
+	CHECK(!drm_tegra_fence_wait_many(fences + 1, 2, 0, 1000, &first));
+	CHECK(first == 0);
+
+	CHECK(!drm_tegra_bo_cpu_prep(target, DRM_TEGRA_CPU_PREP_READ, 1000));
+
+	mock_drm_get_stats(fd, &before);
+	CHECK(!drm_tegra_bo_cpu_prep(target, DRM_TEGRA_CPU_PREP_NOSYNC, 0));
+	CHECK(!drm_tegra_fence_wait_many(fences, 3, DRM_TEGRA_FENCE_WAIT_ALL,
+					 0, NULL));
+	for (i = 0; i < ARRAY_SIZE(fences); i++)
+		CHECK(!drm_tegra_fence_wait_timeout(fences[i], 0));
+	mock_drm_get_stats(fd, &after);
+	CHECK(after.ioctls == before.ioctls);
+
+	for (i = 0; i < ARRAY_SIZE(fences); i++)
+		drm_tegra_fence_free(fences[i]);
+
+	/* the last fence freed is the first reused */
+	CHECK(!submit_job(jobs[1], NULL, &fence));
+	CHECK(fence == fences[2]);
+	CHECK(!drm_tegra_fence_wait(fence));
+	drm_tegra_fence_free(fence);
+
+	for (i = 0; i < ARRAY_SIZE(channels); i++) {
+		CHECK(!drm_tegra_job_free(jobs[i]));
+		CHECK(!drm_tegra_channel_close(channels[i]));
+	}
+
+	drm_tegra_bo_unref(target);
+	CHECK(!mock_drm_set_latency(fd, MOCK_DRM_LATENCY_EXEC, 0));
+
+	return 0;
+}
+
+/*
+ * Frees a job, its channel and a fence after their device, while the job
+ * still holds its pushbuf and a BO it relocates.
+ */
+static int check_free_after_close(void)
+{
+	struct drm_tegra_fence *fences[2];
+	struct drm_tegra_channel *channel;
+	struct drm_tegra_pushbuf *pushbuf;
+	struct drm_tegra_bo *target;
+	struct drm_tegra_job *job;
+	struct drm_tegra *drm;
+	int fd;
+
+	fd = mock_drm_open(MOCK_DRM_TEGRA);
+	CHECK(fd >= 0 && !drm_tegra_new(&drm, fd));
+	CHECK(!drm_tegra_channel_open(&channel, drm, DRM_TEGRA_GR2D));
+	CHECK(!drm_tegra_job_new(&job, channel));
+	CHECK(!drm_tegra_bo_new(&target, drm, 0, 4096));
+
+	CHECK(!submit_job(job, NULL, &fences[0]));
+	CHECK(!drm_tegra_fence_wait(fences[0]));
+	drm_tegra_fence_free(fences[0]);
+
+	/* the job keeps the pushbuf and target until it is freed */
+	CHECK(!drm_tegra_pushbuf_new(&pushbuf, job));
+	CHECK(!drm_tegra_pushbuf_prepare(pushbuf, 8));
+	CHECK(!drm_tegra_pushbuf_relocate(pushbuf, target, 0, 0));
+	CHECK(!drm_tegra_pushbuf_sync(pushbuf, DRM_TEGRA_SYNCPT_COND_OP_DONE));
+	CHECK(!drm_tegra_job_submit(job, &fences[1]));
+	drm_tegra_bo_unref(target);
+
+	drm_tegra_close(drm);
+	CHECK(!drm_tegra_fence_wait(fences[1]));
+	CHECK(!drm_tegra_job_free(job));
+	CHECK(!drm_tegra_channel_close(channel));
+	drm_tegra_fence_free(fences[1]);
+	mock_drm_close(fd);
+
+	return 0;
+}
+
+int main(void)
+{
+	struct drm_tegra *drm;
+	int fd, ret = 0;
+
+	fd = mock_drm_open(MOCK_DRM_TEGRA);
+	if (fd < 0 || drm_tegra_new(&drm, fd))
+		return 1;
+
+	ret |= check_prime_batch(drm, fd);
+	ret |= check_prime_race(drm);
+	ret |= check_pushbuf_pool(drm);
+	ret |= check_close_with_job(drm, fd);
+	ret |= check_job_cache(drm);
+	ret |= check_magazine_aging(drm);
+	ret |= check_shared_not_recycled(drm, fd);
+	ret |= check_fences(drm, fd);
+	ret |= check_free_after_close();
+
+	drm_tegra_close(drm);
+	mock_drm_close(fd);
+
+	return ret;
+}
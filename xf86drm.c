@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
 #include <strings.h>
@@ -58,6 +59,11 @@
 #include <sys/sysmacros.h>
 #endif
 #include <math.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -68,6 +74,7 @@
 
 #include "xf86drm.h"
 #include "libdrm_macros.h"
+#include "libdrm_lists.h"
 
 #include "util_math.h"
 
@@ -178,6 +185,560 @@ drm_public void drmFree(void *pt)
     free(pt);
 }
 
+/*
+ * Optional ioctl statistics and tracing.
+ *
+ * Statistics are enabled with drmIoctlStatsEnable() or by setting
+ * LIBDRM_IOCTL_STATS in the environment, to "dump" to also print them to
+ * stderr at exit.  Each thread counts into its own block, a small
+ * open-addressed table keyed by the full request, so no atomics or locks
+ * are needed on the ioctl path; the blocks are only summed up when the
+ * statistics are read.  Blocks of exited threads are handed to new threads,
+ * keeping their counts.  Samples of more than DRM_IOCTL_STATS_NR distinct
+ * requests are dropped.
+ *
+ * Tracing is enabled with drmIoctlTraceOpen() or LIBDRM_IOCTL_TRACE=<file>,
+ * see drmTraceRecord for the format.
+ *
+ * When both are disabled, the cost is a single load and branch per ioctl.
+ */
+#define DRM_IOCTL_HOOK_STATS    (1 << 0)
+#define DRM_IOCTL_HOOK_TRACE    (1 << 1)
+
+static int drm_ioctl_hooks = -1;            /* -1 until the env is checked */
+static pthread_once_t drm_ioctl_hooks_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drm_ioctl_hooks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define DRM_IOCTL_STATS_BITS 8
+#define DRM_IOCTL_STATS_NR (1 << DRM_IOCTL_STATS_BITS)
+
+struct drm_ioctl_stats_block {
+    struct drm_ioctl_stats_block *next;     /* all blocks */
+    struct drm_ioctl_stats_block *next_free;
+    drmIoctlStats stats[DRM_IOCTL_STATS_NR];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_key_t key;
+    bool key_created;
+    bool dump;
+    struct drm_ioctl_stats_block *blocks;
+    struct drm_ioctl_stats_block *free_blocks;
+} drm_ioctl_stats = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct drm_ioctl_stats_block *drm_ioctl_stats_block;
+
+#define DRM_IOCTL_TRACE_BUFFER_SIZE (256 * 1024)
+
+static struct {
+    pthread_mutex_t lock;
+    int fd;
+    uint64_t start_ns;
+    uint32_t threads;
+    char *buffer;
+    size_t used;
+} drm_ioctl_trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+static __thread uint32_t drm_ioctl_trace_thread;
+
+#ifdef __linux__
+#define DRM_IOCTL_ARG_SIZE(r)   _IOC_SIZE(r)
+#define DRM_IOCTL_ARG_IN(r)     (_IOC_DIR(r) & _IOC_WRITE)
+#define DRM_IOCTL_ARG_OUT(r)    (_IOC_DIR(r) & _IOC_READ)
+#else
+#define DRM_IOCTL_ARG_SIZE(r)   IOCPARM_LEN(r)
+#define DRM_IOCTL_ARG_IN(r)     ((r) & IOC_IN)
+#define DRM_IOCTL_ARG_OUT(r)    ((r) & IOC_OUT)
+#endif
+
+#define DRM_TRACE_ALIGN(x)      (((x) + 7) & ~(size_t)7)
+
+static int drmIoctlTraceStart(const char *path);
+
+static void drmIoctlSetHook(int hook, int enable)
+{
+    pthread_mutex_lock(&drm_ioctl_hooks_lock);
+    if (enable)
+        drm_ioctl_hooks |= hook;
+    else
+        drm_ioctl_hooks &= ~hook;
+    pthread_mutex_unlock(&drm_ioctl_hooks_lock);
+}
+
+static void drmIoctlCheckEnv(void)
+{
+    const char *env = getenv("LIBDRM_IOCTL_STATS");
+
+    drm_ioctl_hooks = 0;
+
+    drm_ioctl_stats.dump = env && !strcmp(env, "dump");
+    if (env && *env && strcmp(env, "0"))
+        drmIoctlSetHook(DRM_IOCTL_HOOK_STATS, 1);
+
+    env = getenv("LIBDRM_IOCTL_TRACE");
+    if (env && *env && drmIoctlTraceStart(env))
+        drmMsg("failed to open ioctl trace %s\n", env);
+}
+
+static uint64_t drmIoctlNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void drmIoctlStatsThreadExit(void *data)
+{
+    struct drm_ioctl_stats_block *block = data;
+
+    pthread_mutex_lock(&drm_ioctl_stats.lock);
+    block->next_free = drm_ioctl_stats.free_blocks;
+    drm_ioctl_stats.free_blocks = block;
+    pthread_mutex_unlock(&drm_ioctl_stats.lock);
+}
+
+static struct drm_ioctl_stats_block *drmIoctlStatsGetBlock(void)
+{
+    struct drm_ioctl_stats_block *block;
+
+    pthread_mutex_lock(&drm_ioctl_stats.lock);
+
+    if (!drm_ioctl_stats.key_created) {
+        if (pthread_key_create(&drm_ioctl_stats.key,
+                               drmIoctlStatsThreadExit)) {
+            pthread_mutex_unlock(&drm_ioctl_stats.lock);
+            return NULL;
+        }
+        drm_ioctl_stats.key_created = true;
+    }
+
+    block = drm_ioctl_stats.free_blocks;
+    if (block) {
+        drm_ioctl_stats.free_blocks = block->next_free;
+    } else {
+        block = calloc(1, sizeof(*block));
+        if (block) {
+            block->next = drm_ioctl_stats.blocks;
+            drm_ioctl_stats.blocks = block;
+        }
+    }
+
+    pthread_mutex_unlock(&drm_ioctl_stats.lock);
+
+    if (block)
+        pthread_setspecific(drm_ioctl_stats.key, block);
+
+    drm_ioctl_stats_block = block;
+    return block;
+}
+
+/*
+ * Find the entry of \p request in a table of DRM_IOCTL_STATS_NR entries,
+ * entries are free while their count is 0.
+ *
+ * \return the entry, a free one if \p request has none yet, or NULL if the
+ * table is full.
+ */
+static drmIoctlStats *drmIoctlStatsLookup(drmIoctlStats *table,
+                                          unsigned long request)
+{
+    unsigned int slot, i;
+
+    slot = ((uint32_t)request * 0x9e3779b1u) >> (32 - DRM_IOCTL_STATS_BITS);
+
+    for (i = 0; i < DRM_IOCTL_STATS_NR; i++) {
+        drmIoctlStats *stats = &table[(slot + i) & (DRM_IOCTL_STATS_NR - 1)];
+
+        if (!stats->count || stats->request == request)
+            return stats;
+    }
+
+    return NULL;
+}
+
+static void drmIoctlStatsAdd(unsigned long request, int ret, int retries,
+                             uint64_t ns)
+{
+    struct drm_ioctl_stats_block *block = drm_ioctl_stats_block;
+    drmIoctlStats *stats;
+    unsigned int bucket = 0;
+    uint64_t us;
+
+    if (!block) {
+        block = drmIoctlStatsGetBlock();
+        if (!block)
+            return;
+    }
+
+    stats = drmIoctlStatsLookup(block->stats, request);
+    if (!stats)
+        return;
+
+    for (us = ns / 1000; us && bucket < DRM_IOCTL_LATENCY_BUCKETS - 1; us >>= 1)
+        bucket++;
+
+    stats->request = request;
+    stats->count++;
+    stats->retries += retries;
+    stats->errors += ret == -1;
+    stats->total_ns += ns;
+    if (ns > stats->max_ns)
+        stats->max_ns = ns;
+    stats->latency[bucket]++;
+}
+
+/*
+ * The arrays hanging off the argument of an ioctl, which are captured
+ * into the trace as chunks.  Only the ioctls that a callback is registered
+ * for are known; for anything else the trace holds the argument alone.
+ */
+struct _drmTraceChunks {
+    const void *arg;
+    drmTraceChunk *chunks;
+    const void **data;
+    unsigned int count;
+    unsigned int size;
+};
+
+#define DRM_IOCTL_TRACE_FUNCS 32
+
+static void drmIoctlTraceAtomic(drmTraceChunksPtr c, const void *arg);
+
+/* protected by drm_ioctl_hooks_lock */
+static struct {
+    unsigned long request;
+    drmTraceChunksFunc func;
+} drm_ioctl_trace_funcs[DRM_IOCTL_TRACE_FUNCS] = {
+    { DRM_IOCTL_MODE_ATOMIC, drmIoctlTraceAtomic },
+};
+static unsigned int drm_ioctl_trace_num_funcs = 1;
+
+/**
+ * Register how to find the arrays that the argument of an ioctl points to
+ *
+ * While a trace is written, \p func is called with the argument before
+ * each \p request ioctl and adds the arrays with drmIoctlTraceAddChunk().
+ * Registering a request again replaces its callback.
+ *
+ * \return zero on success or a negative errno.
+ */
+drm_public int drmIoctlTraceRegister(unsigned long request,
+                                     drmTraceChunksFunc func)
+{
+    unsigned int i;
+    int ret = 0;
+
+    if (!func)
+        return -EINVAL;
+
+    pthread_mutex_lock(&drm_ioctl_hooks_lock);
+
+    for (i = 0; i < drm_ioctl_trace_num_funcs; i++)
+        if (drm_ioctl_trace_funcs[i].request == request)
+            break;
+
+    if (i < DRM_IOCTL_TRACE_FUNCS) {
+        drm_ioctl_trace_funcs[i].request = request;
+        drm_ioctl_trace_funcs[i].func = func;
+        if (i == drm_ioctl_trace_num_funcs)
+            drm_ioctl_trace_num_funcs++;
+    } else {
+        ret = -ENOSPC;
+    }
+
+    pthread_mutex_unlock(&drm_ioctl_hooks_lock);
+    return ret;
+}
+
+/**
+ * Capture an array that the argument or an earlier chunk points to
+ *
+ * \param parent -1 if the pointer is in the argument, otherwise the index
+ * of the chunk it is in.
+ * \param offset of the 64-bit pointer in the parent.
+ * \param size of the array in bytes.
+ *
+ * \return the index of the new chunk, or -1 if the pointer is NULL, the
+ * array is empty or it could not be captured.
+ */
+drm_public int drmIoctlTraceAddChunk(drmTraceChunksPtr c, int parent,
+                                     uint32_t offset, uint64_t size)
+{
+    const void *base;
+    uint64_t ptr;
+
+    if (parent >= (int)c->count)
+        return -1;
+
+    base = parent < 0 ? c->arg : c->data[parent];
+    memcpy(&ptr, (const char *)base + offset, sizeof(ptr));
+    if (!ptr || !size || size > UINT32_MAX)
+        return -1;
+
+    if (c->count == c->size) {
+        unsigned int new_size = c->size ? c->size * 2 : 8;
+        drmTraceChunk *chunks;
+        const void **data;
+
+        chunks = realloc(c->chunks, new_size * sizeof(*chunks));
+        if (!chunks)
+            return -1;
+        c->chunks = chunks;
+
+        data = realloc(c->data, new_size * sizeof(*data));
+        if (!data)
+            return -1;
+        c->data = data;
+
+        c->size = new_size;
+    }
+
+    memclear(c->chunks[c->count]);
+    c->chunks[c->count].parent = parent;
+    c->chunks[c->count].offset = offset;
+    c->chunks[c->count].size = size;
+    c->data[c->count] = (const void *)(uintptr_t)ptr;
+
+    return c->count++;
+}
+
+/**
+ * Get the data of a chunk, as captured by drmIoctlTraceAddChunk()
+ */
+drm_public const void *drmIoctlTraceChunkData(drmTraceChunksPtr c, int index)
+{
+    if (index < 0 || index >= (int)c->count)
+        return NULL;
+
+    return c->data[index];
+}
+
+static void drmIoctlTraceAtomic(drmTraceChunksPtr c, const void *arg)
+{
+    const struct drm_mode_atomic *atomic = arg;
+    const uint32_t *count_props;
+    uint64_t count = 0;
+    unsigned int i;
+    int parent;
+
+    drmIoctlTraceAddChunk(c, -1, offsetof(struct drm_mode_atomic, objs_ptr),
+                          atomic->count_objs * sizeof(uint32_t));
+    parent = drmIoctlTraceAddChunk(c, -1,
+                    offsetof(struct drm_mode_atomic, count_props_ptr),
+                    atomic->count_objs * sizeof(uint32_t));
+    if (parent < 0)
+        return;
+
+    count_props = drmIoctlTraceChunkData(c, parent);
+    for (i = 0; i < atomic->count_objs; i++)
+        count += count_props[i];
+
+    drmIoctlTraceAddChunk(c, -1, offsetof(struct drm_mode_atomic, props_ptr),
+                          count * sizeof(uint32_t));
+    drmIoctlTraceAddChunk(c, -1,
+                          offsetof(struct drm_mode_atomic, prop_values_ptr),
+                          count * sizeof(uint64_t));
+}
+
+static void drmIoctlTraceGetChunks(drmTraceChunksPtr c, unsigned long request)
+{
+    drmTraceChunksFunc func = NULL;
+    unsigned int i;
+
+    pthread_mutex_lock(&drm_ioctl_hooks_lock);
+    for (i = 0; i < drm_ioctl_trace_num_funcs; i++) {
+        if (drm_ioctl_trace_funcs[i].request == request) {
+            func = drm_ioctl_trace_funcs[i].func;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&drm_ioctl_hooks_lock);
+
+    if (func)
+        func(c, c->arg);
+}
+
+/*
+ * Build a record holding everything known before the ioctl; the argument
+ * as it is returned is filled in by drmIoctlTraceEnd().
+ */
+static drmTraceRecord *drmIoctlTraceBegin(unsigned long request, void *arg)
+{
+    drmTraceChunks c = { .arg = arg };
+    size_t arg_size = 0, size;
+    drmTraceRecord *record;
+    unsigned int flags = 0;
+    unsigned int i;
+    char *ptr;
+
+    if (arg) {
+        arg_size = DRM_IOCTL_ARG_SIZE(request);
+        if (arg_size && DRM_IOCTL_ARG_IN(request)) {
+            flags |= DRM_TRACE_ARG_IN;
+            drmIoctlTraceGetChunks(&c, request);
+        }
+        if (arg_size && DRM_IOCTL_ARG_OUT(request))
+            flags |= DRM_TRACE_ARG_OUT;
+    }
+
+    size = sizeof(*record);
+    if (flags & DRM_TRACE_ARG_IN)
+        size += DRM_TRACE_ALIGN(arg_size);
+    if (flags & DRM_TRACE_ARG_OUT)
+        size += DRM_TRACE_ALIGN(arg_size);
+    for (i = 0; i < c.count; i++)
+        size += sizeof(drmTraceChunk) + DRM_TRACE_ALIGN(c.chunks[i].size);
+
+    record = size <= UINT32_MAX ? calloc(1, size) : NULL;
+    if (!record)
+        goto out;
+
+    if (!drm_ioctl_trace_thread)
+        drm_ioctl_trace_thread = __sync_add_and_fetch(&drm_ioctl_trace.threads,
+                                                      1);
+
+    record->size = size;
+    record->flags = flags;
+    record->request = request;
+    record->thread = drm_ioctl_trace_thread;
+    record->arg_size = arg_size;
+    record->num_chunks = c.count;
+
+    ptr = (char *)(record + 1);
+    if (flags & DRM_TRACE_ARG_IN) {
+        memcpy(ptr, arg, arg_size);
+        ptr += DRM_TRACE_ALIGN(arg_size);
+    }
+    if (flags & DRM_TRACE_ARG_OUT)
+        ptr += DRM_TRACE_ALIGN(arg_size);
+
+    for (i = 0; i < c.count; i++) {
+        memcpy(ptr, &c.chunks[i], sizeof(c.chunks[i]));
+        ptr += sizeof(c.chunks[i]);
+        memcpy(ptr, c.data[i], c.chunks[i].size);
+        ptr += DRM_TRACE_ALIGN(c.chunks[i].size);
+    }
+
+out:
+    free(c.chunks);
+    free(c.data);
+    return record;
+}
+
+/*
+ * Called with the trace lock held.  Once a write failed, part of a record
+ * may be in the file and anything written after it would be misaligned, so
+ * tracing is stopped instead.
+ */
+static int drmIoctlTraceFlush(void)
+{
+    size_t done = 0;
+    ssize_t ret;
+    int err;
+
+    while (done < drm_ioctl_trace.used) {
+        ret = write(drm_ioctl_trace.fd, drm_ioctl_trace.buffer + done,
+                    drm_ioctl_trace.used - done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            err = ret < 0 ? -errno : -ENOSPC;
+            drmMsg("ioctl trace write failed: %s, tracing stopped\n",
+                   strerror(-err));
+            drmIoctlSetHook(DRM_IOCTL_HOOK_TRACE, 0);
+            close(drm_ioctl_trace.fd);
+            free(drm_ioctl_trace.buffer);
+            drm_ioctl_trace.fd = -1;
+            drm_ioctl_trace.buffer = NULL;
+            drm_ioctl_trace.used = 0;
+            return err;
+        }
+        done += ret;
+    }
+
+    drm_ioctl_trace.used = 0;
+    return 0;
+}
+
+static void drmIoctlTraceEnd(drmTraceRecord *record, int fd, void *arg,
+                             int ret, int error, uint64_t start, uint64_t ns)
+{
+    const char *data = (const char *)record;
+    size_t size = record->size, len;
+
+    record->fd = fd;
+    record->ret = ret;
+    record->error = ret == -1 ? error : 0;
+    record->duration_ns = ns;
+
+    if (record->flags & DRM_TRACE_ARG_OUT) {
+        char *out = (char *)(record + 1);
+
+        if (record->flags & DRM_TRACE_ARG_IN)
+            out += DRM_TRACE_ALIGN(record->arg_size);
+        memcpy(out, arg, record->arg_size);
+    }
+
+    pthread_mutex_lock(&drm_ioctl_trace.lock);
+
+    if (drm_ioctl_trace.fd < 0)
+        goto out;
+
+    record->time_ns = start - drm_ioctl_trace.start_ns;
+
+    /* records larger than the buffer go through it in pieces */
+    while (size) {
+        if (drm_ioctl_trace.used == DRM_IOCTL_TRACE_BUFFER_SIZE &&
+            drmIoctlTraceFlush())
+            break;
+
+        len = MIN2(size, DRM_IOCTL_TRACE_BUFFER_SIZE - drm_ioctl_trace.used);
+        memcpy(drm_ioctl_trace.buffer + drm_ioctl_trace.used, data, len);
+        drm_ioctl_trace.used += len;
+        data += len;
+        size -= len;
+    }
+
+out:
+    pthread_mutex_unlock(&drm_ioctl_trace.lock);
+    free(record);
+}
+
+static int drmIoctlHooked(int fd, unsigned long request, void *arg)
+{
+    drmTraceRecord *record = NULL;
+    int hooks = drm_ioctl_hooks;
+    int ret, error, retries = -1;
+    uint64_t start, ns;
+
+    if (hooks & DRM_IOCTL_HOOK_TRACE)
+        record = drmIoctlTraceBegin(request, arg);
+
+    start = drmIoctlNow();
+    do {
+        ret = ioctl(fd, request, arg);
+        retries++;
+    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+    error = errno;
+    ns = drmIoctlNow() - start;
+
+    if (hooks & DRM_IOCTL_HOOK_STATS)
+        drmIoctlStatsAdd(request, ret, retries, ns);
+
+    if (record)
+        drmIoctlTraceEnd(record, fd, arg, ret, error, start, ns);
+
+    errno = error;
+    return ret;
+}
+
 /**
  * Call ioctl, restarting if it is interupted
  */
@@ -186,12 +747,190 @@ drmIoctl(int fd, unsigned long request, void *arg)
 {
     int ret;
 
+    if (drm_ioctl_hooks) {
+        if (drm_ioctl_hooks < 0)
+            pthread_once(&drm_ioctl_hooks_once, drmIoctlCheckEnv);
+        if (drm_ioctl_hooks > 0)
+            return drmIoctlHooked(fd, request, arg);
+    }
+
     do {
         ret = ioctl(fd, request, arg);
     } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
     return ret;
 }
 
+drm_public void drmIoctlStatsEnable(int enable)
+{
+    pthread_once(&drm_ioctl_hooks_once, drmIoctlCheckEnv);
+    drmIoctlSetHook(DRM_IOCTL_HOOK_STATS, enable);
+}
+
+/**
+ * Get the ioctl statistics
+ *
+ * Stores the statistics of up to \p max ioctls that were called at least
+ * once, summed over all threads, in \p stats.
+ *
+ * \return the number of ioctls with statistics.
+ */
+drm_public int drmGetIoctlStats(drmIoctlStatsPtr stats, int max)
+{
+    struct drm_ioctl_stats_block *block;
+    drmIoctlStats *sum, *total;
+    int nr, i, count = 0;
+
+    sum = calloc(DRM_IOCTL_STATS_NR, sizeof(*sum));
+    if (!sum)
+        return -ENOMEM;
+
+    pthread_mutex_lock(&drm_ioctl_stats.lock);
+
+    for (block = drm_ioctl_stats.blocks; block; block = block->next) {
+        for (nr = 0; nr < DRM_IOCTL_STATS_NR; nr++) {
+            const drmIoctlStats *s = &block->stats[nr];
+
+            if (!s->count)
+                continue;
+
+            total = drmIoctlStatsLookup(sum, s->request);
+            if (!total)
+                continue;
+
+            total->request = s->request;
+            total->count += s->count;
+            total->retries += s->retries;
+            total->errors += s->errors;
+            total->total_ns += s->total_ns;
+            total->max_ns = MAX2(total->max_ns, s->max_ns);
+            for (i = 0; i < DRM_IOCTL_LATENCY_BUCKETS; i++)
+                total->latency[i] += s->latency[i];
+        }
+    }
+
+    pthread_mutex_unlock(&drm_ioctl_stats.lock);
+
+    for (nr = 0; nr < DRM_IOCTL_STATS_NR; nr++) {
+        if (!sum[nr].count)
+            continue;
+        if (count < max)
+            stats[count] = sum[nr];
+        count++;
+    }
+
+    free(sum);
+    return count;
+}
+
+/* Only exact while no other thread is in an ioctl */
+drm_public void drmResetIoctlStats(void)
+{
+    struct drm_ioctl_stats_block *block;
+
+    pthread_mutex_lock(&drm_ioctl_stats.lock);
+    for (block = drm_ioctl_stats.blocks; block; block = block->next)
+        memset(block->stats, 0, sizeof(block->stats));
+    pthread_mutex_unlock(&drm_ioctl_stats.lock);
+}
+
+drm_public void drmDumpIoctlStats(int fd)
+{
+    drmIoctlStats stats[DRM_IOCTL_STATS_NR];
+    int count, i, j;
+
+    count = drmGetIoctlStats(stats, DRM_IOCTL_STATS_NR);
+
+    for (i = 0; i < count; i++) {
+        dprintf(fd, "ioctl 0x%08lx: %" PRIu64 " calls, %" PRIu64 " retries, "
+                "%" PRIu64 " errors, avg %" PRIu64 " ns, max %" PRIu64 " ns\n",
+                stats[i].request, stats[i].count, stats[i].retries,
+                stats[i].errors, stats[i].total_ns / stats[i].count,
+                stats[i].max_ns);
+
+        for (j = 0; j < DRM_IOCTL_LATENCY_BUCKETS - 1; j++) {
+            if (stats[i].latency[j])
+                dprintf(fd, "  <  %8lu us: %" PRIu64 "\n", 1ul << j,
+                        stats[i].latency[j]);
+        }
+        if (stats[i].latency[j])
+            dprintf(fd, "  >= %8lu us: %" PRIu64 "\n", 1ul << (j - 1),
+                    stats[i].latency[j]);
+    }
+}
+
+static int drmIoctlTraceStart(const char *path)
+{
+    drmTraceHeader header;
+    char *buffer;
+    int fd;
+
+    drmIoctlTraceClose();
+
+    buffer = malloc(DRM_IOCTL_TRACE_BUFFER_SIZE);
+    if (!buffer)
+        return -ENOMEM;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(buffer);
+        return -errno;
+    }
+
+    memclear(header);
+    header.magic = DRM_TRACE_MAGIC;
+    header.version = DRM_TRACE_VERSION;
+    header.pid = getpid();
+    header.start_ns = drmIoctlNow();
+
+    pthread_mutex_lock(&drm_ioctl_trace.lock);
+    drm_ioctl_trace.fd = fd;
+    drm_ioctl_trace.start_ns = header.start_ns;
+    drm_ioctl_trace.buffer = buffer;
+    memcpy(buffer, &header, sizeof(header));
+    drm_ioctl_trace.used = sizeof(header);
+    pthread_mutex_unlock(&drm_ioctl_trace.lock);
+
+    drmIoctlSetHook(DRM_IOCTL_HOOK_TRACE, 1);
+    return 0;
+}
+
+/**
+ * Flush and close the ioctl trace, if one is being written
+ */
+drm_public void drmIoctlTraceClose(void)
+{
+    drmIoctlSetHook(DRM_IOCTL_HOOK_TRACE, 0);
+
+    pthread_mutex_lock(&drm_ioctl_trace.lock);
+    if (drm_ioctl_trace.fd >= 0 && !drmIoctlTraceFlush()) {
+        close(drm_ioctl_trace.fd);
+        free(drm_ioctl_trace.buffer);
+        drm_ioctl_trace.fd = -1;
+        drm_ioctl_trace.buffer = NULL;
+    }
+    pthread_mutex_unlock(&drm_ioctl_trace.lock);
+}
+
+/**
+ * Start writing a trace of all ioctls to \p path
+ *
+ * Any trace that is already being written is closed first.
+ *
+ * \return zero on success or a negative errno.
+ */
+drm_public int drmIoctlTraceOpen(const char *path)
+{
+    pthread_once(&drm_ioctl_hooks_once, drmIoctlCheckEnv);
+    return drmIoctlTraceStart(path);
+}
+
+static void __attribute__((destructor)) drmIoctlHooksFini(void)
+{
+    if (drm_ioctl_stats.dump)
+        drmDumpIoctlStats(STDERR_FILENO);
+    drmIoctlTraceClose();
+}
+
 static unsigned long drmGetKeyFromFd(int fd)
 {
     stat_t     st;
@@ -201,27 +940,62 @@ static unsigned long drmGetKeyFromFd(int fd)
     return st.st_rdev;
 }
 
-drm_public drmHashEntry *drmGetEntry(int fd)
+/*
+ * Per-device entries are looked up through a sharded registry, so that
+ * threads working on different devices do not serialize.  drmHashTable is
+ * only kept up to date for drmGetHashTable() users.
+ */
+static drmRegistryPtr drm_entries;
+static pthread_once_t drm_entries_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drm_hash_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void drmEntriesInit(void)
+{
+    drm_entries = drmRegistryCreate();
+}
+
+static void *drmEntryCreate(unsigned long key, void *data)
 {
-    unsigned long key = drmGetKeyFromFd(fd);
-    void          *value;
     drmHashEntry  *entry;
 
+    entry = drmMalloc(sizeof(*entry));
+    if (!entry)
+        return NULL;
+
+    entry->fd       = *(int *)data;
+    entry->f        = NULL;
+    entry->tagTable = drmHashCreate();
+    if (!entry->tagTable) {
+        drmFree(entry);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&drm_hash_table_lock);
     if (!drmHashTable)
         drmHashTable = drmHashCreate();
-
-    if (drmHashLookup(drmHashTable, key, &value)) {
-        entry           = drmMalloc(sizeof(*entry));
-        entry->fd       = fd;
-        entry->f        = NULL;
-        entry->tagTable = drmHashCreate();
+    if (drmHashTable)
         drmHashInsert(drmHashTable, key, entry);
-    } else {
-        entry = value;
-    }
+    pthread_mutex_unlock(&drm_hash_table_lock);
+
     return entry;
 }
 
+/**
+ * Get the entry of the device behind \p fd, creating it on first use
+ *
+ * \return the entry, or NULL if it could not be allocated.
+ */
+drm_public drmHashEntry *drmGetEntry(int fd)
+{
+    unsigned long key = drmGetKeyFromFd(fd);
+
+    pthread_once(&drm_entries_once, drmEntriesInit);
+    if (!drm_entries)
+        return NULL;
+
+    return drmRegistryGet(drm_entries, key, NULL, drmEntryCreate, &fd);
+}
+
 /**
  * Compare two busid strings
  *
@@ -1236,16 +2010,20 @@ drm_public int drmFreeBufs(int fd, int count, int *list)
  */
 drm_public int drmClose(int fd)
 {
-    unsigned long key    = drmGetKeyFromFd(fd);
-    drmHashEntry  *entry = drmGetEntry(fd);
+    unsigned long key = drmGetKeyFromFd(fd);
+    drmHashEntry  *entry;
 
-    drmHashDestroy(entry->tagTable);
-    entry->fd       = 0;
-    entry->f        = NULL;
-    entry->tagTable = NULL;
+    pthread_once(&drm_entries_once, drmEntriesInit);
+
+    entry = drm_entries ? drmRegistryLookup(drm_entries, key) : NULL;
+    if (entry && !drmRegistryRemove(drm_entries, key, entry)) {
+        pthread_mutex_lock(&drm_hash_table_lock);
+        drmHashDelete(drmHashTable, key);
+        pthread_mutex_unlock(&drm_hash_table_lock);
 
-    drmHashDelete(drmHashTable, key);
-    drmFree(entry);
+        drmHashDestroy(entry->tagTable);
+        drmFree(entry);
+    }
 
     return close(fd);
 }
@@ -2303,6 +3081,9 @@ drm_public int drmAddContextTag(int fd, drm_context_t context, void *tag)
 {
     drmHashEntry  *entry = drmGetEntry(fd);
 
+    if (!entry)
+        return -ENOMEM;
+
     if (drmHashInsert(entry->tagTable, context, tag)) {
         drmHashDelete(entry->tagTable, context);
         drmHashInsert(entry->tagTable, context, tag);
@@ -2314,6 +3095,9 @@ drm_public int drmDelContextTag(int fd, drm_context_t context)
 {
     drmHashEntry  *entry = drmGetEntry(fd);
 
+    if (!entry)
+        return -1;
+
     return drmHashDelete(entry->tagTable, context);
 }
 
@@ -2322,7 +3106,7 @@ drm_public void *drmGetContextTag(int fd, drm_context_t context)
     drmHashEntry  *entry = drmGetEntry(fd);
     void          *value;
 
-    if (drmHashLookup(entry->tagTable, context, &value))
+    if (!entry || drmHashLookup(entry->tagTable, context, &value))
         return NULL;
 
     return value;
@@ -2665,15 +3449,27 @@ drm_public int drmCommandWriteRead(int fd, unsigned long drmCommandIndex,
     return 0;
 }
 
-#define DRM_MAX_FDS 16
-static struct {
+struct drm_once_connection {
+    struct drm_once_connection *next;   /* with the same key */
     char *BusID;
     int fd;
     int refcount;
     int type;
-} connection[DRM_MAX_FDS];
+};
+
+static pthread_mutex_t drm_once_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *drm_once_by_bus;   /* drmOnceKey() -> connection list */
+static void *drm_once_by_fd;    /* fd -> connection */
+
+static unsigned long drmOnceKey(const char *BusID, int type)
+{
+    unsigned long hash = 2166136261u ^ (unsigned long)type;
 
-static int nr_fds = 0;
+    while (*BusID)
+        hash = (hash ^ (unsigned char)*BusID++) * 16777619u;
+
+    return hash;
+}
 
 drm_public int drmOpenOnce(void *unused, const char *BusID, int *newlyopened)
 {
@@ -2683,54 +3479,111 @@ drm_public int drmOpenOnce(void *unused, const char *BusID, int *newlyopened)
 drm_public int drmOpenOnceWithType(const char *BusID, int *newlyopened,
                                    int type)
 {
-    int i;
+    unsigned long key = drmOnceKey(BusID, type);
+    struct drm_once_connection *conn, *head = NULL;
+    void *value;
     int fd;
 
-    for (i = 0; i < nr_fds; i++)
-        if ((strcmp(BusID, connection[i].BusID) == 0) &&
-            (connection[i].type == type)) {
-            connection[i].refcount++;
+    pthread_mutex_lock(&drm_once_lock);
+
+    if (!drm_once_by_bus)
+        drm_once_by_bus = drmHashCreate();
+    if (!drm_once_by_fd)
+        drm_once_by_fd = drmHashCreate();
+
+    if (drm_once_by_bus && !drmHashLookup(drm_once_by_bus, key, &value))
+        head = value;
+
+    for (conn = head; conn; conn = conn->next)
+        if ((strcmp(BusID, conn->BusID) == 0) && (conn->type == type)) {
+            conn->refcount++;
             *newlyopened = 0;
-            return connection[i].fd;
+            pthread_mutex_unlock(&drm_once_lock);
+            return conn->fd;
         }
 
     fd = drmOpenWithType(NULL, BusID, type);
-    if (fd < 0 || nr_fds == DRM_MAX_FDS)
-        return fd;
+    if (fd < 0)
+        goto out;
 
-    connection[nr_fds].BusID = strdup(BusID);
-    connection[nr_fds].fd = fd;
-    connection[nr_fds].refcount = 1;
-    connection[nr_fds].type = type;
     *newlyopened = 1;
 
-    if (0)
-        fprintf(stderr, "saved connection %d for %s %d\n",
-                nr_fds, connection[nr_fds].BusID,
-                strcmp(BusID, connection[nr_fds].BusID));
+    if (!drm_once_by_bus || !drm_once_by_fd)
+        goto out;
+
+    /* if this fails, the fd is returned without being shared */
+    conn = drmMalloc(sizeof(*conn));
+    if (!conn)
+        goto out;
+
+    conn->BusID = strdup(BusID);
+    conn->fd = fd;
+    conn->refcount = 1;
+    conn->type = type;
+    conn->next = head;
+
+    if (!conn->BusID || drmHashInsert(drm_once_by_fd, fd, conn)) {
+        free(conn->BusID);
+        drmFree(conn);
+        goto out;
+    }
+
+    drmHashDelete(drm_once_by_bus, key);
+    if (drmHashInsert(drm_once_by_bus, key, conn)) {
+        drmHashDelete(drm_once_by_fd, fd);
+        if (head)
+            drmHashInsert(drm_once_by_bus, key, head);
+        free(conn->BusID);
+        drmFree(conn);
+        goto out;
+    }
 
-    nr_fds++;
+out:
+    pthread_mutex_unlock(&drm_once_lock);
 
     return fd;
 }
 
 drm_public void drmCloseOnce(int fd)
 {
-    int i;
+    struct drm_once_connection *conn, **prev;
+    unsigned long key;
+    void *value;
+
+    pthread_mutex_lock(&drm_once_lock);
+
+    if (!drm_once_by_fd || drmHashLookup(drm_once_by_fd, fd, &value))
+        goto out;
 
-    for (i = 0; i < nr_fds; i++) {
-        if (fd == connection[i].fd) {
-            if (--connection[i].refcount == 0) {
-                drmClose(connection[i].fd);
-                free(connection[i].BusID);
+    conn = value;
+    if (--conn->refcount)
+        goto out;
 
-                if (i < --nr_fds)
-                    connection[i] = connection[nr_fds];
+    key = drmOnceKey(conn->BusID, conn->type);
+    drmHashDelete(drm_once_by_fd, fd);
 
-                return;
+    if (!drmHashLookup(drm_once_by_bus, key, &value)) {
+        if (value == conn) {
+            drmHashDelete(drm_once_by_bus, key);
+            if (conn->next)
+                drmHashInsert(drm_once_by_bus, key, conn->next);
+        } else {
+            for (prev = &((struct drm_once_connection *)value)->next;
+                 *prev; prev = &(*prev)->next) {
+                if (*prev == conn) {
+                    *prev = conn->next;
+                    break;
+                }
             }
         }
     }
+
+    drmClose(conn->fd);
+    free(conn->BusID);
+    drmFree(conn);
+
+out:
+    pthread_mutex_unlock(&drm_once_lock);
 }
 
 drm_public int drmSetMaster(int fd)
@@ -2766,76 +3619,376 @@ drm_public char *drmGetDeviceNameFromFd(int fd)
     if (i == DRM_MAX_MINOR)
         return NULL;
 
-    return strdup(name);
+    return strdup(name);
+}
+
+static bool drmNodeIsDRM(int maj, int min)
+{
+#ifdef __linux__
+    char path[64];
+    struct stat sbuf;
+
+    snprintf(path, sizeof(path), "/sys/dev/char/%d:%d/device/drm",
+             maj, min);
+    return stat(path, &sbuf) == 0;
+#else
+    return maj == DRM_MAJOR;
+#endif
+}
+
+drm_public int drmGetNodeTypeFromFd(int fd)
+{
+    struct stat sbuf;
+    int maj, min, type;
+
+    if (fstat(fd, &sbuf))
+        return -1;
+
+    maj = major(sbuf.st_rdev);
+    min = minor(sbuf.st_rdev);
+
+    if (!drmNodeIsDRM(maj, min) || !S_ISCHR(sbuf.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    type = drmGetMinorType(min);
+    if (type == -1)
+        errno = ENODEV;
+    return type;
+}
+
+drm_public int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags,
+                                  int *prime_fd)
+{
+    struct drm_prime_handle args;
+    int ret;
+
+    memclear(args);
+    args.fd = -1;
+    args.handle = handle;
+    args.flags = flags;
+    ret = drmIoctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &args);
+    if (ret)
+        return ret;
+
+    *prime_fd = args.fd;
+    return 0;
+}
+
+drm_public int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
+{
+    struct drm_prime_handle args;
+    int ret;
+
+    memclear(args);
+    args.fd = prime_fd;
+    ret = drmIoctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args);
+    if (ret)
+        return ret;
+
+    *handle = args.handle;
+    return 0;
+}
+
+static int drmPrimeSize(int prime_fd, uint64_t *size)
+{
+    off_t end;
+
+    end = lseek(prime_fd, 0, SEEK_END);
+    if (end < 0)
+        return -errno;
+
+    lseek(prime_fd, 0, SEEK_SET);
+    *size = end;
+    return 0;
+}
+
+struct drm_prime_entry {
+    dev_t dev;
+    ino_t ino;
+    uint32_t handle;
+    uint64_t size;          /* 0 until someone asks for it */
+};
+
+struct _drmPrimeCache {
+    int fd;
+    pthread_mutex_t lock;
+    void *inodes;           /* low bits of the inode -> entry */
+    void *handles;          /* GEM handle -> entry */
+    drmPrimeCacheStats stats;
+};
+
+static struct drm_prime_entry *drmPrimeCacheLookup(drmPrimeCachePtr cache,
+                                                   const struct stat *st)
+{
+    struct drm_prime_entry *entry;
+    void *value;
+
+    if (drmHashLookup(cache->inodes, (unsigned long)st->st_ino, &value))
+        return NULL;
+
+    entry = value;
+    if (entry->ino != st->st_ino || entry->dev != st->st_dev)
+        return NULL;
+
+    return entry;
+}
+
+static void drmPrimeCacheRemove(drmPrimeCachePtr cache,
+                                struct drm_prime_entry *entry)
+{
+    void *value;
+
+    if (!drmHashLookup(cache->inodes, (unsigned long)entry->ino, &value) &&
+        value == entry)
+        drmHashDelete(cache->inodes, (unsigned long)entry->ino);
+
+    drmHashDelete(cache->handles, entry->handle);
+    free(entry);
+}
+
+/* Failing to record a buffer only costs a later ioctl, so errors are ignored */
+static void drmPrimeCacheAdd(drmPrimeCachePtr cache, const struct stat *st,
+                             uint32_t handle, uint64_t size)
+{
+    struct drm_prime_entry *entry;
+    void *value;
+
+    if (!drmHashLookup(cache->handles, handle, &value)) {
+        entry = value;
+        if (entry->ino == st->st_ino && entry->dev == st->st_dev) {
+            if (size)
+                entry->size = size;
+            return;
+        }
+        drmPrimeCacheRemove(cache, entry);
+    }
+
+    if (!drmHashLookup(cache->inodes, (unsigned long)st->st_ino, &value))
+        drmPrimeCacheRemove(cache, value);
+
+    entry = malloc(sizeof(*entry));
+    if (!entry)
+        return;
+
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->handle = handle;
+    entry->size = size;
+
+    if (drmHashInsert(cache->handles, handle, entry)) {
+        free(entry);
+        return;
+    }
+
+    if (drmHashInsert(cache->inodes, (unsigned long)st->st_ino, entry)) {
+        drmHashDelete(cache->handles, handle);
+        free(entry);
+    }
+}
+
+static int drmPrimeImport(int fd, drmPrimeCachePtr cache, const int *prime_fds,
+                          uint32_t *handles, uint64_t *sizes,
+                          unsigned int count)
+{
+    struct drm_prime_entry *entry;
+    struct drm_prime_handle args;
+    struct stat st;
+    uint64_t size;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < count; i++) {
+        if (cache) {
+            if (fstat(prime_fds[i], &st))
+                return -errno;
+
+            entry = drmPrimeCacheLookup(cache, &st);
+            if (entry) {
+                if (sizes && !entry->size) {
+                    ret = drmPrimeSize(prime_fds[i], &entry->size);
+                    if (ret)
+                        return ret;
+                }
+
+                cache->stats.hits++;
+                handles[i] = entry->handle;
+                if (sizes)
+                    sizes[i] = entry->size;
+                continue;
+            }
+
+            cache->stats.misses++;
+        }
+
+        /* query the size first so that a failure does not leak a handle */
+        size = 0;
+        if (sizes) {
+            ret = drmPrimeSize(prime_fds[i], &size);
+            if (ret)
+                return ret;
+        }
+
+        memclear(args);
+        args.fd = prime_fds[i];
+        if (drmIoctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args))
+            return -errno;
+
+        handles[i] = args.handle;
+        if (sizes)
+            sizes[i] = size;
+
+        if (cache)
+            drmPrimeCacheAdd(cache, &st, args.handle, size);
+    }
+
+    return 0;
+}
+
+static int drmPrimeExport(int fd, drmPrimeCachePtr cache,
+                          const uint32_t *handles, uint32_t flags,
+                          int *prime_fds, unsigned int count)
+{
+    struct drm_prime_handle args;
+    struct stat st;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        memclear(args);
+        args.fd = -1;
+        args.handle = handles[i];
+        args.flags = flags;
+        if (drmIoctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &args))
+            return -errno;
+
+        prime_fds[i] = args.fd;
+
+        if (cache) {
+            cache->stats.exports++;
+            if (!fstat(args.fd, &st))
+                drmPrimeCacheAdd(cache, &st, handles[i], 0);
+        }
+    }
+
+    return 0;
+}
+
+drm_public int drmPrimeHandlesToFDs(int fd, const uint32_t *handles,
+                                    uint32_t flags, int *prime_fds,
+                                    unsigned int count)
+{
+    if (count && (!handles || !prime_fds))
+        return -EINVAL;
+
+    return drmPrimeExport(fd, NULL, handles, flags, prime_fds, count);
+}
+
+drm_public int drmPrimeFDsToHandles(int fd, const int *prime_fds,
+                                    uint32_t *handles, unsigned int count)
+{
+    if (count && (!prime_fds || !handles))
+        return -EINVAL;
+
+    return drmPrimeImport(fd, NULL, prime_fds, handles, NULL, count);
 }
 
-static bool drmNodeIsDRM(int maj, int min)
+drm_public drmPrimeCachePtr drmPrimeCacheCreate(int fd)
 {
-#ifdef __linux__
-    char path[64];
-    struct stat sbuf;
+    drmPrimeCachePtr cache;
 
-    snprintf(path, sizeof(path), "/sys/dev/char/%d:%d/device/drm",
-             maj, min);
-    return stat(path, &sbuf) == 0;
-#else
-    return maj == DRM_MAJOR;
-#endif
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    cache->fd = fd;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    cache->inodes = drmHashCreate();
+    cache->handles = drmHashCreate();
+    if (!cache->inodes || !cache->handles) {
+        drmPrimeCacheDestroy(cache);
+        return NULL;
+    }
+
+    return cache;
 }
 
-drm_public int drmGetNodeTypeFromFd(int fd)
+drm_public void drmPrimeCacheDestroy(drmPrimeCachePtr cache)
 {
-    struct stat sbuf;
-    int maj, min, type;
+    unsigned long key;
+    void *value;
 
-    if (fstat(fd, &sbuf))
-        return -1;
-
-    maj = major(sbuf.st_rdev);
-    min = minor(sbuf.st_rdev);
+    if (!cache)
+        return;
 
-    if (!drmNodeIsDRM(maj, min) || !S_ISCHR(sbuf.st_mode)) {
-        errno = EINVAL;
-        return -1;
+    if (cache->handles) {
+        if (drmHashFirst(cache->handles, &key, &value)) {
+            do {
+                free(value);
+            } while (drmHashNext(cache->handles, &key, &value));
+        }
+        drmHashDestroy(cache->handles);
     }
 
-    type = drmGetMinorType(min);
-    if (type == -1)
-        errno = ENODEV;
-    return type;
+    if (cache->inodes)
+        drmHashDestroy(cache->inodes);
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
 }
 
-drm_public int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags,
-                                  int *prime_fd)
+drm_public int drmPrimeCacheImport(drmPrimeCachePtr cache, const int *prime_fds,
+                                   uint32_t *handles, uint64_t *sizes,
+                                   unsigned int count)
 {
-    struct drm_prime_handle args;
     int ret;
 
-    memclear(args);
-    args.fd = -1;
-    args.handle = handle;
-    args.flags = flags;
-    ret = drmIoctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &args);
-    if (ret)
-        return ret;
+    if (!cache || (count && (!prime_fds || !handles)))
+        return -EINVAL;
 
-    *prime_fd = args.fd;
-    return 0;
+    pthread_mutex_lock(&cache->lock);
+    ret = drmPrimeImport(cache->fd, cache, prime_fds, handles, sizes, count);
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
 }
 
-drm_public int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
+drm_public int drmPrimeCacheExport(drmPrimeCachePtr cache,
+                                   const uint32_t *handles, uint32_t flags,
+                                   int *prime_fds, unsigned int count)
 {
-    struct drm_prime_handle args;
     int ret;
 
-    memclear(args);
-    args.fd = prime_fd;
-    ret = drmIoctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args);
-    if (ret)
-        return ret;
+    if (!cache || (count && (!handles || !prime_fds)))
+        return -EINVAL;
 
-    *handle = args.handle;
-    return 0;
+    pthread_mutex_lock(&cache->lock);
+    ret = drmPrimeExport(cache->fd, cache, handles, flags, prime_fds, count);
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
+}
+
+drm_public void drmPrimeCacheForget(drmPrimeCachePtr cache, uint32_t handle)
+{
+    void *value;
+
+    if (!cache)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    if (!drmHashLookup(cache->handles, handle, &value))
+        drmPrimeCacheRemove(cache, value);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+drm_public void drmPrimeCacheGetStats(drmPrimeCachePtr cache,
+                                      drmPrimeCacheStatsPtr stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
 }
 
 static char *drmGetMinorNameForFD(int fd, int type)
@@ -3771,56 +4924,451 @@ process_device(drmDevicePtr *device, const char *d_name,
    }
 }
 
-/* Consider devices located on the same bus as duplicate and fold the respective
- * entries into a single one.
- *
- * Note: this leaves "gaps" in the array, while preserving the length.
+/* Consider devices located on the same bus as duplicate and fold the respective
+ * entries into a single one.
+ *
+ * Note: this leaves "gaps" in the array, while preserving the length.
+ */
+static void drmFoldDuplicatedDevices(drmDevicePtr local_devices[], int count)
+{
+    int node_type, i, j;
+
+    for (i = 0; i < count; i++) {
+        for (j = i + 1; j < count; j++) {
+            if (drmDevicesEqual(local_devices[i], local_devices[j])) {
+                local_devices[i]->available_nodes |= local_devices[j]->available_nodes;
+                node_type = log2(local_devices[j]->available_nodes);
+                memcpy(local_devices[i]->nodes[node_type],
+                       local_devices[j]->nodes[node_type], drmGetMaxNodeName());
+                drmFreeDevice(&local_devices[j]);
+            }
+        }
+    }
+}
+
+/* Check that the given flags are valid returning 0 on success */
+static int
+drm_device_validate_flags(uint32_t flags)
+{
+        return (flags & ~DRM_DEVICE_GET_PCI_REVISION);
+}
+
+static bool
+drm_device_has_rdev(drmDevicePtr device, dev_t find_rdev)
+{
+    struct stat sbuf;
+
+    for (int i = 0; i < DRM_NODE_MAX; i++) {
+        if (device->available_nodes & 1 << i) {
+            if (stat(device->nodes[i], &sbuf) == 0 &&
+                sbuf.st_rdev == find_rdev)
+                return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * The kernel drm core has a number of places that assume maximum of
+ * 3x64 devices nodes. That's 64 for each of primary, control and
+ * render nodes. Rounded it up to 256 for simplicity.
+ */
+#define MAX_DRM_NODES 256
+
+#ifdef __linux__
+/*
+ * Process-wide cache of the enumerated devices.
+ *
+ * Walking DRM_DIR_NAME and parsing sysfs for every node is expensive, while
+ * the set of devices only changes on hotplug.  The table is therefore built
+ * once (one per flags value, as the PCI revision is optional) and kept until
+ * the inotify watch on DRM_DIR_NAME reports that a node was added, removed or
+ * changed.  Callers always get their own copies of the cached devices.
+ */
+struct drm_device_cache_entry {
+    drmDevicePtr device;
+    dev_t rdev[DRM_NODE_MAX];
+};
+
+#define DRM_DEVICE_CACHE_TABLES (DRM_DEVICE_GET_PCI_REVISION + 1)
+
+static struct {
+    pthread_mutex_t lock;
+    int inotify_fd;
+    pid_t pid;
+    struct drm_device_cache_entry *entries[DRM_DEVICE_CACHE_TABLES];
+    int count[DRM_DEVICE_CACHE_TABLES];
+    bool valid[DRM_DEVICE_CACHE_TABLES];
+    drmDeviceCacheStats stats;
+} drm_device_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .inotify_fd = -1,
+};
+
+static void drmDeviceCacheDrop(void)
+{
+    int i, j;
+
+    for (i = 0; i < DRM_DEVICE_CACHE_TABLES; i++) {
+        if (drm_device_cache.valid[i])
+            drm_device_cache.stats.invalidations++;
+
+        for (j = 0; j < drm_device_cache.count[i]; j++)
+            drmFreeDevice(&drm_device_cache.entries[i][j].device);
+
+        free(drm_device_cache.entries[i]);
+        drm_device_cache.entries[i] = NULL;
+        drm_device_cache.count[i] = 0;
+        drm_device_cache.valid[i] = false;
+    }
+}
+
+/*
+ * Make sure the inotify watch is set up and drain any pending events,
+ * dropping the cached tables if there were some.  Returns false if the
+ * cache cannot be used.
+ */
+static bool drmDeviceCacheCheck(void)
+{
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    bool changed = false, lost = false;
+    ssize_t len;
+    char *ptr;
+    int fd;
+
+    /* the inotify instance is shared with the parent after a fork */
+    if (drm_device_cache.inotify_fd >= 0 &&
+        drm_device_cache.pid != getpid()) {
+        close(drm_device_cache.inotify_fd);
+        drm_device_cache.inotify_fd = -1;
+    }
+
+    if (drm_device_cache.inotify_fd < 0) {
+        drmDeviceCacheDrop();
+
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        if (inotify_add_watch(fd, DRM_DIR_NAME,
+                              IN_CREATE | IN_DELETE | IN_ATTRIB |
+                              IN_MOVED_FROM | IN_MOVED_TO |
+                              IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+            close(fd);
+            return false;
+        }
+
+        drm_device_cache.inotify_fd = fd;
+        drm_device_cache.pid = getpid();
+        return true;
+    }
+
+    while ((len = read(drm_device_cache.inotify_fd, buf, sizeof(buf))) > 0) {
+        changed = true;
+
+        for (ptr = buf; ptr < buf + len;
+             ptr += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *)ptr;
+
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                lost = true;
+        }
+    }
+
+    if (changed)
+        drmDeviceCacheDrop();
+
+    /* DRM_DIR_NAME itself went away, set up a new watch next time */
+    if (lost) {
+        close(drm_device_cache.inotify_fd);
+        drm_device_cache.inotify_fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+static char **drmDupCompatible(char **compatible)
+{
+    unsigned int count = 0, i;
+    char **dup;
+
+    while (compatible[count])
+        count++;
+
+    dup = calloc(count + 1, sizeof(*dup));
+    if (!dup)
+        return NULL;
+
+    for (i = 0; i < count; i++) {
+        dup[i] = strdup(compatible[i]);
+        if (!dup[i]) {
+            while (i--)
+                free(dup[i]);
+
+            free(dup);
+            return NULL;
+        }
+    }
+
+    return dup;
+}
+
+static drmDevicePtr drmDeviceDup(drmDevicePtr src)
+{
+    size_t bus_size, device_size;
+    drmDevicePtr dev;
+    unsigned int i;
+    char *ptr;
+
+    switch (src->bustype) {
+    case DRM_BUS_PCI:
+        bus_size = sizeof(drmPciBusInfo);
+        device_size = sizeof(drmPciDeviceInfo);
+        break;
+    case DRM_BUS_USB:
+        bus_size = sizeof(drmUsbBusInfo);
+        device_size = sizeof(drmUsbDeviceInfo);
+        break;
+    case DRM_BUS_PLATFORM:
+        bus_size = sizeof(drmPlatformBusInfo);
+        device_size = sizeof(drmPlatformDeviceInfo);
+        break;
+    case DRM_BUS_HOST1X:
+        bus_size = sizeof(drmHost1xBusInfo);
+        device_size = sizeof(drmHost1xDeviceInfo);
+        break;
+    default:
+        return NULL;
+    }
+
+    dev = drmDeviceAlloc(DRM_NODE_PRIMARY, src->nodes[DRM_NODE_PRIMARY],
+                         bus_size, device_size, &ptr);
+    if (!dev)
+        return NULL;
+
+    for (i = 0; i < DRM_NODE_MAX; i++)
+        memcpy(dev->nodes[i], src->nodes[i], drmGetMaxNodeName());
+
+    dev->available_nodes = src->available_nodes;
+    dev->bustype = src->bustype;
+
+    /* all members of the info unions share the same representation */
+    dev->businfo.pci = (drmPciBusInfoPtr)ptr;
+    memcpy(ptr, src->businfo.pci, bus_size);
+    ptr += bus_size;
+
+    dev->deviceinfo.pci = (drmPciDeviceInfoPtr)ptr;
+    memcpy(ptr, src->deviceinfo.pci, device_size);
+
+    switch (src->bustype) {
+    case DRM_BUS_PLATFORM:
+        dev->deviceinfo.platform->compatible =
+            drmDupCompatible(src->deviceinfo.platform->compatible);
+        if (!dev->deviceinfo.platform->compatible)
+            goto free_device;
+        break;
+    case DRM_BUS_HOST1X:
+        dev->deviceinfo.host1x->compatible =
+            drmDupCompatible(src->deviceinfo.host1x->compatible);
+        if (!dev->deviceinfo.host1x->compatible)
+            goto free_device;
+        break;
+    }
+
+    return dev;
+
+free_device:
+    free(dev);
+    return NULL;
+}
+
+/* Scan DRM_DIR_NAME and store the result in the cache table for flags */
+static int drmDeviceCacheFill(uint32_t flags)
+{
+    drmDevicePtr local_devices[MAX_DRM_NODES];
+    struct drm_device_cache_entry *entries;
+    drmDevicePtr device;
+    struct stat sbuf;
+    struct dirent *dent;
+    DIR *sysdir;
+    int ret, i, j, node_count, count;
+
+    sysdir = opendir(DRM_DIR_NAME);
+    if (!sysdir)
+        return -errno;
+
+    i = 0;
+    while ((dent = readdir(sysdir))) {
+        ret = process_device(&device, dent->d_name, -1, true, flags);
+        if (ret)
+            continue;
+
+        if (i >= MAX_DRM_NODES) {
+            fprintf(stderr, "More than %d drm nodes detected. "
+                    "Please report a bug - that should not happen.\n"
+                    "Skipping extra nodes\n", MAX_DRM_NODES);
+            break;
+        }
+        local_devices[i] = device;
+        i++;
+    }
+    node_count = i;
+
+    closedir(sysdir);
+
+    drmFoldDuplicatedDevices(local_devices, node_count);
+
+    entries = calloc(node_count ? node_count : 1, sizeof(*entries));
+    if (!entries) {
+        for (i = 0; i < node_count; i++)
+            drmFreeDevice(&local_devices[i]);
+
+        return -ENOMEM;
+    }
+
+    count = 0;
+    for (i = 0; i < node_count; i++) {
+        if (!local_devices[i])
+            continue;
+
+        entries[count].device = local_devices[i];
+
+        for (j = 0; j < DRM_NODE_MAX; j++) {
+            if (local_devices[i]->available_nodes & 1 << j &&
+                stat(local_devices[i]->nodes[j], &sbuf) == 0)
+                entries[count].rdev[j] = sbuf.st_rdev;
+        }
+
+        count++;
+    }
+
+    drm_device_cache.entries[flags] = entries;
+    drm_device_cache.count[flags] = count;
+    drm_device_cache.valid[flags] = true;
+
+    return 0;
+}
+
+/*
+ * Return the cache table for flags, filling it if needed.  Must be called
+ * with the cache lock held.  Returns NULL if the cache cannot be used.
  */
-static void drmFoldDuplicatedDevices(drmDevicePtr local_devices[], int count)
+static struct drm_device_cache_entry *drmDeviceCacheGet(uint32_t flags)
 {
-    int node_type, i, j;
+    if (!drmDeviceCacheCheck())
+        return NULL;
 
-    for (i = 0; i < count; i++) {
-        for (j = i + 1; j < count; j++) {
-            if (drmDevicesEqual(local_devices[i], local_devices[j])) {
-                local_devices[i]->available_nodes |= local_devices[j]->available_nodes;
-                node_type = log2(local_devices[j]->available_nodes);
-                memcpy(local_devices[i]->nodes[node_type],
-                       local_devices[j]->nodes[node_type], drmGetMaxNodeName());
-                drmFreeDevice(&local_devices[j]);
-            }
-        }
+    if (drm_device_cache.valid[flags]) {
+        drm_device_cache.stats.hits++;
+    } else {
+        drm_device_cache.stats.misses++;
+
+        if (drmDeviceCacheFill(flags))
+            return NULL;
     }
+
+    return drm_device_cache.entries[flags];
 }
 
-/* Check that the given flags are valid returning 0 on success */
-static int
-drm_device_validate_flags(uint32_t flags)
+static bool drmDeviceCacheGetDevice(uint32_t flags, dev_t find_rdev,
+                                    drmDevicePtr *device)
 {
-        return (flags & ~DRM_DEVICE_GET_PCI_REVISION);
+    struct drm_device_cache_entry *entries;
+    int i, j;
+
+    pthread_mutex_lock(&drm_device_cache.lock);
+
+    entries = drmDeviceCacheGet(flags);
+    if (!entries)
+        goto out;
+
+    for (i = 0; i < drm_device_cache.count[flags]; i++) {
+        for (j = 0; j < DRM_NODE_MAX; j++) {
+            if (entries[i].device->available_nodes & 1 << j &&
+                entries[i].rdev[j] == find_rdev) {
+                *device = drmDeviceDup(entries[i].device);
+                pthread_mutex_unlock(&drm_device_cache.lock);
+                return *device != NULL;
+            }
+        }
+    }
+
+out:
+    pthread_mutex_unlock(&drm_device_cache.lock);
+    return false;
 }
 
-static bool
-drm_device_has_rdev(drmDevicePtr device, dev_t find_rdev)
+static bool drmDeviceCacheGetDevices(uint32_t flags, drmDevicePtr devices[],
+                                     int max_devices, int *device_count)
 {
-    struct stat sbuf;
+    struct drm_device_cache_entry *entries;
+    int i, count;
 
-    for (int i = 0; i < DRM_NODE_MAX; i++) {
-        if (device->available_nodes & 1 << i) {
-            if (stat(device->nodes[i], &sbuf) == 0 &&
-                sbuf.st_rdev == find_rdev)
-                return true;
+    pthread_mutex_lock(&drm_device_cache.lock);
+
+    entries = drmDeviceCacheGet(flags);
+    if (!entries) {
+        pthread_mutex_unlock(&drm_device_cache.lock);
+        return false;
+    }
+
+    count = drm_device_cache.count[flags];
+
+    if (devices != NULL) {
+        for (i = 0; i < count && i < max_devices; i++) {
+            devices[i] = drmDeviceDup(entries[i].device);
+            if (!devices[i]) {
+                drmFreeDevices(devices, i);
+                pthread_mutex_unlock(&drm_device_cache.lock);
+                return false;
+            }
         }
     }
-    return false;
+
+    pthread_mutex_unlock(&drm_device_cache.lock);
+
+    *device_count = count;
+    return true;
 }
+#endif
 
-/*
- * The kernel drm core has a number of places that assume maximum of
- * 3x64 devices nodes. That's 64 for each of primary, control and
- * render nodes. Rounded it up to 256 for simplicity.
+/**
+ * Retrieve the device enumeration cache statistics
+ *
+ * \param stats where to store the hit, miss and invalidation counters
  */
-#define MAX_DRM_NODES 256
+drm_public void drmGetDeviceCacheStats(drmDeviceCacheStatsPtr stats)
+{
+    if (stats == NULL)
+        return;
+
+#ifdef __linux__
+    pthread_mutex_lock(&drm_device_cache.lock);
+    *stats = drm_device_cache.stats;
+    pthread_mutex_unlock(&drm_device_cache.lock);
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+/**
+ * Drop the cached device tables
+ *
+ * The next drmGetDevice2() or drmGetDevices2() call rescans the devices.
+ * This is only needed if the device information can change without any of
+ * the device nodes being touched.
+ */
+drm_public void drmInvalidateDeviceCache(void)
+{
+#ifdef __linux__
+    pthread_mutex_lock(&drm_device_cache.lock);
+    drmDeviceCacheDrop();
+    pthread_mutex_unlock(&drm_device_cache.lock);
+#endif
+}
 
 /**
  * Get information about the opened drm device
@@ -3928,6 +5476,11 @@ drm_public int drmGetDevice2(int fd, uint32_t flags, drmDevicePtr *device)
     if (!drmNodeIsDRM(maj, min) || !S_ISCHR(sbuf.st_mode))
         return -EINVAL;
 
+#ifdef __linux__
+    if (drmDeviceCacheGetDevice(flags, find_rdev, device))
+        return 0;
+#endif
+
     subsystem_type = drmParseSubsystemType(maj, min);
     if (subsystem_type < 0)
         return subsystem_type;
@@ -4016,6 +5569,11 @@ drm_public int drmGetDevices2(uint32_t flags, drmDevicePtr devices[],
     if (drm_device_validate_flags(flags))
         return -EINVAL;
 
+#ifdef __linux__
+    if (drmDeviceCacheGetDevices(flags, devices, max_devices, &device_count))
+        return device_count;
+#endif
+
     sysdir = opendir(DRM_DIR_NAME);
     if (!sysdir)
         return -errno;
@@ -4277,3 +5835,461 @@ drm_public int drmSyncobjSignal(int fd, const uint32_t *handles,
     ret = drmIoctl(fd, DRM_IOCTL_SYNCOBJ_SIGNAL, &args);
     return ret;
 }
+
+#ifdef __linux__
+/* Registrations a thread takes before the next one is used */
+#define DRM_SYNCOBJ_WAITER_BATCH 64
+
+struct drm_syncobj_waiter_reg {
+    drmMMListHead link;
+    uint32_t handle;
+    int status;
+    int64_t deadline;
+    uint64_t completed_ns;
+    drmSyncobjWaiterCallback callback;
+    void *data;
+};
+
+struct drm_syncobj_waiter_thread {
+    drmSyncobjWaiterPtr waiter;
+    pthread_t thread;
+    bool started;
+    uint32_t kick;              /* signaled to interrupt a wait */
+    bool waiting;
+    bool kicked;
+    drmMMListHead regs;
+    unsigned int count;
+    struct drm_syncobj_waiter_reg **slots;
+    uint32_t *handles;          /* the kick, then one per slot */
+    unsigned int size;
+};
+
+struct _drmSyncobjWaiter {
+    int fd;
+    int event_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool quit;
+    drmMMListHead done;
+    drmSyncobjWaiterStats stats;
+    unsigned int num_threads;
+    struct drm_syncobj_waiter_thread threads[];
+};
+
+static void drmSyncobjWaiterComplete(drmSyncobjWaiterPtr waiter,
+                                     struct drm_syncobj_waiter_thread *t,
+                                     struct drm_syncobj_waiter_reg *reg,
+                                     int status, uint64_t now)
+{
+    DRMLISTDEL(&reg->link);
+    t->count--;
+
+    reg->status = status;
+    reg->completed_ns = now;
+    DRMLISTADDTAIL(&reg->link, &waiter->done);
+
+    if (status == -ETIME)
+        waiter->stats.timed_out++;
+}
+
+/* Call with the lock held, returns the number of registrations to wait on */
+static int drmSyncobjWaiterPrepare(struct drm_syncobj_waiter_thread *t,
+                                   int64_t *timeout)
+{
+    struct drm_syncobj_waiter_reg *reg, **slots;
+    unsigned int n = 0;
+    uint32_t *handles;
+
+    if (t->count > t->size) {
+        slots = realloc(t->slots, t->count * sizeof(*slots));
+        if (!slots)
+            return -ENOMEM;
+        t->slots = slots;
+
+        handles = realloc(t->handles, (t->count + 1) * sizeof(*handles));
+        if (!handles)
+            return -ENOMEM;
+        t->handles = handles;
+
+        t->size = t->count;
+    }
+
+    *timeout = INT64_MAX;
+    t->handles[0] = t->kick;
+
+    DRMLISTFOREACHENTRY(reg, &t->regs, link) {
+        t->slots[n] = reg;
+        t->handles[++n] = reg->handle;
+        if (reg->deadline < *timeout)
+            *timeout = reg->deadline;
+    }
+
+    return n;
+}
+
+/* Call with the lock held, returns true if anything completed */
+static bool drmSyncobjWaiterUpdate(drmSyncobjWaiterPtr waiter,
+                                   struct drm_syncobj_waiter_thread *t,
+                                   unsigned int n, int ret, uint32_t first,
+                                   uint64_t now)
+{
+    struct drm_syncobj_waiter_reg *reg;
+    bool completed = false;
+    unsigned int i;
+    int err;
+
+    if (ret == 0) {
+        if (first == 0) {
+            waiter->stats.rearms++;
+            return false;
+        }
+
+        /* WAIT_ANY only reports one handle, sweep up any others that
+         * signaled along with it before waiting again.  Retired slots are
+         * swapped out so that each poll only covers the pending ones.
+         */
+        while (ret == 0) {
+            drmSyncobjWaiterComplete(waiter, t, t->slots[first - 1], 0, now);
+
+            if (--n == 0)
+                break;
+            t->slots[first - 1] = t->slots[n];
+            t->handles[first] = t->handles[n + 1];
+
+            ret = drmSyncobjWait(waiter->fd, &t->handles[1], n, 0,
+                                 DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+                                 &first);
+            first++;
+        }
+        return true;
+    }
+
+    if (ret == -ETIME) {
+        for (i = 0; i < n; i++) {
+            reg = t->slots[i];
+            if (reg->deadline <= (int64_t)now) {
+                drmSyncobjWaiterComplete(waiter, t, reg, -ETIME, now);
+                completed = true;
+            }
+        }
+        return completed;
+    }
+
+    /* Find out which handles are at fault, e.g. destroyed syncobjs */
+    for (i = 0; i < n; i++) {
+        reg = t->slots[i];
+        err = drmSyncobjWait(waiter->fd, &reg->handle, 1, 0,
+                             DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT, NULL);
+        if (err != -ETIME) {
+            drmSyncobjWaiterComplete(waiter, t, reg, err, now);
+            completed = true;
+        }
+    }
+
+    /* Don't spin on an error that none of the handles explains */
+    if (!completed) {
+        for (i = 0; i < n; i++)
+            drmSyncobjWaiterComplete(waiter, t, t->slots[i], ret, now);
+        completed = n > 0;
+    }
+
+    return completed;
+}
+
+static void *drmSyncobjWaiterThread(void *arg)
+{
+    struct drm_syncobj_waiter_thread *t = arg;
+    drmSyncobjWaiterPtr waiter = t->waiter;
+    uint64_t one = 1, now;
+    int64_t timeout;
+    uint32_t first;
+    int n, ret;
+
+    pthread_mutex_lock(&waiter->lock);
+
+    while (!waiter->quit) {
+        if (DRMLISTEMPTY(&t->regs)) {
+            pthread_cond_wait(&waiter->cond, &waiter->lock);
+            continue;
+        }
+
+        n = drmSyncobjWaiterPrepare(t, &timeout);
+        if (n < 0) {
+            /* retry once some memory has been freed */
+            pthread_mutex_unlock(&waiter->lock);
+            usleep(1000);
+            pthread_mutex_lock(&waiter->lock);
+            continue;
+        }
+
+        t->waiting = true;
+        waiter->stats.waits++;
+        pthread_mutex_unlock(&waiter->lock);
+
+        ret = drmSyncobjWait(waiter->fd, t->handles, n + 1, timeout,
+                             DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT, &first);
+        now = drmIoctlNow();
+
+        pthread_mutex_lock(&waiter->lock);
+        t->waiting = false;
+
+        if (t->kicked) {
+            drmSyncobjReset(waiter->fd, &t->kick, 1);
+            t->kicked = false;
+        }
+
+        if (drmSyncobjWaiterUpdate(waiter, t, n, ret, first, now)) {
+            if (write(waiter->event_fd, &one, sizeof(one)) < 0 &&
+                errno != EAGAIN)
+                drmMsg("syncobj waiter: eventfd write failed: %s\n",
+                       strerror(errno));
+        }
+    }
+
+    pthread_mutex_unlock(&waiter->lock);
+
+    return NULL;
+}
+
+/* Call with the lock held, interrupts the thread's wait if it is in one */
+static void drmSyncobjWaiterKick(drmSyncobjWaiterPtr waiter,
+                                 struct drm_syncobj_waiter_thread *t)
+{
+    if (t->waiting && !t->kicked) {
+        drmSyncobjSignal(waiter->fd, &t->kick, 1);
+        t->kicked = true;
+    }
+}
+
+drm_public drmSyncobjWaiterPtr drmSyncobjWaiterCreate(int fd,
+                                                      unsigned int num_threads)
+{
+    struct drm_syncobj_waiter_thread *t;
+    drmSyncobjWaiterPtr waiter;
+    unsigned int i;
+
+    if (num_threads == 0)
+        num_threads = 1;
+
+    waiter = calloc(1, sizeof(*waiter) + num_threads * sizeof(*t));
+    if (!waiter)
+        return NULL;
+
+    waiter->fd = fd;
+    waiter->num_threads = num_threads;
+    pthread_mutex_init(&waiter->lock, NULL);
+    pthread_cond_init(&waiter->cond, NULL);
+    DRMINITLISTHEAD(&waiter->done);
+
+    for (i = 0; i < num_threads; i++)
+        DRMINITLISTHEAD(&waiter->threads[i].regs);
+
+    waiter->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (waiter->event_fd < 0)
+        goto err;
+
+    for (i = 0; i < num_threads; i++) {
+        t = &waiter->threads[i];
+        t->waiter = waiter;
+
+        if (drmSyncobjCreate(fd, 0, &t->kick))
+            goto err;
+
+        if (pthread_create(&t->thread, NULL, drmSyncobjWaiterThread, t)) {
+            drmSyncobjDestroy(fd, t->kick);
+            t->kick = 0;
+            goto err;
+        }
+
+        t->started = true;
+    }
+
+    return waiter;
+
+err:
+    drmSyncobjWaiterDestroy(waiter);
+    return NULL;
+}
+
+drm_public void drmSyncobjWaiterDestroy(drmSyncobjWaiterPtr waiter)
+{
+    struct drm_syncobj_waiter_reg *reg, *tmp;
+    struct drm_syncobj_waiter_thread *t;
+    unsigned int i;
+
+    if (!waiter)
+        return;
+
+    pthread_mutex_lock(&waiter->lock);
+    waiter->quit = true;
+    pthread_cond_broadcast(&waiter->cond);
+    for (i = 0; i < waiter->num_threads; i++)
+        if (waiter->threads[i].started)
+            drmSyncobjWaiterKick(waiter, &waiter->threads[i]);
+    pthread_mutex_unlock(&waiter->lock);
+
+    for (i = 0; i < waiter->num_threads; i++) {
+        t = &waiter->threads[i];
+
+        if (t->started)
+            pthread_join(t->thread, NULL);
+
+        if (t->kick)
+            drmSyncobjDestroy(waiter->fd, t->kick);
+
+        DRMLISTFOREACHENTRYSAFE(reg, tmp, &t->regs, link)
+            free(reg);
+
+        free(t->slots);
+        free(t->handles);
+    }
+
+    DRMLISTFOREACHENTRYSAFE(reg, tmp, &waiter->done, link)
+        free(reg);
+
+    if (waiter->event_fd >= 0)
+        close(waiter->event_fd);
+
+    pthread_cond_destroy(&waiter->cond);
+    pthread_mutex_destroy(&waiter->lock);
+    free(waiter);
+}
+
+drm_public int drmSyncobjWaiterGetFD(drmSyncobjWaiterPtr waiter)
+{
+    return waiter->event_fd;
+}
+
+drm_public int drmSyncobjWaiterAdd(drmSyncobjWaiterPtr waiter, uint32_t handle,
+                                   int64_t deadline_nsec,
+                                   drmSyncobjWaiterCallback callback,
+                                   void *data)
+{
+    struct drm_syncobj_waiter_thread *t, *best = NULL;
+    struct drm_syncobj_waiter_reg *reg;
+    unsigned int i;
+
+    if (!waiter || !callback)
+        return -EINVAL;
+
+    reg = malloc(sizeof(*reg));
+    if (!reg)
+        return -ENOMEM;
+
+    reg->handle = handle;
+    reg->status = 0;
+    reg->deadline = deadline_nsec;
+    reg->completed_ns = 0;
+    reg->callback = callback;
+    reg->data = data;
+
+    pthread_mutex_lock(&waiter->lock);
+
+    /* fill threads one batch at a time so that few waits cover everything */
+    for (i = 0; i < waiter->num_threads; i++) {
+        t = &waiter->threads[i];
+        if (t->count < DRM_SYNCOBJ_WAITER_BATCH) {
+            best = t;
+            break;
+        }
+        if (!best || t->count < best->count)
+            best = t;
+    }
+
+    DRMLISTADDTAIL(&reg->link, &best->regs);
+    best->count++;
+    waiter->stats.registered++;
+
+    if (best->count == 1)
+        pthread_cond_broadcast(&waiter->cond);
+    else
+        drmSyncobjWaiterKick(waiter, best);
+
+    pthread_mutex_unlock(&waiter->lock);
+
+    return 0;
+}
+
+drm_public int drmSyncobjWaiterDispatch(drmSyncobjWaiterPtr waiter)
+{
+    struct drm_syncobj_waiter_reg *reg, *tmp;
+    uint64_t count, now, latency, total = 0, max = 0;
+    drmMMListHead done;
+    int n = 0;
+
+    if (read(waiter->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return -errno;
+
+    DRMINITLISTHEAD(&done);
+
+    pthread_mutex_lock(&waiter->lock);
+    DRMLISTJOIN(&waiter->done, &done);
+    DRMINITLISTHEAD(&waiter->done);
+    pthread_mutex_unlock(&waiter->lock);
+
+    now = drmIoctlNow();
+
+    DRMLISTFOREACHENTRYSAFE(reg, tmp, &done, link) {
+        latency = now - reg->completed_ns;
+        total += latency;
+        if (latency > max)
+            max = latency;
+
+        reg->callback(reg->handle, reg->status, reg->data);
+        free(reg);
+        n++;
+    }
+
+    pthread_mutex_lock(&waiter->lock);
+    waiter->stats.completed += n;
+    waiter->stats.total_latency_ns += total;
+    if (max > waiter->stats.max_latency_ns)
+        waiter->stats.max_latency_ns = max;
+    pthread_mutex_unlock(&waiter->lock);
+
+    return n;
+}
+
+drm_public void drmSyncobjWaiterGetStats(drmSyncobjWaiterPtr waiter,
+                                         drmSyncobjWaiterStatsPtr stats)
+{
+    pthread_mutex_lock(&waiter->lock);
+    *stats = waiter->stats;
+    pthread_mutex_unlock(&waiter->lock);
+}
+#else
+drm_public drmSyncobjWaiterPtr drmSyncobjWaiterCreate(int fd,
+                                                      unsigned int num_threads)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+drm_public void drmSyncobjWaiterDestroy(drmSyncobjWaiterPtr waiter)
+{
+}
+
+drm_public int drmSyncobjWaiterGetFD(drmSyncobjWaiterPtr waiter)
+{
+    return -ENOSYS;
+}
+
+drm_public int drmSyncobjWaiterAdd(drmSyncobjWaiterPtr waiter, uint32_t handle,
+                                   int64_t deadline_nsec,
+                                   drmSyncobjWaiterCallback callback,
+                                   void *data)
+{
+    return -ENOSYS;
+}
+
+drm_public int drmSyncobjWaiterDispatch(drmSyncobjWaiterPtr waiter)
+{
+    return -ENOSYS;
+}
+
+drm_public void drmSyncobjWaiterGetStats(drmSyncobjWaiterPtr waiter,
+                                         drmSyncobjWaiterStatsPtr stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+#endif
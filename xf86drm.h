@@ -706,6 +706,25 @@ extern int  drmHashDelete(void *t, unsigned long key);
 extern int  drmHashFirst(void *t, unsigned long *key, void **value);
 extern int  drmHashNext(void *t, unsigned long *key, void **value);
 
+/* Thread-safe registry, split into independently locked shards.
+ *
+ * drmRegistryGet() calls get() on the value stored for key, or create()
+ * when there is none or get() returned NULL, while the key's shard is
+ * locked.  This allows taking a reference on a value atomically with the
+ * lookup.  drmRegistryRemove() only removes key if it still maps to value.
+ */
+typedef struct _drmRegistry drmRegistry, *drmRegistryPtr;
+
+extern drmRegistryPtr drmRegistryCreate(void);
+extern void drmRegistryDestroy(drmRegistryPtr reg);
+extern void *drmRegistryLookup(drmRegistryPtr reg, unsigned long key);
+extern void *drmRegistryGet(drmRegistryPtr reg, unsigned long key,
+                            void *(*get)(void *value, void *data),
+                            void *(*create)(unsigned long key, void *data),
+                            void *data);
+extern int drmRegistryRemove(drmRegistryPtr reg, unsigned long key,
+                             void *value);
+
 /* PRNG routines */
 extern void          *drmRandomCreate(unsigned long seed);
 extern int           drmRandomDestroy(void *state);
@@ -769,6 +788,36 @@ typedef struct _drmEventContext {
 
 extern int drmHandleEvent(int fd, drmEventContextPtr evctx);
 
+/*
+ * Event loop draining the DRM fd in batches.  The fd returned by
+ * drmEventLoopGetFd() can be added to an existing poll/epoll loop, and
+ * drmEventLoopDispatch() be called once it is readable.
+ *
+ * The latency histogram compares the kernel event timestamps, which are
+ * assumed to be CLOCK_MONOTONIC, with the time the events were read.
+ * Bucket 0 counts latencies below 1 us, bucket i >= 1 the ones in
+ * [2^(i-1), 2^i) us, and the last bucket everything above.
+ */
+#define DRM_EVENT_LATENCY_BUCKETS 24
+
+typedef struct _drmEventLoopStats {
+	uint64_t dispatches;	/* drmEventLoopDispatch() calls */
+	uint64_t reads;		/* read() calls on the fd */
+	uint64_t events;	/* events dispatched */
+	uint64_t max_latency_ns;
+	uint64_t latency[DRM_EVENT_LATENCY_BUCKETS];
+} drmEventLoopStats, *drmEventLoopStatsPtr;
+
+typedef struct _drmEventLoop drmEventLoop, *drmEventLoopPtr;
+
+extern drmEventLoopPtr drmEventLoopCreate(int fd, drmEventContextPtr evctx,
+					  size_t buffer_size);
+extern void drmEventLoopDestroy(drmEventLoopPtr loop);
+extern int drmEventLoopGetFd(drmEventLoopPtr loop);
+extern int drmEventLoopDispatch(drmEventLoopPtr loop);
+extern void drmEventLoopGetStats(drmEventLoopPtr loop,
+				 drmEventLoopStatsPtr stats);
+
 extern char *drmGetDeviceNameFromFd(int fd);
 
 /* Improved version of drmGetDeviceNameFromFd which attributes for any type of
@@ -780,6 +829,42 @@ extern int drmGetNodeTypeFromFd(int fd);
 extern int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd);
 extern int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle);
 
+/* Batched variants of the above.  On failure the entries before the one
+ * that failed are filled in and owned by the caller, the others are left
+ * untouched.
+ */
+extern int drmPrimeHandlesToFDs(int fd, const uint32_t *handles,
+                                uint32_t flags, int *prime_fds,
+                                unsigned int count);
+extern int drmPrimeFDsToHandles(int fd, const int *prime_fds,
+                                uint32_t *handles, unsigned int count);
+
+/* PRIME import cache.  dma-bufs are identified by their inode, so that
+ * importing a buffer that already has a GEM handle on the device returns
+ * that handle without a round trip to the kernel.  Buffers exported through
+ * the cache are recorded as well.  The cache does not own the handles:
+ * drmPrimeCacheForget() must be called before a handle is closed.
+ */
+typedef struct _drmPrimeCache drmPrimeCache, *drmPrimeCachePtr;
+
+typedef struct _drmPrimeCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t exports;
+} drmPrimeCacheStats, *drmPrimeCacheStatsPtr;
+
+extern drmPrimeCachePtr drmPrimeCacheCreate(int fd);
+extern void drmPrimeCacheDestroy(drmPrimeCachePtr cache);
+extern int drmPrimeCacheImport(drmPrimeCachePtr cache, const int *prime_fds,
+                               uint32_t *handles, uint64_t *sizes,
+                               unsigned int count);
+extern int drmPrimeCacheExport(drmPrimeCachePtr cache, const uint32_t *handles,
+                               uint32_t flags, int *prime_fds,
+                               unsigned int count);
+extern void drmPrimeCacheForget(drmPrimeCachePtr cache, uint32_t handle);
+extern void drmPrimeCacheGetStats(drmPrimeCachePtr cache,
+                                  drmPrimeCacheStatsPtr stats);
+
 extern char *drmGetPrimaryDeviceNameFromFd(int fd);
 extern char *drmGetRenderDeviceNameFromFd(int fd);
 
@@ -861,6 +946,103 @@ extern void drmFreeDevices(drmDevicePtr devices[], int count);
 extern int drmGetDevice2(int fd, uint32_t flags, drmDevicePtr *device);
 extern int drmGetDevices2(uint32_t flags, drmDevicePtr devices[], int max_devices);
 
+typedef struct _drmDeviceCacheStats {
+    uint64_t hits;          /* lookups served from the cached tables */
+    uint64_t misses;        /* lookups that required a rescan */
+    uint64_t invalidations; /* tables dropped due to device node changes */
+} drmDeviceCacheStats, *drmDeviceCacheStatsPtr;
+
+extern void drmGetDeviceCacheStats(drmDeviceCacheStatsPtr stats);
+extern void drmInvalidateDeviceCache(void);
+
+/*
+ * ioctl statistics, per ioctl request.  Latency bucket 0 counts ioctls below
+ * 1 us, bucket i >= 1 the ones in [2^(i-1), 2^i) us, the last bucket all
+ * longer ones.
+ */
+#define DRM_IOCTL_LATENCY_BUCKETS 24
+
+typedef struct _drmIoctlStats {
+    unsigned long request;
+    uint64_t count;
+    uint64_t retries;       /* restarts after EINTR or EAGAIN */
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t latency[DRM_IOCTL_LATENCY_BUCKETS];
+} drmIoctlStats, *drmIoctlStatsPtr;
+
+extern void drmIoctlStatsEnable(int enable);
+extern int drmGetIoctlStats(drmIoctlStatsPtr stats, int max);
+extern void drmResetIoctlStats(void);
+extern void drmDumpIoctlStats(int fd);
+
+/*
+ * ioctl traces, as written with drmIoctlTraceOpen() or by setting
+ * LIBDRM_IOCTL_TRACE=<file> in the environment.
+ *
+ * A trace is a drmTraceHeader followed by records.  Each record is a
+ * drmTraceRecord followed by the argument as it was passed in, if
+ * DRM_TRACE_ARG_IN is set, the argument as it was returned, if
+ * DRM_TRACE_ARG_OUT is set, and num_chunks chunks.  A chunk is a
+ * drmTraceChunk followed by the data of an array that the argument, or an
+ * earlier chunk, points to, captured before the ioctl.  Arguments and chunk
+ * data are padded to 8 bytes, so that the whole file can be mapped and
+ * walked in place.  Records are in the order the ioctls completed in.
+ */
+#define DRM_TRACE_MAGIC         0x45434152544d5244ull   /* "DRMTRACE" */
+#define DRM_TRACE_VERSION       1
+
+#define DRM_TRACE_ARG_IN        (1 << 0)
+#define DRM_TRACE_ARG_OUT       (1 << 1)
+
+typedef struct _drmTraceHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint64_t start_ns;          /* CLOCK_MONOTONIC */
+} drmTraceHeader;
+
+typedef struct _drmTraceRecord {
+    uint32_t size;              /* of the whole record */
+    uint32_t flags;
+    uint64_t request;
+    uint64_t time_ns;           /* since start_ns */
+    uint64_t duration_ns;
+    int32_t fd;
+    int32_t ret;
+    int32_t error;              /* errno, if ret is -1 */
+    uint32_t thread;            /* numbered from 1 in order of first ioctl */
+    uint32_t arg_size;
+    uint32_t num_chunks;
+} drmTraceRecord;
+
+typedef struct _drmTraceChunk {
+    int32_t parent;             /* index of a chunk, -1 for the argument */
+    uint32_t offset;            /* of the pointer to the data in the parent */
+    uint32_t size;
+    uint32_t pad;
+} drmTraceChunk;
+
+extern int drmIoctlTraceOpen(const char *path);
+extern void drmIoctlTraceClose(void);
+
+/*
+ * Drivers tell the tracer about the arrays that the arguments of their
+ * ioctls point to by registering a callback per ioctl, which adds each
+ * array with drmIoctlTraceAddChunk().  The layout of modesetting ioctls
+ * is known to libdrm itself.
+ */
+typedef struct _drmTraceChunks drmTraceChunks, *drmTraceChunksPtr;
+typedef void (*drmTraceChunksFunc)(drmTraceChunksPtr chunks, const void *arg);
+
+extern int drmIoctlTraceRegister(unsigned long request,
+                                 drmTraceChunksFunc func);
+extern int drmIoctlTraceAddChunk(drmTraceChunksPtr chunks, int parent,
+                                 uint32_t offset, uint64_t size);
+extern const void *drmIoctlTraceChunkData(drmTraceChunksPtr chunks,
+                                          int index);
+
 extern int drmDevicesEqual(drmDevicePtr a, drmDevicePtr b);
 
 extern int drmSyncobjCreate(int fd, uint32_t flags, uint32_t *handle);
@@ -876,6 +1058,45 @@ extern int drmSyncobjWait(int fd, uint32_t *handles, unsigned num_handles,
 extern int drmSyncobjReset(int fd, const uint32_t *handles, uint32_t handle_count);
 extern int drmSyncobjSignal(int fd, const uint32_t *handles, uint32_t handle_count);
 
+/*
+ * Syncobj waiter service.  Registered syncobjs are waited on by a small pool
+ * of threads, each of which coalesces its registrations into a single
+ * drmSyncobjWait() call.  Completions are signaled through an eventfd, see
+ * drmSyncobjWaiterGetFD(); once it is readable, drmSyncobjWaiterDispatch()
+ * runs the callbacks in the calling thread.
+ *
+ * Deadlines are absolute CLOCK_MONOTONIC times in nanoseconds, INT64_MAX
+ * for none.  The callback status is 0 when the syncobj signaled, -ETIME
+ * when the deadline passed first, or another negative errno on failure.
+ * Registrations still pending at drmSyncobjWaiterDestroy() are dropped
+ * without running their callbacks.
+ */
+typedef struct _drmSyncobjWaiter drmSyncobjWaiter, *drmSyncobjWaiterPtr;
+
+typedef void (*drmSyncobjWaiterCallback)(uint32_t handle, int status,
+                                         void *data);
+
+typedef struct _drmSyncobjWaiterStats {
+    uint64_t registered;
+    uint64_t completed;
+    uint64_t timed_out;
+    uint64_t waits;             /* drmSyncobjWait() calls */
+    uint64_t rearms;            /* waits interrupted by a new registration */
+    uint64_t total_latency_ns;  /* from wait return to callback */
+    uint64_t max_latency_ns;
+} drmSyncobjWaiterStats, *drmSyncobjWaiterStatsPtr;
+
+extern drmSyncobjWaiterPtr drmSyncobjWaiterCreate(int fd,
+                                                  unsigned int num_threads);
+extern void drmSyncobjWaiterDestroy(drmSyncobjWaiterPtr waiter);
+extern int drmSyncobjWaiterGetFD(drmSyncobjWaiterPtr waiter);
+extern int drmSyncobjWaiterAdd(drmSyncobjWaiterPtr waiter, uint32_t handle,
+                               int64_t deadline_nsec,
+                               drmSyncobjWaiterCallback callback, void *data);
+extern int drmSyncobjWaiterDispatch(drmSyncobjWaiterPtr waiter);
+extern void drmSyncobjWaiterGetStats(drmSyncobjWaiterPtr waiter,
+                                     drmSyncobjWaiterStatsPtr stats);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -27,47 +27,41 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward implementation of a fixed-sized
- * hash table using self-organizing linked lists [Knuth73, pp. 398-399] for
- * collision resolution.  There are two potentially interesting things
- * about this implementation:
+ * This file contains an implementation of a dynamic hash table using
+ * open addressing with linear probing [Knuth73, pp. 518-526] for collision
+ * resolution.  There are a few potentially interesting things about this
+ * implementation:
  *
- * 1) The table is power-of-two sized.  Prime sized tables are more
- * traditional, but do not have a significant advantage over power-of-two
- * sized table, especially when double hashing is not used for collision
- * resolution.
+ * 1) The table is power-of-two sized and doubles whenever it becomes three
+ * quarters full, so lookups stay short no matter how many keys are added.
+ * It halves again when it drops below an eighth full.
  *
- * 2) The hash computation uses a table of random integers [Hanson97,
- * pp. 39-41].
+ * 2) Next to the slots, a byte array holds a tag for each slot: zero for
+ * empty slots, otherwise seven bits of the hash of the key.  Probing scans
+ * the tags, 64 per cache line, and only looks at a slot when its tag
+ * matches.
  *
- * FUTURE ENHANCEMENTS
+ * 3) Deletion moves the following entries of the probe sequence back
+ * [Knuth73, Algorithm R, p. 527] instead of leaving deleted markers, so
+ * lookups never get slower after deletions.  Walks start after an empty
+ * slot, which entries are never moved across, so the entry a walk just
+ * returned can be deleted without the walk skipping or repeating any.
+ * Shrinking is put off until the walk ends.
  *
- * With a table size of 512, the current implementation is sufficient for a
- * few hundred keys.  Since this is well above the expected size of the
- * tables for which this implementation was designed, the implementation of
- * dynamic hash tables was postponed until the need arises.  A common (and
- * naive) approach to dynamic hash table implementation simply creates a
- * new hash table when necessary, rehashes all the data into the new table,
- * and destroys the old table.  The approach in [Larson88] is superior in
- * two ways: 1) only a portion of the table is expanded when needed,
- * distributing the expansion cost over several insertions, and 2) portions
- * of the table can be locked, enabling a scalable thread-safe
- * implementation.
+ * 4) Lookups do not write to the table, so concurrent lookups do not
+ * bounce its cache lines between CPUs.
  *
- * REFERENCES
+ * The hash computation is a multiplicative one [Knuth73, pp. 508-513].
  *
- * [Hanson97] David R. Hanson.  C Interfaces and Implementations:
- * Techniques for Creating Reusable Software.  Reading, Massachusetts:
- * Addison-Wesley, 1997.
+ * REFERENCES
  *
  * [Knuth73] Donald E. Knuth. The Art of Computer Programming.  Volume 3:
  * Sorting and Searching.  Reading, Massachusetts: Addison-Wesley, 1973.
  *
- * [Larson88] Per-Ake Larson. "Dynamic Hash Tables".  CACM 31(4), April
- * 1988, pp. 446-457.
- *
  */
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -77,29 +71,46 @@
 
 #define HASH_MAGIC 0xdeadbeef
 
-static unsigned long HashHash(unsigned long key)
+#define HASH_TAG_USED 0x80
+
+static uint64_t HashHash(unsigned long key)
 {
-    unsigned long        hash = 0;
-    unsigned long        tmp  = key;
-    static int           init = 0;
-    static unsigned long scatter[256];
-    int                  i;
+    uint64_t hash = key;
 
-    if (!init) {
-	void *state;
-	state = drmRandomCreate(37);
-	for (i = 0; i < 256; i++) scatter[i] = drmRandom(state);
-	drmRandomDestroy(state);
-	++init;
-    }
+    hash ^= hash >> 33;
+    return hash * 0x9e3779b97f4a7c15ull;
+}
+
+static unsigned long HashIndex(HashTablePtr table, uint64_t hash)
+{
+    return (unsigned long)(hash >> table->shift);
+}
+
+static unsigned char HashTag(uint64_t hash)
+{
+    return HASH_TAG_USED | ((hash >> 32) & 0x7f);
+}
 
-    while (tmp) {
-	hash = (hash << 1) + scatter[tmp & 0xff];
-	tmp >>= 8;
+static int HashAlloc(HashTablePtr table, unsigned long size)
+{
+    unsigned int shift = 64;
+    unsigned long i;
+
+    for (i = size; i > 1; i >>= 1)
+	--shift;
+
+    table->tags  = drmMalloc(size);
+    table->slots = drmMalloc(size * sizeof(*table->slots));
+    if (!table->tags || !table->slots) {
+	drmFree(table->tags);
+	drmFree(table->slots);
+	return -1;
     }
 
-    hash %= HASH_SIZE;
-    return hash;
+    table->mask  = size - 1;
+    table->shift = shift;
+    ++table->generation;
+    return 0;
 }
 
 drm_public void *drmHashCreate(void)
@@ -110,133 +121,330 @@ drm_public void *drmHashCreate(void)
     if (!table) return NULL;
     table->magic    = HASH_MAGIC;
 
+    if (HashAlloc(table, HASH_MIN_SIZE)) {
+	drmFree(table);
+	return NULL;
+    }
+
     return table;
 }
 
 drm_public int drmHashDestroy(void *t)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    HashBucketPtr bucket;
-    HashBucketPtr next;
-    int           i;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    for (i = 0; i < HASH_SIZE; i++) {
-	for (bucket = table->buckets[i]; bucket;) {
-	    next = bucket->next;
-	    drmFree(bucket);
-	    bucket = next;
-	}
-    }
+    drmFree(table->tags);
+    drmFree(table->slots);
     drmFree(table);
     return 0;
 }
 
-/* Find the bucket and organize the list so that this bucket is at the
-   top. */
+/* Find the slot of the key, or the empty slot ending its probe sequence */
 
-static HashBucketPtr HashFind(HashTablePtr table,
-			      unsigned long key, unsigned long *h)
+static unsigned long HashFind(HashTablePtr table, unsigned long key,
+			      unsigned char *tag)
 {
-    unsigned long hash = HashHash(key);
-    HashBucketPtr prev = NULL;
-    HashBucketPtr bucket;
+    uint64_t      hash = HashHash(key);
+    unsigned long i    = HashIndex(table, hash);
 
-    if (h) *h = hash;
+    *tag = HashTag(hash);
 
-    for (bucket = table->buckets[hash]; bucket; bucket = bucket->next) {
-	if (bucket->key == key) {
-	    if (prev) {
-				/* Organize */
-		prev->next           = bucket->next;
-		bucket->next         = table->buckets[hash];
-		table->buckets[hash] = bucket;
-		++table->partials;
-	    } else {
-		++table->hits;
-	    }
-	    return bucket;
-	}
-	prev = bucket;
+    while (table->tags[i]) {
+	if (table->tags[i] == *tag && table->slots[i].key == key)
+	    break;
+	i = (i + 1) & table->mask;
+    }
+    return i;
+}
+
+static int HashResize(HashTablePtr table, unsigned long size)
+{
+    unsigned char *tags  = table->tags;
+    HashSlotPtr   slots  = table->slots;
+    unsigned long old    = table->mask + 1;
+    unsigned long i, j;
+    unsigned char tag;
+
+    if (HashAlloc(table, size)) return -1;
+
+    for (i = 0; i < old; i++) {
+	if (!tags[i]) continue;
+	j = HashFind(table, slots[i].key, &tag);
+	table->tags[j]  = tag;
+	table->slots[j] = slots[i];
     }
-    ++table->misses;
-    return NULL;
+
+    drmFree(tags);
+    drmFree(slots);
+    return 0;
 }
 
 drm_public int drmHashLookup(void *t, unsigned long key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    HashBucketPtr bucket;
+    unsigned long i;
+    unsigned char tag;
 
     if (!table || table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    bucket = HashFind(table, key, NULL);
-    if (!bucket) return 1;	/* Not found */
-    *value = bucket->value;
+    i = HashFind(table, key, &tag);
+    if (!table->tags[i]) return 1; /* Not found */
+    *value = table->slots[i].value;
     return 0;			/* Found */
 }
 
 drm_public int drmHashInsert(void *t, unsigned long key, void *value)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    HashBucketPtr bucket;
-    unsigned long hash;
+    unsigned long i;
+    unsigned char tag;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    if (HashFind(table, key, &hash)) return 1; /* Already in table */
+    i = HashFind(table, key, &tag);
+    if (table->tags[i]) return 1; /* Already in table */
 
-    bucket               = drmMalloc(sizeof(*bucket));
-    if (!bucket) return -1;	/* Error */
-    bucket->key          = key;
-    bucket->value        = value;
-    bucket->next         = table->buckets[hash];
-    table->buckets[hash] = bucket;
+    if ((table->entries + 1) * 4 > (table->mask + 1) * 3) {
+	if (HashResize(table, (table->mask + 1) * 2)) return -1; /* Error */
+	i = HashFind(table, key, &tag);
+    }
+
+    table->tags[i]        = tag;
+    table->slots[i].key   = key;
+    table->slots[i].value = value;
+    ++table->entries;
+    ++table->generation;
+    table->walking = 0;		/* Walks do not survive insertions */
     return 0;			/* Added to table */
 }
 
+static void HashShrink(HashTablePtr table)
+{
+    if (table->mask + 1 > HASH_MIN_SIZE &&
+	table->entries * 8 < table->mask + 1)
+	HashResize(table, (table->mask + 1) / 2); /* Keep the old one if this fails */
+}
+
 drm_public int drmHashDelete(void *t, unsigned long key)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    unsigned long hash;
-    HashBucketPtr bucket;
+    unsigned long i, j, home;
+    unsigned char tag;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    bucket = HashFind(table, key, &hash);
+    i = HashFind(table, key, &tag);
+    if (!table->tags[i]) return 1; /* Not found */
+
+				/* Move back the entries that would not be
+				   found anymore across the hole at i */
+    for (j = (i + 1) & table->mask; table->tags[j];
+	 j = (j + 1) & table->mask) {
+	home = HashIndex(table, HashHash(table->slots[j].key));
+	if (((j - home) & table->mask) < ((j - i) & table->mask))
+	    continue;
+	table->tags[i]  = table->tags[j];
+	table->slots[i] = table->slots[j];
+	i = j;
+    }
+    table->tags[i] = 0;
+    --table->entries;
 
-    if (!bucket) return 1;	/* Not found */
+    if (!table->walking)
+	HashShrink(table);
 
-    table->buckets[hash] = bucket->next;
-    drmFree(bucket);
     return 0;
 }
 
-drm_public int drmHashNext(void *t, unsigned long *key, void **value)
-{
-    HashTablePtr  table = (HashTablePtr)t;
+/* Return the next entry of the walk, from p0 on */
 
-    while (table->p0 < HASH_SIZE) {
-	if (table->p1) {
-	    *key       = table->p1->key;
-	    *value     = table->p1->value;
-	    table->p1  = table->p1->next;
+static int HashWalk(HashTablePtr table, unsigned long *key, void **value)
+{
+    unsigned long i;
+
+    while (table->p0 < table->mask) {
+	i = (table->start + 1 + table->p0) & table->mask;
+	if (table->tags[i]) {
+	    *key            = table->slots[i].key;
+	    *value          = table->slots[i].value;
+	    table->last     = i;
+	    table->last_key = *key;
+	    ++table->p0;
 	    return 1;
 	}
-	table->p1 = table->buckets[table->p0];
 	++table->p0;
     }
+
+    table->walking = 0;
+    HashShrink(table);
     return 0;
 }
 
+drm_public int drmHashNext(void *t, unsigned long *key, void **value)
+{
+    HashTablePtr  table = (HashTablePtr)t;
+    unsigned long i     = table->last;
+
+    if (!table->walking) return 0;
+
+				/* If the last entry was deleted, the entry
+				   moved into its slot, if any, is next */
+    if (!table->tags[i] || table->slots[i].key != table->last_key)
+	--table->p0;
+
+    return HashWalk(table, key, value);
+}
+
 drm_public int drmHashFirst(void *t, unsigned long *key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
+    unsigned long i;
+    int           ret;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    table->p0 = 0;
-    table->p1 = table->buckets[0];
-    return drmHashNext(table, key, value);
+				/* Without insertions since the last walk
+				   began, its empty slots still are */
+    if (table->walk_generation != table->generation) {
+	for (i = 0; table->tags[i]; i++);
+	table->start           = i;
+	table->skip            = 0;
+	table->walk_generation = table->generation;
+    }
+
+    table->walking = 1;
+    table->p0      = table->skip;
+    ret            = HashWalk(table, key, value);
+    table->skip    = ret ? table->p0 - 1 : table->mask;
+    return ret;
+}
+
+#define REGISTRY_SHARDS 16	/* a power of two */
+
+struct drm_registry_shard {
+    pthread_mutex_t lock;
+    void            *table;
+} __attribute__((aligned(64)));	/* keep the locks on separate lines */
+
+struct _drmRegistry {
+    struct drm_registry_shard shards[REGISTRY_SHARDS];
+};
+
+/*
+ * The shard tables index with the top bits of HashHash(), so the shard is
+ * picked with a separate mix of the key.  Using bits of HashHash() would
+ * put all keys of a shard into a fraction of its table.
+ */
+static struct drm_registry_shard *RegistryShard(drmRegistryPtr reg,
+						unsigned long key)
+{
+    uint64_t mix = key;
+
+    mix ^= mix >> 33;
+    mix *= 0xff51afd7ed558ccdull;
+    mix ^= mix >> 33;
+    mix *= 0xc4ceb9fe1a85ec53ull;
+    mix ^= mix >> 33;
+    return &reg->shards[mix & (REGISTRY_SHARDS - 1)];
+}
+
+drm_public drmRegistryPtr drmRegistryCreate(void)
+{
+    drmRegistryPtr reg;
+    void *mem;
+    int i;
+
+    if (posix_memalign(&mem, 64, sizeof(*reg)))
+	return NULL;
+    reg = mem;
+
+    for (i = 0; i < REGISTRY_SHARDS; i++) {
+	pthread_mutex_init(&reg->shards[i].lock, NULL);
+	reg->shards[i].table = drmHashCreate();
+	if (!reg->shards[i].table) {
+	    while (i--)
+		drmHashDestroy(reg->shards[i].table);
+	    free(reg);
+	    return NULL;
+	}
+    }
+
+    return reg;
+}
+
+/* The values are owned by the caller and are not freed */
+drm_public void drmRegistryDestroy(drmRegistryPtr reg)
+{
+    int i;
+
+    if (!reg)
+	return;
+
+    for (i = 0; i < REGISTRY_SHARDS; i++) {
+	drmHashDestroy(reg->shards[i].table);
+	pthread_mutex_destroy(&reg->shards[i].lock);
+    }
+
+    free(reg);
+}
+
+drm_public void *drmRegistryLookup(drmRegistryPtr reg, unsigned long key)
+{
+    struct drm_registry_shard *shard = RegistryShard(reg, key);
+    void *value;
+
+    pthread_mutex_lock(&shard->lock);
+    if (drmHashLookup(shard->table, key, &value))
+	value = NULL;
+    pthread_mutex_unlock(&shard->lock);
+
+    return value;
+}
+
+drm_public void *drmRegistryGet(drmRegistryPtr reg, unsigned long key,
+				void *(*get)(void *value, void *data),
+				void *(*create)(unsigned long key, void *data),
+				void *data)
+{
+    struct drm_registry_shard *shard = RegistryShard(reg, key);
+    void *value, *found = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (!drmHashLookup(shard->table, key, &value)) {
+	found = get ? get(value, data) : value;
+	if (found)
+	    goto out;
+
+	drmHashDelete(shard->table, key);
+    }
+
+    /* if the insert fails, the value still works but is not shared */
+    if (create) {
+	found = create(key, data);
+	if (found)
+	    drmHashInsert(shard->table, key, found);
+    }
+
+out:
+    pthread_mutex_unlock(&shard->lock);
+
+    return found;
+}
+
+drm_public int drmRegistryRemove(drmRegistryPtr reg, unsigned long key,
+				 void *value)
+{
+    struct drm_registry_shard *shard = RegistryShard(reg, key);
+    void *found;
+    int ret = 1;
+
+    pthread_mutex_lock(&shard->lock);
+    if (!drmHashLookup(shard->table, key, &found) && found == value)
+	ret = drmHashDelete(shard->table, key);
+    pthread_mutex_unlock(&shard->lock);
+
+    return ret;
 }
@@ -24,24 +24,28 @@
  * Authors: Rickard E. (Rik) Faith <faith@valinux.com>
  */
 
-#define HASH_SIZE  512		/* Good for about 100 entries */
-				/* If you change this value, you probably
-                                   have to change the HashHash hashing
-                                   function! */
+#define HASH_MIN_SIZE 16	/* Initial number of slots, a power of two */
 
-typedef struct HashBucket {
+typedef struct HashSlot {
     unsigned long     key;
     void              *value;
-    struct HashBucket *next;
-} HashBucket, *HashBucketPtr;
+} HashSlot, *HashSlotPtr;
 
 typedef struct HashTable {
     unsigned long    magic;
     unsigned long    entries;
-    unsigned long    hits;	/* At top of linked list */
-    unsigned long    partials;	/* Not at top of linked list */
-    unsigned long    misses;	/* Not in table */
-    HashBucketPtr    buckets[HASH_SIZE];
-    int              p0;
-    HashBucketPtr    p1;
+    unsigned long    mask;	/* Number of slots - 1 */
+    unsigned int     shift;	/* 64 - log2(number of slots) */
+    unsigned char    *tags;	/* 0 if the slot is empty */
+    HashSlotPtr      slots;
+    unsigned long    generation; /* Bumped when entries are added or moved */
+
+				/* drmHashFirst/drmHashNext walk */
+    int              walking;
+    unsigned long    walk_generation;
+    unsigned long    start;	/* Empty slot the walk starts after */
+    unsigned long    skip;	/* Empty slots known to follow start */
+    unsigned long    p0;	/* Slots after start visited */
+    unsigned long    last;	/* Slot of the entry returned last */
+    unsigned long    last_key;
 } HashTable, *HashTablePtr;
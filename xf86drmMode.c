@@ -39,6 +39,7 @@
  */
 
 #include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -47,11 +48,17 @@
 #endif
 #include <stdio.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
 
 #include "libdrm_macros.h"
+#include "libdrm_lists.h"
 #include "xf86drmMode.h"
 #include "xf86drm.h"
+#include "util_math.h"
 #include <drm.h>
+#include <drm_fourcc.h>
 #include <string.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -887,14 +894,61 @@ drm_public int drmModeCrtcSetGamma(int fd, uint32_t crtc_id, uint32_t size,
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_SETGAMMA, &l);
 }
 
+static void drmDispatchEvent(int fd, drmEventContextPtr evctx,
+			     struct drm_event *e)
+{
+	struct drm_event_vblank *vblank;
+	struct drm_event_crtc_sequence *seq;
+	void *user_data;
+
+	switch (e->type) {
+	case DRM_EVENT_VBLANK:
+		if (evctx->version < 1 ||
+		    evctx->vblank_handler == NULL)
+			break;
+		vblank = (struct drm_event_vblank *) e;
+		evctx->vblank_handler(fd,
+				      vblank->sequence,
+				      vblank->tv_sec,
+				      vblank->tv_usec,
+				      U642VOID (vblank->user_data));
+		break;
+	case DRM_EVENT_FLIP_COMPLETE:
+		vblank = (struct drm_event_vblank *) e;
+		user_data = U642VOID (vblank->user_data);
+
+		if (evctx->version >= 3 && evctx->page_flip_handler2)
+			evctx->page_flip_handler2(fd,
+						 vblank->sequence,
+						 vblank->tv_sec,
+						 vblank->tv_usec,
+						 vblank->crtc_id,
+						 user_data);
+		else if (evctx->version >= 2 && evctx->page_flip_handler)
+			evctx->page_flip_handler(fd,
+						 vblank->sequence,
+						 vblank->tv_sec,
+						 vblank->tv_usec,
+						 user_data);
+		break;
+	case DRM_EVENT_CRTC_SEQUENCE:
+		seq = (struct drm_event_crtc_sequence *) e;
+		if (evctx->version >= 4 && evctx->sequence_handler)
+			evctx->sequence_handler(fd,
+						seq->sequence,
+						seq->time_ns,
+						seq->user_data);
+		break;
+	default:
+		break;
+	}
+}
+
 drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 {
 	char buffer[1024];
 	int len, i;
 	struct drm_event *e;
-	struct drm_event_vblank *vblank;
-	struct drm_event_crtc_sequence *seq;
-	void *user_data;
 
 	/* The DRM read semantics guarantees that we always get only
 	 * complete events. */
@@ -908,53 +962,509 @@ drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 	i = 0;
 	while (i < len) {
 		e = (struct drm_event *)(buffer + i);
-		switch (e->type) {
-		case DRM_EVENT_VBLANK:
-			if (evctx->version < 1 ||
-			    evctx->vblank_handler == NULL)
+		drmDispatchEvent(fd, evctx, e);
+		i += e->length;
+	}
+
+	return 0;
+}
+
+/*
+ * Event loop
+ *
+ * Unlike drmHandleEvent(), which dispatches a single read() worth of events
+ * from a small stack buffer, the event loop reads into a larger buffer and
+ * keeps going until the event queue is drained.  The fd is only polled when
+ * a read filled the buffer, so a dispatch usually costs a single read().
+ */
+#define DRM_EVENT_LOOP_DEFAULT_SIZE (64 * 1024)
+
+/* Upper bound of the size of a single event the kernel sends */
+#define DRM_EVENT_MAX_SIZE 4096
+
+struct _drmEventLoop {
+	int fd;
+	drmEventContextPtr evctx;
+	char *buffer;
+	size_t size;
+	drmEventLoopStats stats;
+};
+
+drm_public drmEventLoopPtr drmEventLoopCreate(int fd, drmEventContextPtr evctx,
+					      size_t buffer_size)
+{
+	drmEventLoopPtr loop;
+
+	if (fd < 0 || !evctx)
+		return NULL;
+
+	if (!buffer_size)
+		buffer_size = DRM_EVENT_LOOP_DEFAULT_SIZE;
+
+	if (buffer_size < DRM_EVENT_MAX_SIZE)
+		buffer_size = DRM_EVENT_MAX_SIZE;
+
+	loop = drmMalloc(sizeof(*loop));
+	if (!loop)
+		return NULL;
+
+	loop->buffer = drmMalloc(buffer_size);
+	if (!loop->buffer) {
+		drmFree(loop);
+		return NULL;
+	}
+
+	loop->fd = fd;
+	loop->evctx = evctx;
+	loop->size = buffer_size;
+
+	return loop;
+}
+
+drm_public void drmEventLoopDestroy(drmEventLoopPtr loop)
+{
+	if (!loop)
+		return;
+
+	drmFree(loop->buffer);
+	drmFree(loop);
+}
+
+drm_public int drmEventLoopGetFd(drmEventLoopPtr loop)
+{
+	if (!loop)
+		return -EINVAL;
+
+	return loop->fd;
+}
+
+static uint64_t drmEventTimestamp(const struct drm_event *e)
+{
+	const struct drm_event_vblank *vblank;
+	const struct drm_event_crtc_sequence *seq;
+
+	switch (e->type) {
+	case DRM_EVENT_VBLANK:
+	case DRM_EVENT_FLIP_COMPLETE:
+		vblank = (const struct drm_event_vblank *) e;
+		return vblank->tv_sec * 1000000000ull + vblank->tv_usec * 1000ull;
+	case DRM_EVENT_CRTC_SEQUENCE:
+		seq = (const struct drm_event_crtc_sequence *) e;
+		return seq->time_ns;
+	default:
+		return 0;
+	}
+}
+
+static void drmEventLoopRecordLatency(drmEventLoopPtr loop, uint64_t now,
+				      uint64_t timestamp)
+{
+	uint64_t latency = 0, usec;
+	unsigned int bucket = 0;
+
+	if (!timestamp)
+		return;
+
+	/* timestamps from before the dispatch started count as zero */
+	if (now > timestamp)
+		latency = now - timestamp;
+
+	usec = latency / 1000;
+	while (usec && bucket < DRM_EVENT_LATENCY_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+
+	loop->stats.latency[bucket]++;
+	if (latency > loop->stats.max_latency_ns)
+		loop->stats.max_latency_ns = latency;
+}
+
+/**
+ * Dispatch all pending events
+ *
+ * As with drmHandleEvent(), this must only be called once the fd is
+ * readable, but it does not return before all pending events have been
+ * dispatched.
+ *
+ * \return the number of events dispatched, or a negative error code if a
+ * read failed before any event was dispatched.  An error after some events
+ * were dispatched is reported by the next call.
+ */
+drm_public int drmEventLoopDispatch(drmEventLoopPtr loop)
+{
+	struct pollfd pfd;
+	struct timespec ts;
+	struct drm_event *e;
+	uint64_t now;
+	ssize_t len, i;
+	int count = 0, ret = 0;
+
+	if (!loop)
+		return -EINVAL;
+
+	loop->stats.dispatches++;
+
+	for (;;) {
+		/* The DRM read semantics guarantees that we always get only
+		 * complete events. */
+		len = read(loop->fd, loop->buffer, loop->size);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
 				break;
-			vblank = (struct drm_event_vblank *) e;
-			evctx->vblank_handler(fd,
-					      vblank->sequence,
-					      vblank->tv_sec,
-					      vblank->tv_usec,
-					      U642VOID (vblank->user_data));
+			ret = -errno;
+			break;
+		}
+
+		loop->stats.reads++;
+
+		if (len == 0)
 			break;
-		case DRM_EVENT_FLIP_COMPLETE:
-			vblank = (struct drm_event_vblank *) e;
-			user_data = U642VOID (vblank->user_data);
-
-			if (evctx->version >= 3 && evctx->page_flip_handler2)
-				evctx->page_flip_handler2(fd,
-							 vblank->sequence,
-							 vblank->tv_sec,
-							 vblank->tv_usec,
-							 vblank->crtc_id,
-							 user_data);
-			else if (evctx->version >= 2 && evctx->page_flip_handler)
-				evctx->page_flip_handler(fd,
-							 vblank->sequence,
-							 vblank->tv_sec,
-							 vblank->tv_usec,
-							 user_data);
+		if (len < (ssize_t)sizeof *e) {
+			ret = -EIO;
 			break;
-		case DRM_EVENT_CRTC_SEQUENCE:
-			seq = (struct drm_event_crtc_sequence *) e;
-			if (evctx->version >= 4 && evctx->sequence_handler)
-				evctx->sequence_handler(fd,
-							seq->sequence,
-							seq->time_ns,
-							seq->user_data);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+		for (i = 0; i < len; i += e->length) {
+			e = (struct drm_event *)(loop->buffer + i);
+
+			drmEventLoopRecordLatency(loop, now, drmEventTimestamp(e));
+			drmDispatchEvent(loop->fd, loop->evctx, e);
+			count++;
+		}
+
+		/* with room left for another event, the queue was drained */
+		if ((size_t)len <= loop->size - DRM_EVENT_MAX_SIZE)
 			break;
-		default:
+
+		pfd.fd = loop->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
 			break;
+	}
+
+	loop->stats.events += count;
+
+	return count ? count : ret;
+}
+
+drm_public void drmEventLoopGetStats(drmEventLoopPtr loop,
+				     drmEventLoopStatsPtr stats)
+{
+	if (!loop || !stats)
+		return;
+
+	*stats = loop->stats;
+}
+
+/*
+ * Frame pacing
+ *
+ * The vblank period is tracked as a moving average over the intervals
+ * between the vblanks reported, with the last vblank giving the phase.
+ * With VRR the refresh rate follows the flips, so the period is only the
+ * shortest time between two vblanks and the next vblank cannot happen
+ * before last vblank + period, but can be any time later.
+ */
+#define DRM_PACER_WEIGHT_SHIFT 3
+
+struct _drmModeFramePacer {
+	int fd;
+	uint32_t crtc_id;
+	bool vrr;
+	bool have_vblank;
+	uint64_t last_sequence;
+	uint64_t last_ns;
+	int64_t period_ns;
+	int64_t deviation_ns;	/* average distance to the period */
+	drmModeFramePacerStats stats;
+};
+
+static uint64_t drmPacerNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Initial guess of the period from the current mode, and VRR state */
+static void drmPacerGetCrtcState(drmModeFramePacerPtr pacer)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	drmModeCrtcPtr crtc;
+	uint32_t i;
+
+	crtc = drmModeGetCrtc(pacer->fd, pacer->crtc_id);
+	if (crtc) {
+		if (crtc->mode_valid && crtc->mode.clock)
+			pacer->period_ns = (uint64_t)crtc->mode.htotal *
+					   crtc->mode.vtotal * 1000000 /
+					   crtc->mode.clock;
+		drmModeFreeCrtc(crtc);
+	}
+
+	props = drmModeObjectGetProperties(pacer->fd, pacer->crtc_id,
+					   DRM_MODE_OBJECT_CRTC);
+	if (!props)
+		return;
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(pacer->fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, "VRR_ENABLED"))
+			pacer->vrr = !!props->prop_values[i];
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+}
+
+drm_public drmModeFramePacerPtr drmModeFramePacerCreate(int fd,
+							uint32_t crtc_id)
+{
+	drmModeFramePacerPtr pacer;
+
+	pacer = drmMalloc(sizeof(*pacer));
+	if (!pacer)
+		return NULL;
+
+	pacer->fd = fd;
+	pacer->crtc_id = crtc_id;
+	drmPacerGetCrtcState(pacer);
+
+	return pacer;
+}
+
+drm_public void drmModeFramePacerDestroy(drmModeFramePacerPtr pacer)
+{
+	drmFree(pacer);
+}
+
+/* Override the VRR state read from the CRTC at creation */
+drm_public void drmModeFramePacerSetVrr(drmModeFramePacerPtr pacer, int vrr)
+{
+	if (pacer)
+		pacer->vrr = !!vrr;
+}
+
+/**
+ * Feed a vblank to the pacer
+ *
+ * Meant to be called from the sequence handler of CRTC_SEQUENCE events,
+ * or with the values returned by drmCrtcGetSequence().
+ */
+drm_public void drmModeFramePacerAddVblank(drmModeFramePacerPtr pacer,
+					   uint64_t sequence, uint64_t ns)
+{
+	int64_t interval, deviation;
+	uint64_t count;
+
+	if (!pacer)
+		return;
+
+	if (pacer->have_vblank) {
+		/* same vblank reported twice, or out of order */
+		if (sequence <= pacer->last_sequence || ns <= pacer->last_ns)
+			return;
+
+		count = sequence - pacer->last_sequence;
+		interval = (ns - pacer->last_ns) / count;
+
+		if (!pacer->period_ns) {
+			pacer->period_ns = interval;
+		} else if (pacer->vrr) {
+			/* only the shortest intervals tell the refresh limit */
+			if (interval < pacer->period_ns)
+				pacer->period_ns = interval;
+		} else {
+			deviation = interval - pacer->period_ns;
+			pacer->period_ns += deviation >> DRM_PACER_WEIGHT_SHIFT;
+
+			if (deviation < 0)
+				deviation = -deviation;
+			pacer->deviation_ns += (deviation - pacer->deviation_ns) >>
+					       DRM_PACER_WEIGHT_SHIFT;
 		}
-		i += e->length;
 	}
 
+	pacer->have_vblank = true;
+	pacer->last_sequence = sequence;
+	pacer->last_ns = ns;
+	pacer->stats.vblanks++;
+}
+
+/* Query the current vblank from the kernel */
+drm_public int drmModeFramePacerSample(drmModeFramePacerPtr pacer)
+{
+	uint64_t sequence, ns;
+
+	if (!pacer)
+		return -EINVAL;
+
+	if (drmCrtcGetSequence(pacer->fd, pacer->crtc_id, &sequence, &ns))
+		return -errno;
+
+	drmModeFramePacerAddVblank(pacer, sequence, ns);
+
+	return 0;
+}
+
+/* Number of periods from the last vblank to the first vblank after now */
+static uint64_t drmPacerStepsAfter(drmModeFramePacerPtr pacer, uint64_t now)
+{
+	if (pacer->vrr || now < pacer->last_ns)
+		return 1;
+
+	return (now - pacer->last_ns) / pacer->period_ns + 1;
+}
+
+static int drmPacerPrepare(drmModeFramePacerPtr pacer)
+{
+	int ret;
+
+	if (!pacer)
+		return -EINVAL;
+
+	if (!pacer->have_vblank) {
+		ret = drmModeFramePacerSample(pacer);
+		if (ret)
+			return ret;
+	}
+
+	/* a single vblank and no mode gives no period yet */
+	if (pacer->period_ns <= 0) {
+		ret = drmModeFramePacerSample(pacer);
+		if (ret)
+			return ret;
+		if (pacer->period_ns <= 0)
+			return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/**
+ * Predict the next vblanks
+ *
+ * Stores the sequence number and time (CLOCK_MONOTONIC) of the next
+ * \p count vblanks in \p sequences and \p times, either of which may be
+ * NULL.  With VRR, the times are the earliest the vblanks can happen.
+ */
+drm_public int drmModeFramePacerPredict(drmModeFramePacerPtr pacer,
+					uint64_t *sequences, uint64_t *times,
+					uint32_t count)
+{
+	uint64_t now, steps, first_ns;
+	uint32_t i;
+	int ret;
+
+	ret = drmPacerPrepare(pacer);
+	if (ret)
+		return ret;
+
+	now = drmPacerNow();
+	steps = drmPacerStepsAfter(pacer, now);
+	first_ns = pacer->last_ns + steps * pacer->period_ns;
+	if (pacer->vrr && first_ns < now)
+		first_ns = now;
+
+	for (i = 0; i < count; i++) {
+		if (sequences)
+			sequences[i] = pacer->last_sequence + steps + i;
+		if (times)
+			times[i] = first_ns + i * pacer->period_ns;
+	}
+
+	return 0;
+}
+
+/**
+ * Get the latest time to start rendering a frame
+ *
+ * \p latency_ns is the time needed from the start of rendering until the
+ * frame is ready to be flipped, including any safety margin.  Returns in
+ * \p start_ns the time (CLOCK_MONOTONIC) rendering should start to make it
+ * in time for the vblank returned in \p sequence, the first one that can
+ * still be met.  With VRR, rendering should start right away.
+ */
+drm_public int drmModeFramePacerGetRenderStart(drmModeFramePacerPtr pacer,
+					       uint64_t latency_ns,
+					       uint64_t *start_ns,
+					       uint64_t *sequence)
+{
+	uint64_t now, steps, vblank_ns;
+	int ret;
+
+	ret = drmPacerPrepare(pacer);
+	if (ret)
+		return ret;
+
+	now = drmPacerNow();
+	steps = drmPacerStepsAfter(pacer, now);
+	vblank_ns = pacer->last_ns + steps * pacer->period_ns;
+
+	if (pacer->vrr) {
+		if (vblank_ns < now + latency_ns)
+			vblank_ns = now + latency_ns;
+	} else {
+		while (vblank_ns < now + latency_ns) {
+			vblank_ns += pacer->period_ns;
+			steps++;
+		}
+	}
+
+	if (start_ns)
+		*start_ns = vblank_ns - latency_ns;
+	if (sequence)
+		*sequence = pacer->last_sequence + steps;
+
 	return 0;
 }
 
+/**
+ * Report when a frame was presented
+ *
+ * \p target is the vblank the frame was rendered for, \p sequence the one
+ * it actually made it to.
+ */
+drm_public void drmModeFramePacerPresented(drmModeFramePacerPtr pacer,
+					   uint64_t target, uint64_t sequence)
+{
+	if (!pacer)
+		return;
+
+	pacer->stats.frames++;
+
+	if (sequence > target) {
+		pacer->stats.missed++;
+		if (sequence - target > pacer->stats.max_missed_vblanks)
+			pacer->stats.max_missed_vblanks = sequence - target;
+	}
+}
+
+drm_public void drmModeFramePacerGetStats(drmModeFramePacerPtr pacer,
+					  drmModeFramePacerStatsPtr stats)
+{
+	if (!pacer || !stats)
+		return;
+
+	*stats = pacer->stats;
+	stats->period_ns = pacer->period_ns > 0 ? pacer->period_ns : 0;
+	stats->jitter_ns = pacer->deviation_ns;
+	stats->vrr = pacer->vrr;
+}
+
 drm_public int drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id,
 		    uint32_t flags, void *user_data)
 {
@@ -1209,387 +1719,3643 @@ drm_public int drmModeObjectSetProperty(int fd, uint32_t object_id, uint32_t obj
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_OBJ_SETPROPERTY, &prop);
 }
 
-typedef struct _drmModeAtomicReqItem drmModeAtomicReqItem, *drmModeAtomicReqItemPtr;
-
-struct _drmModeAtomicReqItem {
-	uint32_t object_id;
-	uint32_t property_id;
-	uint64_t value;
+/*
+ * Plane format index
+ *
+ * The IN_FORMATS blob is flattened into a bitmap with one row of modifier
+ * bits per format.  Formats and modifiers are mapped to their row and bit
+ * through small open addressing tables, so that a lookup costs two hash
+ * probes and a bit test.
+ */
+struct _drmModeFormatIndex {
+	uint32_t count_formats;
+	uint32_t count_modifiers;
+	uint32_t words;		/* 64 bit words per format row */
+	uint32_t format_slots_mask;
+	uint32_t modifier_slots_mask;
+	uint32_t format_slots_shift;	/* 32 - log2 of the table size */
+	uint32_t modifier_slots_shift;
+	uint32_t *formats;
+	uint64_t *modifiers;
+	uint64_t *bits;		/* count_formats rows of words */
+	int32_t *format_slots;	/* format hash -> index, -1 if empty */
+	int32_t *modifier_slots;	/* modifier hash -> index, -1 if empty */
 };
 
-struct _drmModeAtomicReq {
-	uint32_t cursor;
-	uint32_t size_items;
-	drmModeAtomicReqItemPtr items;
-};
+/*
+ * Fibonacci hashing: the top bits of the product depend on all bits of the
+ * value, unlike the low ones, so fourccs that only differ in their last
+ * characters still spread out.
+ */
+static uint32_t drmFormatIndexHash(uint64_t value, uint32_t shift)
+{
+	return (uint32_t)((value ^ (value >> 32)) * 2654435761u) >> shift;
+}
 
-drm_public drmModeAtomicReqPtr drmModeAtomicAlloc(void)
+/* Returns the table size, and the hash shift for it in *shift */
+static uint32_t drmFormatIndexSlots(uint32_t count, uint32_t *shift)
 {
-	drmModeAtomicReqPtr req;
+	uint32_t slots = 8;
 
-	req = drmMalloc(sizeof *req);
-	if (!req)
-		return NULL;
+	*shift = 29;
 
-	req->items = NULL;
-	req->cursor = 0;
-	req->size_items = 0;
+	/* keep the tables at most half full */
+	while (slots < 2 * count) {
+		slots *= 2;
+		(*shift)--;
+	}
 
-	return req;
+	return slots;
 }
 
-drm_public drmModeAtomicReqPtr drmModeAtomicDuplicate(drmModeAtomicReqPtr old)
+static int drmFormatIndexFindFormat(drmModeFormatIndexPtr index,
+				    uint32_t format)
 {
-	drmModeAtomicReqPtr new;
+	uint32_t slot = drmFormatIndexHash(format, index->format_slots_shift);
+	int32_t i;
 
-	if (!old)
-		return NULL;
+	for (;; slot++) {
+		i = index->format_slots[slot & index->format_slots_mask];
+		if (i < 0 || index->formats[i] == format)
+			return i;
+	}
+}
 
-	new = drmMalloc(sizeof *new);
-	if (!new)
+static int drmFormatIndexFindModifier(drmModeFormatIndexPtr index,
+				      uint64_t modifier)
+{
+	uint32_t slot = drmFormatIndexHash(modifier,
+					   index->modifier_slots_shift);
+	int32_t i;
+
+	for (;; slot++) {
+		i = index->modifier_slots[slot & index->modifier_slots_mask];
+		if (i < 0 || index->modifiers[i] == modifier)
+			return i;
+	}
+}
+
+static drmModeFormatIndexPtr drmFormatIndexAlloc(uint32_t count_formats,
+						 uint32_t count_modifiers)
+{
+	drmModeFormatIndexPtr index;
+	uint32_t format_slots, modifier_slots, words;
+	uint32_t format_shift, modifier_shift;
+	size_t size;
+	char *p;
+
+	words = (count_modifiers + 63) / 64;
+	format_slots = drmFormatIndexSlots(count_formats, &format_shift);
+	modifier_slots = drmFormatIndexSlots(count_modifiers, &modifier_shift);
+
+	/* 64 bit arrays first to keep them aligned */
+	size = sizeof(*index) +
+	       count_modifiers * sizeof(uint64_t) +
+	       (size_t)count_formats * words * sizeof(uint64_t) +
+	       count_formats * sizeof(uint32_t) +
+	       format_slots * sizeof(int32_t) +
+	       modifier_slots * sizeof(int32_t);
+
+	index = drmMalloc(size);
+	if (!index)
 		return NULL;
 
-	new->cursor = old->cursor;
-	new->size_items = old->size_items;
+	p = (char *)(index + 1);
+	index->modifiers = (uint64_t *)p;
+	p += count_modifiers * sizeof(uint64_t);
+	index->bits = (uint64_t *)p;
+	p += (size_t)count_formats * words * sizeof(uint64_t);
+	index->formats = (uint32_t *)p;
+	p += count_formats * sizeof(uint32_t);
+	index->format_slots = (int32_t *)p;
+	p += format_slots * sizeof(int32_t);
+	index->modifier_slots = (int32_t *)p;
+
+	memset(index->format_slots, 0xff, format_slots * sizeof(int32_t));
+	memset(index->modifier_slots, 0xff, modifier_slots * sizeof(int32_t));
+
+	index->words = words;
+	index->format_slots_mask = format_slots - 1;
+	index->modifier_slots_mask = modifier_slots - 1;
+	index->format_slots_shift = format_shift;
+	index->modifier_slots_shift = modifier_shift;
+
+	return index;
+}
 
-	if (old->size_items) {
-		new->items = drmMalloc(old->size_items * sizeof(*new->items));
-		if (!new->items) {
-			free(new);
-			return NULL;
-		}
-		memcpy(new->items, old->items,
-		       old->size_items * sizeof(*new->items));
-	} else {
-		new->items = NULL;
+/* Returns the row of the format, adding it if needed */
+static int drmFormatIndexAddFormat(drmModeFormatIndexPtr index,
+				   uint32_t format)
+{
+	uint32_t slot = drmFormatIndexHash(format, index->format_slots_shift);
+	int32_t i;
+
+	for (;; slot++) {
+		i = index->format_slots[slot & index->format_slots_mask];
+		if (i < 0)
+			break;
+		if (index->formats[i] == format)
+			return i;
 	}
 
-	return new;
+	i = index->count_formats++;
+	index->formats[i] = format;
+	index->format_slots[slot & index->format_slots_mask] = i;
+
+	return i;
 }
 
-drm_public int drmModeAtomicMerge(drmModeAtomicReqPtr base,
-                                  drmModeAtomicReqPtr augment)
+static int drmFormatIndexAddModifier(drmModeFormatIndexPtr index,
+				     uint64_t modifier)
 {
-	if (!base)
+	uint32_t slot = drmFormatIndexHash(modifier,
+					   index->modifier_slots_shift);
+	int32_t i;
+
+	for (;; slot++) {
+		i = index->modifier_slots[slot & index->modifier_slots_mask];
+		if (i < 0)
+			break;
+		if (index->modifiers[i] == modifier)
+			return i;
+	}
+
+	i = index->count_modifiers++;
+	index->modifiers[i] = modifier;
+	index->modifier_slots[slot & index->modifier_slots_mask] = i;
+
+	return i;
+}
+
+static void drmFormatIndexSet(drmModeFormatIndexPtr index, int format,
+			      int modifier)
+{
+	index->bits[format * index->words + modifier / 64] |=
+		1ull << (modifier % 64);
+}
+
+/**
+ * Build a format index from the contents of an IN_FORMATS blob
+ *
+ * \return the index, or NULL if the blob is malformed or on allocation
+ * failure.
+ */
+drm_public drmModeFormatIndexPtr drmModeFormatIndexCreate(const void *data,
+							  size_t length)
+{
+	const struct drm_format_modifier_blob *blob = data;
+	const struct drm_format_modifier *mods;
+	drmModeFormatIndexPtr index;
+	const uint32_t *formats;
+	uint32_t i, j;
+	int m;
+
+	if (!blob || length < sizeof(*blob) ||
+	    blob->version != FORMAT_BLOB_CURRENT)
+		return NULL;
+
+	if (blob->formats_offset > length ||
+	    (length - blob->formats_offset) / sizeof(uint32_t) <
+	    blob->count_formats ||
+	    blob->modifiers_offset > length ||
+	    (length - blob->modifiers_offset) / sizeof(*mods) <
+	    blob->count_modifiers)
+		return NULL;
+
+	formats = (const uint32_t *)((const char *)data + blob->formats_offset);
+	mods = (const struct drm_format_modifier *)
+		((const char *)data + blob->modifiers_offset);
+
+	index = drmFormatIndexAlloc(blob->count_formats, blob->count_modifiers);
+	if (!index)
+		return NULL;
+
+	for (i = 0; i < blob->count_formats; i++)
+		drmFormatIndexAddFormat(index, formats[i]);
+
+	for (i = 0; i < blob->count_modifiers; i++) {
+		m = drmFormatIndexAddModifier(index, mods[i].modifier);
+
+		for (j = 0; j < 64; j++) {
+			if (!(mods[i].formats & (1ull << j)))
+				continue;
+			if ((uint64_t)mods[i].offset + j >= blob->count_formats)
+				break;
+
+			drmFormatIndexSet(index,
+					  drmFormatIndexFindFormat(index,
+						formats[mods[i].offset + j]),
+					  m);
+		}
+	}
+
+	return index;
+}
+
+static drmModeFormatIndexPtr drmFormatIndexFromPlane(int fd, uint32_t plane_id)
+{
+	drmModeFormatIndexPtr index;
+	drmModePlanePtr plane;
+	uint32_t i;
+	int m;
+
+	plane = drmModeGetPlane(fd, plane_id);
+	if (!plane)
+		return NULL;
+
+	index = drmFormatIndexAlloc(plane->count_formats, 1);
+	if (index) {
+		m = drmFormatIndexAddModifier(index, DRM_FORMAT_MOD_INVALID);
+		for (i = 0; i < plane->count_formats; i++)
+			drmFormatIndexSet(index,
+					  drmFormatIndexAddFormat(index,
+							plane->formats[i]),
+					  m);
+	}
+
+	drmModeFreePlane(plane);
+
+	return index;
+}
+
+/**
+ * Build the format index of a plane
+ *
+ * Planes without an IN_FORMATS property only support implicit modifiers,
+ * their formats are indexed with DRM_FORMAT_MOD_INVALID.
+ */
+drm_public drmModeFormatIndexPtr drmModeGetPlaneFormatIndex(int fd,
+							    uint32_t plane_id)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyBlobPtr blob = NULL;
+	drmModeFormatIndexPtr index;
+	drmModePropertyPtr prop;
+	uint32_t i;
+
+	props = drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return NULL;
+
+	for (i = 0; i < props->count_props && !blob; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, "IN_FORMATS")) {
+			blob = drmModeGetPropertyBlob(fd, props->prop_values[i]);
+			if (!blob) {
+				drmModeFreeProperty(prop);
+				drmModeFreeObjectProperties(props);
+				return NULL;
+			}
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	if (!blob)
+		return drmFormatIndexFromPlane(fd, plane_id);
+
+	index = drmModeFormatIndexCreate(blob->data, blob->length);
+	drmModeFreePropertyBlob(blob);
+
+	return index;
+}
+
+drm_public void drmModeFreeFormatIndex(drmModeFormatIndexPtr index)
+{
+	drmFree(index);
+}
+
+drm_public int drmModeFormatIndexHasFormat(drmModeFormatIndexPtr index,
+					   uint32_t format)
+{
+	return index && drmFormatIndexFindFormat(index, format) >= 0;
+}
+
+drm_public int drmModeFormatIndexSupports(drmModeFormatIndexPtr index,
+					  uint32_t format, uint64_t modifier)
+{
+	int f, m;
+
+	if (!index)
+		return 0;
+
+	f = drmFormatIndexFindFormat(index, format);
+	m = drmFormatIndexFindModifier(index, modifier);
+	if (f < 0 || m < 0)
+		return 0;
+
+	return !!(index->bits[f * index->words + m / 64] & (1ull << (m % 64)));
+}
+
+/**
+ * Get the modifiers supported with a format
+ *
+ * Stores up to \p max modifiers in \p modifiers.
+ *
+ * \return the number of modifiers supported with the format.
+ */
+drm_public int drmModeFormatIndexGetModifiers(drmModeFormatIndexPtr index,
+					      uint32_t format,
+					      uint64_t *modifiers, int max)
+{
+	const uint64_t *row;
+	uint32_t i;
+	int f, count = 0;
+
+	if (!index)
 		return -EINVAL;
 
-	if (!augment || augment->cursor == 0)
+	f = drmFormatIndexFindFormat(index, format);
+	if (f < 0)
 		return 0;
 
-	if (base->cursor + augment->cursor >= base->size_items) {
-		drmModeAtomicReqItemPtr new;
-		int saved_size = base->size_items;
+	row = &index->bits[f * index->words];
+	for (i = 0; i < index->count_modifiers; i++) {
+		if (!(row[i / 64] & (1ull << (i % 64))))
+			continue;
 
-		base->size_items = base->cursor + augment->cursor;
-		new = realloc(base->items,
-			      base->size_items * sizeof(*base->items));
-		if (!new) {
-			base->size_items = saved_size;
-			return -ENOMEM;
+		if (count < max)
+			modifiers[count] = index->modifiers[i];
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * State snapshot
+ *
+ * All objects are first queried for the size of their variable length
+ * arrays, then the whole snapshot is laid out in a single allocation and
+ * the objects are queried again straight into it.  When refreshing, the
+ * counts of CRTCs and planes that were already in the previous snapshot are
+ * taken from it instead of being queried, and the first connector query
+ * already passes arrays sized after it, so unchanged objects are only
+ * fetched once.  Should an array have grown in the meantime, the fill
+ * notices and the snapshot is retaken from scratch.
+ */
+struct drm_snapshot_counts {
+	struct drm_mode_card_res res;
+	uint32_t count_planes;
+	uint32_t *crtc_ids;
+	uint32_t *connector_ids;
+	uint32_t *encoder_ids;
+	uint32_t *plane_ids;
+	uint32_t *crtc_props;		/* property count of each CRTC */
+	uint32_t *plane_props;		/* property count of each plane */
+	uint32_t *plane_formats;	/* format count of each plane */
+	struct drm_mode_get_connector *connectors;
+	bool *connector_done;		/* connector fully fetched by 1st query */
+	void *hints;			/* storage for those connectors */
+};
+
+/* Reserve size bytes in the arena at base, or only account for them */
+static void *drmSnapshotReserve(char *base, size_t *offset, size_t size)
+{
+	void *ptr = base ? base + *offset : NULL;
+
+	*offset += ALIGN(size, sizeof(uint64_t));
+
+	return ptr;
+}
+
+static void drmSnapshotFreeCounts(struct drm_snapshot_counts *c)
+{
+	drmFree(c->crtc_ids);
+	drmFree(c->crtc_props);
+	drmFree(c->connectors);
+	drmFree(c->connector_done);
+	drmFree(c->hints);
+	memclear(*c);
+}
+
+static int drmSnapshotGetIds(int fd, struct drm_snapshot_counts *c)
+{
+	struct drm_mode_card_res counts;
+	struct drm_mode_get_plane_res plane_res;
+	uint32_t count_ids;
+
+retry:
+	memclear(c->res);
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &c->res))
+		return -errno;
+
+	/* planes are optional */
+	memclear(plane_res);
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANERESOURCES, &plane_res))
+		plane_res.count_planes = 0;
+
+	counts = c->res;
+	c->count_planes = plane_res.count_planes;
+
+	count_ids = counts.count_crtcs + counts.count_connectors +
+		    counts.count_encoders + c->count_planes;
+
+	c->crtc_ids = drmMalloc((count_ids + 1) * sizeof(uint32_t));
+	if (!c->crtc_ids)
+		return -ENOMEM;
+
+	c->connector_ids = c->crtc_ids + counts.count_crtcs;
+	c->encoder_ids = c->connector_ids + counts.count_connectors;
+	c->plane_ids = c->encoder_ids + counts.count_encoders;
+
+	c->res.count_fbs = 0;
+	c->res.crtc_id_ptr = VOID2U64(c->crtc_ids);
+	c->res.connector_id_ptr = VOID2U64(c->connector_ids);
+	c->res.encoder_id_ptr = VOID2U64(c->encoder_ids);
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &c->res))
+		return -errno;
+
+	if (c->count_planes) {
+		plane_res.plane_id_ptr = VOID2U64(c->plane_ids);
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANERESOURCES, &plane_res))
+			return -errno;
+	}
+
+	/* Objects may have been added in between the ioctls, start over */
+	if (counts.count_crtcs < c->res.count_crtcs ||
+	    counts.count_connectors < c->res.count_connectors ||
+	    counts.count_encoders < c->res.count_encoders ||
+	    c->count_planes < plane_res.count_planes) {
+		drmFree(c->crtc_ids);
+		goto retry;
+	}
+
+	c->count_planes = plane_res.count_planes;
+
+	return 0;
+}
+
+static const drmModeConnector *
+drmSnapshotFindConnector(drmModeStateSnapshotPtr old, uint32_t connector_id)
+{
+	int i;
+
+	if (!old)
+		return NULL;
+
+	for (i = 0; i < old->count_connectors; i++)
+		if (old->connectors[i].connector_id == connector_id)
+			return &old->connectors[i];
+
+	return NULL;
+}
+
+/* Index of the CRTC in the previous snapshot, or -1 */
+static int drmSnapshotFindCrtc(drmModeStateSnapshotPtr old, uint32_t crtc_id)
+{
+	int i;
+
+	if (!old)
+		return -1;
+
+	for (i = 0; i < old->count_crtcs; i++)
+		if (old->crtcs[i].crtc_id == crtc_id)
+			return i;
+
+	return -1;
+}
+
+/* Index of the plane in the previous snapshot, or -1 */
+static int drmSnapshotFindPlane(drmModeStateSnapshotPtr old, uint32_t plane_id)
+{
+	int i;
+
+	if (!old)
+		return -1;
+
+	for (i = 0; i < old->count_planes; i++)
+		if (old->planes[i].plane_id == plane_id)
+			return i;
+
+	return -1;
+}
+
+/* Size the connector arrays the same as in the previous snapshot */
+static void drmSnapshotHintConnector(struct drm_mode_get_connector *conn,
+				     const drmModeConnector *hint,
+				     char *base, size_t *offset)
+{
+	conn->count_modes = MAX2(hint->count_modes, 1);
+	conn->modes_ptr = VOID2U64(drmSnapshotReserve(base, offset,
+			conn->count_modes * sizeof(struct drm_mode_modeinfo)));
+	conn->count_props = hint->count_props;
+	conn->props_ptr = VOID2U64(drmSnapshotReserve(base, offset,
+			hint->count_props * sizeof(uint32_t)));
+	conn->prop_values_ptr = VOID2U64(drmSnapshotReserve(base, offset,
+			hint->count_props * sizeof(uint64_t)));
+	conn->count_encoders = hint->count_encoders;
+	conn->encoders_ptr = VOID2U64(drmSnapshotReserve(base, offset,
+			hint->count_encoders * sizeof(uint32_t)));
+}
+
+static int drmSnapshotGetCounts(int fd, struct drm_snapshot_counts *c,
+				drmModeStateSnapshotPtr old, bool probe)
+{
+	struct drm_mode_obj_get_properties props;
+	struct drm_mode_get_connector requested;
+	struct drm_mode_modeinfo stack_mode;
+	struct drm_mode_get_plane plane;
+	const drmModeConnector *hint;
+	uint32_t i, count_connectors = c->res.count_connectors;
+	size_t size = 0;
+	int j;
+
+	c->crtc_props = drmMalloc((c->res.count_crtcs + 2 * c->count_planes + 1) *
+				  sizeof(uint32_t));
+	c->connectors = drmMalloc((count_connectors + 1) * sizeof(*c->connectors));
+	c->connector_done = drmMalloc((count_connectors + 1) * sizeof(bool));
+	if (!c->crtc_props || !c->connectors || !c->connector_done)
+		return -ENOMEM;
+
+	c->plane_props = c->crtc_props + c->res.count_crtcs;
+	c->plane_formats = c->plane_props + c->count_planes;
+
+	for (i = 0; i < c->res.count_crtcs; i++) {
+		j = drmSnapshotFindCrtc(old, c->crtc_ids[i]);
+		if (j >= 0) {
+			c->crtc_props[i] = old->crtc_props[j].count_props;
+			continue;
 		}
-		base->items = new;
+
+		memclear(props);
+		props.obj_id = c->crtc_ids[i];
+		props.obj_type = DRM_MODE_OBJECT_CRTC;
+		if (drmIoctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &props))
+			return -errno;
+
+		c->crtc_props[i] = props.count_props;
 	}
 
-	memcpy(&base->items[base->cursor], augment->items,
-	       augment->cursor * sizeof(*augment->items));
-	base->cursor += augment->cursor;
+	for (i = 0; i < c->count_planes; i++) {
+		j = drmSnapshotFindPlane(old, c->plane_ids[i]);
+		if (j >= 0) {
+			c->plane_formats[i] = old->planes[j].count_formats;
+			c->plane_props[i] = old->plane_props[j].count_props;
+			continue;
+		}
+
+		memclear(plane);
+		plane.plane_id = c->plane_ids[i];
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANE, &plane))
+			return -errno;
+
+		c->plane_formats[i] = plane.count_format_types;
+
+		memclear(props);
+		props.obj_id = c->plane_ids[i];
+		props.obj_type = DRM_MODE_OBJECT_PLANE;
+		if (drmIoctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &props))
+			return -errno;
+
+		c->plane_props[i] = props.count_props;
+	}
+
+	/* probing only happens if no room for modes is passed */
+	if (!probe) {
+		for (i = 0; i < count_connectors; i++) {
+			hint = drmSnapshotFindConnector(old, c->connector_ids[i]);
+			if (hint)
+				drmSnapshotHintConnector(&c->connectors[i], hint,
+							 NULL, &size);
+		}
+
+		if (size) {
+			c->hints = drmMalloc(size);
+			if (!c->hints)
+				return -ENOMEM;
+		}
+	}
+
+	size = 0;
+
+	for (i = 0; i < count_connectors; i++) {
+		struct drm_mode_get_connector *conn = &c->connectors[i];
+
+		memclear(*conn);
+		conn->connector_id = c->connector_ids[i];
+
+		hint = probe ? NULL : drmSnapshotFindConnector(old, conn->connector_id);
+		if (hint) {
+			drmSnapshotHintConnector(conn, hint, c->hints, &size);
+		} else if (!probe) {
+			conn->count_modes = 1;
+			conn->modes_ptr = VOID2U64(&stack_mode);
+		}
+
+		requested = *conn;
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, conn))
+			return -errno;
+
+		c->connector_done[i] = hint &&
+			conn->count_modes <= requested.count_modes &&
+			conn->count_props <= requested.count_props &&
+			conn->count_encoders <= requested.count_encoders;
+	}
 
 	return 0;
 }
 
-drm_public int drmModeAtomicGetCursor(drmModeAtomicReqPtr req)
+/*
+ * Lay the snapshot out for the given counts.  With a NULL snapshot this only
+ * computes the size needed.
+ */
+static size_t drmSnapshotLayout(drmModeStateSnapshotPtr snap,
+				const struct drm_snapshot_counts *c)
 {
-	if (!req)
-		return -EINVAL;
-	return req->cursor;
+	const struct drm_mode_get_connector *conn;
+	char *base = (char *)snap;
+	size_t offset = 0;
+	uint32_t i;
+
+	drmSnapshotReserve(base, &offset, sizeof(*snap));
+
+	if (snap) {
+		snap->count_crtcs = c->res.count_crtcs;
+		snap->count_connectors = c->res.count_connectors;
+		snap->count_encoders = c->res.count_encoders;
+		snap->count_planes = c->count_planes;
+	}
+
+#define RESERVE(ptr, count) do { \
+		void *_p = drmSnapshotReserve(base, &offset, \
+					      (count) * sizeof(*(ptr))); \
+		if (snap) \
+			(ptr) = _p; \
+	} while (0)
+
+	RESERVE(snap->crtcs, c->res.count_crtcs);
+	RESERVE(snap->crtc_props, c->res.count_crtcs);
+	RESERVE(snap->connectors, c->res.count_connectors);
+	RESERVE(snap->encoders, c->res.count_encoders);
+	RESERVE(snap->planes, c->count_planes);
+	RESERVE(snap->plane_props, c->count_planes);
+
+	for (i = 0; i < c->res.count_crtcs; i++) {
+		RESERVE(snap->crtc_props[i].props, c->crtc_props[i]);
+		RESERVE(snap->crtc_props[i].prop_values, c->crtc_props[i]);
+	}
+
+	for (i = 0; i < c->res.count_connectors; i++) {
+		conn = &c->connectors[i];
+
+		/* keep room for one mode so that the fill does not probe */
+		RESERVE(snap->connectors[i].modes, MAX2(conn->count_modes, 1));
+		RESERVE(snap->connectors[i].props, conn->count_props);
+		RESERVE(snap->connectors[i].prop_values, conn->count_props);
+		RESERVE(snap->connectors[i].encoders, conn->count_encoders);
+	}
+
+	for (i = 0; i < c->count_planes; i++) {
+		RESERVE(snap->planes[i].formats, c->plane_formats[i]);
+		RESERVE(snap->plane_props[i].props, c->plane_props[i]);
+		RESERVE(snap->plane_props[i].prop_values, c->plane_props[i]);
+	}
+
+#undef RESERVE
+
+	return offset;
 }
 
-drm_public void drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor)
+/* Returns 1 if the property count grew since it was queried */
+static int drmSnapshotFillProperties(int fd, uint32_t object_id,
+				     uint32_t object_type, uint32_t count,
+				     drmModeObjectPropertiesPtr r)
 {
-	if (req)
-		req->cursor = cursor;
+	struct drm_mode_obj_get_properties props;
+
+	memclear(props);
+	props.obj_id = object_id;
+	props.obj_type = object_type;
+	props.count_props = count;
+	props.props_ptr = VOID2U64(r->props);
+	props.prop_values_ptr = VOID2U64(r->prop_values);
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &props))
+		return -errno;
+
+	if (props.count_props > count)
+		return 1;
+
+	r->count_props = props.count_props;
+
+	return 0;
 }
 
-drm_public int drmModeAtomicAddProperty(drmModeAtomicReqPtr req,
-                                        uint32_t object_id,
-                                        uint32_t property_id,
-                                        uint64_t value)
+static int drmSnapshotFillConnector(int fd, struct drm_snapshot_counts *c,
+				    uint32_t index, drmModeConnectorPtr r)
+{
+	struct drm_mode_get_connector *conn = &c->connectors[index];
+	struct drm_mode_get_connector counts = *conn;
+
+	if (c->connector_done[index]) {
+		memcpy(r->modes, U642VOID(conn->modes_ptr),
+		       conn->count_modes * sizeof(*r->modes));
+		memcpy(r->props, U642VOID(conn->props_ptr),
+		       conn->count_props * sizeof(*r->props));
+		memcpy(r->prop_values, U642VOID(conn->prop_values_ptr),
+		       conn->count_props * sizeof(*r->prop_values));
+		memcpy(r->encoders, U642VOID(conn->encoders_ptr),
+		       conn->count_encoders * sizeof(*r->encoders));
+	} else {
+		counts.count_modes = MAX2(counts.count_modes, 1);
+
+		conn->count_modes = counts.count_modes;
+		conn->modes_ptr = VOID2U64(r->modes);
+		conn->props_ptr = VOID2U64(r->props);
+		conn->prop_values_ptr = VOID2U64(r->prop_values);
+		conn->encoders_ptr = VOID2U64(r->encoders);
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, conn))
+			return -errno;
+
+		if (counts.count_props < conn->count_props ||
+		    counts.count_modes < conn->count_modes ||
+		    counts.count_encoders < conn->count_encoders)
+			return 1;
+	}
+
+	r->connector_id = conn->connector_id;
+	r->encoder_id = conn->encoder_id;
+	r->connection = conn->connection;
+	r->mmWidth = conn->mm_width;
+	r->mmHeight = conn->mm_height;
+	/* convert subpixel from kernel to userspace */
+	r->subpixel = conn->subpixel + 1;
+	r->count_modes = conn->count_modes;
+	r->count_props = conn->count_props;
+	r->count_encoders = conn->count_encoders;
+	r->connector_type = conn->connector_type;
+	r->connector_type_id = conn->connector_type_id;
+
+	return 0;
+}
+
+/* Returns 1 if anything grew since it was counted and the caller should retry */
+static int drmSnapshotFill(int fd, drmModeStateSnapshotPtr snap,
+			   struct drm_snapshot_counts *c)
+{
+	struct drm_mode_get_encoder enc;
+	struct drm_mode_get_plane plane;
+	struct drm_mode_crtc crtc;
+	uint32_t i;
+	int ret;
+
+	snap->min_width = c->res.min_width;
+	snap->max_width = c->res.max_width;
+	snap->min_height = c->res.min_height;
+	snap->max_height = c->res.max_height;
+
+	for (i = 0; i < c->res.count_crtcs; i++) {
+		drmModeCrtcPtr r = &snap->crtcs[i];
+
+		memclear(crtc);
+		crtc.crtc_id = c->crtc_ids[i];
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETCRTC, &crtc))
+			return -errno;
+
+		r->crtc_id = crtc.crtc_id;
+		r->x = crtc.x;
+		r->y = crtc.y;
+		r->mode_valid = crtc.mode_valid;
+		if (r->mode_valid) {
+			memcpy(&r->mode, &crtc.mode, sizeof(struct drm_mode_modeinfo));
+			r->width = crtc.mode.hdisplay;
+			r->height = crtc.mode.vdisplay;
+		}
+		r->buffer_id = crtc.fb_id;
+		r->gamma_size = crtc.gamma_size;
+
+		ret = drmSnapshotFillProperties(fd, crtc.crtc_id,
+						DRM_MODE_OBJECT_CRTC,
+						c->crtc_props[i],
+						&snap->crtc_props[i]);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < c->res.count_connectors; i++) {
+		ret = drmSnapshotFillConnector(fd, c, i, &snap->connectors[i]);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < c->res.count_encoders; i++) {
+		drmModeEncoderPtr r = &snap->encoders[i];
+
+		memclear(enc);
+		enc.encoder_id = c->encoder_ids[i];
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc))
+			return -errno;
+
+		r->encoder_id = enc.encoder_id;
+		r->crtc_id = enc.crtc_id;
+		r->encoder_type = enc.encoder_type;
+		r->possible_crtcs = enc.possible_crtcs;
+		r->possible_clones = enc.possible_clones;
+	}
+
+	for (i = 0; i < c->count_planes; i++) {
+		drmModePlanePtr r = &snap->planes[i];
+
+		memclear(plane);
+		plane.plane_id = c->plane_ids[i];
+		plane.count_format_types = c->plane_formats[i];
+		plane.format_type_ptr = VOID2U64(r->formats);
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANE, &plane))
+			return -errno;
+
+		if (plane.count_format_types > c->plane_formats[i])
+			return 1;
+
+		r->count_formats = plane.count_format_types;
+		r->plane_id = plane.plane_id;
+		r->crtc_id = plane.crtc_id;
+		r->fb_id = plane.fb_id;
+		r->possible_crtcs = plane.possible_crtcs;
+		r->gamma_size = plane.gamma_size;
+
+		ret = drmSnapshotFillProperties(fd, plane.plane_id,
+						DRM_MODE_OBJECT_PLANE,
+						c->plane_props[i],
+						&snap->plane_props[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static drmModeStateSnapshotPtr
+drmModeSnapshot(int fd, uint32_t flags, drmModeStateSnapshotPtr old)
+{
+	struct drm_snapshot_counts counts;
+	drmModeStateSnapshotPtr snap;
+	int ret;
+
+	memclear(counts);
+
+retry:
+	drmSnapshotFreeCounts(&counts);
+
+	if (drmSnapshotGetIds(fd, &counts) ||
+	    drmSnapshotGetCounts(fd, &counts, old,
+				 flags & DRM_MODE_SNAPSHOT_PROBE)) {
+		drmSnapshotFreeCounts(&counts);
+		return NULL;
+	}
+
+	snap = drmMalloc(drmSnapshotLayout(NULL, &counts));
+	if (!snap) {
+		drmSnapshotFreeCounts(&counts);
+		return NULL;
+	}
+
+	drmSnapshotLayout(snap, &counts);
+
+	/* The number of objects and etc may have changed with a hotplug event
+	 * in between the ioctls, in which case we start over.
+	 */
+	ret = drmSnapshotFill(fd, snap, &counts);
+	if (ret > 0) {
+		drmFree(snap);
+		old = NULL;
+		goto retry;
+	}
+
+	drmSnapshotFreeCounts(&counts);
+
+	if (ret < 0) {
+		drmFree(snap);
+		return NULL;
+	}
+
+	return snap;
+}
+
+/**
+ * Take a snapshot of all CRTCs, connectors, encoders and planes
+ *
+ * Unless DRM_MODE_SNAPSHOT_PROBE is passed in \p flags, connectors are not
+ * probed, as with drmModeGetConnectorCurrent().
+ */
+drm_public drmModeStateSnapshotPtr drmModeGetStateSnapshot(int fd,
+							   uint32_t flags)
+{
+	return drmModeSnapshot(fd, flags, NULL);
+}
+
+/**
+ * Take a new snapshot based on a previous one
+ *
+ * The array sizes of objects already in \p old are reused instead of being
+ * queried, so CRTCs, connectors and planes that did not change since then
+ * only cost the ioctls that fetch their state.  \p old is left untouched
+ * and must still be freed by the caller.
+ */
+drm_public drmModeStateSnapshotPtr
+drmModeRefreshStateSnapshot(int fd, drmModeStateSnapshotPtr old,
+			    uint32_t flags)
+{
+	return drmModeSnapshot(fd, flags, old);
+}
+
+drm_public void drmModeFreeStateSnapshot(drmModeStateSnapshotPtr snapshot)
+{
+	drmFree(snapshot);
+}
+
+/*
+ * Framebuffer cache
+ *
+ * Entries are hashed over their whole layout, collisions are chained, and
+ * an LRU list bounds the number of framebuffers kept alive.
+ */
+#define DRM_FB_CACHE_DEFAULT_ENTRIES 64
+
+struct drm_fb_cache_key {
+	uint32_t width;
+	uint32_t height;
+	uint32_t pixel_format;
+	uint32_t flags;
+	uint32_t handles[4];
+	uint32_t pitches[4];
+	uint32_t offsets[4];
+	uint64_t modifier[4];
+};
+
+struct drm_hash_link {
+	unsigned long hash;
+	struct drm_hash_link *next;	/* hash collision chain */
+};
+
+struct drm_fb_cache_entry {
+	struct drm_fb_cache_key key;
+	struct drm_hash_link link;
+	uint32_t fb_id;
+	uint32_t pins;		/* not evicted while pinned */
+	drmMMListHead lru;
+};
+
+struct _drmModeFBCache {
+	int fd;
+	pthread_mutex_t lock;
+	void *entries;		/* key hash -> struct drm_fb_cache_entry chain */
+	void *fbs;		/* framebuffer ID -> struct drm_fb_cache_entry */
+	drmMMListHead lru;	/* most recently used first */
+	uint32_t count;
+	uint32_t max_entries;
+	drmModeFBCacheStats stats;
+};
+
+drm_public drmModeFBCachePtr drmModeFBCacheCreate(int fd, uint32_t max_entries)
+{
+	drmModeFBCachePtr cache;
+
+	cache = drmMalloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->entries = drmHashCreate();
+	cache->fbs = drmHashCreate();
+	if (!cache->entries || !cache->fbs) {
+		if (cache->entries)
+			drmHashDestroy(cache->entries);
+		if (cache->fbs)
+			drmHashDestroy(cache->fbs);
+		drmFree(cache);
+		return NULL;
+	}
+
+	cache->fd = fd;
+	cache->max_entries = max_entries ? max_entries :
+					   DRM_FB_CACHE_DEFAULT_ENTRIES;
+	pthread_mutex_init(&cache->lock, NULL);
+	DRMINITLISTHEAD(&cache->lru);
+
+	return cache;
+}
+
+/* FNV-1a */
+static unsigned long drmModeHashData(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+ * Hash tables of the caches map a hash to the first entry with that hash,
+ * and chain the entries whose hashes collide through their drm_hash_link.
+ */
+static struct drm_hash_link *drmHashChainFirst(void *table, unsigned long hash)
+{
+	void *value;
+
+	return drmHashLookup(table, hash, &value) ? NULL : value;
+}
+
+/* New entries go to the front of the collision chain */
+static void drmHashChainInsert(void *table, struct drm_hash_link *link)
+{
+	link->next = drmHashChainFirst(table, link->hash);
+	if (link->next)
+		drmHashDelete(table, link->hash);
+	drmHashInsert(table, link->hash, link);
+}
+
+static void drmHashChainRemove(void *table, struct drm_hash_link *link)
+{
+	struct drm_hash_link *head, **prev;
+
+	head = drmHashChainFirst(table, link->hash);
+	if (!head)
+		return;
+
+	if (head == link) {
+		drmHashDelete(table, link->hash);
+		if (link->next)
+			drmHashInsert(table, link->hash, link->next);
+		return;
+	}
+
+	for (prev = &head->next; *prev; prev = &(*prev)->next) {
+		if (*prev == link) {
+			*prev = link->next;
+			break;
+		}
+	}
+}
+
+static void drmModeFBCacheRemove(drmModeFBCachePtr cache,
+				 struct drm_fb_cache_entry *entry)
+{
+	drmHashChainRemove(cache->entries, &entry->link);
+	drmHashDelete(cache->fbs, entry->fb_id);
+
+	DRMLISTDEL(&entry->lru);
+	cache->count--;
+
+	drmModeRmFB(cache->fd, entry->fb_id);
+	drmFree(entry);
+}
+
+drm_public void drmModeFBCacheDestroy(drmModeFBCachePtr cache)
+{
+	struct drm_fb_cache_entry *entry, *tmp;
+
+	if (!cache)
+		return;
+
+	DRMLISTFOREACHENTRYSAFE(entry, tmp, &cache->lru, lru)
+		drmModeFBCacheRemove(cache, entry);
+
+	drmHashDestroy(cache->entries);
+	drmHashDestroy(cache->fbs);
+	pthread_mutex_destroy(&cache->lock);
+	drmFree(cache);
+}
+
+/**
+ * Get a framebuffer for a buffer layout
+ *
+ * Takes the same arguments as drmModeAddFB2WithModifiers(), but returns the
+ * framebuffer created by an earlier call with the same arguments if there is
+ * one.  The framebuffer is owned by the cache and must not be removed with
+ * drmModeRmFB().  Pin it with drmModeFBCachePin() while it is on screen, as
+ * removing it would turn off the planes showing it.
+ */
+drm_public int drmModeFBCacheGetFB(drmModeFBCachePtr cache, uint32_t width,
+				   uint32_t height, uint32_t pixel_format,
+				   const uint32_t bo_handles[4],
+				   const uint32_t pitches[4],
+				   const uint32_t offsets[4],
+				   const uint64_t modifier[4], uint32_t *buf_id,
+				   uint32_t flags)
+{
+	struct drm_fb_cache_entry *entry, *victim;
+	struct drm_hash_link *link;
+	struct drm_fb_cache_key key;
+	drmMMListHead *item;
+	unsigned long hash;
+	int ret;
+
+	if (!cache || !buf_id)
+		return -EINVAL;
+
+	memclear(key);
+	key.width = width;
+	key.height = height;
+	key.pixel_format = pixel_format;
+	key.flags = flags;
+	memcpy(key.handles, bo_handles, sizeof(key.handles));
+	memcpy(key.pitches, pitches, sizeof(key.pitches));
+	memcpy(key.offsets, offsets, sizeof(key.offsets));
+	/* the kernel ignores the modifiers without DRM_MODE_FB_MODIFIERS */
+	if (modifier && (flags & DRM_MODE_FB_MODIFIERS))
+		memcpy(key.modifier, modifier, sizeof(key.modifier));
+
+	/* the key has no padding, so it can be hashed as bytes */
+	hash = drmModeHashData(&key, sizeof(key));
+
+	pthread_mutex_lock(&cache->lock);
+
+	for (link = drmHashChainFirst(cache->entries, hash); link;
+	     link = link->next) {
+		entry = DRMLISTENTRY(struct drm_fb_cache_entry, link, link);
+		if (!memcmp(&entry->key, &key, sizeof(key))) {
+			DRMLISTDEL(&entry->lru);
+			DRMLISTADD(&entry->lru, &cache->lru);
+			cache->stats.hits++;
+			*buf_id = entry->fb_id;
+			pthread_mutex_unlock(&cache->lock);
+			return 0;
+		}
+	}
+
+	cache->stats.misses++;
+
+	entry = drmMalloc(sizeof(*entry));
+	if (!entry) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = drmModeAddFB2WithModifiers(cache->fd, width, height, pixel_format,
+					 bo_handles, pitches, offsets,
+					 modifier, &entry->fb_id, flags);
+	if (ret) {
+		drmFree(entry);
+		goto out;
+	}
+
+	entry->key = key;
+	entry->link.hash = hash;
+	drmHashChainInsert(cache->entries, &entry->link);
+	drmHashInsert(cache->fbs, entry->fb_id, entry);
+
+	DRMLISTADD(&entry->lru, &cache->lru);
+	cache->count++;
+
+	/* pinned framebuffers may be on screen, leave them alone */
+	item = cache->lru.prev;
+	while (cache->count > cache->max_entries && item != &entry->lru) {
+		victim = DRMLISTENTRY(struct drm_fb_cache_entry, item, lru);
+		item = item->prev;
+		if (victim->pins)
+			continue;
+
+		drmModeFBCacheRemove(cache, victim);
+		cache->stats.evictions++;
+	}
+
+	*buf_id = entry->fb_id;
+
+out:
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
+
+/**
+ * Pin a framebuffer returned by drmModeFBCacheGetFB()
+ *
+ * Pinned framebuffers are not evicted to make room for new ones, so pin a
+ * framebuffer for as long as it may be on screen.  Pins nest, each one is
+ * dropped with drmModeFBCacheUnpin().
+ *
+ * \return zero on success, -ENOENT if the framebuffer is not in the cache.
+ */
+drm_public int drmModeFBCachePin(drmModeFBCachePtr cache, uint32_t buf_id)
+{
+	struct drm_fb_cache_entry *entry;
+	void *value;
+	int ret = -ENOENT;
+
+	if (!cache)
+		return -EINVAL;
+
+	pthread_mutex_lock(&cache->lock);
+
+	if (!drmHashLookup(cache->fbs, buf_id, &value)) {
+		entry = value;
+		entry->pins++;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
+
+drm_public void drmModeFBCacheUnpin(drmModeFBCachePtr cache, uint32_t buf_id)
+{
+	struct drm_fb_cache_entry *entry;
+	void *value;
+
+	if (!cache)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+
+	if (!drmHashLookup(cache->fbs, buf_id, &value)) {
+		entry = value;
+		if (entry->pins)
+			entry->pins--;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* Remove all framebuffers referencing a GEM handle, pinned ones included */
+drm_public void drmModeFBCacheEvictHandle(drmModeFBCachePtr cache,
+					  uint32_t bo_handle)
+{
+	struct drm_fb_cache_entry *entry, *tmp;
+	unsigned int i;
+
+	/* 0 marks the unused planes */
+	if (!cache || !bo_handle)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+
+	DRMLISTFOREACHENTRYSAFE(entry, tmp, &cache->lru, lru) {
+		for (i = 0; i < 4; i++) {
+			if (entry->key.handles[i] == bo_handle) {
+				drmModeFBCacheRemove(cache, entry);
+				cache->stats.evictions++;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+drm_public void drmModeFBCacheGetStats(drmModeFBCachePtr cache,
+				       drmModeFBCacheStatsPtr stats)
+{
+	if (!cache || !stats)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Property metadata cache
+ *
+ * Property IDs and metadata do not change for the lifetime of an object,
+ * so they are looked up once per object and property and then served from
+ * memory.  The kernel only destroys property objects together with the
+ * device, so a property ID never changes meaning while the fd is open.
+ * Invalidation therefore only drops the per-object tables, and properties
+ * stay in the table keyed by their ID until the cache is destroyed.  That
+ * keeps the properties handed out valid for other threads, and bounds the
+ * memory used by the number of properties of the device.
+ */
+struct drm_property_cache_object {
+	uint32_t count_props;
+	drmModePropertyPtr props[];	/* sorted by name */
+};
+
+struct _drmModePropertyCache {
+	int fd;
+	pthread_mutex_t lock;
+	void *objects;		/* object ID -> struct drm_property_cache_object */
+	void *props;		/* property ID -> drmModePropertyPtr */
+	drmMMListHead link;
+};
+
+static pthread_mutex_t property_cache_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static drmMMListHead property_cache_list = {
+	&property_cache_list, &property_cache_list
+};
+
+drm_public drmModePropertyCachePtr drmModePropertyCacheCreate(int fd)
+{
+	drmModePropertyCachePtr cache;
+
+	cache = drmMalloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->fd = fd;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	cache->objects = drmHashCreate();
+	cache->props = drmHashCreate();
+	if (!cache->objects || !cache->props) {
+		drmModePropertyCacheDestroy(cache);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&property_cache_list_lock);
+	DRMLISTADD(&cache->link, &property_cache_list);
+	pthread_mutex_unlock(&property_cache_list_lock);
+
+	return cache;
+}
+
+/* Drop all objects, called with the lock held */
+static void drmModePropertyCacheFlush(drmModePropertyCachePtr cache)
+{
+	unsigned long key;
+	void *value;
+
+	while (drmHashFirst(cache->objects, &key, &value)) {
+		drmHashDelete(cache->objects, key);
+		drmFree(value);
+	}
+}
+
+/**
+ * Forget the properties of all objects
+ *
+ * Must be called when the set of objects changes, such as on hotplug,
+ * which libdrm does not track itself.  Properties returned earlier remain
+ * valid.
+ */
+drm_public void drmModePropertyCacheInvalidate(drmModePropertyCachePtr cache)
+{
+	if (!cache)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	drmModePropertyCacheFlush(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* Leases change the set of objects visible through fd */
+static void drmModePropertyCacheInvalidateFd(int fd)
+{
+	drmModePropertyCachePtr cache;
+
+	pthread_mutex_lock(&property_cache_list_lock);
+
+	DRMLISTFOREACHENTRY(cache, &property_cache_list, link) {
+		if (cache->fd == fd)
+			drmModePropertyCacheInvalidate(cache);
+	}
+
+	pthread_mutex_unlock(&property_cache_list_lock);
+}
+
+drm_public void drmModePropertyCacheDestroy(drmModePropertyCachePtr cache)
+{
+	unsigned long key;
+	void *value;
+
+	if (!cache)
+		return;
+
+	if (cache->objects && cache->props) {
+		pthread_mutex_lock(&property_cache_list_lock);
+		DRMLISTDEL(&cache->link);
+		pthread_mutex_unlock(&property_cache_list_lock);
+
+		drmModePropertyCacheFlush(cache);
+	}
+
+	if (cache->objects)
+		drmHashDestroy(cache->objects);
+
+	if (cache->props) {
+		while (drmHashFirst(cache->props, &key, &value)) {
+			drmHashDelete(cache->props, key);
+			drmModeFreeProperty(value);
+		}
+		drmHashDestroy(cache->props);
+	}
+
+	pthread_mutex_destroy(&cache->lock);
+	drmFree(cache);
+}
+
+static drmModePropertyPtr
+drmModePropertyCacheGetPropertyById(drmModePropertyCachePtr cache,
+				    uint32_t property_id)
+{
+	drmModePropertyPtr prop;
+	void *value;
+
+	if (!drmHashLookup(cache->props, property_id, &value))
+		return value;
+
+	prop = drmModeGetProperty(cache->fd, property_id);
+	if (!prop)
+		return NULL;
+
+	drmHashInsert(cache->props, property_id, prop);
+
+	return prop;
+}
+
+static int drmModePropertyCacheCompare(const void *a, const void *b)
+{
+	const drmModePropertyRes *const *first = a, *const *second = b;
+
+	return strcmp((*first)->name, (*second)->name);
+}
+
+static int drmModePropertyCacheCompareName(const void *key, const void *b)
+{
+	const drmModePropertyRes *const *prop = b;
+
+	return strcmp(key, (*prop)->name);
+}
+
+static struct drm_property_cache_object *
+drmModePropertyCacheGetObject(drmModePropertyCachePtr cache,
+			      uint32_t object_id, uint32_t object_type)
+{
+	struct drm_property_cache_object *object;
+	drmModeObjectPropertiesPtr props;
+	uint32_t i;
+	void *value;
+
+	if (!drmHashLookup(cache->objects, object_id, &value))
+		return value;
+
+	props = drmModeObjectGetProperties(cache->fd, object_id, object_type);
+	if (!props)
+		return NULL;
+
+	object = drmMalloc(sizeof(*object) +
+			   props->count_props * sizeof(object->props[0]));
+	if (!object)
+		goto out;
+
+	for (i = 0; i < props->count_props; i++) {
+		object->props[i] = drmModePropertyCacheGetPropertyById(cache,
+								       props->props[i]);
+		if (!object->props[i]) {
+			drmFree(object);
+			object = NULL;
+			goto out;
+		}
+	}
+
+	object->count_props = props->count_props;
+	qsort(object->props, object->count_props, sizeof(object->props[0]),
+	      drmModePropertyCacheCompare);
+	drmHashInsert(cache->objects, object_id, object);
+
+out:
+	drmModeFreeObjectProperties(props);
+	return object;
+}
+
+/**
+ * Look up a property of an object by name
+ *
+ * The first lookup for an object queries its properties from the kernel,
+ * later lookups are served from memory.  The returned property is owned by
+ * the cache and stays valid until the cache is destroyed.
+ *
+ * \return the property, or NULL if the object has no property of that name.
+ */
+drm_public const drmModePropertyRes *
+drmModePropertyCacheGet(drmModePropertyCachePtr cache, uint32_t object_id,
+			uint32_t object_type, const char *name)
+{
+	struct drm_property_cache_object *object;
+	drmModePropertyPtr *found = NULL;
+
+	if (!cache || !name)
+		return NULL;
+
+	pthread_mutex_lock(&cache->lock);
+
+	object = drmModePropertyCacheGetObject(cache, object_id, object_type);
+	if (object)
+		found = bsearch(name, object->props, object->count_props,
+				sizeof(object->props[0]),
+				drmModePropertyCacheCompareName);
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return found ? *found : NULL;
+}
+
+drm_public uint32_t
+drmModePropertyCacheGetId(drmModePropertyCachePtr cache, uint32_t object_id,
+			  uint32_t object_type, const char *name)
+{
+	const drmModePropertyRes *prop;
+
+	prop = drmModePropertyCacheGet(cache, object_id, object_type, name);
+
+	return prop ? prop->prop_id : 0;
+}
+
+typedef struct _drmModeAtomicReqItem drmModeAtomicReqItem, *drmModeAtomicReqItemPtr;
+
+struct _drmModeAtomicReqItem {
+	uint32_t object_id;
+	uint32_t property_id;
+	uint64_t value;
+};
+
+typedef struct _drmModeAtomicReqUndo drmModeAtomicReqUndo, *drmModeAtomicReqUndoPtr;
+
+/* How to revert one drmModeAtomicAddProperty() call on a sorted request */
+struct _drmModeAtomicReqUndo {
+	uint32_t object_id;
+	uint32_t property_id;
+	uint64_t value;
+	uint32_t inserted;
+};
+
+struct _drmModeAtomicReq {
+	uint32_t cursor;
+	uint32_t size_items;
+	drmModeAtomicReqItemPtr items;
+
+	/*
+	 * Requests allocated with drmModeAtomicAllocSorted() keep the items
+	 * sorted by object and property ID, without duplicates.  count_items
+	 * is the number of items, while the cursor counts the
+	 * drmModeAtomicAddProperty() calls since the request was emptied.  The
+	 * undo log only covers the calls since the last successful commit,
+	 * undo[0] being call number base.  The arena holds the arrays handed
+	 * to the kernel, sized for size_items entries.
+	 */
+	bool sorted;
+	uint32_t count_items;
+	uint32_t base;
+	uint32_t size_undo;
+	drmModeAtomicReqUndoPtr undo;
+	void *arena;
+};
+
+#define ATOMIC_ARENA_ENTRY_SIZE (sizeof(uint64_t) + 3 * sizeof(uint32_t))
+
+drm_public drmModeAtomicReqPtr drmModeAtomicAlloc(void)
+{
+	drmModeAtomicReqPtr req;
+
+	req = drmMalloc(sizeof *req);
+	if (!req)
+		return NULL;
+
+	req->items = NULL;
+	req->cursor = 0;
+	req->size_items = 0;
+
+	return req;
+}
+
+drm_public drmModeAtomicReqPtr drmModeAtomicAllocSorted(void)
+{
+	drmModeAtomicReqPtr req;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return NULL;
+
+	req->sorted = true;
+
+	return req;
+}
+
+static uint32_t drmModeAtomicCountItems(drmModeAtomicReqPtr req)
+{
+	return req->sorted ? req->count_items : req->cursor;
+}
+
+static int drmModeAtomicReserveItems(drmModeAtomicReqPtr req, uint32_t count)
+{
+	drmModeAtomicReqItemPtr items;
+	uint32_t size;
+	void *arena;
+
+	if (count <= req->size_items)
+		return 0;
+
+	size = req->size_items ? req->size_items : 16;
+	while (size < count)
+		size *= 2;
+
+	items = realloc(req->items, size * sizeof(*items));
+	if (!items)
+		return -ENOMEM;
+	req->items = items;
+
+	/* the arena is rebuilt on every commit, so no need to preserve it */
+	arena = malloc(size * ATOMIC_ARENA_ENTRY_SIZE);
+	if (!arena)
+		return -ENOMEM;
+	free(req->arena);
+	req->arena = arena;
+
+	req->size_items = size;
+
+	return 0;
+}
+
+static int drmModeAtomicReserveUndo(drmModeAtomicReqPtr req, uint32_t count)
+{
+	drmModeAtomicReqUndoPtr undo;
+	uint32_t size;
+
+	if (count <= req->size_undo)
+		return 0;
+
+	size = req->size_undo ? req->size_undo : 16;
+	while (size < count)
+		size *= 2;
+
+	undo = realloc(req->undo, size * sizeof(*undo));
+	if (!undo)
+		return -ENOMEM;
+
+	req->undo = undo;
+	req->size_undo = size;
+
+	return 0;
+}
+
+/*
+ * Find the position of (object_id, property_id) in a sorted request, or the
+ * position where it has to be inserted if it is not part of the request.
+ */
+static uint32_t drmModeAtomicFindItem(drmModeAtomicReqPtr req,
+				      uint32_t object_id,
+				      uint32_t property_id, bool *found)
+{
+	const drmModeAtomicReqItem *item;
+	uint32_t low = 0, high = req->count_items, mid;
+
+	*found = false;
+
+	/* properties are usually added in order, check the end first */
+	if (high > 0) {
+		item = &req->items[high - 1];
+
+		if (item->object_id < object_id ||
+		    (item->object_id == object_id &&
+		     item->property_id < property_id))
+			return high;
+	}
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		item = &req->items[mid];
+
+		if (item->object_id < object_id ||
+		    (item->object_id == object_id &&
+		     item->property_id < property_id))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low < req->count_items) {
+		item = &req->items[low];
+
+		*found = item->object_id == object_id &&
+			 item->property_id == property_id;
+	}
+
+	return low;
+}
+
+static int drmModeAtomicAddPropertySorted(drmModeAtomicReqPtr req,
+					  uint32_t object_id,
+					  uint32_t property_id,
+					  uint64_t value)
+{
+	drmModeAtomicReqUndoPtr undo;
+	uint32_t index;
+	bool found;
+	int ret;
+
+	ret = drmModeAtomicReserveUndo(req, req->cursor - req->base + 1);
+	if (ret < 0)
+		return ret;
+
+	index = drmModeAtomicFindItem(req, object_id, property_id, &found);
+
+	undo = &req->undo[req->cursor - req->base];
+	undo->object_id = object_id;
+	undo->property_id = property_id;
+
+	if (found) {
+		undo->value = req->items[index].value;
+		undo->inserted = 0;
+	} else {
+		ret = drmModeAtomicReserveItems(req, req->count_items + 1);
+		if (ret < 0)
+			return ret;
+
+		memmove(&req->items[index + 1], &req->items[index],
+			(req->count_items - index) * sizeof(*req->items));
+		req->count_items++;
+
+		req->items[index].object_id = object_id;
+		req->items[index].property_id = property_id;
+		undo->inserted = 1;
+	}
+
+	req->items[index].value = value;
+	req->cursor++;
+
+	return req->cursor;
+}
+
+/* Shrink the undo log storage to fit count entries, if it is well past that */
+static void drmModeAtomicShrinkUndo(drmModeAtomicReqPtr req, uint32_t count)
+{
+	drmModeAtomicReqUndoPtr undo;
+	uint32_t size = 16;
+
+	while (size < count)
+		size *= 2;
+
+	if (req->size_undo <= 2 * size)
+		return;
+
+	undo = realloc(req->undo, size * sizeof(*undo));
+	if (!undo)
+		return;
+
+	req->undo = undo;
+	req->size_undo = size;
+}
+
+static void drmModeAtomicSetCursorSorted(drmModeAtomicReqPtr req,
+					 uint32_t cursor)
+{
+	drmModeAtomicReqUndoPtr undo;
+	uint32_t index;
+	bool found;
+
+	if (cursor == 0) {
+		req->count_items = 0;
+		req->cursor = 0;
+		req->base = 0;
+		drmModeAtomicShrinkUndo(req, 0);
+		return;
+	}
+
+	/* nothing before the last commit can be rolled back */
+	if (cursor < req->base)
+		cursor = req->base;
+
+	/* items that were rolled back are gone, so moving forward is a no-op */
+	while (req->cursor > cursor) {
+		undo = &req->undo[--req->cursor - req->base];
+
+		index = drmModeAtomicFindItem(req, undo->object_id,
+					      undo->property_id, &found);
+		if (!found)
+			continue;
+
+		if (undo->inserted) {
+			req->count_items--;
+			memmove(&req->items[index], &req->items[index + 1],
+				(req->count_items - index) * sizeof(*req->items));
+		} else {
+			req->items[index].value = undo->value;
+		}
+	}
+
+	drmModeAtomicShrinkUndo(req, req->cursor - req->base);
+}
+
+drm_public drmModeAtomicReqPtr drmModeAtomicDuplicate(drmModeAtomicReqPtr old)
+{
+	drmModeAtomicReqPtr new;
+
+	if (!old)
+		return NULL;
+
+	if (old->sorted) {
+		new = drmModeAtomicAllocSorted();
+		if (!new)
+			return NULL;
+
+		if (drmModeAtomicReserveItems(new, old->count_items) ||
+		    drmModeAtomicReserveUndo(new, old->cursor - old->base)) {
+			drmModeAtomicFree(new);
+			return NULL;
+		}
+
+		memcpy(new->items, old->items,
+		       old->count_items * sizeof(*new->items));
+		memcpy(new->undo, old->undo,
+		       (old->cursor - old->base) * sizeof(*new->undo));
+		new->count_items = old->count_items;
+		new->cursor = old->cursor;
+		new->base = old->base;
+
+		return new;
+	}
+
+	new = drmMalloc(sizeof *new);
+	if (!new)
+		return NULL;
+
+	new->cursor = old->cursor;
+	new->size_items = old->size_items;
+
+	if (old->size_items) {
+		new->items = drmMalloc(old->size_items * sizeof(*new->items));
+		if (!new->items) {
+			free(new);
+			return NULL;
+		}
+		memcpy(new->items, old->items,
+		       old->size_items * sizeof(*new->items));
+	} else {
+		new->items = NULL;
+	}
+
+	return new;
+}
+
+drm_public int drmModeAtomicMerge(drmModeAtomicReqPtr base,
+                                  drmModeAtomicReqPtr augment)
+{
+	uint32_t count, i;
+	int ret;
+
+	if (!base)
+		return -EINVAL;
+
+	if (!augment || augment->cursor == 0)
+		return 0;
+
+	count = drmModeAtomicCountItems(augment);
+
+	if (base->sorted) {
+		uint32_t saved_cursor = base->cursor;
+
+		for (i = 0; i < count; i++) {
+			ret = drmModeAtomicAddPropertySorted(base,
+							     augment->items[i].object_id,
+							     augment->items[i].property_id,
+							     augment->items[i].value);
+			if (ret < 0) {
+				drmModeAtomicSetCursorSorted(base, saved_cursor);
+				return ret;
+			}
+		}
+
+		return 0;
+	}
+
+	if (base->cursor + count >= base->size_items) {
+		drmModeAtomicReqItemPtr new;
+		int saved_size = base->size_items;
+
+		base->size_items = base->cursor + count;
+		new = realloc(base->items,
+			      base->size_items * sizeof(*base->items));
+		if (!new) {
+			base->size_items = saved_size;
+			return -ENOMEM;
+		}
+		base->items = new;
+	}
+
+	memcpy(&base->items[base->cursor], augment->items,
+	       count * sizeof(*augment->items));
+	base->cursor += count;
+
+	return 0;
+}
+
+drm_public int drmModeAtomicGetCursor(drmModeAtomicReqPtr req)
+{
+	if (!req)
+		return -EINVAL;
+	return req->cursor;
+}
+
+drm_public void drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor)
+{
+	if (!req)
+		return;
+
+	if (req->sorted)
+		drmModeAtomicSetCursorSorted(req, cursor < 0 ? 0 : cursor);
+	else
+		req->cursor = cursor;
+}
+
+drm_public int drmModeAtomicAddProperty(drmModeAtomicReqPtr req,
+                                        uint32_t object_id,
+                                        uint32_t property_id,
+                                        uint64_t value)
+{
+	if (!req)
+		return -EINVAL;
+
+	if (object_id == 0 || property_id == 0)
+		return -EINVAL;
+
+	if (req->sorted)
+		return drmModeAtomicAddPropertySorted(req, object_id,
+						      property_id, value);
+
+	if (req->cursor >= req->size_items) {
+		drmModeAtomicReqItemPtr new;
+
+		req->size_items += 16;
+		new = realloc(req->items, req->size_items * sizeof(*req->items));
+		if (!new) {
+			req->size_items -= 16;
+			return -ENOMEM;
+		}
+		req->items = new;
+	}
+
+	req->items[req->cursor].object_id = object_id;
+	req->items[req->cursor].property_id = property_id;
+	req->items[req->cursor].value = value;
+	req->cursor++;
+
+	return req->cursor;
+}
+
+drm_public void drmModeAtomicFree(drmModeAtomicReqPtr req)
+{
+	if (!req)
+		return;
+
+	if (req->items)
+		drmFree(req->items);
+	free(req->undo);
+	free(req->arena);
+	drmFree(req);
+}
+
+static int sort_req_list(const void *misc, const void *other)
+{
+	const drmModeAtomicReqItem *first = misc;
+	const drmModeAtomicReqItem *second = other;
+
+	if (first->object_id < second->object_id)
+		return -1;
+	else if (first->object_id > second->object_id)
+		return 1;
+	else
+		return second->property_id - first->property_id;
+}
+
+/*
+ * The items of a sorted request are already in the order the kernel wants
+ * them, so all that is left is splitting them into the arena arrays.
+ */
+static int drmModeAtomicCommitSorted(int fd, drmModeAtomicReqPtr req,
+				     uint32_t flags, void *user_data)
+{
+	struct drm_mode_atomic atomic;
+	uint64_t *prop_values_ptr = req->arena;
+	uint32_t *objs_ptr = (uint32_t *)(prop_values_ptr + req->size_items);
+	uint32_t *count_props_ptr = objs_ptr + req->size_items;
+	uint32_t *props_ptr = count_props_ptr + req->size_items;
+	uint32_t last_obj_id = 0;
+	uint32_t i;
+	int obj_idx = -1;
+	int ret;
+
+	if (req->count_items == 0)
+		return 0;
+
+	memclear(atomic);
+
+	for (i = 0; i < req->count_items; i++) {
+		if (req->items[i].object_id != last_obj_id) {
+			obj_idx++;
+			objs_ptr[obj_idx] = req->items[i].object_id;
+			count_props_ptr[obj_idx] = 0;
+			last_obj_id = objs_ptr[obj_idx];
+		}
+
+		count_props_ptr[obj_idx]++;
+		props_ptr[i] = req->items[i].property_id;
+		prop_values_ptr[i] = req->items[i].value;
+	}
+
+	atomic.flags = flags;
+	atomic.count_objs = obj_idx + 1;
+	atomic.objs_ptr = VOID2U64(objs_ptr);
+	atomic.count_props_ptr = VOID2U64(count_props_ptr);
+	atomic.props_ptr = VOID2U64(props_ptr);
+	atomic.prop_values_ptr = VOID2U64(prop_values_ptr);
+	atomic.user_data = VOID2U64(user_data);
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+
+	/*
+	 * The committed state is the new starting point, so drop the undo log
+	 * to keep reused requests from growing it forever.  Test-only commits
+	 * are usually followed by a rollback, so they keep it.
+	 */
+	if (ret == 0 && !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+		req->base = req->cursor;
+		drmModeAtomicShrinkUndo(req, 0);
+	}
+
+	return ret;
+}
+
+drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
+                                   uint32_t flags, void *user_data)
+{
+	drmModeAtomicReqPtr sorted;
+	struct drm_mode_atomic atomic;
+	uint32_t *objs_ptr = NULL;
+	uint32_t *count_props_ptr = NULL;
+	uint32_t *props_ptr = NULL;
+	uint64_t *prop_values_ptr = NULL;
+	uint32_t last_obj_id = 0;
+	uint32_t i;
+	int obj_idx = -1;
+	int ret = -1;
+
+	if (!req)
+		return -EINVAL;
+
+	if (req->sorted)
+		return drmModeAtomicCommitSorted(fd, req, flags, user_data);
+
+	if (req->cursor == 0)
+		return 0;
+
+	sorted = drmModeAtomicDuplicate(req);
+	if (sorted == NULL)
+		return -ENOMEM;
+
+	memclear(atomic);
+
+	/* Sort the list by object ID, then by property ID. */
+	qsort(sorted->items, sorted->cursor, sizeof(*sorted->items),
+	      sort_req_list);
+
+	/* Now the list is sorted, eliminate duplicate property sets. */
+	for (i = 0; i < sorted->cursor; i++) {
+		if (sorted->items[i].object_id != last_obj_id) {
+			atomic.count_objs++;
+			last_obj_id = sorted->items[i].object_id;
+		}
+
+		if (i == sorted->cursor - 1)
+			continue;
+
+		if (sorted->items[i].object_id != sorted->items[i + 1].object_id ||
+		    sorted->items[i].property_id != sorted->items[i + 1].property_id)
+			continue;
+
+		memmove(&sorted->items[i], &sorted->items[i + 1],
+			(sorted->cursor - i - 1) * sizeof(*sorted->items));
+		sorted->cursor--;
+	}
+
+	objs_ptr = drmMalloc(atomic.count_objs * sizeof objs_ptr[0]);
+	if (!objs_ptr) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	count_props_ptr = drmMalloc(atomic.count_objs * sizeof count_props_ptr[0]);
+	if (!count_props_ptr) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	props_ptr = drmMalloc(sorted->cursor * sizeof props_ptr[0]);
+	if (!props_ptr) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	prop_values_ptr = drmMalloc(sorted->cursor * sizeof prop_values_ptr[0]);
+	if (!prop_values_ptr) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0, last_obj_id = 0; i < sorted->cursor; i++) {
+		if (sorted->items[i].object_id != last_obj_id) {
+			obj_idx++;
+			objs_ptr[obj_idx] = sorted->items[i].object_id;
+			last_obj_id = objs_ptr[obj_idx];
+		}
+
+		count_props_ptr[obj_idx]++;
+		props_ptr[i] = sorted->items[i].property_id;
+		prop_values_ptr[i] = sorted->items[i].value;
+
+	}
+
+	atomic.flags = flags;
+	atomic.objs_ptr = VOID2U64(objs_ptr);
+	atomic.count_props_ptr = VOID2U64(count_props_ptr);
+	atomic.props_ptr = VOID2U64(props_ptr);
+	atomic.prop_values_ptr = VOID2U64(prop_values_ptr);
+	atomic.user_data = VOID2U64(user_data);
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+
+out:
+	drmFree(objs_ptr);
+	drmFree(count_props_ptr);
+	drmFree(props_ptr);
+	drmFree(prop_values_ptr);
+	drmModeAtomicFree(sorted);
+
+	return ret;
+}
+
+drm_public int
+drmModeCreatePropertyBlob(int fd, const void *data, size_t length,
+                                     uint32_t *id)
+{
+	struct drm_mode_create_blob create;
+	int ret;
+
+	if (length >= 0xffffffff)
+		return -ERANGE;
+
+	memclear(create);
+
+	create.length = length;
+	create.data = (uintptr_t) data;
+	create.blob_id = 0;
+	*id = 0;
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATEPROPBLOB, &create);
+	if (ret != 0)
+		return ret;
+
+	*id = create.blob_id;
+	return 0;
+}
+
+drm_public int
+drmModeDestroyPropertyBlob(int fd, uint32_t id)
+{
+	struct drm_mode_destroy_blob destroy;
+
+	memclear(destroy);
+	destroy.blob_id = id;
+	return DRM_IOCTL(fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &destroy);
+}
+
+/*
+ * Property blob cache
+ *
+ * Blobs are looked up by content, so that creating the same mode, LUT or
+ * HDR metadata blob again returns the blob created the first time.  Blobs
+ * that are no longer referenced are kept around on an idle list, as the
+ * same contents are likely to be used again a few frames later, and only
+ * destroyed once more than DRM_BLOB_CACHE_MAX_IDLE of them pile up.
+ */
+#define DRM_BLOB_CACHE_MAX_IDLE 16
+
+struct drm_blob_cache_entry {
+	uint32_t blob_id;
+	uint32_t refcount;
+	struct drm_hash_link link;
+	drmMMListHead idle;
+	size_t size;
+	char data[];
+};
+
+struct _drmModeBlobCache {
+	int fd;
+	pthread_mutex_t lock;
+	void *contents;		/* content hash -> struct drm_blob_cache_entry chain */
+	void *blobs;		/* blob ID -> struct drm_blob_cache_entry */
+	drmMMListHead idle;	/* most recently released first */
+	uint32_t count_idle;
+	drmModeBlobCacheStats stats;
+};
+
+drm_public drmModeBlobCachePtr drmModeBlobCacheCreate(int fd)
+{
+	drmModeBlobCachePtr cache;
+
+	cache = drmMalloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->fd = fd;
+	pthread_mutex_init(&cache->lock, NULL);
+	DRMINITLISTHEAD(&cache->idle);
+
+	cache->contents = drmHashCreate();
+	cache->blobs = drmHashCreate();
+	if (!cache->contents || !cache->blobs) {
+		drmModeBlobCacheDestroy(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void drmModeBlobCacheRemove(drmModeBlobCachePtr cache,
+				   struct drm_blob_cache_entry *entry)
+{
+	drmHashChainRemove(cache->contents, &entry->link);
+	drmHashDelete(cache->blobs, entry->blob_id);
+
+	if (!entry->refcount) {
+		DRMLISTDEL(&entry->idle);
+		cache->count_idle--;
+	}
+
+	drmModeDestroyPropertyBlob(cache->fd, entry->blob_id);
+	cache->stats.destroyed++;
+	drmFree(entry);
+}
+
+drm_public void drmModeBlobCacheDestroy(drmModeBlobCachePtr cache)
+{
+	unsigned long key;
+	void *value;
+
+	if (!cache)
+		return;
+
+	if (cache->contents && cache->blobs) {
+		while (drmHashFirst(cache->blobs, &key, &value))
+			drmModeBlobCacheRemove(cache, value);
+	}
+
+	if (cache->contents)
+		drmHashDestroy(cache->contents);
+	if (cache->blobs)
+		drmHashDestroy(cache->blobs);
+
+	pthread_mutex_destroy(&cache->lock);
+	drmFree(cache);
+}
+
+/**
+ * Get a blob with the given contents
+ *
+ * Returns the blob created for the same contents if it still exists and
+ * creates a new one otherwise.  Each successful call takes a reference that
+ * must be dropped with drmModeBlobCacheRelease(); the blob must not be
+ * destroyed with drmModeDestroyPropertyBlob().
+ */
+drm_public int drmModeBlobCacheAcquire(drmModeBlobCachePtr cache,
+				       const void *data, size_t size,
+				       uint32_t *id)
+{
+	struct drm_blob_cache_entry *entry;
+	struct drm_hash_link *link;
+	unsigned long hash;
+	int ret;
+
+	if (!cache || !id)
+		return -EINVAL;
+
+	hash = drmModeHashData(data, size);
+
+	pthread_mutex_lock(&cache->lock);
+
+	for (link = drmHashChainFirst(cache->contents, hash); link;
+	     link = link->next) {
+		entry = DRMLISTENTRY(struct drm_blob_cache_entry, link, link);
+		if (entry->size == size && !memcmp(entry->data, data, size)) {
+			if (!entry->refcount++) {
+				DRMLISTDEL(&entry->idle);
+				cache->count_idle--;
+			}
+			cache->stats.hits++;
+			*id = entry->blob_id;
+			pthread_mutex_unlock(&cache->lock);
+			return 0;
+		}
+	}
+
+	cache->stats.misses++;
+
+	entry = drmMalloc(sizeof(*entry) + size);
+	if (!entry) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = drmModeCreatePropertyBlob(cache->fd, data, size, &entry->blob_id);
+	if (ret) {
+		drmFree(entry);
+		goto out;
+	}
+
+	entry->refcount = 1;
+	entry->link.hash = hash;
+	entry->size = size;
+	memcpy(entry->data, data, size);
+
+	drmHashChainInsert(cache->contents, &entry->link);
+	drmHashInsert(cache->blobs, entry->blob_id, entry);
+
+	*id = entry->blob_id;
+
+out:
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
+
+drm_public void drmModeBlobCacheRelease(drmModeBlobCachePtr cache, uint32_t id)
+{
+	struct drm_blob_cache_entry *entry;
+	void *value;
+
+	if (!cache || !id)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+
+	if (drmHashLookup(cache->blobs, id, &value))
+		goto out;
+
+	entry = value;
+	if (!entry->refcount || --entry->refcount)
+		goto out;
+
+	DRMLISTADD(&entry->idle, &cache->idle);
+	cache->count_idle++;
+
+	while (cache->count_idle > DRM_BLOB_CACHE_MAX_IDLE)
+		drmModeBlobCacheRemove(cache,
+				       DRMLISTENTRY(struct drm_blob_cache_entry,
+						    cache->idle.prev, idle));
+
+out:
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* Destroy all blobs that are no longer referenced */
+drm_public void drmModeBlobCacheTrim(drmModeBlobCachePtr cache)
+{
+	struct drm_blob_cache_entry *entry, *tmp;
+
+	if (!cache)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+
+	DRMLISTFOREACHENTRYSAFE(entry, tmp, &cache->idle, idle)
+		drmModeBlobCacheRemove(cache, entry);
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+drm_public void drmModeBlobCacheGetStats(drmModeBlobCachePtr cache,
+					 drmModeBlobCacheStatsPtr stats)
+{
+	if (!cache || !stats)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+drm_public int
+drmModeCreateLease(int fd, const uint32_t *objects, int num_objects, int flags,
+                   uint32_t *lessee_id)
+{
+	struct drm_mode_create_lease create;
+	int ret;
+
+	memclear(create);
+	create.object_ids = (uintptr_t) objects;
+	create.object_count = num_objects;
+	create.flags = flags;
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATE_LEASE, &create);
+	if (ret == 0) {
+		drmModePropertyCacheInvalidateFd(fd);
+		*lessee_id = create.lessee_id;
+		return create.fd;
+	}
+	return -errno;
+}
+
+drm_public drmModeLesseeListPtr
+drmModeListLessees(int fd)
+{
+	struct drm_mode_list_lessees list;
+	uint32_t count;
+	drmModeLesseeListPtr ret;
+
+	memclear(list);
+
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list))
+		return NULL;
+
+	count = list.count_lessees;
+	ret = drmMalloc(sizeof (drmModeLesseeListRes) + count * sizeof (ret->lessees[0]));
+	if (!ret)
+		return NULL;
+
+	list.lessees_ptr = VOID2U64(&ret->lessees[0]);
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list)) {
+		drmFree(ret);
+		return NULL;
+	}
+
+	ret->count = count;
+	return ret;
+}
+
+drm_public drmModeObjectListPtr
+drmModeGetLease(int fd)
+{
+	struct drm_mode_get_lease get;
+	uint32_t count;
+	drmModeObjectListPtr ret;
+
+	memclear(get);
+
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get))
+		return NULL;
+
+	count = get.count_objects;
+	ret = drmMalloc(sizeof (drmModeObjectListRes) + count * sizeof (ret->objects[0]));
+	if (!ret)
+		return NULL;
+
+	get.objects_ptr = VOID2U64(&ret->objects[0]);
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get)) {
+		drmFree(ret);
+		return NULL;
+	}
+
+	ret->count = count;
+	return ret;
+}
+
+drm_public int
+drmModeRevokeLease(int fd, uint32_t lessee_id)
+{
+	struct drm_mode_revoke_lease revoke;
+	int ret;
+
+	memclear(revoke);
+
+	revoke.lessee_id = lessee_id;
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_REVOKE_LEASE, &revoke);
+	if (ret == 0) {
+		drmModePropertyCacheInvalidateFd(fd);
+		return 0;
+	}
+	return -errno;
+}
+
+/*
+ * Plane assignment solver
+ *
+ * Layers are put on planes bottom to top, with each plane above the one
+ * of the layer below it.  Every partial assignment is checked with a
+ * TEST_ONLY commit before going on with the next layer, and the search
+ * backtracks when a layer fits no plane left.  Each layer gets the lowest
+ * zpos above the layer below it that its plane's zpos range allows.  When
+ * no assignment exists, the bottom layers are handed to composition one by
+ * one, with the composition layer taking their place at the bottom.  The
+ * search is limited to DRM_SOLVER_MAX_TESTS test commits, but putting all
+ * layers on composition is always tried.
+ *
+ * The result of a search is remembered per layer configuration, leaving
+ * out the framebuffers, so that steady state frames need no test commits.
+ * Searches cut short by the limit are not remembered, as a later one may
+ * find more.
+ */
+#define DRM_SOLVER_MAX_TESTS 64
+#define DRM_SOLVER_MAX_ENTRIES 256
+
+enum {
+	DRM_SOLVER_PROP_FB_ID,
+	DRM_SOLVER_PROP_CRTC_ID,
+	DRM_SOLVER_PROP_SRC_X,
+	DRM_SOLVER_PROP_SRC_Y,
+	DRM_SOLVER_PROP_SRC_W,
+	DRM_SOLVER_PROP_SRC_H,
+	DRM_SOLVER_PROP_CRTC_X,
+	DRM_SOLVER_PROP_CRTC_Y,
+	DRM_SOLVER_PROP_CRTC_W,
+	DRM_SOLVER_PROP_CRTC_H,
+	DRM_SOLVER_PROP_ZPOS,
+	DRM_SOLVER_PROP_COUNT
+};
+
+static const char * const drm_solver_prop_names[DRM_SOLVER_PROP_COUNT] = {
+	[DRM_SOLVER_PROP_FB_ID] = "FB_ID",
+	[DRM_SOLVER_PROP_CRTC_ID] = "CRTC_ID",
+	[DRM_SOLVER_PROP_SRC_X] = "SRC_X",
+	[DRM_SOLVER_PROP_SRC_Y] = "SRC_Y",
+	[DRM_SOLVER_PROP_SRC_W] = "SRC_W",
+	[DRM_SOLVER_PROP_SRC_H] = "SRC_H",
+	[DRM_SOLVER_PROP_CRTC_X] = "CRTC_X",
+	[DRM_SOLVER_PROP_CRTC_Y] = "CRTC_Y",
+	[DRM_SOLVER_PROP_CRTC_W] = "CRTC_W",
+	[DRM_SOLVER_PROP_CRTC_H] = "CRTC_H",
+	[DRM_SOLVER_PROP_ZPOS] = "zpos",
+};
+
+struct drm_solver_plane {
+	uint32_t id;
+	uint32_t type;
+	uint64_t zpos;
+	uint64_t zpos_min, zpos_max;
+	uint32_t props[DRM_SOLVER_PROP_COUNT];	/* 0 if missing or immutable */
+	drmModeFormatIndexPtr formats;
+};
+
+/* The part of a layer the assignment depends on, without padding */
+struct drm_solver_key {
+	uint32_t format;
+	uint32_t zpos;
+	uint64_t modifier;
+	uint32_t src_x, src_y, src_w, src_h;
+	int32_t crtc_x, crtc_y;
+	uint32_t crtc_w, crtc_h;
+};
+
+struct drm_solver_entry {
+	unsigned long hash;
+	struct drm_solver_entry *next;	/* hash collision chain */
+	uint32_t count_keys;
+	uint32_t composited;
+	int32_t *planes;	/* plane index of each layer, -1 if composited */
+	struct drm_solver_key keys[];
+};
+
+struct _drmModePlaneSolver {
+	int fd;
+	uint32_t crtc_id;
+	uint32_t count_planes;
+	struct drm_solver_plane *planes;
+	uint64_t *zpos;		/* of the planes being tested, bottom to top */
+	void *entries;		/* key hash -> struct drm_solver_entry chain */
+	uint32_t count_entries;
+	drmModePlaneSolverStats stats;
+};
+
+static int drmSolverGetPlaneProps(int fd, struct drm_solver_plane *plane)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	uint32_t i, j;
+
+	props = drmModeObjectGetProperties(fd, plane->id, DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return -errno;
+
+	plane->type = DRM_PLANE_TYPE_OVERLAY;
+	plane->zpos_min = 0;
+	plane->zpos_max = UINT64_MAX;
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, "type"))
+			plane->type = props->prop_values[i];
+
+		if (!strcmp(prop->name, "zpos")) {
+			plane->zpos = props->prop_values[i];
+			if (prop->flags & DRM_MODE_PROP_IMMUTABLE) {
+				plane->zpos_min = plane->zpos;
+				plane->zpos_max = plane->zpos;
+			} else if ((prop->flags & DRM_MODE_PROP_RANGE) &&
+				   prop->count_values >= 2) {
+				plane->zpos_min = prop->values[0];
+				plane->zpos_max = prop->values[1];
+			}
+		}
+
+		for (j = 0; j < DRM_SOLVER_PROP_COUNT; j++) {
+			if (!strcmp(prop->name, drm_solver_prop_names[j]) &&
+			    !(prop->flags & DRM_MODE_PROP_IMMUTABLE))
+				plane->props[j] = prop->prop_id;
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return 0;
+}
+
+/* Primary first, then overlays in zpos order, cursors last */
+static int drmSolverPlaneRank(const struct drm_solver_plane *plane)
+{
+	switch (plane->type) {
+	case DRM_PLANE_TYPE_PRIMARY:
+		return 0;
+	case DRM_PLANE_TYPE_CURSOR:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+static int drmSolverComparePlanes(const void *a, const void *b)
+{
+	const struct drm_solver_plane *first = a, *second = b;
+	int rank = drmSolverPlaneRank(first) - drmSolverPlaneRank(second);
+
+	if (rank)
+		return rank;
+	if (first->zpos != second->zpos)
+		return first->zpos < second->zpos ? -1 : 1;
+	return first->id < second->id ? -1 : first->id > second->id;
+}
+
+/**
+ * Create a plane assignment solver for a CRTC
+ *
+ * The universal planes and atomic client caps must be set on \p fd.  Only
+ * planes that can be used with the CRTC and are either disabled or on the
+ * CRTC at this point are considered.
+ */
+drm_public drmModePlaneSolverPtr drmModePlaneSolverCreate(int fd,
+							  uint32_t crtc_id)
+{
+	drmModePlaneSolverPtr solver;
+	drmModePlaneResPtr plane_res;
+	drmModePlanePtr plane;
+	drmModeResPtr res;
+	uint32_t i;
+	int crtc_index = -1;
+
+	res = drmModeGetResources(fd);
+	if (!res)
+		return NULL;
+
+	for (i = 0; i < (uint32_t)res->count_crtcs; i++)
+		if (res->crtcs[i] == crtc_id)
+			crtc_index = i;
+
+	drmModeFreeResources(res);
+
+	if (crtc_index < 0)
+		return NULL;
+
+	plane_res = drmModeGetPlaneResources(fd);
+	if (!plane_res)
+		return NULL;
+
+	solver = drmMalloc(sizeof(*solver));
+	if (!solver)
+		goto err_res;
+
+	solver->fd = fd;
+	solver->crtc_id = crtc_id;
+
+	solver->entries = drmHashCreate();
+	solver->planes = drmMalloc(plane_res->count_planes *
+				   sizeof(*solver->planes));
+	solver->zpos = drmMalloc(plane_res->count_planes *
+				 sizeof(*solver->zpos));
+	if (!solver->entries || !solver->planes ||
+	    (plane_res->count_planes && !solver->zpos))
+		goto err_solver;
+
+	for (i = 0; i < plane_res->count_planes; i++) {
+		struct drm_solver_plane *p = &solver->planes[solver->count_planes];
+
+		plane = drmModeGetPlane(fd, plane_res->planes[i]);
+		if (!plane)
+			goto err_solver;
+
+		if (!(plane->possible_crtcs & (1 << crtc_index)) ||
+		    (plane->crtc_id && plane->crtc_id != crtc_id)) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+
+		drmModeFreePlane(plane);
+
+		p->id = plane_res->planes[i];
+		if (drmSolverGetPlaneProps(fd, p))
+			goto err_solver;
+
+		p->formats = drmModeGetPlaneFormatIndex(fd, p->id);
+		if (!p->formats)
+			goto err_solver;
+
+		solver->count_planes++;
+	}
+
+	qsort(solver->planes, solver->count_planes, sizeof(*solver->planes),
+	      drmSolverComparePlanes);
+
+	drmModeFreePlaneResources(plane_res);
+
+	return solver;
+
+err_solver:
+	drmModePlaneSolverDestroy(solver);
+err_res:
+	drmModeFreePlaneResources(plane_res);
+	return NULL;
+}
+
+/* Forget all remembered assignments, e.g. after a modeset */
+drm_public void drmModePlaneSolverInvalidate(drmModePlaneSolverPtr solver)
+{
+	struct drm_solver_entry *entry, *next;
+	unsigned long key;
+	void *value;
+
+	if (!solver)
+		return;
+
+	while (drmHashFirst(solver->entries, &key, &value)) {
+		drmHashDelete(solver->entries, key);
+
+		for (entry = value; entry; entry = next) {
+			next = entry->next;
+			drmFree(entry);
+		}
+	}
+
+	solver->count_entries = 0;
+}
+
+drm_public void drmModePlaneSolverDestroy(drmModePlaneSolverPtr solver)
+{
+	uint32_t i;
+
+	if (!solver)
+		return;
+
+	if (solver->entries) {
+		drmModePlaneSolverInvalidate(solver);
+		drmHashDestroy(solver->entries);
+	}
+
+	if (solver->planes) {
+		for (i = 0; i < solver->count_planes; i++)
+			drmModeFreeFormatIndex(solver->planes[i].formats);
+		drmFree(solver->planes);
+	}
+
+	drmFree(solver->zpos);
+	drmFree(solver);
+}
+
+static int drmSolverSupports(const struct drm_solver_plane *plane,
+			     const drmModePlaneLayer *layer)
+{
+	if (layer->modifier == DRM_FORMAT_MOD_INVALID)
+		return drmModeFormatIndexHasFormat(plane->formats,
+						   layer->format);
+
+	return drmModeFormatIndexSupports(plane->formats, layer->format,
+					  layer->modifier);
+}
+
+/*
+ * Give the first count layers increasing zpos values within the ranges of
+ * their planes, in solver->zpos.
+ *
+ * \return false if the ranges do not allow it.
+ */
+static bool drmSolverAssignZpos(drmModePlaneSolverPtr solver,
+				const int32_t *planes, uint32_t count)
+{
+	const struct drm_solver_plane *plane;
+	uint64_t zpos = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		plane = &solver->planes[planes[i]];
+
+		if (zpos < plane->zpos_min)
+			zpos = plane->zpos_min;
+		if (zpos > plane->zpos_max)
+			return false;
+
+		solver->zpos[i] = zpos++;
+	}
+
+	return true;
+}
+
+static int drmSolverAddPlane(drmModePlaneSolverPtr solver,
+			     drmModeAtomicReqPtr req,
+			     const struct drm_solver_plane *plane,
+			     const drmModePlaneLayer *layer, uint64_t zpos)
+{
+	const uint32_t *props = plane->props;
+	uint64_t values[DRM_SOLVER_PROP_COUNT];
+	uint32_t i;
+	int ret;
+
+	values[DRM_SOLVER_PROP_FB_ID] = layer ? layer->fb_id : 0;
+	values[DRM_SOLVER_PROP_CRTC_ID] = layer ? solver->crtc_id : 0;
+
+	if (layer) {
+		values[DRM_SOLVER_PROP_SRC_X] = layer->src_x;
+		values[DRM_SOLVER_PROP_SRC_Y] = layer->src_y;
+		values[DRM_SOLVER_PROP_SRC_W] = layer->src_w;
+		values[DRM_SOLVER_PROP_SRC_H] = layer->src_h;
+		values[DRM_SOLVER_PROP_CRTC_X] = (uint64_t)(int64_t)layer->crtc_x;
+		values[DRM_SOLVER_PROP_CRTC_Y] = (uint64_t)(int64_t)layer->crtc_y;
+		values[DRM_SOLVER_PROP_CRTC_W] = layer->crtc_w;
+		values[DRM_SOLVER_PROP_CRTC_H] = layer->crtc_h;
+		values[DRM_SOLVER_PROP_ZPOS] = zpos;
+	}
+
+	for (i = 0; i < (layer ? DRM_SOLVER_PROP_COUNT : 2); i++) {
+		if (!props[i])
+			continue;
+
+		ret = drmModeAtomicAddProperty(req, plane->id, props[i],
+					       values[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Add the first count layers on their planes to the request, and disable
+ * all other planes of the CRTC.
+ */
+static int drmSolverAddLayers(drmModePlaneSolverPtr solver,
+			      drmModeAtomicReqPtr req,
+			      drmModePlaneLayerPtr *layers,
+			      const int32_t *planes, uint32_t count)
+{
+	const drmModePlaneLayer *layer;
+	uint64_t zpos;
+	uint32_t i, j;
+	int ret;
+
+	if (!drmSolverAssignZpos(solver, planes, count))
+		return -EINVAL;
+
+	for (i = 0, j = 0; i < solver->count_planes; i++) {
+		layer = NULL;
+		zpos = 0;
+		if (j < count && planes[j] == (int32_t)i) {
+			layer = layers[j];
+			zpos = solver->zpos[j];
+		}
+
+		ret = drmSolverAddPlane(solver, req, &solver->planes[i], layer,
+					zpos);
+		if (ret)
+			return ret;
+
+		if (layer)
+			j++;
+	}
+
+	return 0;
+}
+
+static int drmSolverTest(drmModePlaneSolverPtr solver,
+			 drmModeAtomicReqPtr req, uint32_t flags,
+			 drmModePlaneLayerPtr *layers,
+			 const int32_t *planes, uint32_t count)
+{
+	int cursor = drmModeAtomicGetCursor(req);
+	int ret;
+
+	solver->stats.tests++;
+
+	ret = drmSolverAddLayers(solver, req, layers, planes, count);
+	if (!ret)
+		ret = drmModeAtomicCommit(solver->fd, req,
+					  flags | DRM_MODE_ATOMIC_TEST_ONLY,
+					  NULL);
+
+	drmModeAtomicSetCursor(req, cursor);
+
+	return ret;
+}
+
+/* Find planes for layers level and up, all layers below are placed */
+static bool drmSolverSearch(drmModePlaneSolverPtr solver,
+			    drmModeAtomicReqPtr req, uint32_t flags,
+			    drmModePlaneLayerPtr *layers, int32_t *planes,
+			    uint32_t count, uint32_t level, int *budget)
+{
+	uint32_t p, first = level ? planes[level - 1] + 1 : 0;
+
+	if (level == count)
+		return true;
+
+	for (p = first; p + (count - level) <= solver->count_planes; p++) {
+		if (!drmSolverSupports(&solver->planes[p], layers[level]))
+			continue;
+
+		planes[level] = p;
+		if (!drmSolverAssignZpos(solver, planes, level + 1))
+			continue;
+
+		if ((*budget)-- <= 0)
+			return false;
+
+		if (drmSolverTest(solver, req, flags, layers, planes, level + 1))
+			continue;
+
+		if (drmSolverSearch(solver, req, flags, layers, planes, count,
+				    level + 1, budget))
+			return true;
+	}
+
+	return false;
+}
+
+static void drmSolverMakeKey(struct drm_solver_key *key,
+			     const drmModePlaneLayer *layer)
+{
+	memclear(*key);
+
+	if (!layer)
+		return;
+
+	key->format = layer->format;
+	key->zpos = layer->zpos;
+	key->modifier = layer->modifier;
+	key->src_x = layer->src_x;
+	key->src_y = layer->src_y;
+	key->src_w = layer->src_w;
+	key->src_h = layer->src_h;
+	key->crtc_x = layer->crtc_x;
+	key->crtc_y = layer->crtc_y;
+	key->crtc_w = layer->crtc_w;
+	key->crtc_h = layer->crtc_h;
+}
+
+static struct drm_solver_entry *
+drmSolverLookup(drmModePlaneSolverPtr solver, const struct drm_solver_key *keys,
+		uint32_t count_keys, unsigned long hash)
+{
+	struct drm_solver_entry *entry;
+	void *value;
+
+	if (drmHashLookup(solver->entries, hash, &value))
+		return NULL;
+
+	for (entry = value; entry; entry = entry->next) {
+		if (entry->count_keys == count_keys &&
+		    !memcmp(entry->keys, keys, count_keys * sizeof(*keys)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void drmSolverRemember(drmModePlaneSolverPtr solver,
+			      const struct drm_solver_key *keys,
+			      uint32_t count_keys, unsigned long hash,
+			      uint32_t composited, const int32_t *planes)
+{
+	struct drm_solver_entry *entry;
+	void *value;
+
+	if (solver->count_entries >= DRM_SOLVER_MAX_ENTRIES)
+		drmModePlaneSolverInvalidate(solver);
+
+	entry = drmMalloc(sizeof(*entry) + count_keys * sizeof(*keys) +
+			  count_keys * sizeof(*planes));
+	if (!entry)
+		return;
+
+	entry->hash = hash;
+	entry->count_keys = count_keys;
+	entry->composited = composited;
+	entry->planes = (int32_t *)((char *)entry->keys +
+				    count_keys * sizeof(*keys));
+	memcpy(entry->keys, keys, count_keys * sizeof(*keys));
+	memcpy(entry->planes, planes, count_keys * sizeof(*planes));
+
+	if (!drmHashLookup(solver->entries, hash, &value)) {
+		drmHashDelete(solver->entries, hash);
+		entry->next = value;
+	}
+	drmHashInsert(solver->entries, hash, entry);
+	solver->count_entries++;
+}
+
+/**
+ * Assign layers to planes
+ *
+ * Finds planes for as many of the topmost layers as possible and adds
+ * their state to \p req, along with disabling the planes left unused.
+ * The layers are stacked by zpos.  Layers left to composition get a
+ * plane_id of 0; as soon as one is, \p composition is put on the lowest
+ * plane used and the caller has to draw the composited layers into it.
+ * \p composition may be NULL if the caller cannot composite, in which case
+ * all layers have to fit.
+ *
+ * \p flags are used for the test commits, on top of
+ * DRM_MODE_ATOMIC_TEST_ONLY.
+ *
+ * \return the number of composited layers, or a negative error code if no
+ * assignment was found.
+ */
+drm_public int drmModePlaneSolverAssign(drmModePlaneSolverPtr solver,
+					drmModeAtomicReqPtr req,
+					drmModePlaneLayerPtr layers,
+					uint32_t count_layers,
+					drmModePlaneLayerPtr composition,
+					uint32_t flags)
+{
+	drmModePlaneLayerPtr *order, *config;
+	struct drm_solver_entry *entry;
+	struct drm_solver_key *keys;
+	uint32_t i, j, composited, count_config;
+	int32_t *planes, *config_planes;
+	unsigned long hash;
+	bool exhausted = false;
+	int budget, ret = -EINVAL;
+
+	if (!solver || !req || (count_layers && !layers))
+		return -EINVAL;
+
+	/*
+	 * order, keys and planes hold the layers in zpos order followed by
+	 * the composition layer, config and config_planes the layers that are
+	 * put on planes, bottom to top.
+	 */
+	order = drmMalloc(2 * (count_layers + 1) * sizeof(*order));
+	keys = drmMalloc((count_layers + 1) * sizeof(*keys));
+	planes = drmMalloc(2 * (count_layers + 1) * sizeof(*planes));
+	if (!order || !keys || !planes) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	config = order + count_layers + 1;
+	config_planes = planes + count_layers + 1;
+
+	for (i = 0; i < count_layers; i++) {
+		for (j = i; j > 0 && order[j - 1]->zpos > layers[i].zpos; j--)
+			order[j] = order[j - 1];
+		order[j] = &layers[i];
+	}
+	order[count_layers] = composition;
+
+	for (i = 0; i <= count_layers; i++)
+		drmSolverMakeKey(&keys[i], order[i]);
+
+	hash = drmModeHashData(keys, (count_layers + 1) * sizeof(*keys));
+	solver->stats.solves++;
+
+	entry = drmSolverLookup(solver, keys, count_layers + 1, hash);
+	if (entry) {
+		solver->stats.hits++;
+		composited = entry->composited;
+		if (composited > count_layers)
+			goto out;
+
+		memcpy(planes, entry->planes,
+		       (count_layers + 1) * sizeof(*planes));
+		goto found;
+	}
+
+	budget = DRM_SOLVER_MAX_TESTS;
+
+	for (composited = 0; composited <= count_layers; composited++) {
+		if (composited && !composition)
+			break;
+
+		/*
+		 * Out of tests, so skip to composing all layers, which takes
+		 * at most one test per plane.
+		 */
+		if (budget <= 0) {
+			exhausted = true;
+			if (!composition)
+				break;
+			composited = count_layers;
+			budget = solver->count_planes + 1;
+		}
+
+		count_config = 0;
+		if (composited)
+			config[count_config++] = composition;
+		for (i = composited; i < count_layers; i++)
+			config[count_config++] = order[i];
+
+		if (count_config > solver->count_planes)
+			continue;
+
+		if (count_config &&
+		    !drmSolverSearch(solver, req, flags, config, config_planes,
+				     count_config, 0, &budget)) {
+			if (budget <= 0)
+				exhausted = true;
+			continue;
+		}
+
+		j = 0;
+		planes[count_layers] = composited ? config_planes[j++] : -1;
+		for (i = 0; i < count_layers; i++)
+			planes[i] = i < composited ? -1 : config_planes[j++];
+
+		if (!exhausted)
+			drmSolverRemember(solver, keys, count_layers + 1, hash,
+					  composited, planes);
+		goto found;
+	}
+
+	/* remember failures too, they are just as expensive to find */
+	if (!exhausted) {
+		for (i = 0; i <= count_layers; i++)
+			planes[i] = -1;
+		drmSolverRemember(solver, keys, count_layers + 1, hash,
+				  count_layers + 1, planes);
+	}
+	goto out;
+
+found:
+	count_config = 0;
+	if (composited) {
+		config[count_config] = composition;
+		config_planes[count_config++] = planes[count_layers];
+	}
+
+	for (i = 0; i < count_layers; i++) {
+		if (planes[i] < 0) {
+			order[i]->plane_id = 0;
+			continue;
+		}
+
+		order[i]->plane_id = solver->planes[planes[i]].id;
+		config[count_config] = order[i];
+		config_planes[count_config++] = planes[i];
+	}
+
+	if (composition)
+		composition->plane_id = composited ?
+			solver->planes[planes[count_layers]].id : 0;
+
+	ret = drmSolverAddLayers(solver, req, config, config_planes,
+				 count_config);
+	if (!ret)
+		ret = composited;
+
+out:
+	drmFree(planes);
+	drmFree(keys);
+	drmFree(order);
+	return ret;
+}
+
+drm_public void drmModePlaneSolverGetStats(drmModePlaneSolverPtr solver,
+					   drmModePlaneSolverStatsPtr stats)
+{
+	if (!solver || !stats)
+		return;
+
+	*stats = solver->stats;
+}
+
+drm_public drmModeLutPtr drmModeLutCreate(uint32_t size)
+{
+	drmModeLutPtr lut;
+
+	if (size < 2 || size > (1 << 20))
+		return NULL;
+
+	lut = drmMalloc(sizeof(*lut) + 3 * size * sizeof(uint16_t));
+	if (!lut)
+		return NULL;
+
+	lut->size = size;
+	lut->red = (uint16_t *)(lut + 1);
+	lut->green = lut->red + size;
+	lut->blue = lut->green + size;
+
+	return lut;
+}
+
+drm_public void drmModeLutFree(drmModeLutPtr lut)
+{
+	drmFree(lut);
+}
+
+static double drmLutCurve(drmModeLutCurve curve, double param, double x)
+{
+	/* SMPTE ST 2084 */
+	const double m1 = 2610.0 / 16384, m2 = 2523.0 / 4096 * 128;
+	const double c1 = 3424.0 / 4096, c2 = 2413.0 / 4096 * 32;
+	const double c3 = 2392.0 / 4096 * 32;
+	/* ARIB STD-B67 */
+	const double a = 0.17883277, b = 0.28466892, c = 0.55991073;
+	double p;
+
+	switch (curve) {
+	case DRM_MODE_LUT_LINEAR:
+		return x;
+	case DRM_MODE_LUT_POWER:
+		return pow(x, param);
+	case DRM_MODE_LUT_SRGB_EOTF:
+		return x <= 0.04045 ? x / 12.92 : pow((x + 0.055) / 1.055, 2.4);
+	case DRM_MODE_LUT_SRGB_INV_EOTF:
+		return x <= 0.0031308 ? x * 12.92 :
+			1.055 * pow(x, 1 / 2.4) - 0.055;
+	case DRM_MODE_LUT_PQ_EOTF:
+		p = pow(x, 1 / m2);
+		return pow(fmax(p - c1, 0) / (c2 - c3 * p), 1 / m1);
+	case DRM_MODE_LUT_PQ_INV_EOTF:
+		p = pow(x, m1);
+		return pow((c1 + c2 * p) / (1 + c3 * p), m2);
+	case DRM_MODE_LUT_HLG_OETF:
+		return x <= 1.0 / 12 ? sqrt(3 * x) : a * log(12 * x - b) + c;
+	case DRM_MODE_LUT_HLG_INV_OETF:
+		return x <= 0.5 ? x * x / 3 : (exp((x - c) / a) + b) / 12;
+	}
+
+	return x;
+}
+
+drm_public int drmModeLutFillCurve(drmModeLutPtr lut, drmModeLutCurve curve,
+				   double param)
 {
-	if (!req)
-		return -EINVAL;
+	uint32_t i, last;
+	double y;
 
-	if (object_id == 0 || property_id == 0)
+	if (!lut || curve > DRM_MODE_LUT_HLG_INV_OETF ||
+	    (curve == DRM_MODE_LUT_POWER && !(param > 0)))
 		return -EINVAL;
 
-	if (req->cursor >= req->size_items) {
-		drmModeAtomicReqItemPtr new;
+	last = lut->size - 1;
 
-		req->size_items += 16;
-		new = realloc(req->items, req->size_items * sizeof(*req->items));
-		if (!new) {
-			req->size_items -= 16;
-			return -ENOMEM;
-		}
-		req->items = new;
+	for (i = 0; i < lut->size; i++) {
+		y = drmLutCurve(curve, param, (double)i / last);
+		lut->red[i] = lrint(fmin(fmax(y, 0), 1) * 0xffff);
 	}
 
-	req->items[req->cursor].object_id = object_id;
-	req->items[req->cursor].property_id = property_id;
-	req->items[req->cursor].value = value;
-	req->cursor++;
-
-	return req->cursor;
-}
-
-drm_public void drmModeAtomicFree(drmModeAtomicReqPtr req)
-{
-	if (!req)
-		return;
+	memcpy(lut->green, lut->red, lut->size * sizeof(uint16_t));
+	memcpy(lut->blue, lut->red, lut->size * sizeof(uint16_t));
 
-	if (req->items)
-		drmFree(req->items);
-	drmFree(req);
+	return 0;
 }
 
-static int sort_req_list(const void *misc, const void *other)
+/* Scales a channel by factor / 65536, in a loop the compiler vectorizes */
+static void drmLutScale(uint16_t *restrict channel, uint32_t size,
+			uint32_t factor)
 {
-	const drmModeAtomicReqItem *first = misc;
-	const drmModeAtomicReqItem *second = other;
+	uint32_t i;
 
-	if (first->object_id < second->object_id)
-		return -1;
-	else if (first->object_id > second->object_id)
-		return 1;
-	else
-		return second->property_id - first->property_id;
+	for (i = 0; i < size; i++)
+		channel[i] = (channel[i] * factor + 0x8000) >> 16;
 }
 
-drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
-                                   uint32_t flags, void *user_data)
+/*
+ * Tints the LUT towards the white point of a black body at the given
+ * temperature, normalized so that the brightest channel is unchanged.
+ * Uses Tanner Helland's fit of the black body colours, which is plenty
+ * for night light style adjustments between 1000 K and 40000 K.
+ */
+drm_public int drmModeLutTint(drmModeLutPtr lut, unsigned int kelvin)
 {
-	drmModeAtomicReqPtr sorted;
-	struct drm_mode_atomic atomic;
-	uint32_t *objs_ptr = NULL;
-	uint32_t *count_props_ptr = NULL;
-	uint32_t *props_ptr = NULL;
-	uint64_t *prop_values_ptr = NULL;
-	uint32_t last_obj_id = 0;
-	uint32_t i;
-	int obj_idx = -1;
-	int ret = -1;
+	double t, r, g, b, max;
 
-	if (!req)
+	if (!lut || kelvin < 1000 || kelvin > 40000)
 		return -EINVAL;
 
-	if (req->cursor == 0)
-		return 0;
+	t = kelvin / 100.0;
 
-	sorted = drmModeAtomicDuplicate(req);
-	if (sorted == NULL)
-		return -ENOMEM;
+	if (t <= 66) {
+		r = 255;
+		g = 99.4708025861 * log(t) - 161.1195681661;
+	} else {
+		r = 329.698727446 * pow(t - 60, -0.1332047592);
+		g = 288.1221695283 * pow(t - 60, -0.0755148492);
+	}
 
-	memclear(atomic);
+	if (t >= 66)
+		b = 255;
+	else if (t <= 19)
+		b = 0;
+	else
+		b = 138.5177312231 * log(t - 10) - 305.0447927307;
 
-	/* Sort the list by object ID, then by property ID. */
-	qsort(sorted->items, sorted->cursor, sizeof(*sorted->items),
-	      sort_req_list);
+	r = fmin(fmax(r, 0), 255);
+	g = fmin(fmax(g, 0), 255);
+	b = fmin(fmax(b, 0), 255);
+	max = fmax(r, fmax(g, b));
 
-	/* Now the list is sorted, eliminate duplicate property sets. */
-	for (i = 0; i < sorted->cursor; i++) {
-		if (sorted->items[i].object_id != last_obj_id) {
-			atomic.count_objs++;
-			last_obj_id = sorted->items[i].object_id;
-		}
+	drmLutScale(lut->red, lut->size, lrint(r / max * 65536));
+	drmLutScale(lut->green, lut->size, lrint(g / max * 65536));
+	drmLutScale(lut->blue, lut->size, lrint(b / max * 65536));
 
-		if (i == sorted->cursor - 1)
-			continue;
+	return 0;
+}
 
-		if (sorted->items[i].object_id != sorted->items[i + 1].object_id ||
-		    sorted->items[i].property_id != sorted->items[i + 1].property_id)
-			continue;
+static void drmLutLerp(uint16_t *restrict dst, const uint16_t *restrict from,
+		       const uint16_t *restrict to, uint32_t size,
+		       uint32_t weight)
+{
+	uint32_t i;
 
-		memmove(&sorted->items[i], &sorted->items[i + 1],
-			(sorted->cursor - i - 1) * sizeof(*sorted->items));
-		sorted->cursor--;
-	}
+	/* at most 0xffff * 0x10000, so this fits in 32 bits */
+	for (i = 0; i < size; i++)
+		dst[i] = (from[i] * (0x10000 - weight) + to[i] * weight +
+			  0x8000) >> 16;
+}
 
-	objs_ptr = drmMalloc(atomic.count_objs * sizeof objs_ptr[0]);
-	if (!objs_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+/* weight goes from 0 (from) to 65536 (to) */
+drm_public int drmModeLutInterpolate(drmModeLutPtr lut, const drmModeLut *from,
+				     const drmModeLut *to, uint32_t weight)
+{
+	if (!lut || !from || !to || weight > 0x10000 ||
+	    lut->size != from->size || lut->size != to->size)
+		return -EINVAL;
 
-	count_props_ptr = drmMalloc(atomic.count_objs * sizeof count_props_ptr[0]);
-	if (!count_props_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+	drmLutLerp(lut->red, from->red, to->red, lut->size, weight);
+	drmLutLerp(lut->green, from->green, to->green, lut->size, weight);
+	drmLutLerp(lut->blue, from->blue, to->blue, lut->size, weight);
 
-	props_ptr = drmMalloc(sorted->cursor * sizeof props_ptr[0]);
-	if (!props_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+	return 0;
+}
 
-	prop_values_ptr = drmMalloc(sorted->cursor * sizeof prop_values_ptr[0]);
-	if (!prop_values_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+drm_public int drmModeLutSetGamma(int fd, uint32_t crtc_id,
+				  const drmModeLut *lut)
+{
+	if (!lut)
+		return -EINVAL;
 
-	for (i = 0, last_obj_id = 0; i < sorted->cursor; i++) {
-		if (sorted->items[i].object_id != last_obj_id) {
-			obj_idx++;
-			objs_ptr[obj_idx] = sorted->items[i].object_id;
-			last_obj_id = objs_ptr[obj_idx];
-		}
+	return drmModeCrtcSetGamma(fd, crtc_id, lut->size, lut->red,
+				   lut->green, lut->blue);
+}
 
-		count_props_ptr[obj_idx]++;
-		props_ptr[i] = sorted->items[i].property_id;
-		prop_values_ptr[i] = sorted->items[i].value;
+static void drmLutPack(struct drm_color_lut *restrict dst,
+		       const drmModeLut *lut)
+{
+	uint32_t i;
 
+	for (i = 0; i < lut->size; i++) {
+		dst[i].red = lut->red[i];
+		dst[i].green = lut->green[i];
+		dst[i].blue = lut->blue[i];
+		dst[i].reserved = 0;
 	}
+}
 
-	atomic.flags = flags;
-	atomic.objs_ptr = VOID2U64(objs_ptr);
-	atomic.count_props_ptr = VOID2U64(count_props_ptr);
-	atomic.props_ptr = VOID2U64(props_ptr);
-	atomic.prop_values_ptr = VOID2U64(prop_values_ptr);
-	atomic.user_data = VOID2U64(user_data);
+drm_public int drmModeLutCreateBlob(int fd, const drmModeLut *lut,
+				    uint32_t *blob_id)
+{
+	struct drm_color_lut *data;
+	int ret;
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+	if (!lut || !blob_id)
+		return -EINVAL;
 
-out:
-	drmFree(objs_ptr);
-	drmFree(count_props_ptr);
-	drmFree(props_ptr);
-	drmFree(prop_values_ptr);
-	drmModeAtomicFree(sorted);
+	data = drmMalloc(lut->size * sizeof(*data));
+	if (!data)
+		return -ENOMEM;
+
+	drmLutPack(data, lut);
+	ret = drmModeCreatePropertyBlob(fd, data, lut->size * sizeof(*data),
+					blob_id);
+	drmFree(data);
 
 	return ret;
 }
 
-drm_public int
-drmModeCreatePropertyBlob(int fd, const void *data, size_t length,
-                                     uint32_t *id)
+/* Identical LUTs share one blob, see drmModeBlobCacheAcquire() */
+drm_public int drmModeLutAcquireBlob(drmModeBlobCachePtr cache,
+				     const drmModeLut *lut, uint32_t *blob_id)
 {
-	struct drm_mode_create_blob create;
+	struct drm_color_lut *data;
 	int ret;
 
-	if (length >= 0xffffffff)
-		return -ERANGE;
-
-	memclear(create);
+	if (!cache || !lut || !blob_id)
+		return -EINVAL;
 
-	create.length = length;
-	create.data = (uintptr_t) data;
-	create.blob_id = 0;
-	*id = 0;
+	data = drmMalloc(lut->size * sizeof(*data));
+	if (!data)
+		return -ENOMEM;
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATEPROPBLOB, &create);
-	if (ret != 0)
-		return ret;
+	drmLutPack(data, lut);
+	ret = drmModeBlobCacheAcquire(cache, data, lut->size * sizeof(*data),
+				      blob_id);
+	drmFree(data);
 
-	*id = create.blob_id;
-	return 0;
+	return ret;
 }
 
-drm_public int
-drmModeDestroyPropertyBlob(int fd, uint32_t id)
+/* matrix is row-major and converted to S31.32 sign-magnitude */
+drm_public int drmModeCtmAcquireBlob(drmModeBlobCachePtr cache,
+				     const double matrix[9], uint32_t *blob_id)
 {
-	struct drm_mode_destroy_blob destroy;
+	struct drm_color_ctm ctm;
+	double v;
+	int i;
 
-	memclear(destroy);
-	destroy.blob_id = id;
-	return DRM_IOCTL(fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &destroy);
+	if (!cache || !matrix || !blob_id)
+		return -EINVAL;
+
+	for (i = 0; i < 9; i++) {
+		v = fmin(fabs(matrix[i]), (double)INT32_MAX);
+		ctm.matrix[i] = (uint64_t)llrint(v * 4294967296.0);
+		if (matrix[i] < 0)
+			ctm.matrix[i] |= 1ull << 63;
+	}
+
+	return drmModeBlobCacheAcquire(cache, &ctm, sizeof(ctm), blob_id);
 }
 
-drm_public int
-drmModeCreateLease(int fd, const uint32_t *objects, int num_objects, int flags,
-                   uint32_t *lessee_id)
+struct _drmModeLutTransition {
+	int fd;
+	uint32_t steps;
+	uint32_t step;		/* step the accumulators are at */
+	drmModeLutPtr from, to, lut;
+	uint32_t *acc;		/* 16.16, all three channels */
+	int32_t *delta;		/* per step */
+	uint32_t *blobs;	/* per step, 0 until created */
+	struct drm_color_lut *packed;
+};
+
+drm_public drmModeLutTransitionPtr
+drmModeLutTransitionCreate(int fd, const drmModeLut *from,
+			   const drmModeLut *to, uint32_t steps)
 {
-	struct drm_mode_create_lease create;
-	int ret;
+	drmModeLutTransitionPtr transition;
+	uint32_t i, count;
+	const uint16_t *f, *t;
 
-	memclear(create);
-	create.object_ids = (uintptr_t) objects;
-	create.object_count = num_objects;
-	create.flags = flags;
+	if (!from || !to || from->size != to->size || steps == 0)
+		return NULL;
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATE_LEASE, &create);
-	if (ret == 0) {
-		*lessee_id = create.lessee_id;
-		return create.fd;
+	transition = drmMalloc(sizeof(*transition));
+	if (!transition)
+		return NULL;
+
+	count = 3 * from->size;
+	transition->fd = fd;
+	transition->steps = steps;
+	transition->step = 0;
+	transition->from = drmModeLutCreate(from->size);
+	transition->to = drmModeLutCreate(from->size);
+	transition->lut = drmModeLutCreate(from->size);
+	transition->acc = drmMalloc(count * sizeof(uint32_t));
+	transition->delta = drmMalloc(count * sizeof(int32_t));
+	transition->blobs = drmMalloc((steps + 1) * sizeof(uint32_t));
+	transition->packed = drmMalloc(from->size *
+				       sizeof(struct drm_color_lut));
+
+	if (!transition->from || !transition->to || !transition->lut ||
+	    !transition->acc || !transition->delta || !transition->blobs ||
+	    !transition->packed) {
+		drmModeLutTransitionFree(transition);
+		return NULL;
 	}
-	return -errno;
+
+	memcpy(transition->from->red, from->red, from->size * 2);
+	memcpy(transition->from->green, from->green, from->size * 2);
+	memcpy(transition->from->blue, from->blue, from->size * 2);
+	memcpy(transition->to->red, to->red, to->size * 2);
+	memcpy(transition->to->green, to->green, to->size * 2);
+	memcpy(transition->to->blue, to->blue, to->size * 2);
+
+	/* our copies keep the channels contiguous, so one loop covers all */
+	f = transition->from->red;
+	t = transition->to->red;
+
+	/* |delta| < 2^31 with two or more steps, a single step is just 'to' */
+	for (i = 0; i < count; i++) {
+		transition->acc[i] = (uint32_t)f[i] << 16 | 0x8000;
+		transition->delta[i] = steps > 1 ?
+			(int64_t)(t[i] - f[i]) * 65536 / steps : 0;
+	}
+
+	return transition;
 }
 
-drm_public drmModeLesseeListPtr
-drmModeListLessees(int fd)
+drm_public void drmModeLutTransitionFree(drmModeLutTransitionPtr transition)
 {
-	struct drm_mode_list_lessees list;
-	uint32_t count;
-	drmModeLesseeListPtr ret;
+	uint32_t i;
 
-	memclear(list);
+	if (!transition)
+		return;
 
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list))
-		return NULL;
+	if (transition->blobs) {
+		for (i = 0; i <= transition->steps; i++)
+			if (transition->blobs[i])
+				drmModeDestroyPropertyBlob(transition->fd,
+							   transition->blobs[i]);
+	}
 
-	count = list.count_lessees;
-	ret = drmMalloc(sizeof (drmModeLesseeListRes) + count * sizeof (ret->lessees[0]));
-	if (!ret)
-		return NULL;
+	drmModeLutFree(transition->from);
+	drmModeLutFree(transition->to);
+	drmModeLutFree(transition->lut);
+	drmFree(transition->acc);
+	drmFree(transition->delta);
+	drmFree(transition->blobs);
+	drmFree(transition->packed);
+	drmFree(transition);
+}
 
-	list.lessees_ptr = VOID2U64(&ret->lessees[0]);
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list)) {
-		drmFree(ret);
-		return NULL;
+static void drmLutTransitionSeek(drmModeLutTransitionPtr transition,
+				 uint32_t step)
+{
+	uint32_t *restrict acc = transition->acc;
+	const int32_t *restrict delta = transition->delta;
+	const uint16_t *from = transition->from->red;
+	uint32_t i, count = 3 * transition->from->size;
+
+	if (step == transition->step + 1) {
+		for (i = 0; i < count; i++)
+			acc[i] += delta[i];
+	} else if (step != transition->step) {
+		for (i = 0; i < count; i++)
+			acc[i] = ((uint32_t)from[i] << 16 | 0x8000) +
+				 (uint32_t)delta[i] * step;
 	}
 
-	ret->count = count;
-	return ret;
+	transition->step = step;
 }
 
-drm_public drmModeObjectListPtr
-drmModeGetLease(int fd)
+drm_public int drmModeLutTransitionGetLut(drmModeLutTransitionPtr transition,
+					  uint32_t step, drmModeLutPtr lut)
 {
-	struct drm_mode_get_lease get;
-	uint32_t count;
-	drmModeObjectListPtr ret;
+	uint32_t i, count;
+	const drmModeLut *end = NULL;
 
-	memclear(get);
+	if (!transition || !lut || lut->size != transition->from->size ||
+	    step > transition->steps)
+		return -EINVAL;
 
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get))
-		return NULL;
+	if (step == 0)
+		end = transition->from;
+	else if (step == transition->steps)
+		end = transition->to;
 
-	count = get.count_objects;
-	ret = drmMalloc(sizeof (drmModeObjectListRes) + count * sizeof (ret->objects[0]));
-	if (!ret)
-		return NULL;
+	if (end) {
+		memcpy(lut->red, end->red, lut->size * 2);
+		memcpy(lut->green, end->green, lut->size * 2);
+		memcpy(lut->blue, end->blue, lut->size * 2);
+		return 0;
+	}
 
-	get.objects_ptr = VOID2U64(&ret->objects[0]);
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get)) {
-		drmFree(ret);
-		return NULL;
+	drmLutTransitionSeek(transition, step);
+
+	count = lut->size;
+	for (i = 0; i < count; i++) {
+		lut->red[i] = transition->acc[i] >> 16;
+		lut->green[i] = transition->acc[count + i] >> 16;
+		lut->blue[i] = transition->acc[2 * count + i] >> 16;
 	}
 
-	ret->count = count;
-	return ret;
+	return 0;
 }
 
-drm_public int
-drmModeRevokeLease(int fd, uint32_t lessee_id)
+drm_public int drmModeLutTransitionGetBlob(drmModeLutTransitionPtr transition,
+					   uint32_t step, uint32_t *blob_id)
 {
-	struct drm_mode_revoke_lease revoke;
+	drmModeLutPtr lut;
 	int ret;
 
-	memclear(revoke);
+	if (!transition || !blob_id || step > transition->steps)
+		return -EINVAL;
 
-	revoke.lessee_id = lessee_id;
+	if (!transition->blobs[step]) {
+		lut = transition->lut;
+
+		ret = drmModeLutTransitionGetLut(transition, step, lut);
+		if (ret)
+			return ret;
+
+		drmLutPack(transition->packed, lut);
+		ret = drmModeCreatePropertyBlob(transition->fd,
+						transition->packed,
+						lut->size *
+						sizeof(struct drm_color_lut),
+						&transition->blobs[step]);
+		if (ret)
+			return ret;
+	}
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_REVOKE_LEASE, &revoke);
-	if (ret == 0)
-		return 0;
-	return -errno;
+	*blob_id = transition->blobs[step];
+
+	return 0;
 }
@@ -498,10 +498,132 @@ extern int drmModeObjectSetProperty(int fd, uint32_t object_id,
 				    uint32_t object_type, uint32_t property_id,
 				    uint64_t value);
 
+/*
+ * Index of the (format, modifier) pairs a plane supports, built from its
+ * IN_FORMATS blob, so that checking a pair does not require parsing the
+ * blob again.
+ */
+typedef struct _drmModeFormatIndex drmModeFormatIndex, *drmModeFormatIndexPtr;
+
+extern drmModeFormatIndexPtr drmModeFormatIndexCreate(const void *data,
+						      size_t length);
+extern drmModeFormatIndexPtr drmModeGetPlaneFormatIndex(int fd,
+							uint32_t plane_id);
+extern void drmModeFreeFormatIndex(drmModeFormatIndexPtr index);
+extern int drmModeFormatIndexHasFormat(drmModeFormatIndexPtr index,
+				       uint32_t format);
+extern int drmModeFormatIndexSupports(drmModeFormatIndexPtr index,
+				      uint32_t format, uint64_t modifier);
+extern int drmModeFormatIndexGetModifiers(drmModeFormatIndexPtr index,
+					  uint32_t format,
+					  uint64_t *modifiers, int max);
+
+/*
+ * Snapshot of all CRTCs, connectors, encoders and planes, along with the
+ * property values of the CRTCs and planes, stored in a single allocation
+ * freed by drmModeFreeStateSnapshot().  Connectors are not probed unless
+ * DRM_MODE_SNAPSHOT_PROBE is passed.
+ */
+#define DRM_MODE_SNAPSHOT_PROBE (1 << 0)
+
+typedef struct _drmModeStateSnapshot {
+	uint32_t min_width, max_width;
+	uint32_t min_height, max_height;
+
+	int count_crtcs;
+	drmModeCrtcPtr crtcs;
+	drmModeObjectPropertiesPtr crtc_props; /* one per CRTC */
+
+	int count_connectors;
+	drmModeConnectorPtr connectors;
+
+	int count_encoders;
+	drmModeEncoderPtr encoders;
+
+	int count_planes;
+	drmModePlanePtr planes;
+	drmModeObjectPropertiesPtr plane_props; /* one per plane */
+} drmModeStateSnapshot, *drmModeStateSnapshotPtr;
+
+extern drmModeStateSnapshotPtr drmModeGetStateSnapshot(int fd, uint32_t flags);
+extern drmModeStateSnapshotPtr drmModeRefreshStateSnapshot(int fd,
+							   drmModeStateSnapshotPtr old,
+							   uint32_t flags);
+extern void drmModeFreeStateSnapshot(drmModeStateSnapshotPtr snapshot);
+
+/*
+ * Property metadata cache.  Maps (object, property name) to the property
+ * without any ioctl after the first lookup of an object.  Safe to share
+ * between threads.  libdrm does not see hotplug events, so callers must
+ * call drmModePropertyCacheInvalidate() when they get one; lease changes
+ * made through drmModeCreateLease()/drmModeRevokeLease() invalidate it for
+ * the fd automatically.  Returned properties stay valid until the cache is
+ * destroyed.
+ */
+typedef struct _drmModePropertyCache drmModePropertyCache, *drmModePropertyCachePtr;
+
+extern drmModePropertyCachePtr drmModePropertyCacheCreate(int fd);
+extern void drmModePropertyCacheDestroy(drmModePropertyCachePtr cache);
+extern void drmModePropertyCacheInvalidate(drmModePropertyCachePtr cache);
+extern const drmModePropertyRes *drmModePropertyCacheGet(drmModePropertyCachePtr cache,
+							 uint32_t object_id,
+							 uint32_t object_type,
+							 const char *name);
+extern uint32_t drmModePropertyCacheGetId(drmModePropertyCachePtr cache,
+					  uint32_t object_id,
+					  uint32_t object_type,
+					  const char *name);
+
+/*
+ * Framebuffer cache.  Returns the same framebuffer for repeated requests
+ * with the same buffer layout instead of creating a new one each time.
+ * The cache owns its framebuffers: the least recently used ones are
+ * removed once it holds more than max_entries.  Framebuffers pinned with
+ * drmModeFBCachePin() are skipped, so pin the ones that are on screen.
+ * drmModeFBCacheEvictHandle() must be called before a GEM handle used by
+ * the cache is closed.
+ */
+typedef struct _drmModeFBCache drmModeFBCache, *drmModeFBCachePtr;
+
+typedef struct _drmModeFBCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} drmModeFBCacheStats, *drmModeFBCacheStatsPtr;
+
+extern drmModeFBCachePtr drmModeFBCacheCreate(int fd, uint32_t max_entries);
+extern void drmModeFBCacheDestroy(drmModeFBCachePtr cache);
+extern int drmModeFBCacheGetFB(drmModeFBCachePtr cache, uint32_t width,
+			       uint32_t height, uint32_t pixel_format,
+			       const uint32_t bo_handles[4],
+			       const uint32_t pitches[4],
+			       const uint32_t offsets[4],
+			       const uint64_t modifier[4], uint32_t *buf_id,
+			       uint32_t flags);
+extern int drmModeFBCachePin(drmModeFBCachePtr cache, uint32_t buf_id);
+extern void drmModeFBCacheUnpin(drmModeFBCachePtr cache, uint32_t buf_id);
+extern void drmModeFBCacheEvictHandle(drmModeFBCachePtr cache,
+				      uint32_t bo_handle);
+extern void drmModeFBCacheGetStats(drmModeFBCachePtr cache,
+				   drmModeFBCacheStatsPtr stats);
 
 typedef struct _drmModeAtomicReq drmModeAtomicReq, *drmModeAtomicReqPtr;
 
 extern drmModeAtomicReqPtr drmModeAtomicAlloc(void);
+/*
+ * Sorted requests keep their properties sorted and deduplicated as they are
+ * added, with the last value set for a property winning, and reuse their
+ * storage across drmModeAtomicCommit() calls.  drmModeAtomicSetCursor() can
+ * only move the cursor backwards on them.
+ *
+ * On a sorted request, drmModeAtomicGetCursor() returns the number of
+ * drmModeAtomicAddProperty() calls since the request was last reset to 0,
+ * not the number of properties in it.  Only the calls since the last
+ * successful commit without DRM_MODE_ATOMIC_TEST_ONLY can be undone: a
+ * cursor saved before that commit restores the committed state, and 0
+ * still empties the request.
+ */
+extern drmModeAtomicReqPtr drmModeAtomicAllocSorted(void);
 extern drmModeAtomicReqPtr drmModeAtomicDuplicate(drmModeAtomicReqPtr req);
 extern int drmModeAtomicMerge(drmModeAtomicReqPtr base,
 			      drmModeAtomicReqPtr augment);
@@ -521,6 +643,30 @@ extern int drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
 				     uint32_t *id);
 extern int drmModeDestroyPropertyBlob(int fd, uint32_t id);
 
+/*
+ * Property blob cache.  Identical contents share a single blob, which is
+ * reference counted and destroyed lazily after the last reference is
+ * dropped, so per-frame modes, LUTs and HDR metadata do not create new
+ * blobs when they do not change.
+ */
+typedef struct _drmModeBlobCache drmModeBlobCache, *drmModeBlobCachePtr;
+
+typedef struct _drmModeBlobCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t destroyed;
+} drmModeBlobCacheStats, *drmModeBlobCacheStatsPtr;
+
+extern drmModeBlobCachePtr drmModeBlobCacheCreate(int fd);
+extern void drmModeBlobCacheDestroy(drmModeBlobCachePtr cache);
+extern int drmModeBlobCacheAcquire(drmModeBlobCachePtr cache,
+				   const void *data, size_t size,
+				   uint32_t *id);
+extern void drmModeBlobCacheRelease(drmModeBlobCachePtr cache, uint32_t id);
+extern void drmModeBlobCacheTrim(drmModeBlobCachePtr cache);
+extern void drmModeBlobCacheGetStats(drmModeBlobCachePtr cache,
+				     drmModeBlobCacheStatsPtr stats);
+
 /*
  * DRM mode lease APIs. These create and manage new drm_masters with
  * access to a subset of the available DRM resources
@@ -544,6 +690,137 @@ extern drmModeObjectListPtr drmModeGetLease(int fd);
 
 extern int drmModeRevokeLease(int fd, uint32_t lessee_id);
 
+/*
+ * Plane assignment solver.  Chooses the planes of a CRTC for a set of
+ * layers with TEST_ONLY commits, and remembers the outcome for each layer
+ * configuration so that it is only searched for once.  The framebuffers
+ * are not part of the configuration, so layers can flip without a new
+ * search.
+ */
+typedef struct _drmModePlaneSolver drmModePlaneSolver, *drmModePlaneSolverPtr;
+
+typedef struct _drmModePlaneLayer {
+	uint32_t fb_id;
+	uint32_t format;
+	uint64_t modifier;	/* DRM_FORMAT_MOD_INVALID for implicit */
+	uint32_t src_x, src_y, src_w, src_h;	/* 16.16 fixed point */
+	int32_t crtc_x, crtc_y;
+	uint32_t crtc_w, crtc_h;
+	uint32_t zpos;
+	uint32_t plane_id;	/* set by the solver, 0 if composited */
+} drmModePlaneLayer, *drmModePlaneLayerPtr;
+
+typedef struct _drmModePlaneSolverStats {
+	uint64_t solves;
+	uint64_t hits;		/* solves answered without any test commit */
+	uint64_t tests;		/* TEST_ONLY commits */
+} drmModePlaneSolverStats, *drmModePlaneSolverStatsPtr;
+
+extern drmModePlaneSolverPtr drmModePlaneSolverCreate(int fd, uint32_t crtc_id);
+extern void drmModePlaneSolverDestroy(drmModePlaneSolverPtr solver);
+extern void drmModePlaneSolverInvalidate(drmModePlaneSolverPtr solver);
+extern int drmModePlaneSolverAssign(drmModePlaneSolverPtr solver,
+				    drmModeAtomicReqPtr req,
+				    drmModePlaneLayerPtr layers,
+				    uint32_t count_layers,
+				    drmModePlaneLayerPtr composition,
+				    uint32_t flags);
+extern void drmModePlaneSolverGetStats(drmModePlaneSolverPtr solver,
+				       drmModePlaneSolverStatsPtr stats);
+
+/*
+ * Frame pacing.  Tracks the vblank period and phase of a CRTC from the
+ * vblanks it is fed, predicts the next vblanks and tells how late
+ * rendering of a frame can start to still make a given vblank.  All times
+ * are CLOCK_MONOTONIC nanoseconds, as in CRTC_SEQUENCE events.
+ */
+typedef struct _drmModeFramePacer drmModeFramePacer, *drmModeFramePacerPtr;
+
+typedef struct _drmModeFramePacerStats {
+	uint64_t period_ns;	/* shortest period with VRR */
+	uint64_t jitter_ns;	/* average deviation from the period */
+	uint64_t vblanks;
+	uint64_t frames;
+	uint64_t missed;	/* frames presented after their target vblank */
+	uint64_t max_missed_vblanks;
+	int vrr;
+} drmModeFramePacerStats, *drmModeFramePacerStatsPtr;
+
+extern drmModeFramePacerPtr drmModeFramePacerCreate(int fd, uint32_t crtc_id);
+extern void drmModeFramePacerDestroy(drmModeFramePacerPtr pacer);
+extern void drmModeFramePacerSetVrr(drmModeFramePacerPtr pacer, int vrr);
+extern void drmModeFramePacerAddVblank(drmModeFramePacerPtr pacer,
+				       uint64_t sequence, uint64_t ns);
+extern int drmModeFramePacerSample(drmModeFramePacerPtr pacer);
+extern int drmModeFramePacerPredict(drmModeFramePacerPtr pacer,
+				    uint64_t *sequences, uint64_t *times,
+				    uint32_t count);
+extern int drmModeFramePacerGetRenderStart(drmModeFramePacerPtr pacer,
+					   uint64_t latency_ns,
+					   uint64_t *start_ns,
+					   uint64_t *sequence);
+extern void drmModeFramePacerPresented(drmModeFramePacerPtr pacer,
+				       uint64_t target, uint64_t sequence);
+extern void drmModeFramePacerGetStats(drmModeFramePacerPtr pacer,
+				      drmModeFramePacerStatsPtr stats);
+
+/*
+ * Colour LUTs.  Entries are U0.16 and stored one array per channel, as
+ * drmModeCrtcSetGamma() takes them; drmModeLutCreateBlob() packs them into
+ * the struct drm_color_lut layout of the GAMMA_LUT and DEGAMMA_LUT
+ * properties.
+ */
+typedef enum {
+	DRM_MODE_LUT_LINEAR,
+	DRM_MODE_LUT_POWER,		/* x^param */
+	DRM_MODE_LUT_SRGB_EOTF,		/* sRGB encoded to linear */
+	DRM_MODE_LUT_SRGB_INV_EOTF,	/* linear to sRGB encoded */
+	DRM_MODE_LUT_PQ_EOTF,		/* SMPTE ST 2084 to linear */
+	DRM_MODE_LUT_PQ_INV_EOTF,
+	DRM_MODE_LUT_HLG_OETF,		/* linear to ARIB STD-B67 */
+	DRM_MODE_LUT_HLG_INV_OETF,
+} drmModeLutCurve;
+
+typedef struct _drmModeLut {
+	uint32_t size;
+	uint16_t *red;
+	uint16_t *green;
+	uint16_t *blue;
+} drmModeLut, *drmModeLutPtr;
+
+extern drmModeLutPtr drmModeLutCreate(uint32_t size);
+extern void drmModeLutFree(drmModeLutPtr lut);
+extern int drmModeLutFillCurve(drmModeLutPtr lut, drmModeLutCurve curve,
+			       double param);
+extern int drmModeLutTint(drmModeLutPtr lut, unsigned int kelvin);
+extern int drmModeLutInterpolate(drmModeLutPtr lut, const drmModeLut *from,
+				 const drmModeLut *to, uint32_t weight);
+extern int drmModeLutSetGamma(int fd, uint32_t crtc_id,
+			      const drmModeLut *lut);
+extern int drmModeLutCreateBlob(int fd, const drmModeLut *lut,
+				uint32_t *blob_id);
+extern int drmModeLutAcquireBlob(drmModeBlobCachePtr cache,
+				 const drmModeLut *lut, uint32_t *blob_id);
+extern int drmModeCtmAcquireBlob(drmModeBlobCachePtr cache,
+				 const double matrix[9], uint32_t *blob_id);
+
+/*
+ * Animated transition between two LUTs over a fixed number of steps.
+ * Consecutive steps are computed incrementally, and the blob created for
+ * each step is kept, so replaying a transition costs no blob creation.
+ */
+typedef struct _drmModeLutTransition drmModeLutTransition,
+	*drmModeLutTransitionPtr;
+
+extern drmModeLutTransitionPtr
+drmModeLutTransitionCreate(int fd, const drmModeLut *from,
+			   const drmModeLut *to, uint32_t steps);
+extern void drmModeLutTransitionFree(drmModeLutTransitionPtr transition);
+extern int drmModeLutTransitionGetLut(drmModeLutTransitionPtr transition,
+				      uint32_t step, drmModeLutPtr lut);
+extern int drmModeLutTransitionGetBlob(drmModeLutTransitionPtr transition,
+				       uint32_t step, uint32_t *blob_id);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -1,4 +1,4 @@
-/* xf86drmSL.c -- Skip list support
+/* xf86drmSL.c -- Ordered map support
  * Created: Mon May 10 09:28:13 1999 by faith@precisioninsight.com
  *
  * Copyright 1999 Precision Insight, Inc., Cedar Park, Texas.
@@ -27,12 +27,21 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward skip list implementation.n
+ * This file contains an ordered map implemented as a B+-tree [Comer79].
+ * The name and the drmSL prefix remain from the skip list [Pugh90] it
+ * replaced.
  *
- * FUTURE ENHANCEMENTS
+ * Each node holds up to SL_NODE_KEYS sorted keys in a single allocation,
+ * so a lookup walks a handful of nodes instead of one allocation per key.
+ * All values live in the leaves, which are chained in key order for
+ * iteration.  Branch key i is a lower bound of the keys in child i + 1 and
+ * greater than all keys in child i.
  *
  * REFERENCES
  *
+ * [Comer79] Douglas Comer.  The Ubiquitous B-Tree.  ACM Computing Surveys
+ * 11(2), June 1979, pp. 121-137.
+ *
  * [Pugh90] William Pugh.  Skip Lists: A Probabilistic Alternative to
  * Balanced Trees. CACM 33(6), June 1990, pp. 668-676.
  *
@@ -40,174 +49,389 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
 
 #define SL_LIST_MAGIC  0xfacade00LU
-#define SL_ENTRY_MAGIC 0x00fab1edLU
 #define SL_FREED_MAGIC 0xdecea5edLU
-#define SL_MAX_LEVEL   16
-#define SL_RANDOM_SEED 0xc01055a1LU
-
-#define SL_RANDOM_DECL        static void *state = NULL
-#define SL_RANDOM_INIT(seed)  if (!state) state = drmRandomCreate(seed)
-#define SL_RANDOM             drmRandom(state)
-
-typedef struct SLEntry {
-    unsigned long     magic;	   /* SL_ENTRY_MAGIC */
-    unsigned long     key;
-    void              *value;
-    int               levels;
-    struct SLEntry    *forward[1]; /* variable sized array */
-} SLEntry, *SLEntryPtr;
+#define SL_NODE_KEYS   32
+#define SL_NODE_MIN    (SL_NODE_KEYS / 2 - 1)
+
+typedef struct SLNode {
+    int               leaf;
+    int               count;
+    unsigned long     keys[SL_NODE_KEYS];
+} SLNode, *SLNodePtr;
+
+typedef struct SLLeaf {
+    SLNode            node;
+    void              *values[SL_NODE_KEYS];
+    struct SLLeaf     *next;
+} SLLeaf, *SLLeafPtr;
+
+typedef struct SLBranch {
+    SLNode            node;
+    SLNodePtr         children[SL_NODE_KEYS + 1];
+} SLBranch, *SLBranchPtr;
 
 typedef struct SkipList {
     unsigned long    magic;	/* SL_LIST_MAGIC */
-    int              level;
+    int              depth;	/* Number of branch levels */
     int              count;
-    SLEntryPtr       head;
-    SLEntryPtr       p0;	/* Position for iteration */
+    SLNodePtr        root;
+    unsigned long    stamp;	/* Bumped by every insertion and deletion */
+    SLLeafPtr        p0;	/* Position for iteration */
+    int              p1;
+    unsigned long    p_key;	/* Key returned last */
+    unsigned long    p_stamp;
 } SkipList, *SkipListPtr;
 
-static SLEntryPtr SLCreateEntry(int max_level, unsigned long key, void *value)
+#define SL_LEAF(n)   ((SLLeafPtr)(n))
+#define SL_BRANCH(n) ((SLBranchPtr)(n))
+
+/* Index of the first key >= key */
+static int SLLowerBound(SLNodePtr node, unsigned long key)
+{
+    int lo = 0, hi = node->count, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (node->keys[mid] < key) lo = mid + 1;
+	else                       hi = mid;
+    }
+    return lo;
+}
+
+/* Index of the child of a branch that may hold key */
+static int SLChild(SLNodePtr node, unsigned long key)
+{
+    int lo = 0, hi = node->count, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (node->keys[mid] <= key) lo = mid + 1;
+	else                        hi = mid;
+    }
+    return lo;
+}
+
+static SLNodePtr SLCreateNode(int leaf)
 {
-    SLEntryPtr entry;
-    
-    if (max_level < 0 || max_level > SL_MAX_LEVEL) max_level = SL_MAX_LEVEL;
-
-    entry         = drmMalloc(sizeof(*entry)
-			     + (max_level + 1) * sizeof(entry->forward[0]));
-    if (!entry) return NULL;
-    entry->magic  = SL_ENTRY_MAGIC;
-    entry->key    = key;
-    entry->value  = value;
-    entry->levels = max_level + 1;
-
-    return entry;
+    SLNodePtr node;
+
+    node = drmMalloc(leaf ? sizeof(SLLeaf) : sizeof(SLBranch));
+    if (!node) return NULL;
+    node->leaf = leaf;
+
+    return node;
 }
 
-static int SLRandomLevel(void)
+static void SLFreeNode(SLNodePtr node)
 {
-    int level = 1;
-    SL_RANDOM_DECL;
+    int i;
 
-    SL_RANDOM_INIT(SL_RANDOM_SEED);
-    
-    while ((SL_RANDOM & 0x01) && level < SL_MAX_LEVEL) ++level;
-    return level;
+    if (!node->leaf) {
+	for (i = 0; i <= node->count; i++)
+	    SLFreeNode(SL_BRANCH(node)->children[i]);
+    }
+    drmFree(node);
 }
 
 drm_public void *drmSLCreate(void)
 {
     SkipListPtr  list;
-    int          i;
 
     list           = drmMalloc(sizeof(*list));
     if (!list) return NULL;
     list->magic    = SL_LIST_MAGIC;
-    list->level    = 0;
-    list->head     = SLCreateEntry(SL_MAX_LEVEL, 0, NULL);
+    list->depth    = 0;
+    list->root     = SLCreateNode(1);
     list->count    = 0;
 
-    for (i = 0; i <= SL_MAX_LEVEL; i++) list->head->forward[i] = NULL;
-    
+    if (!list->root) {
+	drmFree(list);
+	return NULL;
+    }
+
     return list;
 }
 
 drm_public int drmSLDestroy(void *l)
 {
     SkipListPtr   list  = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    SLEntryPtr    next;
 
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    for (entry = list->head; entry; entry = next) {
-	if (entry->magic != SL_ENTRY_MAGIC) return -1; /* Bad magic */
-	next         = entry->forward[0];
-	entry->magic = SL_FREED_MAGIC;
-	drmFree(entry);
-    }
+    SLFreeNode(list->root);
 
     list->magic = SL_FREED_MAGIC;
     drmFree(list);
     return 0;
 }
 
-static SLEntryPtr SLLocate(void *l, unsigned long key, SLEntryPtr *update)
+static SLLeafPtr SLLocate(SkipListPtr list, unsigned long key)
 {
-    SkipListPtr   list  = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    int           i;
+    SLNodePtr node = list->root;
+
+    while (!node->leaf)
+	node = SL_BRANCH(node)->children[SLChild(node, key)];
 
-    if (list->magic != SL_LIST_MAGIC) return NULL;
+    return SL_LEAF(node);
+}
+
+/* Insert into a leaf that has room */
+static void SLLeafInsert(SLLeafPtr leaf, int pos, unsigned long key,
+			 void *value)
+{
+    int count = leaf->node.count;
+
+    memmove(&leaf->node.keys[pos + 1], &leaf->node.keys[pos],
+	    (count - pos) * sizeof(leaf->node.keys[0]));
+    memmove(&leaf->values[pos + 1], &leaf->values[pos],
+	    (count - pos) * sizeof(leaf->values[0]));
+    leaf->node.keys[pos] = key;
+    leaf->values[pos]    = value;
+    ++leaf->node.count;
+}
 
-    for (i = list->level, entry = list->head; i >= 0; i--) {
-	while (entry->forward[i] && entry->forward[i]->key < key)
-	    entry = entry->forward[i];
-	update[i] = entry;
+/*
+ * Split the full child i of parent, which has room for one more key.  The
+ * upper half of the child moves to a new node right of it.
+ */
+static int SLSplitChild(SLBranchPtr parent, int i)
+{
+    SLNodePtr     child = parent->children[i];
+    SLNodePtr     right;
+    unsigned long split_key;
+    int           half  = SL_NODE_KEYS / 2;
+
+    right = SLCreateNode(child->leaf);
+    if (!right) return -1;
+
+    if (child->leaf) {
+	right->count = SL_NODE_KEYS - half;
+	memcpy(right->keys, &child->keys[half],
+	       right->count * sizeof(child->keys[0]));
+	memcpy(SL_LEAF(right)->values, &SL_LEAF(child)->values[half],
+	       right->count * sizeof(SL_LEAF(child)->values[0]));
+	SL_LEAF(right)->next = SL_LEAF(child)->next;
+	SL_LEAF(child)->next = SL_LEAF(right);
+	split_key = right->keys[0];
+    } else {
+				/* The middle key moves up to the parent */
+	right->count = SL_NODE_KEYS - half - 1;
+	memcpy(right->keys, &child->keys[half + 1],
+	       right->count * sizeof(child->keys[0]));
+	memcpy(SL_BRANCH(right)->children, &SL_BRANCH(child)->children[half + 1],
+	       (right->count + 1) * sizeof(SL_BRANCH(child)->children[0]));
+	split_key = child->keys[half];
     }
+    child->count = half;
 
-    return entry->forward[0];
+    memmove(&parent->node.keys[i + 1], &parent->node.keys[i],
+	    (parent->node.count - i) * sizeof(parent->node.keys[0]));
+    memmove(&parent->children[i + 2], &parent->children[i + 1],
+	    (parent->node.count - i) * sizeof(parent->children[0]));
+    parent->node.keys[i]     = split_key;
+    parent->children[i + 1]  = right;
+    ++parent->node.count;
+
+    return 0;
 }
 
 drm_public int drmSLInsert(void *l, unsigned long key, void *value)
 {
     SkipListPtr   list  = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1];
-    int           level;
-    int           i;
+    SLBranchPtr   root;
+    SLNodePtr     node;
+    int           pos;
 
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    entry = SLLocate(list, key, update);
+    ++list->stamp;		/* Splits move keys even if key exists */
+
+				/* Full nodes are split on the way down, so
+				   that there always is room for the key
+				   moving up from a split */
+    if (list->root->count == SL_NODE_KEYS) {
+	root = SL_BRANCH(SLCreateNode(0));
+	if (!root) return -1;
+	root->children[0] = list->root;
+	if (SLSplitChild(root, 0)) {
+	    drmFree(root);
+	    return -1;
+	}
+	list->root = &root->node;
+	++list->depth;
+    }
+
+    for (node = list->root; !node->leaf;) {
+	pos = SLChild(node, key);
+	if (SL_BRANCH(node)->children[pos]->count == SL_NODE_KEYS) {
+	    if (SLSplitChild(SL_BRANCH(node), pos)) return -1;
+	    pos = SLChild(node, key);
+	}
+	node = SL_BRANCH(node)->children[pos];
+    }
+
+    pos = SLLowerBound(node, key);
+    if (pos < node->count && node->keys[pos] == key)
+	return 1;		/* Already in list */
 
-    if (entry && entry->key == key) return 1; /* Already in list */
+    SLLeafInsert(SL_LEAF(node), pos, key, value);
 
+    ++list->count;
+    return 0;			/* Added to table */
+}
 
-    level = SLRandomLevel();
-    if (level > list->level) {
-	level = ++list->level;
-	update[level] = list->head;
+/* Move the first key of the right sibling to the end of the left one */
+static void SLShiftLeft(SLBranchPtr parent, int i)
+{
+    SLNodePtr left  = parent->children[i];
+    SLNodePtr right = parent->children[i + 1];
+
+    if (left->leaf) {
+	left->keys[left->count] = right->keys[0];
+	SL_LEAF(left)->values[left->count] = SL_LEAF(right)->values[0];
+	memmove(&SL_LEAF(right)->values[0], &SL_LEAF(right)->values[1],
+		(right->count - 1) * sizeof(SL_LEAF(right)->values[0]));
+	memmove(&right->keys[0], &right->keys[1],
+		(right->count - 1) * sizeof(right->keys[0]));
+	parent->node.keys[i] = right->keys[0];
+    } else {
+	left->keys[left->count] = parent->node.keys[i];
+	SL_BRANCH(left)->children[left->count + 1] =
+	    SL_BRANCH(right)->children[0];
+	parent->node.keys[i] = right->keys[0];
+	memmove(&right->keys[0], &right->keys[1],
+		(right->count - 1) * sizeof(right->keys[0]));
+	memmove(&SL_BRANCH(right)->children[0], &SL_BRANCH(right)->children[1],
+		right->count * sizeof(SL_BRANCH(right)->children[0]));
     }
 
-    entry = SLCreateEntry(level, key, value);
+    ++left->count;
+    --right->count;
+}
 
-				/* Fix up forward pointers */
-    for (i = 0; i <= level; i++) {
-	entry->forward[i]     = update[i]->forward[i];
-	update[i]->forward[i] = entry;
+/* Move the last key of the left sibling to the start of the right one */
+static void SLShiftRight(SLBranchPtr parent, int i)
+{
+    SLNodePtr left  = parent->children[i];
+    SLNodePtr right = parent->children[i + 1];
+
+    memmove(&right->keys[1], &right->keys[0],
+	    right->count * sizeof(right->keys[0]));
+
+    if (right->leaf) {
+	memmove(&SL_LEAF(right)->values[1], &SL_LEAF(right)->values[0],
+		right->count * sizeof(SL_LEAF(right)->values[0]));
+	right->keys[0] = left->keys[left->count - 1];
+	SL_LEAF(right)->values[0] = SL_LEAF(left)->values[left->count - 1];
+	parent->node.keys[i] = right->keys[0];
+    } else {
+	memmove(&SL_BRANCH(right)->children[1], &SL_BRANCH(right)->children[0],
+		(right->count + 1) * sizeof(SL_BRANCH(right)->children[0]));
+	right->keys[0] = parent->node.keys[i];
+	SL_BRANCH(right)->children[0] =
+	    SL_BRANCH(left)->children[left->count];
+	parent->node.keys[i] = left->keys[left->count - 1];
     }
 
-    ++list->count;
-    return 0;			/* Added to table */
+    --left->count;
+    ++right->count;
+}
+
+/* Merge child i + 1 of parent into child i */
+static void SLMerge(SLBranchPtr parent, int i)
+{
+    SLNodePtr left  = parent->children[i];
+    SLNodePtr right = parent->children[i + 1];
+
+    if (left->leaf) {
+	memcpy(&left->keys[left->count], right->keys,
+	       right->count * sizeof(right->keys[0]));
+	memcpy(&SL_LEAF(left)->values[left->count], SL_LEAF(right)->values,
+	       right->count * sizeof(SL_LEAF(right)->values[0]));
+	SL_LEAF(left)->next = SL_LEAF(right)->next;
+	left->count += right->count;
+    } else {
+	left->keys[left->count] = parent->node.keys[i];
+	memcpy(&left->keys[left->count + 1], right->keys,
+	       right->count * sizeof(right->keys[0]));
+	memcpy(&SL_BRANCH(left)->children[left->count + 1],
+	       SL_BRANCH(right)->children,
+	       (right->count + 1) * sizeof(SL_BRANCH(right)->children[0]));
+	left->count += right->count + 1;
+    }
+
+    memmove(&parent->node.keys[i], &parent->node.keys[i + 1],
+	    (parent->node.count - i - 1) * sizeof(parent->node.keys[0]));
+    memmove(&parent->children[i + 1], &parent->children[i + 2],
+	    (parent->node.count - i - 1) * sizeof(parent->children[0]));
+    --parent->node.count;
+
+    drmFree(right);
+}
+
+/* Refill child i of parent from a sibling, or merge it with one */
+static void SLRebalance(SLBranchPtr parent, int i)
+{
+    if (i > 0 && parent->children[i - 1]->count > SL_NODE_MIN)
+	SLShiftRight(parent, i - 1);
+    else if (i < parent->node.count &&
+	     parent->children[i + 1]->count > SL_NODE_MIN)
+	SLShiftLeft(parent, i);
+    else if (i < parent->node.count)
+	SLMerge(parent, i);
+    else
+	SLMerge(parent, i - 1);
+}
+
+static int SLDelete(SLNodePtr node, unsigned long key)
+{
+    int pos, ret;
+
+    if (node->leaf) {
+	pos = SLLowerBound(node, key);
+	if (pos == node->count || node->keys[pos] != key)
+	    return 1;		/* Not found */
+
+	memmove(&node->keys[pos], &node->keys[pos + 1],
+		(node->count - pos - 1) * sizeof(node->keys[0]));
+	memmove(&SL_LEAF(node)->values[pos], &SL_LEAF(node)->values[pos + 1],
+		(node->count - pos - 1) * sizeof(SL_LEAF(node)->values[0]));
+	--node->count;
+	return 0;
+    }
+
+    pos = SLChild(node, key);
+    ret = SLDelete(SL_BRANCH(node)->children[pos], key);
+    if (!ret && SL_BRANCH(node)->children[pos]->count < SL_NODE_MIN)
+	SLRebalance(SL_BRANCH(node), pos);
+
+    return ret;
 }
 
 drm_public int drmSLDelete(void *l, unsigned long key)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1];
-    SLEntryPtr    entry;
-    int           i;
+    SLNodePtr     root;
 
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    entry = SLLocate(list, key, update);
-
-    if (!entry || entry->key != key) return 1; /* Not found */
+    if (SLDelete(list->root, key)) return 1; /* Not found */
 
-				/* Fix up forward pointers */
-    for (i = 0; i <= list->level; i++) {
-	if (update[i]->forward[i] == entry)
-	    update[i]->forward[i] = entry->forward[i];
+				/* Drop a root left with a single child */
+    root = list->root;
+    if (!root->leaf && !root->count) {
+	list->root = SL_BRANCH(root)->children[0];
+	--list->depth;
+	drmFree(root);
     }
 
-    entry->magic = SL_FREED_MAGIC;
-    drmFree(entry);
-
-    while (list->level && !list->head->forward[list->level]) --list->level;
+    ++list->stamp;
     --list->count;
     return 0;
 }
@@ -215,41 +439,66 @@ drm_public int drmSLDelete(void *l, unsigned long key)
 drm_public int drmSLLookup(void *l, unsigned long key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1];
-    SLEntryPtr    entry;
+    SLLeafPtr     leaf;
+    int           pos;
 
-    entry = SLLocate(list, key, update);
+    leaf = SLLocate(list, key);
+    pos  = SLLowerBound(&leaf->node, key);
 
-    if (entry && entry->key == key) {
-	*value = entry;
+    if (pos < leaf->node.count && leaf->node.keys[pos] == key) {
+	*value = leaf->values[pos];
 	return 0;
     }
     *value = NULL;
     return -1;
 }
 
+/*
+ * Returns the last key < key as the previous neighbor, or 0 and NULL when
+ * there is none, and the first key >= key as the next neighbor.  Both
+ * count in the return value, the previous one even when there is none.
+ */
 drm_public int drmSLLookupNeighbors(void *l, unsigned long key,
                                     unsigned long *prev_key, void **prev_value,
                                     unsigned long *next_key, void **next_value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1] = {0};
-    int           retcode = 0;
-
-    SLLocate(list, key, update);
+    SLNodePtr     node = list->root;
+    SLNodePtr     left = NULL;	/* Subtree holding the previous key */
+    SLLeafPtr     leaf;
+    int           pos, retcode = 1;
+
+    while (!node->leaf) {
+	pos = SLChild(node, key);
+	if (pos > 0) left = SL_BRANCH(node)->children[pos - 1];
+	node = SL_BRANCH(node)->children[pos];
+    }
+    leaf = SL_LEAF(node);
+    pos  = SLLowerBound(node, key);
 
     *prev_key   = *next_key   = key;
     *prev_value = *next_value = NULL;
 
-    if (update[0]) {
-	*prev_key   = update[0]->key;
-	*prev_value = update[0]->value;
+    if (pos > 0) {
+	*prev_key   = node->keys[pos - 1];
+	*prev_value = leaf->values[pos - 1];
+    } else if (left) {
+	while (!left->leaf)
+	    left = SL_BRANCH(left)->children[left->count];
+	*prev_key   = left->keys[left->count - 1];
+	*prev_value = SL_LEAF(left)->values[left->count - 1];
+    } else {
+	*prev_key   = 0;
+    }
+
+    if (pos == node->count && leaf->next) {
+	leaf = leaf->next;
+	pos  = 0;
+    }
+    if (pos < leaf->node.count) {
+	*next_key   = leaf->node.keys[pos];
+	*next_value = leaf->values[pos];
 	++retcode;
-	if (update[0]->forward[0]) {
-	    *next_key   = update[0]->forward[0]->key;
-	    *next_value = update[0]->forward[0]->value;
-	    ++retcode;
-	}
     }
     return retcode;
 }
@@ -257,16 +506,38 @@ drm_public int drmSLLookupNeighbors(void *l, unsigned long key,
 drm_public int drmSLNext(void *l, unsigned long *key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    
+    SLLeafPtr     leaf;
+    int           pos;
+
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    entry    = list->p0;
+    leaf = list->p0;
+    if (!leaf) return 0;
 
-    if (entry) {
-	list->p0 = entry->forward[0];
-	*key     = entry->key;
-	*value   = entry->value;
+				/* The list changed, find the position again
+				   from the key returned last */
+    if (list->p_stamp != list->stamp) {
+	if (list->p_key == ~0UL) {
+	    list->p0 = NULL;
+	    return 0;
+	}
+	leaf = SLLocate(list, list->p_key + 1);
+	list->p1 = SLLowerBound(&leaf->node, list->p_key + 1);
+	list->p_stamp = list->stamp;
+    }
+
+    pos = list->p1;
+    while (leaf && pos == leaf->node.count) {
+	leaf = leaf->next;
+	pos  = 0;
+    }
+
+    if (leaf) {
+	list->p0    = leaf;
+	list->p1    = pos + 1;
+	list->p_key = leaf->node.keys[pos];
+	*key        = leaf->node.keys[pos];
+	*value      = leaf->values[pos];
 	return 1;
     }
     list->p0 = NULL;
@@ -276,44 +547,50 @@ drm_public int drmSLNext(void *l, unsigned long *key, void **value)
 drm_public int drmSLFirst(void *l, unsigned long *key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    
+    SLNodePtr     node;
+
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
-    
-    list->p0 = list->head->forward[0];
+
+    for (node = list->root; !node->leaf;)
+	node = SL_BRANCH(node)->children[0];
+
+    list->p0      = SL_LEAF(node);
+    list->p1      = 0;
+    list->p_stamp = list->stamp;
     return drmSLNext(list, key, value);
 }
 
+static void SLDumpNode(SLNodePtr node, int level)
+{
+    int i;
+
+    printf("%*s%s %p with %d keys:", level * 2, "",
+	   node->leaf ? "Leaf" : "Branch", (void *)node, node->count);
+    for (i = 0; i < node->count; i++) {
+	if (node->leaf)
+	    printf(" <0x%08lx, %p>", node->keys[i], SL_LEAF(node)->values[i]);
+	else
+	    printf(" 0x%08lx", node->keys[i]);
+    }
+    printf("\n");
+
+    if (!node->leaf) {
+	for (i = 0; i <= node->count; i++)
+	    SLDumpNode(SL_BRANCH(node)->children[i], level + 1);
+    }
+}
+
 /* Dump internal data structures for debugging. */
 drm_public void drmSLDump(void *l)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    int           i;
-    
+
     if (list->magic != SL_LIST_MAGIC) {
 	printf("Bad magic: 0x%08lx (expected 0x%08lx)\n",
 	       list->magic, SL_LIST_MAGIC);
 	return;
     }
 
-    printf("Level = %d, count = %d\n", list->level, list->count);
-    for (entry = list->head; entry; entry = entry->forward[0]) {
-	if (entry->magic != SL_ENTRY_MAGIC) {
-	    printf("Bad magic: 0x%08lx (expected 0x%08lx)\n",
-		   list->magic, SL_ENTRY_MAGIC);
-	}
-	printf("\nEntry %p <0x%08lx, %p> has %2d levels\n",
-	       entry, entry->key, entry->value, entry->levels);
-	for (i = 0; i < entry->levels; i++) {
-	    if (entry->forward[i]) {
-		printf("   %2d: %p <0x%08lx, %p>\n",
-		       i,
-		       entry->forward[i],
-		       entry->forward[i]->key,
-		       entry->forward[i]->value);
-	    } else {
-		printf("   %2d: %p\n", i, entry->forward[i]);
-	    }
-	}
-    }
+    printf("Depth = %d, count = %d\n", list->depth, list->count);
+    SLDumpNode(list->root, 0);
 }